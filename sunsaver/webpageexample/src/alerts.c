@@ -0,0 +1,530 @@
+/*
+ *  alerts.c - Threshold and state rules on the SunSaver MPPT channels, evaluated only when a channel they use changes.
+ *
+ *	Each rule in ALERTRULES is one line:
+ *
+ *		[id:]channel op value [for time]
+ *
+ *	channel is a RAM channel named as in ssmppt.c (Vb_f, T_hs, load_state, alarm ...) or Vb, Va, Vl, Ic, Il or Ths.  op is one of
+ *	< <= > >= == != or has, and value is a number, a state name for charge_state, load_state or led_state, or a bit name for
+ *	has on alarm, array_fault or load_fault.  time is in seconds, or with m or h.  Without id the rule is on every device:
+ *
+ *		Vb < 11.8 for 10m
+ *		Ths > 70
+ *		load_state == LVD_WARNING
+ *		2:alarm has RTS miswire
+ *
+ *	The rules are compiled into a list for each channel of each device, so a sample only evaluates the rules on a channel whose
+ *	register changed since the last read, and a steady system costs one compare per channel used.  The thresholds in a list are
+ *	sorted, and only those between the last value and the new one can have changed, so a small step evaluates a few of hundreds
+ *	of rules.  A rule with a time is put on a timer wheel when it comes true, one slot a second, and fires when its slot comes
+ *	round unless a later sample has taken it off again, so a pending rule costs nothing between samples.  A rule that fires or
+ *	clears is a notification to every sink:
+ *
+ *		MM/DD/YYYY	HH:MM:SS	id	firing|resolved	rule	value
+ *
+ *	appended to a file (file:path), sent to a datagram socket (unix:path) or given to a command (exec:command) in ALERT_ID,
+ *	ALERT_STATE, ALERT_RULE, ALERT_VALUE and ALERT_LINE.  The command runs in the background and isn't waited for.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "powersystem.h"
+#include "alerts.h"
+
+struct alias {
+	const char *name;
+	int channel;
+};
+
+static const struct alias aliases[] = {
+	{ "Vb", SS_VB_F }, { "Va", SS_ADC_VA_F }, { "Vl", SS_ADC_VL_F }, { "Ic", SS_ADC_IC_F }, { "Il", SS_ADC_IL_F }, { "Ths", SS_T_HS }
+};
+
+static const char *ops[] = { "<=", ">=", "==", "!=", "<", ">", "has" };
+static const int opcodes[] = { AL_LE, AL_GE, AL_EQ, AL_NE, AL_LT, AL_GT, AL_HAS };
+
+static int fileopen(struct al_sink *s);
+static int filesend(struct al_sink *s, const struct al_inst *in, const struct al_rule *r, int slave, const char *line);
+static int unixopen(struct al_sink *s);
+static int unixsend(struct al_sink *s, const struct al_inst *in, const struct al_rule *r, int slave, const char *line);
+static int execopen(struct al_sink *s);
+static int execsend(struct al_sink *s, const struct al_inst *in, const struct al_rule *r, int slave, const char *line);
+
+static const struct al_sinktype sinktypes[] = {
+	{ "file:", fileopen, filesend },
+	{ "unix:", unixopen, unixsend },
+	{ "exec:", execopen, execsend }
+};
+
+static int compile(struct al_rule *r, const char *text);
+static int names(int ch, const char ***table);
+static int threshold(const struct al_rule *r);
+static void evaluate(struct al_engine *e, struct al_inst *in, float v, unsigned int raw, long now, time_t t);
+static void notify(struct al_engine *e, struct al_inst *in, time_t t);
+static const char *valuename(const struct al_rule *r, float v, char *buf);
+static void wheeladd(struct al_engine *e, struct al_inst *in);
+static void wheelremove(struct al_inst *in);
+
+/*	Compile the rules for the devices, reporting and skipping any that don't parse.  now is the monotonic time in milliseconds.
+	Returns the number of rules, or -1 if there's no memory. */
+int al_init(struct al_engine *e, const int *slaves, int ndevices, const char **rules, int nrules, long now)
+{
+	int i, d, r, ch, n, k, tmp;
+
+	memset(e, 0, sizeof(struct al_engine));
+	if (ndevices > AL_MAXDEVICES) ndevices=AL_MAXDEVICES;
+	e->ndevices=ndevices;
+	memcpy(e->slave, slaves, ndevices*sizeof(int));
+	for (i=0; i<nrules && e->nrules < AL_MAXRULES; i++) {
+		if (compile(&e->rule[e->nrules], rules[i]) == -1) {
+			fprintf(stderr, "Can't understand alert rule: %s\n", rules[i]);
+			continue;
+		}
+		e->nrules++;
+	}
+	for (i=0; i<AL_WHEELSLOTS; i++) e->wheel[i].next=e->wheel[i].prev=&e->wheel[i];
+	e->wheeltick=now/AL_TICK;
+	for (d=0; d<AL_MAXDEVICES; d++) {
+		for (ch=0; ch<SS_NCHANNELS; ch++) e->last[d][ch]=AL_UNREAD;	/* So the first read evaluates every rule */
+	}
+
+	e->inst=calloc(ndevices*e->nrules+1, sizeof(struct al_inst));
+	e->disp=malloc((ndevices*e->nrules+1)*sizeof(int));
+	e->dispstart=malloc((ndevices*SS_NCHANNELS+1)*sizeof(int));
+	e->dispmid=malloc(ndevices*SS_NCHANNELS*sizeof(int));
+	if (e->inst == NULL || e->disp == NULL || e->dispstart == NULL || e->dispmid == NULL) {
+		al_free(e);
+		return -1;
+	}
+
+	/*	The instances a change of each channel of each device evaluates: the thresholds (< <= > >=) first, sorted by their value,
+		then the rest */
+	n=0;
+	for (d=0; d<ndevices; d++) {
+		for (ch=0; ch<SS_NCHANNELS; ch++) {
+			e->dispstart[d*SS_NCHANNELS+ch]=n;
+			for (k=0; k<2; k++) {
+				for (r=0; r<e->nrules; r++) {
+					if (e->rule[r].channel != ch || (e->rule[r].slave != 0 && e->rule[r].slave != slaves[d])) continue;
+					if (threshold(&e->rule[r]) != !k) continue;
+					e->inst[d*e->nrules+r].rule=r;
+					e->inst[d*e->nrules+r].dev=d;
+					e->disp[n++]=d*e->nrules+r;
+					for (i=n-1; k == 0 && i > e->dispstart[d*SS_NCHANNELS+ch] &&
+						 e->rule[e->inst[e->disp[i-1]].rule].value > e->rule[r].value; i--) {
+						tmp=e->disp[i];
+						e->disp[i]=e->disp[i-1];
+						e->disp[i-1]=tmp;
+					}
+				}
+				if (k == 0) e->dispmid[d*SS_NCHANNELS+ch]=n;
+			}
+		}
+	}
+	e->dispstart[ndevices*SS_NCHANNELS]=n;
+	for (ch=0; ch<SS_NCHANNELS; ch++) {
+		for (r=0; r<e->nrules && e->rule[r].channel != ch; r++);
+		if (r < e->nrules) e->watch[e->nwatch++]=ch;
+	}
+
+	return e->nrules;
+}
+
+/* Add a sink by its spec (file:path, unix:path or exec:command).  Returns 0, or -1. */
+int al_addsink(struct al_engine *e, const char *spec)
+{
+	struct al_sink *s;
+	int i;
+
+	if (e->nsinks >= AL_MAXSINKS) return -1;
+	for (i=0; i<sizeof(sinktypes)/sizeof(sinktypes[0]); i++) {
+		if (strncmp(spec, sinktypes[i].prefix, strlen(sinktypes[i].prefix)) != 0) continue;
+		s=&e->sink[e->nsinks];
+		s->type=&sinktypes[i];
+		snprintf(s->target, AL_TEXTSIZE, "%s", spec+strlen(sinktypes[i].prefix));
+		s->fd=-1;
+		if (s->target[0] == '\0' || s->type->open(s) == -1) return -1;
+		e->nsinks++;
+		return 0;
+	}
+	return -1;
+}
+
+/*	Evaluate the rules of device dev on the channels of its classes in got that changed since the last read.  A threshold can only
+	have changed if it lies between the last value and this one, so only those are evaluated, found by a binary search. */
+void al_sample(struct al_engine *e, int dev, const struct ss_image *im, unsigned int got, long now, time_t t)
+{
+	struct timespec start, end;
+	unsigned int raw, old;
+	float v, lo, hi;
+	int w, ch, k, first, mid, last, a, b;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	e->samples++;
+	e->sinkus=0;
+	for (w=0; w<e->nwatch; w++) {
+		ch=e->watch[w];
+		if (!(got & (1 << ss_channels[ch].pollclass))) continue;
+		raw=ss_raw(im, ch);
+		old=e->last[dev][ch];
+		if (raw == old) continue;
+		v=ss_value(im, ch);
+		first=e->dispstart[dev*SS_NCHANNELS+ch];
+		mid=e->dispmid[dev*SS_NCHANNELS+ch];
+		last=e->dispstart[dev*SS_NCHANNELS+ch+1];
+		if (old == AL_UNREAD) {
+			for (k=first; k<last; k++) evaluate(e, &e->inst[e->disp[k]], v, raw, now, t);
+		} else {
+			lo=(v < e->value[dev][ch]) ? v : e->value[dev][ch];
+			hi=(v < e->value[dev][ch]) ? e->value[dev][ch] : v;
+			a=first;
+			b=mid;
+			while (a < b) {
+				k=(a+b)/2;
+				if (e->rule[e->inst[e->disp[k]].rule].value < lo) a=k+1; else b=k;
+			}
+			for (k=a; k<mid && e->rule[e->inst[e->disp[k]].rule].value <= hi; k++) evaluate(e, &e->inst[e->disp[k]], v, raw, now, t);
+			for (k=mid; k<last; k++) evaluate(e, &e->inst[e->disp[k]], v, raw, now, t);
+		}
+		e->last[dev][ch]=raw;
+		e->value[dev][ch]=v;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	e->evalus+=(end.tv_sec-start.tv_sec)*1e6+(end.tv_nsec-start.tv_nsec)/1e3-e->sinkus;
+}
+
+/* Turn the timer wheel to now, firing the rules that have been true for their time */
+void al_tick(struct al_engine *e, long now, time_t t)
+{
+	struct al_inst *head, *in, *next;
+	long tick, n, k;
+
+	while (e->children > 0 && waitpid(-1, NULL, WNOHANG) > 0) e->children--;	/* The commands that have finished */
+	tick=now/AL_TICK;
+	n=tick-e->wheeltick;
+	if (n > AL_WHEELSLOTS) n=AL_WHEELSLOTS;						/* Once round is every slot */
+	for (k=1; k<=n; k++) {
+		head=&e->wheel[(e->wheeltick+k)%AL_WHEELSLOTS];
+		for (in=head->next; in != head; in=next) {
+			next=in->next;
+			if (in->due > now) continue;						/* A later time round */
+			wheelremove(in);
+			in->state=AL_FIRING;
+			e->firing++;
+			notify(e, in, t);
+		}
+	}
+	if (n > 0) e->wheeltick=tick;
+}
+
+void al_free(struct al_engine *e)
+{
+	int i;
+
+	for (i=0; i<e->nsinks; i++) {
+		if (e->sink[i].fd != -1) close(e->sink[i].fd);
+	}
+	e->nsinks=0;
+	free(e->inst);
+	free(e->disp);
+	free(e->dispstart);
+	free(e->dispmid);
+	e->inst=NULL;
+	e->disp=NULL;
+	e->dispstart=NULL;
+	e->dispmid=NULL;
+}
+
+/* Parse [id:]channel op value [for time].  Returns 0, or -1. */
+static int compile(struct al_rule *r, const char *text)
+{
+	const char **table;
+	char buf[AL_TEXTSIZE], *p, *q, *end, *value;
+	double x, unit;
+	int i, n;
+
+	memset(r, 0, sizeof(struct al_rule));
+	snprintf(r->text, AL_TEXTSIZE, "%s", text);
+	snprintf(buf, AL_TEXTSIZE, "%s", text);
+	p=buf;
+	while (isspace((unsigned char) *p)) p++;
+	if (isdigit((unsigned char) *p) && (q = strchr(p, ':')) != NULL) {
+		r->slave=strtol(p, &end, 0);
+		if (end != q) return -1;
+		p=q+1;
+		while (isspace((unsigned char) *p)) p++;
+	}
+
+	/* The channel, up to a space or the comparison */
+	for (q=p; *q != '\0' && !isspace((unsigned char) *q) && strchr("<>=!", *q) == NULL; q++);
+	n=q-p;
+	r->channel=-1;
+	for (i=0; i<SS_NCHANNELS; i++) {
+		if (strlen(ss_channels[i].name) == n && strncasecmp(p, ss_channels[i].name, n) == 0) r->channel=i;
+	}
+	for (i=0; i<sizeof(aliases)/sizeof(aliases[0]) && r->channel == -1; i++) {
+		if (strlen(aliases[i].name) == n && strncasecmp(p, aliases[i].name, n) == 0) r->channel=aliases[i].channel;
+	}
+	if (r->channel == -1) return -1;
+	p=q;
+	while (isspace((unsigned char) *p)) p++;
+	for (i=0; i<sizeof(ops)/sizeof(ops[0]) && strncmp(p, ops[i], strlen(ops[i])) != 0; i++);
+	if (i == sizeof(ops)/sizeof(ops[0])) return -1;
+	r->op=opcodes[i];
+	p+=strlen(ops[i]);
+
+	/* The hold time, then the value is what is left */
+	if ((q = strstr(p, " for ")) != NULL) {
+		*q='\0';
+		x=strtod(q+5, &end);
+		unit=1000;
+		if (*end == 'm') unit=60000;
+		if (*end == 'h') unit=3600000;
+		if (end == q+5 || x < 0) return -1;
+		r->hold=x*unit;
+	}
+	while (isspace((unsigned char) *p)) p++;
+	for (q=p+strlen(p); q > p && isspace((unsigned char) q[-1]); q--);
+	*q='\0';
+	value=p;
+	if (*value == '\0') return -1;
+	x=strtod(value, &end);
+	if (*end == '\0') {
+		r->value=x;
+	} else {
+		n=names(r->channel, &table);
+		for (i=0; i<n && strcasecmp(value, table[i]) != 0; i++);
+		if (i == n) return -1;
+		r->value=i;
+	}
+	if (r->op == AL_HAS && (r->value < 0 || r->value > 31)) return -1;
+	return 0;
+}
+
+/* The state or bit names of a channel.  Returns how many, 0 if it has none. */
+static int names(int ch, const char ***table)
+{
+	switch (ch) {
+		case SS_CHARGE_STATE:
+			*table=ss_charge_states;
+			return SS_CS_EQUALIZE+1;
+		case SS_LOAD_STATE:
+			*table=ss_load_states;
+			return SS_LS_DISCONNECT+1;
+		case SS_LED_STATE:
+			*table=ss_led_states;
+			return SS_LED_STATES;
+		case SS_ALARM:
+		case SS_ALARM_DAILY:
+			*table=ss_alarm_bits;
+			return SS_ALARM_BITS;
+		case SS_ARRAY_FAULT:
+		case SS_ARRAY_FAULT_DAILY:
+			*table=ss_array_fault_bits;
+			return SS_ARRAY_FAULT_BITS;
+		case SS_LOAD_FAULT:
+		case SS_LOAD_FAULT_DAILY:
+			*table=ss_load_fault_bits;
+			return SS_LOAD_FAULT_BITS;
+	}
+	*table=NULL;
+	return 0;
+}
+
+/* Whether a rule compares against a threshold, and so can be found by its value */
+static int threshold(const struct al_rule *r)
+{
+	return r->op == AL_LT || r->op == AL_LE || r->op == AL_GT || r->op == AL_GE;
+}
+
+static void evaluate(struct al_engine *e, struct al_inst *in, float v, unsigned int raw, long now, time_t t)
+{
+	const struct al_rule *r;
+	int ok;
+
+	r=&e->rule[in->rule];
+	e->evaluations++;
+	switch (r->op) {
+		case AL_LT: ok=(v < r->value); break;
+		case AL_LE: ok=(v <= r->value); break;
+		case AL_GT: ok=(v > r->value); break;
+		case AL_GE: ok=(v >= r->value); break;
+		case AL_EQ: ok=(v == r->value); break;
+		case AL_NE: ok=(v != r->value); break;
+		default: ok=(raw >> (int) r->value) & 1; break;
+	}
+
+	if (ok) {
+		if (in->state == AL_FIRING) return;
+		in->value=v;
+		if (in->state == AL_PENDING) return;
+		if (r->hold <= 0) {
+			in->state=AL_FIRING;
+			e->firing++;
+			notify(e, in, t);
+		} else {
+			in->state=AL_PENDING;
+			in->due=(now+r->hold+AL_TICK-1)/AL_TICK*AL_TICK;		/* On a slot boundary, so it never fires early */
+			wheeladd(e, in);
+		}
+	} else if (in->state == AL_PENDING) {
+		wheelremove(in);
+		in->state=AL_CLEAR;
+	} else if (in->state == AL_FIRING) {
+		in->state=AL_CLEAR;
+		in->value=v;
+		e->firing--;
+		notify(e, in, t);
+	}
+}
+
+/* Send a rule that fired or cleared to every sink */
+static void notify(struct al_engine *e, struct al_inst *in, time_t t)
+{
+	const struct al_rule *r;
+	struct timespec start, end;
+	char ts[32], value[32], line[2*AL_TEXTSIZE];
+	int i;
+
+	e->notifications++;
+	if (e->nsinks == 0) return;
+	r=&e->rule[in->rule];
+	strftime(ts, 32, "%m/%d/%Y\t%H:%M:%S", localtime(&t));
+	snprintf(line, sizeof(line), "%s\t%d\t%s\t%s\t%s\n", ts, e->slave[in->dev], (in->state == AL_FIRING) ? "firing" : "resolved",
+			 r->text, valuename(r, in->value, value));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i=0; i<e->nsinks; i++) {
+		if (e->sink[i].type->send(&e->sink[i], in, r, e->slave[in->dev], line) == -1) {
+			e->sinkerrors++;
+		} else if (e->sink[i].type->send == execsend) {
+			e->children++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	e->sinkus+=(end.tv_sec-start.tv_sec)*1e6+(end.tv_nsec-start.tv_nsec)/1e3;	/* Not part of the evaluation time */
+}
+
+/* A value as a state name for the state comparisons, or a number */
+static const char *valuename(const struct al_rule *r, float v, char *buf)
+{
+	const char **table;
+	int n;
+
+	n=names(r->channel, &table);
+	if ((r->op == AL_EQ || r->op == AL_NE) && v >= 0 && v < n) return table[(int) v];
+	if (r->op == AL_HAS) {
+		snprintf(buf, 32, "0x%X", (unsigned int) v);
+	} else {
+		snprintf(buf, 32, "%.2f", v);
+	}
+	return buf;
+}
+
+/* Put a pending rule in the slot of the tick it is due */
+static void wheeladd(struct al_engine *e, struct al_inst *in)
+{
+	struct al_inst *head;
+
+	head=&e->wheel[(in->due/AL_TICK)%AL_WHEELSLOTS];
+	in->next=head->next;
+	in->prev=head;
+	head->next->prev=in;
+	head->next=in;
+}
+
+static void wheelremove(struct al_inst *in)
+{
+	in->prev->next=in->next;
+	in->next->prev=in->prev;
+	in->next=in->prev=NULL;
+}
+
+static int fileopen(struct al_sink *s)
+{
+	return 0;
+}
+
+static int filesend(struct al_sink *s, const struct al_inst *in, const struct al_rule *r, int slave, const char *line)
+{
+	FILE *outfile;
+
+	if ((outfile = fopen(s->target, "a")) == NULL) {
+		return -1;
+	}
+	fputs(line, outfile);
+	return (fclose(outfile) == 0) ? 0 : -1;
+}
+
+static int unixopen(struct al_sink *s)
+{
+	s->fd=socket(AF_UNIX, SOCK_DGRAM, 0);
+	return (s->fd == -1) ? -1 : 0;
+}
+
+/* A datagram to whoever is listening, dropped rather than waited for if nobody is */
+static int unixsend(struct al_sink *s, const struct al_inst *in, const struct al_rule *r, int slave, const char *line)
+{
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", s->target);
+	return (sendto(s->fd, line, strlen(line), MSG_DONTWAIT, (struct sockaddr *) &addr, sizeof(addr)) == -1) ? -1 : 0;
+}
+
+static int execopen(struct al_sink *s)
+{
+	return 0;
+}
+
+/* Run the command in the background with the alert in its environment */
+static int execsend(struct al_sink *s, const struct al_inst *in, const struct al_rule *r, int slave, const char *line)
+{
+	char id[16], buf[32];
+	const char *value;
+	pid_t pid;
+
+	value=valuename(r, in->value, buf);
+	snprintf(id, sizeof(id), "%d", slave);
+	if ((pid = fork()) == -1) {
+		return -1;
+	}
+	if (pid == 0) {
+		setenv("ALERT_ID", id, 1);
+		setenv("ALERT_STATE", (in->state == AL_FIRING) ? "firing" : "resolved", 1);
+		setenv("ALERT_RULE", r->text, 1);
+		setenv("ALERT_VALUE", value, 1);
+		setenv("ALERT_LINE", line, 1);
+		execl("/bin/sh", "sh", "-c", s->target, (char *) NULL);
+		_exit(127);
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ *  alerts.h - Threshold and state rules on the SunSaver MPPT channels, evaluated only when a channel they use changes.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef ALERTS_H
+#define ALERTS_H
+
+#include <time.h>
+
+#include "ssmppt.h"
+
+#define AL_MAXRULES		512
+#define AL_MAXDEVICES	8
+#define AL_MAXSINKS		4
+#define AL_TEXTSIZE		80
+#define AL_WHEELSLOTS	256										/* Slots of the timer wheel, one a second */
+#define AL_TICK			1000									/* Milliseconds a slot */
+#define AL_UNREAD		0xFFFFFFFF								/* A channel not read yet */
+
+/* Comparisons */
+
+enum {
+	AL_LT, AL_LE, AL_GT, AL_GE, AL_EQ, AL_NE, AL_HAS
+};
+
+/* Rule instance states */
+
+#define AL_CLEAR		0
+#define AL_PENDING		1										/* True, waiting out the hold time on the timer wheel */
+#define AL_FIRING		2
+
+/* One rule, [id:]channel op value [for time], compiled from ALERTRULES */
+
+struct al_rule {
+	char text[AL_TEXTSIZE];
+	int slave;													/* MODBUS id, or 0 for every device */
+	int channel;												/* ss_channels index */
+	int op;
+	float value;												/* Threshold, state or bit number */
+	long hold;													/* Milliseconds it must stay true */
+};
+
+/* A rule on one device.  While pending it is linked into a slot of the timer wheel. */
+
+struct al_inst {
+	int rule;
+	int dev;
+	int state;
+	long due;
+	float value;												/* Channel value when it last changed state */
+	struct al_inst *prev;
+	struct al_inst *next;
+};
+
+/* Where notifications go: file:path, unix:path (a datagram socket) or exec:command */
+
+struct al_sink {
+	const struct al_sinktype *type;
+	char target[AL_TEXTSIZE];
+	int fd;
+};
+
+struct al_sinktype {
+	const char *prefix;
+	int (*open)(struct al_sink *s);
+	int (*send)(struct al_sink *s, const struct al_inst *in, const struct al_rule *r, int slave, const char *line);
+};
+
+struct al_engine {
+	int nrules;
+	struct al_rule rule[AL_MAXRULES];
+	int ndevices;
+	int slave[AL_MAXDEVICES];
+	struct al_inst *inst;										/* nrules for each device */
+	int *disp;													/* Instances to evaluate when a channel of a device changes */
+	int *dispstart;												/* Where each device and channel's list starts in disp */
+	int *dispmid;												/* Where its thresholds end */
+	int nwatch;
+	int watch[SS_NCHANNELS];									/* Channels any rule uses */
+	unsigned int last[AL_MAXDEVICES][SS_NCHANNELS];				/* Raw values as last read */
+	float value[AL_MAXDEVICES][SS_NCHANNELS];					/* And scaled */
+	struct al_inst wheel[AL_WHEELSLOTS];						/* List heads */
+	long wheeltick;												/* Last tick the wheel was turned to */
+	int nsinks;
+	struct al_sink sink[AL_MAXSINKS];
+	int firing;
+	unsigned long samples;
+	unsigned long evaluations;
+	unsigned long notifications;
+	unsigned long sinkerrors;
+	double evalus;												/* Microseconds spent in al_sample, less the sinks */
+	double sinkus;												/* Microseconds spent in the sinks this sample */
+	int children;												/* exec commands not waited for yet */
+};
+
+int al_init(struct al_engine *e, const int *slaves, int ndevices, const char **rules, int nrules, long now);
+int al_addsink(struct al_engine *e, const char *spec);
+void al_sample(struct al_engine *e, int dev, const struct ss_image *im, unsigned int got, long now, time_t t);
+void al_tick(struct al_engine *e, long now, time_t t);
+void al_free(struct al_engine *e);
+
+#endif
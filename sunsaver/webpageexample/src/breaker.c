@@ -0,0 +1,254 @@
+/*
+ *  breaker.c - Per-device circuit breaker and cycle deadline for the acquisition daemon.
+ *
+ *	A device that doesn't answer costs a whole response timeout on every read, which would hold up every other device on the bus.
+ *	So the reads of a polling cycle are made one device at a time, and a device that fails stops being read for the rest of the
+ *	cycle.  After BREAKERFAILS failed cycles in a row it is taken out of service (the breaker opens) and its reads are skipped.
+ *	Once BREAKERBACKOFF milliseconds have passed one probe read is allowed (half open): if it works the device is back in service,
+ *	if not the wait doubles, up to BREAKERMAXBACKOFF.  Probes are made after the reads of the devices in service, and only when a
+ *	whole response timeout still fits before the cycle deadline, so they never cost the healthy devices a sample.
+ *
+ *	No read is started that is expected to run past the cycle deadline.  It is marked deferred and the polling scheduler leaves
+ *	its class due, so it is read straight away in the next cycle.  Urgent commands (see cmdqueue.c) are written before each read.
+ *
+ *	Over MODBUS TCP (see mbtcp.c) the reads are pipelined instead, so a device that doesn't answer only holds up its own reads.
+ *	The reads of every device the breakers allow are sent together, and a device is counted as failed when any of its reads is.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <modbus.h>
+
+#include "powersystem.h"
+#include "breaker.h"
+#include "pollsched.h"
+
+static int tcpexecute(struct br_set *b, struct rp_plan *plan, modbus_t *ctx, long deadline);
+static struct br_device *finddev(struct br_set *b, int slave);
+
+void br_init(struct br_set *b, const int *slaves, int ndevices, const struct rp_cost *cost, float chartime, long timeout)
+{
+	int i;
+
+	memset(b, 0, sizeof(struct br_set));
+	if (ndevices > BR_MAXDEVICES) ndevices=BR_MAXDEVICES;
+	b->ndevices=ndevices;
+	for (i=0; i<ndevices; i++) {
+		b->dev[i].slave=slaves[i];
+		b->dev[i].state=BR_CLOSED;
+		b->dev[i].backoff=BREAKERBACKOFF;
+	}
+	b->cost=*cost;
+	b->chartime=chartime;
+	b->timeout=timeout;
+}
+
+/*	Run the reads of a plan that the breakers allow and that fit before deadline (monotonic milliseconds), and set the status of
+	every read.  Devices in service are read first, probes of devices out of service last.  Returns the number of failed reads. */
+int br_execute(struct br_set *b, struct rp_plan *plan, modbus_t *ctx, long deadline)
+{
+	struct br_device *d;
+	int i, pass, rc, made, failed, slave;
+	long now, need;
+
+	for (i=0; i<b->ndevices; i++) b->dev[i].failed=0;
+	for (i=0; i<plan->nreads; i++) plan->status[i]=RP_PENDING;
+	if (b->tcp != NULL) return tcpexecute(b, plan, ctx, deadline);
+
+	made=0;
+	failed=0;
+	slave=-1;
+	for (pass=0; pass<2; pass++) {
+		for (i=0; i<plan->nreads; i++) {
+			if (plan->status[i] != RP_PENDING) continue;
+			d=finddev(b, plan->read[i].slave);
+			if (pass == 0 && d != NULL && d->state != BR_CLOSED) continue;
+			if (d != NULL && d->failed) {
+				plan->status[i]=RP_SKIPPED;
+				continue;
+			}
+
+			/* Any read can take a whole response timeout - a device in service can stop answering too */
+			now=ps_now();
+			need=(b->cost.overhead+b->cost.perreg*plan->read[i].count)*b->chartime+RP_READDELAY/1000+b->timeout;
+			if (d != NULL && d->state != BR_CLOSED) {
+				/* A probe that doesn't fit waits for a cycle with room */
+				if (d->state == BR_OPEN && now < d->retry) {
+					plan->status[i]=RP_SKIPPED;
+					d->skipped++;
+					continue;
+				}
+				if (made > 0 && now+need > deadline) {
+					plan->status[i]=RP_SKIPPED;
+					d->skipped++;
+					continue;
+				}
+				br_allow(b, d->slave, now);
+			} else if (made > 0 && now+need > deadline) {
+				plan->status[i]=RP_DEFERRED;
+				b->deferred++;
+				continue;
+			}
+
+			/* A load shed can't wait for the end of the cycle */
+			if (b->urgent != NULL) {
+				cq_receive(b->urgent);
+				if (cq_pending(b->urgent, CQ_URGENT) > 0) {
+					if (made > 0) usleep(RP_READDELAY);
+					cq_run(b->urgent, ctx, CQ_URGENT);
+					slave=-1;
+					made++;
+				}
+			}
+
+			if (made > 0) {
+				usleep(RP_READDELAY);							// Give the charge controller time before requesting next set of registers
+			}
+			if (plan->read[i].slave != slave) {
+				slave=plan->read[i].slave;
+				modbus_set_slave(ctx, slave);
+			}
+			rc=modbus_read_registers(ctx, plan->read[i].addr, plan->read[i].count, plan->data+plan->read[i].offset);
+			made++;
+			if (rc == -1) {
+				if (d == NULL || d->state == BR_CLOSED) fprintf(stderr, "MODBUS id %d: %s\n", slave, modbus_strerror(errno));
+				plan->status[i]=RP_FAILED;
+				failed++;
+				modbus_flush(ctx);
+				if (d != NULL) {
+					d->failed=1;
+					d->failures++;
+					br_result(b, d->slave, 0, ps_now());
+				}
+			} else {
+				plan->status[i]=RP_OK;
+				if (d != NULL) br_result(b, d->slave, 1, ps_now());
+			}
+		}
+	}
+
+	return failed;
+}
+
+/* br_execute() over a pipelined MODBUS TCP connection */
+static int tcpexecute(struct br_set *b, struct rp_plan *plan, modbus_t *ctx, long deadline)
+{
+	struct br_device *d;
+	int i, failed, ok[BR_MAXDEVICES];
+	long now;
+
+	/* Urgent commands still go first */
+	if (b->urgent != NULL) {
+		cq_receive(b->urgent);
+		if (cq_pending(b->urgent, CQ_URGENT) > 0) cq_run(b->urgent, ctx, CQ_URGENT);
+	}
+
+	now=ps_now();
+	for (i=0; i<plan->nreads; i++) {
+		d=finddev(b, plan->read[i].slave);
+		if (d == NULL || d->state == BR_CLOSED) continue;
+		if (d->state == BR_OPEN && now < d->retry) {
+			plan->status[i]=RP_SKIPPED;
+			d->skipped++;
+		} else {
+			br_allow(b, d->slave, now);							/* Half open - all of its reads are the probe */
+		}
+	}
+
+	failed=mt_execute(b->tcp, plan, deadline);
+
+	memset(ok, 0, sizeof(ok));
+	for (i=0; i<plan->nreads; i++) {
+		if (plan->status[i] == RP_DEFERRED) b->deferred++;
+		if ((d = finddev(b, plan->read[i].slave)) == NULL) continue;
+		if (plan->status[i] == RP_FAILED) {
+			if (!d->failed && d->state == BR_CLOSED) fprintf(stderr, "MODBUS id %d: no answer over MODBUS TCP\n", d->slave);
+			d->failed=1;
+			d->failures++;
+		} else if (plan->status[i] == RP_OK) {
+			ok[d-b->dev]=1;
+		}
+	}
+	now=ps_now();
+	for (i=0; i<b->ndevices; i++) {
+		if (b->dev[i].failed) {
+			br_result(b, b->dev[i].slave, 0, now);
+		} else if (ok[i]) {
+			br_result(b, b->dev[i].slave, 1, now);
+		}
+	}
+
+	return failed;
+}
+
+/* True if a read of the device may be made now.  An open breaker whose wait is over goes half open for one probe. */
+int br_allow(struct br_set *b, int slave, long now)
+{
+	struct br_device *d;
+
+	if ((d = finddev(b, slave)) == NULL) return 1;
+	if (d->state == BR_OPEN) {
+		if (now < d->retry) return 0;
+		d->state=BR_HALFOPEN;
+		d->probes++;
+	}
+	return 1;
+}
+
+/* Record the outcome of a read of the device */
+void br_result(struct br_set *b, int slave, int ok, long now)
+{
+	struct br_device *d;
+
+	if ((d = finddev(b, slave)) == NULL) return;
+	if (ok) {
+		if (d->state != BR_CLOSED) {
+			fprintf(stderr, "MODBUS id %d is back in service\n", d->slave);
+		}
+		d->state=BR_CLOSED;
+		d->fails=0;
+		d->backoff=BREAKERBACKOFF;
+		return;
+	}
+
+	if (d->state == BR_HALFOPEN) {
+		d->backoff*=2;
+		if (d->backoff > BREAKERMAXBACKOFF) d->backoff=BREAKERMAXBACKOFF;
+		d->state=BR_OPEN;
+		d->retry=now+d->backoff;
+	} else if (d->state == BR_CLOSED && ++d->fails >= BREAKERFAILS) {
+		fprintf(stderr, "MODBUS id %d is out of service after %d failed cycles\n", d->slave, d->fails);
+		d->state=BR_OPEN;
+		d->trips++;
+		d->retry=now+d->backoff;
+	}
+}
+
+static struct br_device *finddev(struct br_set *b, int slave)
+{
+	int i;
+
+	for (i=0; i<b->ndevices; i++) {
+		if (b->dev[i].slave == slave) return &b->dev[i];
+	}
+	return NULL;
+}
@@ -0,0 +1,68 @@
+/*
+ *  breaker.h - Per-device circuit breaker and cycle deadline for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef BREAKER_H
+#define BREAKER_H
+
+#include <modbus.h>
+
+#include "readplan.h"
+#include "cmdqueue.h"
+#include "mbtcp.h"
+
+#define BR_MAXDEVICES	8
+
+/* Device states */
+
+#define BR_CLOSED		0										/* In service */
+#define BR_OPEN			1										/* Out of service until the next probe */
+#define BR_HALFOPEN		2										/* One probe read allowed - it decides which way the breaker goes */
+
+struct br_device {
+	int slave;
+	int state;
+	int fails;													/* Failed cycles in a row */
+	long backoff;												/* Milliseconds from a failed probe to the next one */
+	long retry;													/* When the next probe may be made */
+	int failed;													/* A read failed in this cycle */
+	unsigned long trips;
+	unsigned long probes;
+	unsigned long failures;										/* Failed reads */
+	unsigned long skipped;										/* Reads not made because the device was out of service */
+};
+
+struct br_set {
+	int ndevices;
+	struct br_device dev[BR_MAXDEVICES];
+	struct rp_cost cost;
+	float chartime;												/* Milliseconds per character on the bus */
+	long timeout;												/* MODBUS response timeout in milliseconds */
+	unsigned long deferred;										/* Reads left for the next cycle because of the deadline */
+	struct cq_queue *urgent;									/* Commands to write between reads, or NULL */
+	struct mt_conn *tcp;										/* Pipelined MODBUS TCP connection, or NULL to read one at a time */
+};
+
+void br_init(struct br_set *b, const int *slaves, int ndevices, const struct rp_cost *cost, float chartime, long timeout);
+int br_execute(struct br_set *b, struct rp_plan *plan, modbus_t *ctx, long deadline);
+int br_allow(struct br_set *b, int slave, long now);
+void br_result(struct br_set *b, int slave, int ok, long now);
+
+#endif
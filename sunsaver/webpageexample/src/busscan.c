@@ -0,0 +1,324 @@
+/*
+ *  busscan.c - This program finds the Morningstar devices on one or more serial ports and prints their MODBUS addresses as
+ *	powersystem.h settings.
+ *
+ *	Usage: busscan [port]...
+ *
+ *	Every address from 1 to 247 is asked for its first five registers with a short response timeout (SCANTIMEOUT), so an empty
+ *	address costs tens of milliseconds instead of libmodbus's 500 ms.  The timeout is kept at half again the slowest answer so far,
+ *	and doubles for a while if an answer comes in garbled (a late answer to the last request).  A device that answers with an exception
+ *	is there too, it just doesn't have those registers.  All the ports are scanned at the same time, from one event loop (see
+ *	rtuloop.c), so a dozen USB-serial adaptors take no longer than one.  With no ports on the command line SERIALPORTPATH is scanned.
+ *
+ *	Each device found is then identified by its registers, using the maps in the basic examples:
+ *
+ *		SunSaver MPPT	no registers below 0x0008, and Emodbus_id (0xE034) is its own address
+ *		TriStar PWM		no registers below 0x0008, and 0x0008 reads
+ *		TriStar MPPT	V_PU_hi and I_PU_hi (0x0000, 0x0002) are small whole numbers and ver_sw (0x0004) isn't 0
+ *		Relay Driver	answers a read of its four relay coils
+ *		SureSine		adc_vb (0x0000) and Vb (0x0004) agree and are a 12 V battery
+ *		SunSaver Duo	vb1 (0x0000) is a 12 or 24 V battery
+ *
+ *	Only the SunSaver MPPT and SureSine signatures have been tried on real devices.  Anything else is printed as unknown with
+ *	its registers so it can be looked up by hand.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` busscan.c rtuloop.c pollsched.c readplan.c -o busscan */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "powersystem.h"
+#include "pollsched.h"
+#include "rtuloop.h"
+
+#define MAXPORTS		RL_MAXPORTS
+#define FIRSTID			1
+#define LASTID			247										/* Highest MODBUS address a device can have */
+#define IDTIMEOUT		500										/* Response timeout (ms) while identifying a device that has answered */
+
+/* Device types */
+
+#define DT_UNKNOWN		0
+#define DT_SUNSAVERMPPT	1
+#define DT_TRISTARPWM	2
+#define DT_TRISTARMPPT	3
+#define DT_RELAYDRIVER	4
+#define DT_SURESINE		5
+#define DT_SUNSAVERDUO	6
+#define DT_NTYPES		7
+
+/* Where the scan of a port has got to */
+
+#define SC_FIRST		0										/* Asking the next address */
+#define SC_RECHECK		1										/* Asking the address before again after a garbled answer */
+#define SC_AGAIN		2										/* Asking the address again after a garbled answer */
+
+#define ID_EEPROM		0										/* Reading Emodbus_id */
+#define ID_PWM			1										/* Reading 0x0008 */
+#define ID_COILS		2										/* Reading the relay coils */
+
+static const char *typenames[DT_NTYPES] = {
+	"unknown", "SunSaver MPPT", "TriStar PWM", "TriStar MPPT", "Relay Driver", "SureSine-300", "SunSaver Duo"
+};
+
+/* powersystem.h names for each type */
+static const char *typedefines[DT_NTYPES] = {
+	NULL, "SUNSAVERMPPT", "TRISTARPWM", "TRISTARMPPT", "RELAYDRIVER", "SURESINE", "SUNSAVERDUO"
+};
+
+struct bs_device {
+	int id;
+	int type;
+	int haveregs;												/* regs[] holds 0x0000 - 0x0004 */
+	uint16_t regs[5];
+	long rtt;													/* Milliseconds to answer the scan */
+};
+
+struct bs_port {
+	const char *path;
+	int port;													/* Port number in the event loop */
+	struct bs_device devs[LASTID+1];
+	int n;
+	int id;														/* Address being scanned */
+	int asked;													/* Address of the request in progress */
+	int stage;
+	int dev;													/* Device being identified */
+	int step;
+	long timeout;
+	long floor;
+	long start;
+};
+
+static struct bs_port ports[MAXPORTS];
+
+void probe(struct rl_loop *l, struct bs_port *sc, int id, long gap);
+void scanned(struct rl_loop *l, int port, const struct rl_result *res, void *arg);
+void identify(struct rl_loop *l, struct bs_port *sc);
+void identified(struct rl_loop *l, int port, const struct rl_result *res, void *arg);
+void report(const struct bs_port *sc);
+
+int main(int argc, char *argv[])
+{
+	struct rl_loop loop;
+	const char *defaultport[1] = { SERIALPORTPATH };
+	const char **paths;
+	int i, n, failed;
+
+	paths=(argc == 1) ? defaultport : (const char **) argv+1;
+	n=(argc == 1) ? 1 : argc-1;
+	if (n > MAXPORTS) {
+		fprintf(stderr, "Too many ports\n");
+		return -1;
+	}
+	if (rl_init(&loop) == -1) {
+		fprintf(stderr, "epoll: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* Start every port on its first address, then let the loop run them all */
+	failed=0;
+	for (i=0; i<n; i++) {
+		memset(&ports[i], 0, sizeof(struct bs_port));
+		ports[i].path=paths[i];
+		if ((ports[i].port = rl_open(&loop, paths[i], 9600)) == -1) {
+			fprintf(stderr, "%s: connection failed: %s\n", paths[i], strerror(errno));
+			failed++;
+			continue;
+		}
+		ports[i].start=ps_now();
+		ports[i].floor=SCANTIMEOUT;
+		ports[i].timeout=SCANTIMEOUT;
+		ports[i].id=FIRSTID;
+		ports[i].stage=SC_FIRST;
+		probe(&loop, &ports[i], FIRSTID, 0);
+	}
+	if (rl_run(&loop) == -1) {
+		fprintf(stderr, "epoll: %s\n", strerror(errno));
+		failed++;
+	}
+	rl_close(&loop);
+
+	return (failed ? -1 : 0);
+}
+
+/* Ask one address for registers 0x0000 - 0x0004, after gap microseconds of quiet */
+void probe(struct rl_loop *l, struct bs_port *sc, int id, long gap)
+{
+	sc->asked=id;
+	rl_request(l, sc->port, id, RL_READREGS, 0x0000, 5, sc->timeout, gap, scanned, sc);
+}
+
+/* Result of a probe - note the device if one answered and ask the next address */
+void scanned(struct rl_loop *l, int port, const struct rl_result *res, void *arg)
+{
+	struct bs_port *sc;
+	struct bs_device *dev;
+	int rc;
+
+	sc=arg;
+	rc=(res->status == RL_OK || res->status == RL_EXCEPTION) ? 1 : (res->status == RL_TIMEOUT) ? 0 : -1;
+
+	if (sc->stage == SC_FIRST && rc == -1) {
+		/* Garbled - most likely the last address answered after its timeout.  Slow down and ask both again. */
+		sc->timeout=(2*sc->timeout < IDTIMEOUT) ? 2*sc->timeout : IDTIMEOUT;
+		if (sc->id > FIRSTID && (sc->n == 0 || sc->devs[sc->n-1].id != sc->id-1)) {
+			sc->stage=SC_RECHECK;
+			probe(l, sc, sc->id-1, sc->timeout*1000);
+		} else {
+			sc->stage=SC_AGAIN;
+			probe(l, sc, sc->id, sc->timeout*1000);
+		}
+		return;
+	}
+
+	/* An exception is an answer */
+	if (rc == 1) {
+		dev=&sc->devs[sc->n++];
+		dev->id=sc->asked;
+		dev->type=DT_UNKNOWN;
+		dev->rtt=res->rtt;
+		dev->haveregs=(res->status == RL_OK);
+		if (dev->haveregs) memcpy(dev->regs, res->data, sizeof(dev->regs));
+		if (sc->asked == sc->id && dev->rtt*3/2 > sc->floor) sc->floor=dev->rtt*3/2;
+	}
+	if (sc->stage == SC_RECHECK) {
+		sc->stage=SC_AGAIN;
+		probe(l, sc, sc->id, 0);
+		return;
+	}
+
+	sc->timeout=(sc->timeout+sc->floor)/2;						/* Back down after a garbled answer */
+	if (sc->timeout < sc->floor) sc->timeout=sc->floor;
+	sc->stage=SC_FIRST;
+	if (++sc->id <= LASTID) {
+		probe(l, sc, sc->id, 0);
+	} else {
+		sc->dev=0;
+		identify(l, sc);
+	}
+}
+
+/* Work out what each device is from its registers (see the table at the top), reading more where the scan isn't enough */
+void identify(struct rl_loop *l, struct bs_port *sc)
+{
+	struct bs_device *dev;
+	float v, vb;
+
+	for (; sc->dev < sc->n; sc->dev++) {
+		dev=&sc->devs[sc->dev];
+		if (!dev->haveregs) {
+			sc->step=ID_EEPROM;
+			rl_request(l, sc->port, dev->id, RL_READREGS, 0xE034, 1, IDTIMEOUT, RP_READDELAY, identified, sc);
+			return;
+		}
+		if (dev->regs[0] > 0 && dev->regs[0] < 1000 && dev->regs[2] > 0 && dev->regs[2] < 1000 && dev->regs[4] != 0) {
+			dev->type=DT_TRISTARMPPT;
+			continue;
+		}
+		v=dev->regs[0]*16.92/65536.0;
+		vb=dev->regs[4]*16.92/65536.0;
+		if (v > 9.0 && v < 16.5 && vb > 0.9*v && vb < 1.1*v) dev->type=DT_SURESINE;
+		v=dev->regs[0]/1800.0;
+		if (dev->type == DT_UNKNOWN && v > 9.0 && v < 33.0) dev->type=DT_SUNSAVERDUO;
+		sc->step=ID_COILS;										/* A Relay Driver could look like either */
+		rl_request(l, sc->port, dev->id, RL_READBITS, 0x0000, 4, IDTIMEOUT, RP_READDELAY, identified, sc);
+		return;
+	}
+	report(sc);
+}
+
+/* Result of an identification read */
+void identified(struct rl_loop *l, int port, const struct rl_result *res, void *arg)
+{
+	struct bs_port *sc;
+	struct bs_device *dev;
+
+	sc=arg;
+	dev=&sc->devs[sc->dev];
+	switch (sc->step) {
+	case ID_EEPROM:
+		if (res->status == RL_OK && res->data[0] == dev->id) {
+			dev->type=DT_SUNSAVERMPPT;
+			break;
+		}
+		sc->step=ID_PWM;
+		rl_request(l, sc->port, dev->id, RL_READREGS, 0x0008, 1, IDTIMEOUT, RP_READDELAY, identified, sc);
+		return;
+	case ID_PWM:
+		if (res->status == RL_OK) dev->type=DT_TRISTARPWM;
+		break;
+	case ID_COILS:
+		if (res->status == RL_OK) dev->type=DT_RELAYDRIVER;
+		break;
+	}
+	sc->dev++;
+	identify(l, sc);
+}
+
+/* Print what is on one port as one block, so blocks from ports scanned at the same time don't mix */
+void report(const struct bs_port *sc)
+{
+	const struct bs_device *devs;
+	int count[DT_NTYPES];
+	char out[8192];
+	int n, i, k, len, rc;
+
+	devs=sc->devs;
+	n=sc->n;
+	memset(count, 0, sizeof(count));
+	for (i=0; i<n; i++) count[devs[i].type]++;
+
+	/* powersystem.h settings for what was found */
+	len=snprintf(out, sizeof(out), "/* %s: %d device%s found in %.1f s */\n", sc->path, n, n == 1 ? "" : "s", (ps_now()-sc->start)/1000.0);
+	for (k=1; k<DT_NTYPES; k++) {
+		rc=0;
+		for (i=0; i<n && len < sizeof(out)-256; i++) {
+			if (devs[i].type != k) continue;
+			if (rc++ == 0) {
+				len+=snprintf(out+len, sizeof(out)-len, "#define %s\t\t0x%02X\t\t\t\t\t\t\t\t\t/* MODBUS Address of the %s */\n",
+							  typedefines[k], devs[i].id, typenames[k]);
+			} else {
+				len+=snprintf(out+len, sizeof(out)-len, "#define %s%d\t\t0x%02X\t\t\t\t\t\t\t\t\t/* MODBUS Address of %s %d */\n",
+							  typedefines[k], rc, devs[i].id, typenames[k], rc);
+			}
+		}
+	}
+	if (count[DT_SUNSAVERMPPT] > 0) {
+		len+=snprintf(out+len, sizeof(out)-len, "#define DAEMONDEVICES\t{");
+		for (i=0, rc=0; i<n && len < sizeof(out)-16; i++) {
+			if (devs[i].type == DT_SUNSAVERMPPT) len+=snprintf(out+len, sizeof(out)-len, "%s 0x%02X", rc++ ? "," : "", devs[i].id);
+		}
+		len+=snprintf(out+len, sizeof(out)-len, " }\n");
+	}
+	for (i=0; i<n && len < sizeof(out)-128; i++) {
+		if (devs[i].type != DT_UNKNOWN) continue;
+		if (devs[i].haveregs) {
+			len+=snprintf(out+len, sizeof(out)-len, "/* 0x%02X: unknown device, registers 0x0000 - 0x0004 = %u %u %u %u %u */\n",
+						  devs[i].id, devs[i].regs[0], devs[i].regs[1], devs[i].regs[2], devs[i].regs[3], devs[i].regs[4]);
+		} else {
+			len+=snprintf(out+len, sizeof(out)-len, "/* 0x%02X: unknown device */\n", devs[i].id);
+		}
+	}
+	fwrite(out, 1, len, stdout);
+	fflush(stdout);
+}
@@ -0,0 +1,275 @@
+/*
+ *  cmdqueue.c - Priority queue of register and coil writes for the acquisition daemon.
+ *
+ *	The daemon has the serial port, so other programs hand it writes (turning the SunSaver MPPT load off, switching a Relay Driver
+ *	relay) through a FIFO, CMDFIFO.  Each line is one command:
+ *
+ *		priority id coil|reg addr value sent tag
+ *
+ *	sent is the client's CLOCK_MONOTONIC time in milliseconds, and tag is its name for the command.  Urgent commands (priority
+ *	CQ_URGENT) are written between two reads of a polling cycle, so a load shed only waits for the transaction already on the wire.
+ *	Others wait for the end of the cycle.  Every write is read back, and the result is added to CMDRESULTS as
+ *
+ *		tag ok|failed|mismatch latency wait
+ *
+ *	where latency is the milliseconds from sent to the read back and wait is how long the command waited to go on the wire.  When
+ *	CMDRESULTS grows past CMDRESULTSSIZE bytes it is cut back to its newest results, renamed into place so it is never half written.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <modbus.h>
+
+#include "powersystem.h"
+#include "cmdqueue.h"
+#include "pollsched.h"
+#include "readplan.h"
+
+static const char *results[] = { "ok", "failed", "mismatch", "bad" };
+
+static void enqueue(struct cq_queue *q, const struct cq_cmd *cmd);
+static void writeresult(const struct cq_cmd *cmd, int result, long latency, long wait);
+static void trimresults(void);
+
+/* Make the FIFO if it isn't there and open it without blocking.  Returns 0, or -1 if it can't be opened. */
+int cq_open(struct cq_queue *q, const char *path)
+{
+	memset(q, 0, sizeof(struct cq_queue));
+	q->fd=-1;
+	q->wfd=-1;
+
+	if (mkfifo(path, 0660) == -1 && errno != EEXIST) {
+		return -1;
+	}
+	if ((q->fd = open(path, O_RDONLY | O_NONBLOCK)) == -1) {
+		return -1;
+	}
+	q->wfd=open(path, O_WRONLY | O_NONBLOCK);
+	return 0;
+}
+
+/* Parse one command line.  Returns 0, or -1 if it isn't a command. */
+int cq_parse(const char *line, struct cq_cmd *cmd)
+{
+	char type[8];
+	int addr, value;
+
+	if (sscanf(line, "%d %d %7s %i %i %ld %31s", &cmd->priority, &cmd->slave, type, &addr, &value, &cmd->submitted, cmd->tag) != 7) {
+		return -1;
+	}
+	cmd->priority=(cmd->priority <= CQ_URGENT) ? CQ_URGENT : CQ_NORMAL;
+	if (strcmp(type, "coil") == 0) {
+		cmd->type=CQ_COIL;
+		value=(value != 0);
+	} else if (strcmp(type, "reg") == 0) {
+		cmd->type=CQ_REG;
+	} else {
+		return -1;
+	}
+	if (cmd->slave < 1 || cmd->slave > 247 || addr < 0 || addr > 0xFFFF || value < 0 || value > 0xFFFF) {
+		return -1;
+	}
+	cmd->addr=addr;
+	cmd->value=value;
+	return 0;
+}
+
+/* Take whatever commands have come in on the FIFO and queue them.  Never blocks.  Returns the number of commands queued. */
+int cq_receive(struct cq_queue *q)
+{
+	struct cq_cmd cmd;
+	char *line, *end;
+	ssize_t n;
+	int count;
+
+	if (q->fd == -1) return 0;
+	count=0;
+	while ((n = read(q->fd, q->buf+q->buflen, sizeof(q->buf)-1-q->buflen)) > 0) {
+		q->buflen+=n;
+		q->buf[q->buflen]='\0';
+		line=q->buf;
+		while ((end = strchr(line, '\n')) != NULL) {
+			*end='\0';
+			if (cq_parse(line, &cmd) == 0) {
+				enqueue(q, &cmd);
+				count++;
+			} else if (*line != '\0') {
+				q->dropped++;
+			}
+			line=end+1;
+		}
+		q->buflen-=line-q->buf;
+		memmove(q->buf, line, q->buflen);
+		if (q->buflen == sizeof(q->buf)-1) {
+			q->buflen=0;										/* A line too long to be a command */
+			q->dropped++;
+		}
+	}
+
+	return count;
+}
+
+/* Number of queued commands at this priority or more urgent */
+int cq_pending(const struct cq_queue *q, int priority)
+{
+	int i, n;
+
+	n=0;
+	for (i=0; i<q->n; i++) {
+		if (q->cmd[i].priority <= priority) n++;
+	}
+	return n;
+}
+
+/* Write the queued commands at this priority or more urgent, most urgent first.  Returns the number written. */
+int cq_run(struct cq_queue *q, modbus_t *ctx, int priority)
+{
+	struct cq_cmd cmd;
+	long start, now;
+	int i, result, count;
+
+	count=0;
+	for (i=0; i<q->n; ) {
+		if (q->cmd[i].priority > priority) {
+			i++;
+			continue;
+		}
+		cmd=q->cmd[i];
+		memmove(&q->cmd[i], &q->cmd[i+1], (q->n-i-1)*sizeof(struct cq_cmd));
+		q->n--;
+
+		start=ps_now();
+		result=cq_write(ctx, &cmd);
+		now=ps_now();
+
+		q->done++;
+		if (result == CQ_FAILED) q->failed++;
+		if (result == CQ_MISMATCH) q->mismatches++;
+		q->lastwait=start-cmd.submitted;
+		q->lastlatency=now-cmd.submitted;
+		if (q->lastlatency > q->maxlatency) q->maxlatency=q->lastlatency;
+		q->totallatency+=q->lastlatency;
+		writeresult(&cmd, result, q->lastlatency, q->lastwait);
+		count++;
+	}
+
+	return count;
+}
+
+/* Write one command and read it back.  Returns CQ_OK, CQ_FAILED or CQ_MISMATCH. */
+int cq_write(modbus_t *ctx, const struct cq_cmd *cmd)
+{
+	uint16_t reg;
+	uint8_t bit;
+	int rc;
+
+	modbus_set_slave(ctx, cmd->slave);
+	if (cmd->type == CQ_COIL) {
+		rc=modbus_write_bit(ctx, cmd->addr, cmd->value);
+	} else {
+		rc=modbus_write_register(ctx, cmd->addr, cmd->value);
+	}
+	if (rc != 1) {
+		modbus_flush(ctx);
+		return CQ_FAILED;
+	}
+
+	usleep(RP_READDELAY);
+	if (cmd->type == CQ_COIL) {
+		rc=modbus_read_bits(ctx, cmd->addr, 1, &bit);
+		reg=bit;
+	} else {
+		rc=modbus_read_registers(ctx, cmd->addr, 1, &reg);
+	}
+	if (rc != 1) {
+		modbus_flush(ctx);
+		return CQ_FAILED;
+	}
+	return (reg == cmd->value) ? CQ_OK : CQ_MISMATCH;
+}
+
+void cq_close(struct cq_queue *q)
+{
+	if (q->fd != -1) close(q->fd);
+	if (q->wfd != -1) close(q->wfd);
+	q->fd=-1;
+	q->wfd=-1;
+}
+
+/* Insert after the commands of the same or more urgent priority, so each priority is first come first served */
+static void enqueue(struct cq_queue *q, const struct cq_cmd *cmd)
+{
+	int i;
+
+	q->received++;
+	if (q->n == CQ_MAXCMDS) {
+		q->dropped++;
+		writeresult(cmd, CQ_FAILED, 0, 0);
+		return;
+	}
+	for (i=q->n; i>0 && q->cmd[i-1].priority > cmd->priority; i--) {
+		q->cmd[i]=q->cmd[i-1];
+	}
+	q->cmd[i]=*cmd;
+	q->n++;
+}
+
+static void writeresult(const struct cq_cmd *cmd, int result, long latency, long wait)
+{
+	FILE *outfile;
+	long size;
+
+	if ((outfile = fopen(CMDRESULTS, "a")) == NULL) {
+		return;
+	}
+	fprintf(outfile, "%s %s %ld %ld\n", cmd->tag, results[result], latency, wait);
+	size=ftell(outfile);
+	fclose(outfile);
+
+	if (size > CMDRESULTSSIZE) trimresults();
+}
+
+/* Keep the results in the last half of CMDRESULTSSIZE, starting at a whole line */
+static void trimresults(void)
+{
+	FILE *infile, *outfile;
+	char tmppath[96], line[CQ_LINESIZE];
+
+	if ((infile = fopen(CMDRESULTS, "r")) == NULL) {
+		return;
+	}
+	sprintf(tmppath,"%s.tmp",CMDRESULTS);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		fclose(infile);
+		return;
+	}
+	fseek(infile, -(CMDRESULTSSIZE/2), SEEK_END);
+	fgets(line, sizeof(line), infile);							/* The rest of a line cut in the middle */
+	while (fgets(line, sizeof(line), infile) != NULL) {
+		fputs(line, outfile);
+	}
+	fclose(infile);
+	fclose(outfile);
+	rename(tmppath, CMDRESULTS);
+}
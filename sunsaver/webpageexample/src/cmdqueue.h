@@ -0,0 +1,83 @@
+/*
+ *  cmdqueue.h - Priority queue of register and coil writes for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef CMDQUEUE_H
+#define CMDQUEUE_H
+
+#include <stdint.h>
+#include <modbus.h>
+
+#define CQ_MAXCMDS		32										/* Commands waiting at once */
+#define CQ_LINESIZE		128										/* Longest command line */
+#define CQ_TAGSIZE		32
+
+#define CQ_URGENT		0										/* Priority of commands that go between the reads of a cycle (load shedding) */
+#define CQ_NORMAL		1										/* Priority of commands that go between cycles */
+
+/* Command types */
+
+#define CQ_COIL			0
+#define CQ_REG			1
+
+/* Command results */
+
+#define CQ_OK			0
+#define CQ_FAILED		1										/* The write or the read back failed */
+#define CQ_MISMATCH		2										/* The read back didn't show the value written */
+#define CQ_BADCMD		3
+
+struct cq_cmd {
+	int priority;
+	int slave;
+	int type;
+	uint16_t addr;
+	uint16_t value;
+	long submitted;												/* Monotonic milliseconds when the client sent it */
+	char tag[CQ_TAGSIZE];										/* The client's name for it, returned with the result */
+};
+
+struct cq_queue {
+	int fd;														/* Command FIFO, read end */
+	int wfd;													/* Write end kept open so the FIFO never reads end of file */
+	char buf[CQ_LINESIZE*4];
+	int buflen;
+	int n;
+	struct cq_cmd cmd[CQ_MAXCMDS];								/* In the order they are to be written */
+	unsigned long received;
+	unsigned long done;
+	unsigned long failed;
+	unsigned long mismatches;
+	unsigned long dropped;										/* Bad lines, and commands that came when the queue was full */
+	long lastlatency;											/* Milliseconds from the client sending a command to its read back */
+	long maxlatency;
+	long lastwait;												/* Milliseconds before the command went on the wire */
+	double totallatency;
+};
+
+int cq_open(struct cq_queue *q, const char *path);
+int cq_parse(const char *line, struct cq_cmd *cmd);
+int cq_receive(struct cq_queue *q);
+int cq_pending(const struct cq_queue *q, int priority);
+int cq_run(struct cq_queue *q, modbus_t *ctx, int priority);
+int cq_write(modbus_t *ctx, const struct cq_cmd *cmd);
+void cq_close(struct cq_queue *q);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ *  daemonlock.c - Tells the tools whether powersystemd is running, from a lock it holds on DAEMONPIDFILE.
+ *
+ *	The register snapshots in RUNFILEPATH only say when a device was last read, which doesn't tell whether the daemon is there:
+ *	a device can be out of service or off the bus, and at night the reads are minutes apart.  So the daemon keeps an exclusive
+ *	flock on DAEMONPIDFILE, with its pid in it, for as long as it runs.  The kernel drops the lock when the process ends, however
+ *	it ends, so a tool that finds the lock held knows the daemon has the serial port and must go through it or keep off the bus.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+
+#include "powersystem.h"
+#include "daemonlock.h"
+
+/* Take the lock for the daemon and write its pid.  Returns the file descriptor to keep open, or -1 if another daemon has it. */
+int dl_acquire(void)
+{
+	char pid[16];
+	int fd, len;
+
+	if ((fd = open(DAEMONPIDFILE, O_RDWR | O_CREAT, 0644)) == -1) {
+		return -1;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+		return -1;
+	}
+	len=snprintf(pid, sizeof(pid), "%d\n", (int) getpid());
+	if (ftruncate(fd, 0) == -1 || pwrite(fd, pid, len, 0) != len) {
+		fprintf(stderr, "Can't write the pid to %s: %s\n", DAEMONPIDFILE, strerror(errno));
+	}
+	return fd;
+}
+
+/* Remove the pid file and let go of the lock as the daemon stops */
+void dl_release(int fd)
+{
+	if (fd == -1) return;
+	unlink(DAEMONPIDFILE);
+	close(fd);
+}
+
+/* True if powersystemd is running, whether or not it has read any device lately */
+int dl_running(void)
+{
+	int fd, held;
+
+	if ((fd = open(DAEMONPIDFILE, O_RDONLY)) == -1) {
+		return 0;
+	}
+	held=(flock(fd, LOCK_SH | LOCK_NB) == -1 && errno == EWOULDBLOCK);
+	close(fd);													/* Drops the shared lock if it was taken */
+
+	return held;
+}
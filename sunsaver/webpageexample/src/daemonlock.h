@@ -0,0 +1,29 @@
+/*
+ *  daemonlock.h - Tells the tools whether powersystemd is running, from a lock it holds on DAEMONPIDFILE.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef DAEMONLOCK_H
+#define DAEMONLOCK_H
+
+int dl_acquire(void);
+void dl_release(int fd);
+int dl_running(void);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ *  dailylogpage.c - Writes the SunSaver MPPT daily log web page (dailylog.html) from the daily log file (dailylog.txt).
+ *
+ *	Used by dailylog, and by powersystemd after it copies a new record from the SunSaver MPPT.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+
+#include "dailylogpage.h"
+
+void writehtmlfile(char *logfilename, char *htmlfilename)
+{
+	FILE *htmlfile, *infile;
+	int month, day, year;
+	unsigned int hourmeter, alarm_daily;
+	float Vb_min_daily, Vb_max_daily, Ahc_daily, Ahl_daily, Va_max_daily;
+	int array_fault_daily, load_fault_daily, time_ab_daily, time_eq_daily, time_fl_daily;
+	char inputline[1000] = "";
+	
+	// Write data to html file
+	if ((htmlfile = fopen(htmlfilename, "w")) == NULL) { 
+		printf("Can't create file: %s.\n", htmlfilename);
+		return;
+	}
+	
+	fprintf(htmlfile,"<html>\n<head>\n\t<title>SunSaver MPPT Daily Log</title>\n</head>\n");
+	fprintf(htmlfile,"<body bgcolor=\"#6699FF\" text=\"#000000\" link=\"#330099\" vlink=\"#336633\" alink=\"#FFCC00\">\n");
+	fprintf(htmlfile,"<h3 style=\"font-family:Comic Sans MS;color:#663300\">SunSaver MPPT Daily Log</h3>\n");
+	fprintf(htmlfile,"<table border=\"1\" style=\"font-family:arial;color:black;font-size:12px;background-color:white;text-align:center;\">\n");
+	fprintf(htmlfile,"\t<tr>\n\t\t<th>Date</th>\n");
+	fprintf(htmlfile,"\t\t<th>Hour Meter</th>\n");
+	fprintf(htmlfile,"\t\t<th>Min Vb</th>\n");
+	fprintf(htmlfile,"\t\t<th>Max Vb</th>\n");
+	fprintf(htmlfile,"\t\t<th>Charge Ah</th>\n");
+	fprintf(htmlfile,"\t\t<th>Load Ah</th>\n");
+	fprintf(htmlfile,"\t\t<th>Max Va</th>\n");
+	fprintf(htmlfile,"\t\t<th>Ab Time</th>\n");
+	fprintf(htmlfile,"\t\t<th>Eq Time</th>\n");
+	fprintf(htmlfile,"\t\t<th>Fl Time</th>\n");
+	fprintf(htmlfile,"\t\t<th>Controller Alarms</th>\n");
+	fprintf(htmlfile,"\t\t<th>Solar Input Faults</th>\n");
+	fprintf(htmlfile,"\t\t<th>Load Output Faults</th>\n\t</tr>\n");
+	infile = fopen(logfilename, "r");
+	if(infile != NULL) {
+		while (fscanf(infile, "%[^\n]\n", inputline) != EOF)
+		{
+			sscanf(inputline,"%2d%*c%2d%*c%4d%u%u%f%f%f%f%d%d%f%d%d%d",&month,&day,&year,&hourmeter,&alarm_daily,&Vb_min_daily,
+				   &Vb_max_daily,&Ahc_daily,&Ahl_daily,&array_fault_daily,&load_fault_daily,&Va_max_daily,
+				   &time_ab_daily,&time_eq_daily,&time_fl_daily);
+			fprintf(htmlfile,"\t<tr>\n\t\t<td>%0d/%0d/%d</td>\n",month,day,year);
+			fprintf(htmlfile,"\t\t<td>%d</td>\n",hourmeter);
+			fprintf(htmlfile,"\t\t<td>%.2f</td>\n",Vb_min_daily);
+			fprintf(htmlfile,"\t\t<td>%.2f</td>\n",Vb_max_daily);
+			fprintf(htmlfile,"\t\t<td>%.2f</td>\n",Ahc_daily);
+			fprintf(htmlfile,"\t\t<td>%.2f</td>\n",Ahl_daily);
+			fprintf(htmlfile,"\t\t<td>%.2f</td>\n",Va_max_daily);
+			fprintf(htmlfile,"\t\t<td>%d</td>\n",time_ab_daily);
+			fprintf(htmlfile,"\t\t<td>%d</td>\n",time_eq_daily);
+			fprintf(htmlfile,"\t\t<td>%d</td>\n",time_fl_daily);
+			fprintf(htmlfile,"\t\t<td>");
+			if (alarm_daily == 0) {
+				fprintf(htmlfile,"No alarms</td>\n");
+			} else {
+				if (alarm_daily & 1) fprintf(htmlfile,"RTS open<br>");
+				if ((alarm_daily & (1 << 1)) >> 1) fprintf(htmlfile,"RTS shorted<br>");
+				if ((alarm_daily & (1 << 2)) >> 2) fprintf(htmlfile,"RTS disconnected<br>");
+				if ((alarm_daily & (1 << 3)) >> 3) fprintf(htmlfile,"Ths open<br>");
+				if ((alarm_daily & (1 << 4)) >> 4) fprintf(htmlfile,"Ths shorted<br>");
+				if ((alarm_daily & (1 << 5)) >> 5) fprintf(htmlfile,"SSMPPT hot<br>");
+				if ((alarm_daily & (1 << 6)) >> 6) fprintf(htmlfile,"Current limit<br>");
+				if ((alarm_daily & (1 << 7)) >> 7) fprintf(htmlfile,"Current offset<br>");
+				if ((alarm_daily & (1 << 8)) >> 8) fprintf(htmlfile,"Undefined<br>");
+				if ((alarm_daily & (1 << 9)) >> 9) fprintf(htmlfile,"Undefined<br>");
+				if ((alarm_daily & (1 << 10)) >> 10) fprintf(htmlfile,"Uncalibrated<br>");
+				if ((alarm_daily & (1 << 11)) >> 11) fprintf(htmlfile,"RTS miswire<br>");
+				if ((alarm_daily & (1 << 12)) >> 12) fprintf(htmlfile,"Undefined<br>");
+				if ((alarm_daily & (1 << 13)) >> 13) fprintf(htmlfile,"Undefined<br>");
+				if ((alarm_daily & (1 << 14)) >> 14) fprintf(htmlfile,"Miswire<br>");
+				if ((alarm_daily & (1 << 15)) >> 15) fprintf(htmlfile,"FET open<br>");
+				if ((alarm_daily & (1 << 16)) >> 16) fprintf(htmlfile,"P12<br>");
+				if ((alarm_daily & (1 << 17)) >> 17) fprintf(htmlfile,"High Va current limit<br>");
+				if ((alarm_daily & (1 << 18)) >> 18) fprintf(htmlfile,"Alarm 19<br>");
+				if ((alarm_daily & (1 << 19)) >> 19) fprintf(htmlfile,"Alarm 20<br>");
+				if ((alarm_daily & (1 << 20)) >> 20) fprintf(htmlfile,"Alarm 21<br>");
+				if ((alarm_daily & (1 << 21)) >> 21) fprintf(htmlfile,"Alarm 22<br>");
+				if ((alarm_daily & (1 << 22)) >> 22) fprintf(htmlfile,"Alarm 23<br>");
+				if ((alarm_daily & (1 << 23)) >> 23) fprintf(htmlfile,"Alarm 24");
+				fprintf(htmlfile,"</td>\n");
+			}
+			fprintf(htmlfile,"\t\t<td>");
+			if (array_fault_daily == 0) {
+				fprintf(htmlfile,"No faults</td>\n");
+			} else {
+				if (array_fault_daily & 1) fprintf(htmlfile,"Overcurrent<br>");
+				if ((array_fault_daily & (1 << 1)) >> 1) fprintf(htmlfile,"FETs shorted<br>");
+				if ((array_fault_daily & (1 << 2)) >> 2) fprintf(htmlfile,"Software bug<br>");
+				if ((array_fault_daily & (1 << 3)) >> 3) fprintf(htmlfile,"Battery HVD<br>");
+				if ((array_fault_daily & (1 << 4)) >> 4) fprintf(htmlfile,"Array HVD<br>");
+				if ((array_fault_daily & (1 << 5)) >> 5) fprintf(htmlfile,"EEPROM setting edit (reset required)<br>");
+				if ((array_fault_daily & (1 << 6)) >> 6) fprintf(htmlfile,"RTS shorted<br>");
+				if ((array_fault_daily & (1 << 7)) >> 7) fprintf(htmlfile,"RTS was valid, now disconnected<br>");
+				if ((array_fault_daily & (1 << 8)) >> 8) fprintf(htmlfile,"Local temperature sensor failed<br>");
+				if ((array_fault_daily & (1 << 9)) >> 9) fprintf(htmlfile,"Fault 10<br>");
+				if ((array_fault_daily & (1 << 10)) >> 10) fprintf(htmlfile,"Fault 11<br>");
+				if ((array_fault_daily & (1 << 11)) >> 11) fprintf(htmlfile,"Fault 12<br>");
+				if ((array_fault_daily & (1 << 12)) >> 12) fprintf(htmlfile,"Fault 13<br>");
+				if ((array_fault_daily & (1 << 13)) >> 13) fprintf(htmlfile,"Fault 14<br>");
+				if ((array_fault_daily & (1 << 14)) >> 14) fprintf(htmlfile,"Fault 15<br>");
+				if ((array_fault_daily & (1 << 15)) >> 15) fprintf(htmlfile,"Fault 16");
+				fprintf(htmlfile,"</td>\n");
+			}
+			fprintf(htmlfile,"\t\t<td>");
+			if (load_fault_daily == 0) {
+				fprintf(htmlfile,"No faults</td>\n\t</tr>\n");
+			} else {
+				if (load_fault_daily & 1) fprintf(htmlfile,"External short circuit\n");
+				if ((load_fault_daily & (1 << 1)) >> 1) fprintf(htmlfile,"Overcurrent<br>");
+				if ((load_fault_daily & (1 << 2)) >> 2) fprintf(htmlfile,"FETs shorted<br>");
+				if ((load_fault_daily & (1 << 3)) >> 3) fprintf(htmlfile,"Software bug<br>");
+				if ((load_fault_daily & (1 << 4)) >> 4) fprintf(htmlfile,"HVD<br>");
+				if ((load_fault_daily & (1 << 5)) >> 5) fprintf(htmlfile,"Heatsink over-temperature<br>");
+				if ((load_fault_daily & (1 << 6)) >> 6) fprintf(htmlfile,"EEPROM setting edit (reset required)<br>");
+				if ((load_fault_daily & (1 << 7)) >> 7) fprintf(htmlfile,"Fault 8<br>");
+				fprintf(htmlfile,"</td>\n\t</tr>\n");
+			}
+		}
+		fclose(infile);
+	}
+	
+	fprintf(htmlfile,"</table>\n");
+ 	fprintf(htmlfile,"</body>\n</html>\n");
+	
+	fclose(htmlfile);
+}
+
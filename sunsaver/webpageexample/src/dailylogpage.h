@@ -0,0 +1,27 @@
+/*
+ *  dailylogpage.h - Writes the SunSaver MPPT daily log web page (dailylog.html) from the daily log file (dailylog.txt).
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef DAILYLOGPAGE_H
+#define DAILYLOGPAGE_H
+
+void writehtmlfile(char *logfilename, char *htmlfilename);
+
+#endif
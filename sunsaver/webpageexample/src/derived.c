@@ -0,0 +1,350 @@
+/*
+ *  derived.c - Channels worked out from the measured ones by expressions given in powersystem.h.
+ *
+ *	Each of DERIVEDCHANNELS is "Name = expression", with + - * / and parentheses over numbers, the inputs (the log file columns
+ *	Vb, Va, Vl, Ic, Il, Power_out, Ahc_daily, Ahl_daily, charge_state and load_state, and Ia and Power_in, which only a TriStar
+ *	MPPT measures), the channels defined before it, and min(a,b), max(a,b), abs(a) and sum(a).  sum adds a value up over the
+ *	samples evaluated together, which in powersystemd are the controllers read in one fast cycle.  Dividing by 0 gives 0, so a
+ *	ratio is 0 rather than undefined while the array is dark.
+ *
+ *	Each expression is parsed once into a list of stack operations.  They are run on a whole batch of samples at a time, one
+ *	operation over a column of up to DV_BATCH values, so the cost of decoding an operation is shared by the batch and the inner
+ *	loops are simple enough for the compiler to unroll.  powersystemd evaluates each fast cycle's devices as one batch, and
+ *	powersystemstatus the rows of the day's log file for the graph - one row at a time if sum() is used, as each row is one
+ *	controller at one time.  A channel that uses an input a device doesn't measure, such as Ia on a SunSaver MPPT, is left out
+ *	for that device (dv_has).
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "derived.h"
+
+static const char *inputs[DV_NINPUTS] = {
+	"Vb", "Va", "Vl", "Ic", "Il", "Power_out", "Ahc_daily", "Ahl_daily", "charge_state", "load_state", "Ia", "Power_in"
+};
+
+/* The expression being compiled */
+
+struct parser {
+	const struct dv_set *s;
+	struct dv_channel *ch;
+	const char *p;
+	int depth;
+	int error;
+};
+
+static void expr(struct parser *ps);
+static void term(struct parser *ps);
+static void unary(struct parser *ps);
+static void primary(struct parser *ps);
+static void emit(struct parser *ps, int code, int arg, float value, int pushes);
+static int word(struct parser *ps, char *name);
+static int next(struct parser *ps, char c);
+static void run(const struct dv_channel *ch, int c, const float *in, int n, float *out);
+
+/* Compile the definitions, reporting and skipping any that don't parse.  Returns the number of channels. */
+int dv_init(struct dv_set *s, const char **defs, int ndefs)
+{
+	struct parser ps;
+	struct dv_channel *ch;
+	const char *eq;
+	int i, n;
+
+	memset(s, 0, sizeof(struct dv_set));
+	for (i=0; i<ndefs && s->nchannels < DV_MAXCHANNELS; i++) {
+		ch=&s->ch[s->nchannels];
+		memset(ch, 0, sizeof(struct dv_channel));
+		snprintf(ch->text, DV_TEXTSIZE, "%s", defs[i]);
+		memset(&ps, 0, sizeof(ps));
+		ps.s=s;
+		ps.ch=ch;
+		ps.p=defs[i];
+		eq=strchr(defs[i], '=');
+		if (eq == NULL || word(&ps, ch->name) == 0 || !next(&ps, '=')) {
+			fprintf(stderr, "Can't understand derived channel: %s\n", defs[i]);
+			continue;
+		}
+		for (n=0; n<s->nchannels && strcasecmp(s->ch[n].name, ch->name) != 0; n++);
+		if (n < s->nchannels || dv_input(ch->name) != -1) {
+			fprintf(stderr, "Derived channel %s is already a channel\n", ch->name);
+			continue;
+		}
+		expr(&ps);
+		while (isspace((unsigned char) *ps.p)) ps.p++;
+		if (ps.error || *ps.p != '\0' || ps.depth != 1) {
+			fprintf(stderr, "Can't understand derived channel: %s\n", defs[i]);
+			continue;
+		}
+		s->aggregate|=ch->aggregate;
+		s->nchannels++;
+	}
+	return s->nchannels;
+}
+
+/*	Evaluate every channel for n samples: in holds DV_NINPUTS values a sample and out gets DV_MAXCHANNELS a sample.  A batch
+	bigger than DV_BATCH is done in pieces, which sum() can't be used with.  Returns 0, or -1 if it was. */
+int dv_eval(const struct dv_set *s, const float *in, int n, float *out)
+{
+	int start, m, c;
+
+	if (s->aggregate && n > DV_BATCH) return -1;
+	for (start=0; start<n; start+=DV_BATCH) {
+		m=(n-start < DV_BATCH) ? n-start : DV_BATCH;
+		for (c=0; c<s->nchannels; c++) run(&s->ch[c], c, in+start*DV_NINPUTS, m, out+start*DV_MAXCHANNELS);
+	}
+	return 0;
+}
+
+/* Derived channel by name, or -1 */
+int dv_find(const struct dv_set *s, const char *name)
+{
+	int c;
+
+	for (c=0; c<s->nchannels; c++) {
+		if (strcasecmp(name, s->ch[c].name) == 0) return c;
+	}
+	return -1;
+}
+
+/* True if every input channel c uses is in the mask have */
+int dv_has(const struct dv_set *s, int c, unsigned int have)
+{
+	return (s->ch[c].inputs & ~have) == 0;
+}
+
+/* Input by name, or -1 */
+int dv_input(const char *name)
+{
+	int i;
+
+	for (i=0; i<DV_NINPUTS; i++) {
+		if (strcasecmp(name, inputs[i]) == 0) return i;
+	}
+	return -1;
+}
+
+static void expr(struct parser *ps)
+{
+	term(ps);
+	for (;;) {
+		if (next(ps, '+')) {
+			term(ps);
+			emit(ps, DV_ADD, 0, 0, -1);
+		} else if (next(ps, '-')) {
+			term(ps);
+			emit(ps, DV_SUB, 0, 0, -1);
+		} else {
+			return;
+		}
+	}
+}
+
+static void term(struct parser *ps)
+{
+	unary(ps);
+	for (;;) {
+		if (next(ps, '*')) {
+			unary(ps);
+			emit(ps, DV_MUL, 0, 0, -1);
+		} else if (next(ps, '/')) {
+			unary(ps);
+			emit(ps, DV_DIV, 0, 0, -1);
+		} else {
+			return;
+		}
+	}
+}
+
+static void unary(struct parser *ps)
+{
+	if (next(ps, '-')) {
+		unary(ps);
+		emit(ps, DV_NEG, 0, 0, 0);
+	} else {
+		primary(ps);
+	}
+}
+
+static void primary(struct parser *ps)
+{
+	char name[DV_NAMESIZE], *end;
+	float x;
+	int i, code, args;
+
+	while (isspace((unsigned char) *ps->p)) ps->p++;
+	if (next(ps, '(')) {
+		expr(ps);
+		if (!next(ps, ')')) ps->error=1;
+		return;
+	}
+	x=strtod(ps->p, &end);
+	if (end != ps->p) {
+		ps->p=end;
+		emit(ps, DV_CONST, 0, x, 1);
+		return;
+	}
+	if (word(ps, name) == 0) {
+		ps->error=1;
+		return;
+	}
+
+	/* A function */
+	if (next(ps, '(')) {
+		code=-1;
+		args=1;
+		if (strcasecmp(name, "min") == 0) { code=DV_MIN; args=2; }
+		if (strcasecmp(name, "max") == 0) { code=DV_MAX; args=2; }
+		if (strcasecmp(name, "abs") == 0) code=DV_ABS;
+		if (strcasecmp(name, "sum") == 0) code=DV_SUM;
+		if (code == -1) {
+			ps->error=1;
+			return;
+		}
+		expr(ps);
+		for (i=1; i<args; i++) {
+			if (!next(ps, ',')) ps->error=1;
+			expr(ps);
+		}
+		if (!next(ps, ')')) ps->error=1;
+		emit(ps, code, 0, 0, 1-args);
+		if (code == DV_SUM) ps->ch->aggregate=1;
+		return;
+	}
+
+	/* An input, or a channel defined before this one */
+	if ((i = dv_input(name)) != -1) {
+		emit(ps, DV_INPUT, i, 0, 1);
+		ps->ch->inputs|=1U << i;
+	} else if ((i = dv_find(ps->s, name)) != -1) {
+		emit(ps, DV_DERIVED, i, 0, 1);
+		ps->ch->aggregate|=ps->s->ch[i].aggregate;
+		ps->ch->inputs|=ps->s->ch[i].inputs;
+	} else {
+		ps->error=1;
+	}
+}
+
+/* Add an operation that changes the stack depth by pushes */
+static void emit(struct parser *ps, int code, int arg, float value, int pushes)
+{
+	struct dv_op *op;
+
+	if (ps->error) return;
+	ps->depth+=pushes;
+	if (ps->ch->nops >= DV_MAXOPS || ps->depth > DV_MAXDEPTH || ps->depth < 1) {
+		ps->error=1;
+		return;
+	}
+	op=&ps->ch->op[ps->ch->nops++];
+	op->code=code;
+	op->arg=arg;
+	op->value=value;
+}
+
+/* A name of letters, digits and _.  Returns its length. */
+static int word(struct parser *ps, char *name)
+{
+	int n;
+
+	while (isspace((unsigned char) *ps->p)) ps->p++;
+	for (n=0; (isalnum((unsigned char) ps->p[n]) || ps->p[n] == '_') && n < DV_NAMESIZE-1; n++) name[n]=ps->p[n];
+	name[n]='\0';
+	if (n == 0 || isdigit((unsigned char) name[0])) return 0;
+	ps->p+=n;
+	return n;
+}
+
+/* Take c if it is next */
+static int next(struct parser *ps, char c)
+{
+	while (isspace((unsigned char) *ps->p)) ps->p++;
+	if (*ps->p != c) return 0;
+	ps->p++;
+	return 1;
+}
+
+/* Run one channel's operations over n samples, a column at a time */
+static void run(const struct dv_channel *ch, int c, const float *in, int n, float *out)
+{
+	float stack[DV_MAXDEPTH][DV_BATCH], *a, *b, total;
+	const struct dv_op *op;
+	int i, k, sp;
+
+	sp=0;
+	for (i=0; i<ch->nops; i++) {
+		op=&ch->op[i];
+		a=(sp > 0) ? stack[sp-1] : NULL;
+		b=(sp > 1) ? stack[sp-2] : NULL;
+		switch (op->code) {
+			case DV_CONST:
+				for (k=0; k<n; k++) stack[sp][k]=op->value;
+				sp++;
+				break;
+			case DV_INPUT:
+				for (k=0; k<n; k++) stack[sp][k]=in[k*DV_NINPUTS+op->arg];
+				sp++;
+				break;
+			case DV_DERIVED:
+				for (k=0; k<n; k++) stack[sp][k]=out[k*DV_MAXCHANNELS+op->arg];
+				sp++;
+				break;
+			case DV_ADD:
+				for (k=0; k<n; k++) b[k]+=a[k];
+				sp--;
+				break;
+			case DV_SUB:
+				for (k=0; k<n; k++) b[k]-=a[k];
+				sp--;
+				break;
+			case DV_MUL:
+				for (k=0; k<n; k++) b[k]*=a[k];
+				sp--;
+				break;
+			case DV_DIV:
+				for (k=0; k<n; k++) b[k]=(a[k] != 0) ? b[k]/a[k] : 0;
+				sp--;
+				break;
+			case DV_NEG:
+				for (k=0; k<n; k++) a[k]=-a[k];
+				break;
+			case DV_MIN:
+				for (k=0; k<n; k++) b[k]=(a[k] < b[k]) ? a[k] : b[k];
+				sp--;
+				break;
+			case DV_MAX:
+				for (k=0; k<n; k++) b[k]=(a[k] > b[k]) ? a[k] : b[k];
+				sp--;
+				break;
+			case DV_ABS:
+				for (k=0; k<n; k++) a[k]=(a[k] < 0) ? -a[k] : a[k];
+				break;
+			case DV_SUM:
+				total=0;
+				for (k=0; k<n; k++) total+=a[k];
+				for (k=0; k<n; k++) a[k]=total;
+				break;
+		}
+	}
+	for (k=0; k<n; k++) out[k*DV_MAXCHANNELS+c]=stack[0][k];
+}
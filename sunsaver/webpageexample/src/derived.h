@@ -0,0 +1,77 @@
+/*
+ *  derived.h - Channels worked out from the measured ones by expressions given in powersystem.h.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef DERIVED_H
+#define DERIVED_H
+
+#define DV_MAXCHANNELS	16
+#define DV_MAXOPS		32
+#define DV_MAXDEPTH		8
+#define DV_BATCH		256										/* Samples evaluated at once */
+#define DV_NAMESIZE		24
+#define DV_TEXTSIZE		80
+
+/* Inputs of each sample: the log file columns, then the array current and power only a TriStar MPPT measures */
+
+enum {
+	DV_VB, DV_VA, DV_VL, DV_IC, DV_IL, DV_POWER_OUT, DV_AHC_DAILY, DV_AHL_DAILY, DV_CHARGE_STATE, DV_LOAD_STATE, DV_IA,
+	DV_POWER_IN, DV_NINPUTS
+};
+
+#define DV_ALLINPUTS		((1U << DV_NINPUTS)-1)
+#define DV_SUNSAVERINPUTS	(DV_ALLINPUTS & ~(1U << DV_IA) & ~(1U << DV_POWER_IN))	/* The SunSaver MPPT measures no array current */
+
+/* Operations */
+
+enum {
+	DV_CONST, DV_INPUT, DV_DERIVED, DV_ADD, DV_SUB, DV_MUL, DV_DIV, DV_NEG, DV_MIN, DV_MAX, DV_ABS, DV_SUM
+};
+
+struct dv_op {
+	int code;
+	int arg;													/* Input or derived channel */
+	float value;												/* Constant */
+};
+
+/* One channel, "Name = expression", compiled to operations on a stack of sample columns */
+
+struct dv_channel {
+	char name[DV_NAMESIZE];
+	char text[DV_TEXTSIZE];
+	int nops;
+	struct dv_op op[DV_MAXOPS];
+	int aggregate;												/* Uses sum(), so it depends on the whole batch */
+	unsigned int inputs;										/* A bit for each input it uses, directly or through another channel */
+};
+
+struct dv_set {
+	int nchannels;
+	struct dv_channel ch[DV_MAXCHANNELS];
+	int aggregate;												/* Any channel does */
+};
+
+int dv_init(struct dv_set *s, const char **defs, int ndefs);
+int dv_eval(const struct dv_set *s, const float *in, int n, float *out);
+int dv_find(const struct dv_set *s, const char *name);
+int dv_input(const char *name);
+int dv_has(const struct dv_set *s, int c, unsigned int have);
+
+#endif
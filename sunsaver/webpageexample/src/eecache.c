@@ -0,0 +1,180 @@
+/*
+ *  eecache.c - Versioned snapshot of the SunSaver MPPT EEPROM settings, kept by powersystemd and read by the tools.
+ *
+ *	The EEPROM settings almost never change, so the daemon reads them when it starts and every POLLEEPROM milliseconds, and keeps
+ *	the registers with a hash of the settings in RUNFILEPATH/eeprom<id>.txt.  A read whose hash differs from the last one is a new
+ *	version of the settings, and is noted with the time and hash in LOGFILEPATH/eeprom.txt so the version number survives a
+ *	reboot.  The SunSaver MPPT sets the "EEPROM setting edit" bit in array_fault when a setting is written, so the daemon watches
+ *	that bit in its fast samples and reads the EEPROM again straight away instead of waiting for the next daily read.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "powersystem.h"
+#include "eecache.h"
+
+static void writesnapshot(const struct ee_cache *ec);
+
+/* Pick up the version and hash of the last settings seen from the history file */
+void ee_init(struct ee_cache *ec, int slave)
+{
+	FILE *infile;
+	char filepath[64], inputline[200];
+	unsigned int version, hash;
+	long changed;
+	int id;
+
+	memset(ec, 0, sizeof(struct ee_cache));
+	ec->slave=slave;
+
+	sprintf(filepath,"%s/eeprom.txt",LOGFILEPATH);
+	if ((infile = fopen(filepath, "r")) == NULL) {
+		return;
+	}
+	while (fgets(inputline, sizeof(inputline), infile) != NULL) {
+		if (sscanf(inputline, "%*s%*s%ld%d%u%x", &changed, &id, &version, &hash) == 4 && id == slave) {
+			ec->version=version;
+			ec->hash=hash;
+			ec->changed=changed;
+		}
+	}
+	fclose(infile);
+}
+
+/* Store a fresh read of the EEPROM.  Returns 1 if the settings differ from the last version. */
+int ee_update(struct ee_cache *ec, const uint16_t *regs, time_t t)
+{
+	FILE *outfile;
+	struct tm *now;
+	char filepath[64], ts[32];
+	uint32_t hash;
+	int changed;
+
+	hash=ee_hash(regs);
+	changed=(ec->version == 0 || hash != ec->hash);
+	memcpy(ec->regs, regs, sizeof(ec->regs));
+	ec->valid=1;
+	ec->read=t;
+	ec->reads++;
+
+	if (changed) {
+		ec->version++;
+		ec->hash=hash;
+		ec->changed=t;
+		ec->changes++;
+
+		/* One line per version - date, time, unix time, MODBUS id, version, hash */
+		now=localtime(&t);
+		strftime(ts, 32, "%m/%d/%Y\t%H:%M:%S", now);
+		sprintf(filepath,"%s/eeprom.txt",LOGFILEPATH);
+		if ((outfile = fopen(filepath, "a")) != NULL) {
+			fprintf(outfile,"%s\t%ld\t%d\t%u\t%08x\n", ts, (long) t, ec->slave, ec->version, hash);
+			fclose(outfile);
+		}
+	}
+	writesnapshot(ec);
+
+	return changed;
+}
+
+/* Returns 1 when the EEPROM setting edit bit comes on, which means the EEPROM should be read again */
+int ee_checkfault(struct ee_cache *ec, unsigned int array_fault)
+{
+	int edit;
+
+	edit=(array_fault & EE_EDITFAULT) != 0;
+	if (edit && !ec->editfault) {
+		ec->editfault=1;
+		ec->edits++;
+		return 1;
+	}
+	ec->editfault=edit;
+	return 0;
+}
+
+/* 32-bit FNV-1a hash of the EEPROM settings */
+uint32_t ee_hash(const uint16_t *regs)
+{
+	uint32_t hash;
+	int i;
+
+	hash=2166136261U;
+	for (i=0; i<EE_SETTINGS; i++) {
+		hash=(hash ^ (regs[i] & 0xFF))*16777619U;
+		hash=(hash ^ (regs[i] >> 8))*16777619U;
+	}
+	return hash;
+}
+
+/* Read the daemon's snapshot of one device.  Returns -1 if there isn't one or it doesn't match its hash. */
+int ee_load(int slave, uint16_t *regs, unsigned int *version, time_t *read)
+{
+	FILE *infile;
+	char filepath[64];
+	unsigned int v, hash, value;
+	long t;
+	int i;
+
+	sprintf(filepath,"%s/eeprom%d.txt",RUNFILEPATH,slave);
+	if ((infile = fopen(filepath, "r")) == NULL) {
+		return -1;
+	}
+	if (fscanf(infile, "%u%x%ld", &v, &hash, &t) != 3) {
+		fclose(infile);
+		return -1;
+	}
+	for (i=0; i<SS_EEREGS; i++) {
+		if (fscanf(infile, "%u", &value) != 1) {
+			fclose(infile);
+			return -1;
+		}
+		regs[i]=value;
+	}
+	fclose(infile);
+
+	if (ee_hash(regs) != hash) {
+		return -1;												/* Torn or edited by hand */
+	}
+	if (version != NULL) *version=v;
+	if (read != NULL) *read=t;
+	return 0;
+}
+
+/* Version, hash and read time on the first line, then the registers from 0xE000.  Renamed into place so it is never half written. */
+static void writesnapshot(const struct ee_cache *ec)
+{
+	FILE *outfile;
+	char filepath[64], tmppath[72];
+	int i;
+
+	sprintf(filepath,"%s/eeprom%d.txt",RUNFILEPATH,ec->slave);
+	sprintf(tmppath,"%s.tmp",filepath);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return;
+	}
+	fprintf(outfile,"%u %08x %ld\n", ec->version, ec->hash, (long) ec->read);
+	for (i=0; i<SS_EEREGS; i++) {
+		fprintf(outfile,"%u%c", ec->regs[i], (i < SS_EEREGS-1) ? ' ' : '\n');
+	}
+	fclose(outfile);
+	rename(tmppath, filepath);
+}
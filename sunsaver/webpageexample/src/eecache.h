@@ -0,0 +1,54 @@
+/*
+ *  eecache.h - Versioned snapshot of the SunSaver MPPT EEPROM settings, kept by powersystemd and read by the tools.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef EECACHE_H
+#define EECACHE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "ssmppt.h"
+
+#define EE_EDITFAULT	(1 << 5)								/* array_fault: EEPROM setting edit (reset required) */
+#define EE_SETTINGS		0x40									/* Registers from 0xE000 that hold settings.  The read only section after them
+																	has counters that change all the time, so it isn't in the hash. */
+
+struct ee_cache {
+	int slave;
+	int valid;													/* regs holds a snapshot */
+	unsigned int version;										/* Goes up by one every time the settings change */
+	uint32_t hash;												/* Hash of the settings */
+	time_t read;												/* When the EEPROM was last read */
+	time_t changed;												/* When the current version was first seen */
+	uint16_t regs[SS_EEREGS];
+	int editfault;												/* Last state of the array_fault edit bit */
+	unsigned long reads;
+	unsigned long changes;
+	unsigned long edits;										/* Times the edit bit came on */
+};
+
+void ee_init(struct ee_cache *ec, int slave);
+int ee_update(struct ee_cache *ec, const uint16_t *regs, time_t t);
+int ee_checkfault(struct ee_cache *ec, unsigned int array_fault);
+uint32_t ee_hash(const uint16_t *regs);
+int ee_load(int slave, uint16_t *regs, unsigned int *version, time_t *read);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ *  energy.c - Energy accounting from the charge controllers' amp-hour and kilowatt-hour counters, for the acquisition daemon.
+ *
+ *	Power_out and Vl*Il are single samples, and adding them up between log rows misses every cloud that comes and goes in
+ *	between.  The charge controller already adds up the current itself, many times a second: Ahc_t and Ahl_t count amp-hours
+ *	charged and used and kWhc counts kilowatt-hours.  The difference between two readings of a counter is the exact energy in
+ *	between, however long apart they are, so the counters only need reading on the slow interval.  Watt-hours are the amp-hours
+ *	times the mean battery (or load) voltage over the same time, which moves slowly, since kWhc only counts tenths of a kWh.
+ *
+ *	A counter that goes down is taken to have wrapped if it was in its top quarter and is now in its bottom quarter, and to have
+ *	been reset (e.g. with the reset coils) otherwise, in which case it has counted up from 0 since.  A rise of more than
+ *	ENERGYMAXAMPS allows in the time since the last reading is a bad read and isn't counted.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string.h>
+
+#include "powersystem.h"
+#include "energy.h"
+
+static void initcounter(struct en_counter *c, int present, double scale, double modulus);
+static double difference(struct en_counter *c, unsigned int v, long now, double maxrate);
+
+/*	Set up the counters of one device: ahscale is amp-hours per count of its 32-bit amp-hour counters, haveload 0 for a device
+	with no load output, and kwhscale and kwhmodulus describe its kilowatt-hour counter. */
+void en_init(struct en_meter *m, int slave, double ahscale, int haveload, double kwhscale, double kwhmodulus)
+{
+	memset(m, 0, sizeof(struct en_meter));
+	m->slave=slave;
+	initcounter(&m->cahc, 1, ahscale, 4294967296.0);
+	initcounter(&m->cahl, haveload, ahscale, 4294967296.0);
+	initcounter(&m->ckwh, 1, kwhscale, kwhmodulus);
+}
+
+/* Call on every fast read, for the mean voltages the amp-hours are turned into watt-hours with */
+void en_voltage(struct en_meter *m, float vb, float vl)
+{
+	m->vbsum+=vb;
+	m->nvb++;
+	m->vb=vb;
+	m->vlsum+=vl;
+	m->nvl++;
+	m->vl=vl;
+}
+
+/* Call with the raw counters on every slow read (now in monotonic milliseconds) */
+void en_counters(struct en_meter *m, unsigned int ahc, unsigned int ahl, unsigned int kwhc, long now)
+{
+	double dahc, dahl, vb, vl;
+
+	vb=(m->nvb > 0) ? m->vbsum/m->nvb : m->vb;
+	vl=(m->nvl > 0) ? m->vlsum/m->nvl : m->vl;
+	m->vbsum=0;
+	m->nvb=0;
+	m->vlsum=0;
+	m->nvl=0;
+
+	dahc=difference(&m->cahc, ahc, now, ENERGYMAXAMPS);
+	dahl=difference(&m->cahl, ahl, now, ENERGYMAXAMPS);
+	m->kwh+=difference(&m->ckwh, kwhc, now, ENERGYMAXAMPS*16.0*VOLTAGESCALE/1000.0);
+
+	m->ahc+=dahc;
+	m->ahl+=dahl;
+	m->whc+=dahc*vb;
+	m->whl+=dahl*vl;
+	m->iahc+=dahc;
+	m->iahl+=dahl;
+	m->iwhc+=dahc*vb;
+	m->iwhl+=dahl*vl;
+}
+
+/* Start the next interval once its row has been written */
+void en_endinterval(struct en_meter *m)
+{
+	m->iahc=0;
+	m->iahl=0;
+	m->iwhc=0;
+	m->iwhl=0;
+}
+
+static void initcounter(struct en_counter *c, int present, double scale, double modulus)
+{
+	c->present=present;
+	c->scale=scale;
+	c->modulus=modulus;
+}
+
+/* Units counted since the last reading of a counter that can count at most maxrate units an hour */
+static double difference(struct en_counter *c, unsigned int v, long now, double maxrate)
+{
+	double d, hours;
+
+	if (!c->present) return 0;
+	if (!c->valid) {
+		c->valid=1;
+		c->last=v;
+		c->lastread=now;
+		return 0;
+	}
+
+	if (v >= c->last) {
+		d=(double) v-c->last;
+	} else if (c->last >= c->modulus*3/4 && v < c->modulus/4) {
+		d=c->modulus-c->last+v;
+		c->wraps++;
+	} else {
+		d=v;													/* Reset, and counting up from 0 since */
+		c->resets++;
+	}
+	hours=(now-c->lastread)/3600000.0;
+	c->last=v;
+	c->lastread=now;
+
+	/* One count of slack for the counter having been just short of its next count last time */
+	if (d*c->scale > maxrate*hours+c->scale) {
+		c->glitches++;
+		return 0;
+	}
+	return d*c->scale;
+}
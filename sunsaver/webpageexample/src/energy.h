@@ -0,0 +1,56 @@
+/*
+ *  energy.h - Energy accounting from the charge controllers' amp-hour and kilowatt-hour counters, for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+/* One counter register (or hi/lo pair) as it is differenced */
+
+struct en_counter {
+	int present;												/* 0 if the device doesn't have this counter */
+	int valid;													/* last holds a reading */
+	unsigned int last;
+	double modulus;												/* Where the counter wraps to 0 (65536 or 2^32) */
+	double scale;												/* Units per count */
+	long lastread;												/* Monotonic milliseconds of the last reading */
+	unsigned long wraps;
+	unsigned long resets;										/* Went down without wrapping - reset by the user or the controller */
+	unsigned long glitches;										/* Went up faster than ENERGYMAXAMPS allows - not counted */
+};
+
+struct en_meter {
+	int slave;
+	struct en_counter cahc;										/* Charge amp-hours */
+	struct en_counter cahl;										/* Load amp-hours */
+	struct en_counter ckwh;										/* Charge kilowatt-hours */
+	double vbsum, vlsum;										/* Voltages since the last counter reading, for the watt-hours */
+	long nvb, nvl;
+	float vb, vl;												/* Latest voltages, if none since the last counter reading */
+	double ahc, ahl, whc, whl, kwh;								/* Since the daemon started */
+	double iahc, iahl, iwhc, iwhl;								/* In the interval being logged */
+};
+
+void en_init(struct en_meter *m, int slave, double ahscale, int haveload, double kwhscale, double kwhmodulus);
+void en_voltage(struct en_meter *m, float vb, float vl);
+void en_counters(struct en_meter *m, unsigned int ahc, unsigned int ahl, unsigned int kwhc, long now);
+void en_endinterval(struct en_meter *m);
+
+#endif
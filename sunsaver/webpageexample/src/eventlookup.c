@@ -0,0 +1,109 @@
+/*
+ *  eventlookup.c - This program tells when each alarm, fault and state was first and last seen, from the index powersystemd keeps.
+ *
+ *	Usage: eventlookup [-i id] [text]
+ *
+ *	Every alarm, array_fault and load_fault bit and every charge, load and LED state a device has had is listed with when it was
+ *	first and last set or entered, when it last cleared or was left and how many times, or only those whose channel or name
+ *	contains text (in any case).  -i only lists the device with that MODBUS id.  For example when RTS miswire first appeared:
+ *
+ *		eventlookup miswire
+ *
+ *	The rows around a time are in LOGFILEPATH/YYYY/YYYYeventlog.txt.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` eventlookup.c events.c journal.c ssmppt.c readplan.c -o eventlookup */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "powersystem.h"
+#include "events.h"
+
+static int contains(const char *s, const char *text);
+static const char *when(time_t t, char *buf);
+
+int main(int argc, char *argv[])
+{
+	static struct ev_engine events;
+	const struct ev_key *k;
+	const char *text;
+	char first[32], last[32], cleared[32];
+	int a, id, i, ch, key, found;
+
+	id=0;
+	for (a=1; a<argc && argv[a][0] == '-'; a++) {
+		if (strcmp(argv[a], "-i") == 0 && a+1 < argc) {
+			id=strtol(argv[++a], NULL, 0);
+		} else {
+			fprintf(stderr, "Usage: %s [-i id] [text]\n", argv[0]);
+			return -1;
+		}
+	}
+	text=(a < argc) ? argv[a] : "";
+
+	ev_init(&events, NULL, 0, NULL);
+	if (ev_loadindex(&events, EVENTINDEX) == -1) {
+		fprintf(stderr, "Can't open the event index: %s\n", EVENTINDEX);
+		return -1;
+	}
+
+	found=0;
+	for (i=0; i<events.ndevices; i++) {
+		if (id != 0 && events.dev[i].slave != id) continue;
+		for (ch=0; ch<EV_NCHANNELS; ch++) {
+			for (key=0; key<EV_MAXKEYS; key++) {
+				k=&events.dev[i].key[ch][key];
+				if (k->count == 0) continue;
+				if (!contains(ev_channelname(ch), text) && !contains(ev_keyname(ch, key), text)) continue;
+				if (found++ == 0) printf("id\tchannel\tname\tfirst\tlast\tcleared\tcount\n");
+				printf("%d\t%s\t%s\t%s\t%s\t%s\t%lu\n", events.dev[i].slave, ev_channelname(ch), ev_keyname(ch, key),
+					   when(k->first, first), when(k->last, last), (k->cleared >= k->last) ? when(k->cleared, cleared) : "-", k->count);
+			}
+		}
+	}
+	if (found == 0) {
+		fprintf(stderr, "No events%s%s in %s\n", (text[0] != '\0') ? " matching " : "", text, EVENTINDEX);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Whether text is in s, in any case */
+static int contains(const char *s, const char *text)
+{
+	size_t n;
+
+	n=strlen(text);
+	for (; *s != '\0'; s++) {
+		if (strncasecmp(s, text, n) == 0) return 1;
+	}
+	return n == 0;
+}
+
+static const char *when(time_t t, char *buf)
+{
+	strftime(buf, 32, "%m/%d/%Y %H:%M:%S", localtime(&t));
+	return buf;
+}
@@ -0,0 +1,256 @@
+/*
+ *  events.c - Alarm, fault and state change events of the SunSaver MPPTs, with an index of when each was first and last seen.
+ *
+ *	alarm (24 bits), array_fault (16) and load_fault (8) are compared with their last reading on every read: the XOR of the two
+ *	has a bit set for each bit that changed, and only those are visited, lowest first, by counting the trailing zeros and clearing
+ *	the lowest set bit.  A reading with nothing changed costs one XOR per register.  charge_state, load_state and led_state give
+ *	an event when they change.  Each event is a row in LOGFILEPATH/YYYY/YYYYeventlog.txt, through the journal:
+ *
+ *		MM/DD/YYYY	HH:MM:SS	id	channel	rise|clear|state	name	[old state]
+ *
+ *	EVENTINDEX keeps, for every bit and state of every device, when it was first and last set or entered, when it was last
+ *	cleared or left and how many times it has been set, so "when did RTS miswire first appear" is one line of it (see
+ *	eventlookup.c) instead of a pass over every log.  It also keeps the last readings, so a change while the daemon was stopped
+ *	is an event when it starts again.  It is rewritten only after an event.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "powersystem.h"
+#include "events.h"
+
+struct watched {
+	const char *name;
+	int channel;												/* ss_channels index */
+	int bits;													/* 1 for a bitmask, 0 for a state */
+	int nkeys;
+	const char **names;
+};
+
+static const struct watched watched[EV_NCHANNELS] = {
+	{ "alarm",			SS_ALARM,			1,	SS_ALARM_BITS,			ss_alarm_bits },
+	{ "array_fault",	SS_ARRAY_FAULT,		1,	SS_ARRAY_FAULT_BITS,	ss_array_fault_bits },
+	{ "load_fault",		SS_LOAD_FAULT,		1,	SS_LOAD_FAULT_BITS,		ss_load_fault_bits },
+	{ "charge_state",	SS_CHARGE_STATE,	0,	SS_CS_EQUALIZE+1,		ss_charge_states },
+	{ "load_state",		SS_LOAD_STATE,		0,	SS_LS_DISCONNECT+1,		ss_load_states },
+	{ "led_state",		SS_LED_STATE,		0,	SS_LED_STATES,			ss_led_states }
+};
+
+static const char *types[] = { "rise", "clear", "state" };
+
+static void emit(struct ev_engine *e, struct ev_device *d, int ch, int type, int key, unsigned int old, time_t t);
+static struct ev_device *finddevice(struct ev_engine *e, int slave);
+
+void ev_init(struct ev_engine *e, const int *slaves, int ndevices, struct jn_journal *journal)
+{
+	int i, ch;
+
+	memset(e, 0, sizeof(struct ev_engine));
+	if (ndevices > EV_MAXDEVICES) ndevices=EV_MAXDEVICES;
+	e->journal=journal;
+	for (i=0; i<ndevices; i++) {
+		e->dev[i].slave=slaves[i];
+		for (ch=0; ch<EV_NCHANNELS; ch++) e->dev[i].value[ch]=watched[ch].bits ? 0 : EV_UNKNOWN;
+	}
+	e->ndevices=ndevices;
+}
+
+/*	Compare the channels just read (the classes in got[] for each device) with their last readings and log an event for each
+	change.  Returns the number of events, which are also in e->recent. */
+int ev_update(struct ev_engine *e, const struct ss_image *image, const unsigned int *got, time_t t)
+{
+	struct ev_device *d;
+	unsigned int v, changed;
+	int i, ch, b;
+
+	e->nrecent=0;
+	for (i=0; i<e->ndevices; i++) {
+		d=&e->dev[i];
+		for (ch=0; ch<EV_NCHANNELS; ch++) {
+			if (!(got[i] & (1 << ss_channels[watched[ch].channel].pollclass))) continue;
+			v=ss_raw(&image[i], watched[ch].channel);
+			if (v == d->value[ch]) continue;
+			if (watched[ch].bits) {
+				changed=v ^ d->value[ch];
+				while (changed != 0) {
+					b=__builtin_ctz(changed);
+					changed&=changed-1;
+					emit(e, d, ch, (v >> b) & 1 ? EV_RISE : EV_CLEAR, b, 0, t);
+				}
+			} else {
+				emit(e, d, ch, EV_STATE, v, d->value[ch], t);
+			}
+			d->value[ch]=v;
+		}
+	}
+	return e->nrecent;
+}
+
+/*	Read the index written by ev_saveindex.  Devices not set up by ev_init are added, so the whole history can be looked up.
+	Returns 0, or -1 if there is no index. */
+int ev_loadindex(struct ev_engine *e, const char *path)
+{
+	FILE *infile;
+	struct ev_device *d;
+	struct ev_key k;
+	char line[256], name[32];
+	unsigned int v[EV_NCHANNELS];
+	long first, last, cleared;
+	int slave, ch, key;
+
+	if ((infile = fopen(path, "r")) == NULL) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), infile) != NULL) {
+		if (sscanf(line, "%d last %u %u %u %u %u %u", &slave, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 7) {
+			if ((d = finddevice(e, slave)) != NULL) memcpy(d->value, v, sizeof(v));
+		} else if (sscanf(line, "%d %31s %d %ld %ld %ld %lu", &slave, name, &key, &first, &last, &cleared, &k.count) == 7) {
+			for (ch=0; ch<EV_NCHANNELS && strcmp(name, watched[ch].name) != 0; ch++);
+			if (ch == EV_NCHANNELS || key < 0 || key >= EV_MAXKEYS || (d = finddevice(e, slave)) == NULL) continue;
+			k.first=first;
+			k.last=last;
+			k.cleared=cleared;
+			d->key[ch][key]=k;
+		}
+	}
+	fclose(infile);
+
+	return 0;
+}
+
+/*	Write the index, one line for the last readings of each device and one for each bit or state it has ever had, renamed into
+	place.  Returns 0, or -1. */
+int ev_saveindex(struct ev_engine *e, const char *path)
+{
+	FILE *outfile;
+	const struct ev_device *d;
+	const struct ev_key *k;
+	char tmppath[136];
+	int i, ch, key;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return -1;
+	}
+	for (i=0; i<e->ndevices; i++) {
+		d=&e->dev[i];
+		fprintf(outfile,"%d last", d->slave);
+		for (ch=0; ch<EV_NCHANNELS; ch++) fprintf(outfile," %u", d->value[ch]);
+		fprintf(outfile,"\n");
+		for (ch=0; ch<EV_NCHANNELS; ch++) {
+			for (key=0; key<EV_MAXKEYS; key++) {
+				k=&d->key[ch][key];
+				if (k->count == 0 && k->cleared == 0) continue;
+				fprintf(outfile,"%d\t%s\t%d\t%ld\t%ld\t%ld\t%lu\t%s\n", d->slave, watched[ch].name, key, (long) k->first, (long) k->last,
+						(long) k->cleared, k->count, ev_keyname(ch, key));
+			}
+		}
+	}
+	if (fclose(outfile) != 0) {
+		remove(tmppath);
+		return -1;
+	}
+	if (rename(tmppath, path) == -1) return -1;
+	e->dirty=0;
+	return 0;
+}
+
+const char *ev_channelname(int ch)
+{
+	return watched[ch].name;
+}
+
+/* Name of a bit or state of a channel */
+const char *ev_keyname(int ch, int key)
+{
+	if (key < 0 || key >= watched[ch].nkeys) return "UNKNOWN";
+	return watched[ch].names[key];
+}
+
+int ev_nkeys(int ch)
+{
+	return watched[ch].nkeys;
+}
+
+/* Add an event to the log and the index */
+static void emit(struct ev_engine *e, struct ev_device *d, int ch, int type, int key, unsigned int old, time_t t)
+{
+	struct ev_event *ev;
+	struct ev_key *k;
+	struct tm *now;
+	char ts[32], filepath[64], logfile[64], row[160];
+
+	e->events++;
+	e->dirty=1;
+	if (e->nrecent < EV_RECENT) {
+		ev=&e->recent[e->nrecent++];
+		ev->slave=d->slave;
+		ev->channel=ch;
+		ev->type=type;
+		ev->key=key;
+		ev->old=old;
+		ev->t=t;
+	}
+
+	if (key < EV_MAXKEYS) {
+		k=&d->key[ch][key];
+		if (type == EV_CLEAR) {
+			k->cleared=t;
+		} else {
+			if (k->first == 0) k->first=t;
+			k->last=t;
+			k->count++;
+		}
+	}
+	if (type == EV_STATE && old < EV_MAXKEYS) d->key[ch][old].cleared=t;
+
+	if (e->journal == NULL) return;
+	now=localtime(&t);
+	strftime(ts, 32, "%m/%d/%Y\t%H:%M:%S", now);
+	sprintf(filepath,"%s/%%Y/%%Yeventlog.txt",LOGFILEPATH);
+	strftime(logfile, 64, filepath, now);
+	if (type == EV_STATE) {
+		snprintf(row, sizeof(row), "%s\t%d\t%s\t%s\t%s\t%s\n", ts, d->slave, watched[ch].name, types[type], ev_keyname(ch, key),
+				 (old == EV_UNKNOWN) ? "UNKNOWN" : ev_keyname(ch, old));
+	} else {
+		snprintf(row, sizeof(row), "%s\t%d\t%s\t%s\t%s\n", ts, d->slave, watched[ch].name, types[type], ev_keyname(ch, key));
+	}
+	if (jn_add(e->journal, logfile, row, t) == -1) {
+		fprintf(stderr, "Can't add a row for event log: %s\n", logfile);
+	}
+}
+
+/* The device with a MODBUS id, added if there is room */
+static struct ev_device *finddevice(struct ev_engine *e, int slave)
+{
+	int i, ch;
+
+	for (i=0; i<e->ndevices; i++) {
+		if (e->dev[i].slave == slave) return &e->dev[i];
+	}
+	if (e->ndevices >= EV_MAXDEVICES) return NULL;
+	memset(&e->dev[i], 0, sizeof(struct ev_device));
+	e->dev[i].slave=slave;
+	for (ch=0; ch<EV_NCHANNELS; ch++) e->dev[i].value[ch]=watched[ch].bits ? 0 : EV_UNKNOWN;
+	e->ndevices++;
+	return &e->dev[i];
+}
@@ -0,0 +1,89 @@
+/*
+ *  events.h - Alarm, fault and state change events of the SunSaver MPPTs, with an index of when each was first and last seen.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <time.h>
+
+#include "ssmppt.h"
+#include "journal.h"
+
+#define EV_MAXDEVICES	8
+#define EV_MAXKEYS		32										/* Bits or state values of one channel */
+#define EV_UNKNOWN		0xFFFFFFFF								/* A state not read yet */
+#define EV_RECENT		64										/* Events kept from the last update */
+
+/* Channels watched */
+
+enum {
+	EV_ALARM, EV_ARRAY_FAULT, EV_LOAD_FAULT, EV_CHARGE_STATE, EV_LOAD_STATE, EV_LED_STATE, EV_NCHANNELS
+};
+
+/* Event types */
+
+#define EV_RISE			0										/* A bit was set */
+#define EV_CLEAR		1										/* A bit was cleared */
+#define EV_STATE		2										/* A state changed */
+
+/* When one bit or state value was first and last seen */
+
+struct ev_key {
+	time_t first;												/* First set or entered, 0 if never */
+	time_t last;												/* Last set or entered */
+	time_t cleared;												/* Last cleared or left */
+	unsigned long count;										/* Times set or entered */
+};
+
+struct ev_device {
+	int slave;
+	unsigned int value[EV_NCHANNELS];							/* As last read */
+	struct ev_key key[EV_NCHANNELS][EV_MAXKEYS];
+};
+
+struct ev_event {
+	int slave;
+	int channel;
+	int type;
+	int key;													/* Bit number, or the new state */
+	unsigned int old;											/* The state left, for EV_STATE */
+	time_t t;
+};
+
+struct ev_engine {
+	int ndevices;
+	struct ev_device dev[EV_MAXDEVICES];
+	struct jn_journal *journal;									/* The event log rows go through the daemon's journal */
+	struct ev_event recent[EV_RECENT];							/* The events of the last update */
+	int nrecent;
+	int dirty;													/* The index needs writing */
+	unsigned long events;
+};
+
+void ev_init(struct ev_engine *e, const int *slaves, int ndevices, struct jn_journal *journal);
+int ev_update(struct ev_engine *e, const struct ss_image *image, const unsigned int *got, time_t t);
+int ev_loadindex(struct ev_engine *e, const char *path);
+int ev_saveindex(struct ev_engine *e, const char *path);
+const char *ev_channelname(int ch);
+const char *ev_keyname(int ch, int key);
+int ev_nkeys(int ch);
+
+#endif
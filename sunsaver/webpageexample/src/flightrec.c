@@ -0,0 +1,265 @@
+/*
+ *  flightrec.c - Flight recorder of full rate samples around faults and other events, for the acquisition daemon.
+ *
+ *	The log file has a row every few minutes at best, so a fault shows up with nothing of what led to it.  The recorder keeps the
+ *	RAM registers of every fast sample from the last FLIGHTPRE seconds in memory.  A trigger is a new array_fault, load_fault or
+ *	alarm bit, a change of charge_state, or a Sweep_Pmax or Sweep_Vmp that moves more than FLIGHTSWEEP percent.  On a trigger
+ *	the daemon samples every FLIGHTBURST milliseconds for FLIGHTPOST seconds, and then the whole window is added to the day's
+ *	events file (LOGFILEPATH/YYYY/YYYYMMDDevents.txt) through the daemon's journal, which is committed at the end of the record
+ *	so a power loss can't leave it half written.  Records are compact: each line is a sample, as milliseconds
+ *	from the trigger and the MODBUS id, followed by the raw value of only the channels that changed since that device's last line.
+ *	Triggers during a record are noted in it, and those within FLIGHTHOLDOFF seconds after it are counted but don't start another.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "powersystem.h"
+#include "flightrec.h"
+#include "journal.h"
+
+/* Channels that trigger a record */
+
+static const int bitchannels[] = { SS_ARRAY_FAULT, SS_LOAD_FAULT, SS_ALARM };		/* On a new bit */
+static const int sweepchannels[] = { SS_SWEEP_PMAX, SS_SWEEP_VMP };					/* On a move of more than FLIGHTSWEEP percent */
+
+static int check(struct fr_recorder *fr, const struct ss_image *im, int i, unsigned int gotmask, char *cause);
+static void trigger(struct fr_recorder *fr, const char *cause, long now, time_t t);
+static void writerecord(struct fr_recorder *fr);
+static void addrow(struct fr_recorder *fr, const char *eventfile, const char *row);
+
+/*	Allocate the ring for FLIGHTPRE seconds before a trigger and FLIGHTPOST after it at FLIGHTBURST.  Records are committed
+	through journal.  Returns 0, or -1. */
+int fr_init(struct fr_recorder *fr, const int *slaves, int ndevices, struct jn_journal *journal)
+{
+	int i;
+
+	memset(fr, 0, sizeof(struct fr_recorder));
+	fr->journal=journal;
+	if (ndevices > FR_MAXDEVICES) ndevices=FR_MAXDEVICES;
+	fr->ndevices=ndevices;
+	for (i=0; i<ndevices; i++) fr->slave[i]=slaves[i];
+	fr->size=(FLIGHTPRE+FLIGHTPOST)*1000L/FLIGHTBURST+1;
+	fr->when=malloc(fr->size*sizeof(long));
+	fr->got=malloc(fr->size*sizeof(unsigned int));
+	fr->ram=malloc(fr->size*ndevices*SS_RAMREGS*sizeof(uint16_t));
+	if (fr->when == NULL || fr->got == NULL || fr->ram == NULL) {
+		fr_free(fr);
+		return -1;
+	}
+	fr->state=FR_IDLE;
+	fr->lastevent=-1;
+	return 0;
+}
+
+/*	Call after every cycle with the classes read from each device (got).  Adds a fast sample to the ring, checks the triggers
+	and writes the record once its window is over.  Returns 1 while recording, when the daemon should poll at FLIGHTBURST. */
+int fr_sample(struct fr_recorder *fr, const struct ss_image *image, const unsigned int *got, long now, time_t t)
+{
+	char cause[FR_CAUSESIZE];
+	unsigned int mask;
+	int i, oldest;
+
+	if (fr->size == 0) return 0;
+
+	/* The sample goes in first, so a record starts with the registers that triggered it */
+	mask=0;
+	for (i=0; i<fr->ndevices; i++) {
+		if (got[i] & (1 << SS_FAST)) mask|=1 << i;
+	}
+	if (mask != 0) {
+		fr->when[fr->head]=now;
+		fr->got[fr->head]=mask;
+		for (i=0; i<fr->ndevices; i++) {
+			memcpy(fr->ram+(fr->head*fr->ndevices+i)*SS_RAMREGS, image[i].ram, SS_RAMREGS*sizeof(uint16_t));
+		}
+		fr->head=(fr->head+1)%fr->size;
+		if (fr->count < fr->size) fr->count++;
+	}
+
+	for (i=0; i<fr->ndevices; i++) {
+		if (check(fr, &image[i], i, got[i], cause)) trigger(fr, cause, now, t);
+		fr->seen[i]|=got[i];
+	}
+
+	if (fr->state == FR_RECORDING) {
+		/* Write it when the window is over, or before the ring would lose the trigger */
+		oldest=(fr->head-fr->count+fr->size)%fr->size;
+		if (now >= fr->end || (fr->count == fr->size && fr->when[oldest] >= fr->trigger)) writerecord(fr);
+	}
+
+	return fr->state == FR_RECORDING;
+}
+
+/* Write the record being made, e.g. when the daemon stops */
+void fr_finish(struct fr_recorder *fr)
+{
+	if (fr->state == FR_RECORDING) writerecord(fr);
+}
+
+void fr_free(struct fr_recorder *fr)
+{
+	free(fr->when);
+	free(fr->got);
+	free(fr->ram);
+	fr->when=NULL;
+	fr->got=NULL;
+	fr->ram=NULL;
+	fr->size=0;
+}
+
+/* Compare a device's trigger channels with the last read.  Returns 1 and describes the first one that fired in cause. */
+static int check(struct fr_recorder *fr, const struct ss_image *im, int i, unsigned int gotmask, char *cause)
+{
+	const struct ss_channel *ch;
+	unsigned int v, old;
+	int k, c, fired;
+
+	fired=0;
+	for (k=0; k<sizeof(bitchannels)/sizeof(bitchannels[0]); k++) {
+		c=bitchannels[k];
+		if (!(gotmask & (1 << ss_channels[c].pollclass))) continue;
+		v=ss_raw(im, c);
+		old=fr->last[i][c];
+		fr->last[i][c]=v;
+		if (!fired && (fr->seen[i] & (1 << ss_channels[c].pollclass)) && (v & ~old) != 0) {
+			snprintf(cause, FR_CAUSESIZE, "id %d %s 0x%04X -> 0x%04X", fr->slave[i], ss_channels[c].name, old, v);
+			fired=1;
+		}
+	}
+
+	c=SS_CHARGE_STATE;
+	if (gotmask & (1 << ss_channels[c].pollclass)) {
+		v=ss_raw(im, c);
+		old=fr->last[i][c];
+		fr->last[i][c]=v;
+		if (!fired && (fr->seen[i] & (1 << ss_channels[c].pollclass)) && v != old) {
+			snprintf(cause, FR_CAUSESIZE, "id %d charge_state %s -> %s", fr->slave[i],
+					 old <= SS_CS_EQUALIZE ? ss_charge_states[old] : "UNKNOWN", v <= SS_CS_EQUALIZE ? ss_charge_states[v] : "UNKNOWN");
+			fired=1;
+		}
+	}
+
+	for (k=0; k<sizeof(sweepchannels)/sizeof(sweepchannels[0]); k++) {
+		c=sweepchannels[k];
+		ch=&ss_channels[c];
+		if (!(gotmask & (1 << ch->pollclass))) continue;
+		v=ss_raw(im, c);
+		old=fr->last[i][c];
+		fr->last[i][c]=v;
+		if (!fired && (fr->seen[i] & (1 << ch->pollclass)) && v != old && abs((int) v-(int) old)*100 > (int) old*FLIGHTSWEEP) {
+			snprintf(cause, FR_CAUSESIZE, "id %d %s %.1f -> %.1f %s", fr->slave[i], ch->name, old*ch->scale, v*ch->scale, ch->units);
+			fired=1;
+		}
+	}
+
+	return fired;
+}
+
+static void trigger(struct fr_recorder *fr, const char *cause, long now, time_t t)
+{
+	fr->triggers++;
+	if (fr->state == FR_IDLE) {
+		if (fr->lastevent >= 0 && now-fr->lastevent < FLIGHTHOLDOFF*1000L) {
+			fr->suppressed++;
+			return;
+		}
+		fr->state=FR_RECORDING;
+		fr->trigger=now;
+		fr->triggertime=t;
+		fr->end=now+FLIGHTPOST*1000L;
+		fr->lastevent=now;
+		fr->nnotes=0;
+	}
+	if (fr->nnotes < FR_MAXNOTES) {
+		fr->note[fr->nnotes].when=now;
+		strcpy(fr->note[fr->nnotes].cause, cause);
+		fr->nnotes++;
+	}
+}
+
+/* Add the samples from FLIGHTPRE seconds before the trigger to now to the day's events file, and commit them */
+static void writerecord(struct fr_recorder *fr)
+{
+	struct ss_image im;
+	struct tm *then;
+	char filepath[64], eventfile[64], ts[32], row[FR_ROWSIZE];
+	unsigned int prev[FR_MAXDEVICES][SS_NCHANNELS], v;
+	int haveprev[FR_MAXDEVICES];
+	int i, j, k, c, n, note, written;
+	long start;
+
+	fr->state=FR_IDLE;
+	fr->records++;
+	if (fr->journal == NULL) return;
+
+	then=localtime(&fr->triggertime);
+	sprintf(filepath,"%s/%%Y/%%Y%%m%%devents.txt",LOGFILEPATH);
+	strftime(eventfile, 64, filepath, then);
+
+	strftime(ts, 32, "%m/%d/%Y\t%H:%M:%S", then);
+	snprintf(row, sizeof(row), "# %s\t%s\n", ts, fr->note[0].cause);
+	addrow(fr, eventfile, row);
+
+	memset(haveprev, 0, sizeof(haveprev));
+	start=fr->trigger-FLIGHTPRE*1000L;
+	note=1;
+	written=0;
+	for (j=0; j<fr->count; j++) {
+		k=(fr->head-fr->count+j+fr->size)%fr->size;
+		if (fr->when[k] < start) continue;
+		for (; note < fr->nnotes && fr->note[note].when <= fr->when[k]; note++) {
+			snprintf(row, sizeof(row), "# %+ld\t%s\n", fr->note[note].when-fr->trigger, fr->note[note].cause);
+			addrow(fr, eventfile, row);
+		}
+		for (i=0; i<fr->ndevices; i++) {
+			if (!(fr->got[k] & (1 << i))) continue;
+			memcpy(im.ram, fr->ram+(k*fr->ndevices+i)*SS_RAMREGS, SS_RAMREGS*sizeof(uint16_t));
+			n=snprintf(row, sizeof(row), "%+ld\t%d", fr->when[k]-fr->trigger, fr->slave[i]);
+			for (c=0; c<SS_NCHANNELS; c++) {
+				v=ss_raw(&im, c);
+				if (haveprev[i] && v == prev[i][c]) continue;
+				n+=snprintf(row+n, sizeof(row)-n, "\t%s=%u", ss_channels[c].name, v);
+				prev[i][c]=v;
+			}
+			snprintf(row+n, sizeof(row)-n, "\n");
+			addrow(fr, eventfile, row);
+			haveprev[i]=1;
+			written++;
+		}
+	}
+	addrow(fr, eventfile, "\n");
+	fr->samples+=written;
+
+	/* A record is written after a fault, when the host may be about to lose power */
+	jn_flush(fr->journal);
+}
+
+/* Add one line of a record to the journal */
+static void addrow(struct fr_recorder *fr, const char *eventfile, const char *row)
+{
+	if (jn_add(fr->journal, eventfile, row, time(NULL)) == -1) {
+		fprintf(stderr, "Can't add a flight record row for %s\n", eventfile);
+		return;
+	}
+	fr->bytes+=strlen(row);
+}
@@ -0,0 +1,77 @@
+/*
+ *  flightrec.h - Flight recorder of full rate samples around faults and other events, for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "ssmppt.h"
+#include "journal.h"
+
+#define FR_MAXDEVICES	8
+#define FR_MAXNOTES		16										/* Triggers noted in one record */
+#define FR_CAUSESIZE	48
+#define FR_ROWSIZE		2048									/* A sample with every channel, well under a journal block */
+
+/* Recorder states */
+
+#define FR_IDLE			0										/* Keeping the last FLIGHTPRE seconds */
+#define FR_RECORDING	1										/* Triggered - polling at FLIGHTBURST until FLIGHTPOST seconds have passed */
+
+struct fr_note {
+	long when;													/* Monotonic milliseconds */
+	char cause[FR_CAUSESIZE];
+};
+
+struct fr_recorder {
+	struct jn_journal *journal;									/* The records go through the daemon's journal */
+	int ndevices;
+	int slave[FR_MAXDEVICES];
+	int size;													/* Samples the ring holds */
+	int head;													/* Next sample to write */
+	int count;
+	long *when;													/* Monotonic milliseconds of each sample */
+	unsigned int *got;											/* Devices read in each sample, one bit each */
+	uint16_t *ram;												/* RAM registers of every device for each sample */
+	unsigned int seen[FR_MAXDEVICES];							/* Classes read at least once from each device */
+	unsigned int last[FR_MAXDEVICES][SS_NCHANNELS];				/* Trigger channels when last read */
+	int state;
+	long trigger;												/* When the record was triggered */
+	time_t triggertime;
+	long end;													/* When the post trigger window ends */
+	long lastevent;												/* When the last record was triggered, for FLIGHTHOLDOFF */
+	int nnotes;
+	struct fr_note note[FR_MAXNOTES];
+	unsigned long triggers;
+	unsigned long records;
+	unsigned long suppressed;									/* Triggers in the FLIGHTHOLDOFF after a record */
+	unsigned long samples;										/* Samples written to records */
+	unsigned long bytes;										/* Bytes of records written */
+};
+
+int fr_init(struct fr_recorder *fr, const int *slaves, int ndevices, struct jn_journal *journal);
+int fr_sample(struct fr_recorder *fr, const struct ss_image *image, const unsigned int *got, long now, time_t t);
+void fr_finish(struct fr_recorder *fr);
+void fr_free(struct fr_recorder *fr);
+
+#endif
@@ -0,0 +1,457 @@
+/*
+ *  journal.c - Group commit journal for log file rows, so the SD card sees a few large aligned writes instead of many small ones.
+ *
+ *	Rows wait in memory until JOURNALSIZE bytes have built up, JOURNALFLUSH seconds have passed, or the daemon asks for a commit
+ *	(e.g. on a low voltage disconnect).  A commit packs the waiting rows into whole JN_BLOCKSIZE blocks, writes them at block
+ *	aligned offsets of a fixed size ring file, and waits for them to reach the card.  Only then are the rows appended to their log
+ *	files, one append per file.  Each block carries a sequence number and a CRC, and each row in it the offset in its log file it
+ *	is appended at.  The rows of an append that fails (the year's directory isn't there yet, say) keep waiting and go in the next
+ *	commit at the same offsets, so a later append to that file can't take their place.  After a power loss jn_open() finds the
+ *	blocks that made it, cuts off a row torn at the end of a log file, and appends each row the file doesn't reach yet.  Rows are
+ *	matched by position rather than by their time stamps, so rows with the same stamp, or stamps that go back an hour in the
+ *	autumn, are all put back, and a file is only cut back or passed over where it holds the journaled row's own bytes.  At most
+ *	the rows still in memory are lost.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "journal.h"
+
+#define JN_MAGIC		0x4A4E4C32								/* "JNL2" - rows with offsets */
+#define JN_HEADER		16
+#define JN_PAYLOAD		(JN_BLOCKSIZE-JN_HEADER)
+#define JN_MAXBLOCKS	(2*JN_BUFSIZE/JN_PAYLOAD+1)				/* Most blocks one commit can take, allowing for the space left at the end of each */
+#define JN_OFFSETLEN	16										/* Hex digits of the log file offset after the path of each row */
+#define JN_MAXTAILS		8
+
+struct jn_tail {												/* Size of a log file, while committing or recovering */
+	const char *path;
+	int plen;
+	off_t size;
+};
+
+static uint32_t crc32(const unsigned char *p, int n);
+static uint32_t get32(const unsigned char *p);
+static void put32(unsigned char *p, uint32_t v);
+static off_t logsize(const char *path, int fixtail);
+static int logholds(const char *path, off_t offset, const char *row, int len);
+static int recover(struct jn_journal *j, unsigned char *block);
+static int writelog(const char *path, const char *rows, int len, int sync);
+
+/* Open (or create) the journal ring and put back any rows that didn't make it to the log files.  Returns -1 on error. */
+int jn_open(struct jn_journal *j, const char *path, int nblocks, int flushsize)
+{
+	unsigned char *block;
+
+	memset(j, 0, sizeof(struct jn_journal));
+	if (nblocks < 2*JN_MAXBLOCKS) nblocks=2*JN_MAXBLOCKS;		/* Room for two full commits, so a torn commit never overwrites the last good one */
+	if (flushsize > JN_BUFSIZE) flushsize=JN_BUFSIZE;
+	j->nblocks=nblocks;
+	j->flushsize=flushsize;
+
+	if ((j->buf=malloc(JN_BUFSIZE)) == NULL) {
+		return -1;
+	}
+	if (posix_memalign((void **) &block, JN_BLOCKSIZE, JN_MAXBLOCKS*JN_BLOCKSIZE) != 0) {
+		free(j->buf);
+		return -1;
+	}
+	if ((j->fd=open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+		free(j->buf);
+		free(block);
+		return -1;
+	}
+
+	/* Allocate the whole ring up front, so a commit never changes the file size and the sync only has the data to write */
+	if (lseek(j->fd, 0, SEEK_END) < (off_t) nblocks*JN_BLOCKSIZE) {
+		posix_fallocate(j->fd, 0, (off_t) nblocks*JN_BLOCKSIZE);
+	}
+
+	recover(j, block);
+	free(block);
+	return 0;
+}
+
+/*	Add a row (ending in a newline) for a log file.  Commits first if the row would take the waiting rows past the flush size.  The
+	row waits as "path<tab>offset<tab>line", with the offset filled in when it is committed. */
+int jn_add(struct jn_journal *j, const char *path, const char *line, time_t t)
+{
+	int plen, llen, len;
+
+	plen=strlen(path);
+	llen=strlen(line);
+	len=plen+1+JN_OFFSETLEN+1+llen;
+	if (plen >= JN_MAXPATH || len > JN_PAYLOAD) {
+		return -1;
+	}
+	if (j->buflen+len > j->flushsize) {
+		jn_flush(j);
+	}
+	if (j->buflen+len > JN_BUFSIZE) {
+		return -1;												/* Commits are failing and memory is full */
+	}
+
+	if (j->nrows == 0) j->oldest=t;
+	memcpy(j->buf+j->buflen, path, plen);
+	j->buf[j->buflen+plen]='\t';
+	memset(j->buf+j->buflen+plen+1, '0', JN_OFFSETLEN);
+	j->buf[j->buflen+plen+1+JN_OFFSETLEN]='\t';
+	memcpy(j->buf+j->buflen+plen+1+JN_OFFSETLEN+1, line, llen);
+	j->buflen+=len;
+	j->nrows++;
+	j->rows++;
+
+	return 0;
+}
+
+/* Commit the waiting rows to the journal, then append them to the log files.  Returns -1 if the journal couldn't be written. */
+int jn_flush(struct jn_journal *j)
+{
+	struct jn_tail *files;
+	unsigned char *block, *b;
+	char *p, *end, *eol, *tab, *run, *rows, offset[JN_OFFSETLEN+1], path[JN_MAXPATH];
+	int nb, len, plen, first, n, nfiles, nrun, kept, nkept, ok;
+
+	if (j->buflen == 0) {
+		return 0;
+	}
+	files=calloc(j->nrows, sizeof(struct jn_tail));
+	rows=malloc(JN_BUFSIZE);
+	if (files == NULL || rows == NULL || posix_memalign((void **) &block, JN_BLOCKSIZE, JN_MAXBLOCKS*JN_BLOCKSIZE) != 0) {
+		free(files);
+		free(rows);
+		return -1;
+	}
+	end=j->buf+j->buflen;
+
+	/* The offset each row will be appended at: the size of its log file now, plus the rows for it before this one */
+	nfiles=0;
+	for (p=j->buf; p < end; p=eol) {
+		tab=memchr(p, '\t', end-p);
+		eol=memchr(tab, '\n', end-tab)+1;
+		plen=tab-p;
+		for (n=0; n<nfiles && (files[n].plen != plen || memcmp(files[n].path, p, plen) != 0); n++);
+		if (n == nfiles) {
+			*tab='\0';
+			files[n].path=p;
+			files[n].plen=plen;
+			files[n].size=logsize(p, 0);
+			*tab='\t';
+			nfiles++;
+		}
+		snprintf(offset, sizeof(offset), "%016llx", (unsigned long long) files[n].size);
+		memcpy(tab+1, offset, JN_OFFSETLEN);
+		files[n].size+=eol-tab-1-JN_OFFSETLEN-1;
+	}
+	free(files);
+
+	/* Pack whole rows into blocks */
+	nb=0;
+	len=0;
+	p=j->buf;
+	memset(block, 0, JN_BLOCKSIZE);
+	while (p < end) {
+		eol=memchr(p, '\n', end-p)+1;
+		if (len+(eol-p) > JN_PAYLOAD) {
+			b=block+nb*JN_BLOCKSIZE;
+			put32(b+8, len);
+			nb++;
+			len=0;
+			memset(block+nb*JN_BLOCKSIZE, 0, JN_BLOCKSIZE);
+		}
+		memcpy(block+nb*JN_BLOCKSIZE+JN_HEADER+len, p, eol-p);
+		len+=eol-p;
+		p=eol;
+	}
+	put32(block+nb*JN_BLOCKSIZE+8, len);
+	nb++;
+	for (n=0; n<nb; n++) {
+		b=block+n*JN_BLOCKSIZE;
+		put32(b, JN_MAGIC);
+		put32(b+4, j->seq+n);
+		put32(b+12, crc32(b+4, JN_BLOCKSIZE-4));				/* CRC over the header with its CRC field zeroed, and the payload */
+	}
+
+	/* At most two writes - up to the end of the ring, and the rest from the start */
+	ok=1;
+	first=j->seq%j->nblocks;
+	n=nb < j->nblocks-first ? nb : j->nblocks-first;
+	if (pwrite(j->fd, block, n*JN_BLOCKSIZE, (off_t) first*JN_BLOCKSIZE) != n*JN_BLOCKSIZE) ok=0;
+	if (ok && n < nb && pwrite(j->fd, block+n*JN_BLOCKSIZE, (nb-n)*JN_BLOCKSIZE, 0) != (nb-n)*JN_BLOCKSIZE) ok=0;
+	if (ok && fdatasync(j->fd) == -1) ok=0;
+	free(block);
+	if (!ok) {
+		fprintf(stderr, "Journal write failed: %s\n", strerror(errno));
+	}
+	j->seq+=nb;
+	j->blocks+=nb;
+	j->flushes++;
+	j->payload+=j->buflen;
+
+	/* Append the rows to their log files, one append per run of rows for the same file.  Even if the journal failed, the rows are
+	   better off in the log files than lost.  A run that can't be appended stays at the front of the buffer for the next commit,
+	   up to half the flush size, so the offsets this commit gave it are never handed to other rows. */
+	kept=0;
+	nkept=0;
+	p=j->buf;
+	while (p < end) {
+		tab=memchr(p, '\t', end-p);
+		plen=tab-p;
+		len=0;
+		nrun=0;
+		run=tab+1;
+		for (;;) {
+			eol=memchr(run, '\n', end-run)+1;
+			memcpy(rows+len, run+JN_OFFSETLEN+1, eol-run-JN_OFFSETLEN-1);	/* The rows of the run, without their paths and offsets */
+			len+=eol-run-JN_OFFSETLEN-1;
+			nrun++;
+			if (end-eol <= plen || memcmp(eol, p, plen) != 0 || eol[plen] != '\t') break;
+			run=eol+plen+1;
+		}
+		memcpy(path, p, plen);
+		path[plen]='\0';
+		if (writelog(path, rows, len, 0) == 0) {
+			j->appends++;
+			j->logbytes+=len;
+		} else if (kept+(eol-p) <= j->flushsize/2) {
+			memmove(j->buf+kept, p, eol-p);
+			kept+=eol-p;
+			nkept+=nrun;
+		} else {
+			fprintf(stderr, "Gave up on %d rows for log file: %s\n", nrun, path);
+			j->dropped+=nrun;
+		}
+		p=eol;
+	}
+	free(rows);
+
+	j->buflen=kept;
+	j->nrows=nkept;
+	if (nkept > 0) j->oldest=time(NULL);						/* Try them again after JOURNALFLUSH, not on every pass */
+	return ok ? 0 : -1;
+}
+
+/* Commit anything left and close the journal */
+void jn_close(struct jn_journal *j)
+{
+	jn_flush(j);
+	close(j->fd);
+	free(j->buf);
+}
+
+/*	Find the blocks that made it to the card, oldest first, and append any of their rows that the log files are missing: a row is
+	there if its file holds its bytes at its offset.  A row torn at the end of a file is cut off and written again.  A row whose
+	place holds something else was never appended - its append failed and it was given up on - so the file is left alone. */
+static int recover(struct jn_journal *j, unsigned char *block)
+{
+	struct jn_tail *tails;
+	uint32_t *seqs, crc, best;
+	unsigned long long offset;
+	int *valid, i, k, n, ntails, len, rlen, pick;
+	char *p, *end, *eol, *tab, *row;
+
+	seqs=calloc(j->nblocks, sizeof(uint32_t));
+	valid=calloc(j->nblocks, sizeof(int));
+	tails=calloc(JN_MAXTAILS, sizeof(struct jn_tail));
+	if (seqs == NULL || valid == NULL || tails == NULL) {
+		free(seqs);
+		free(valid);
+		free(tails);
+		return -1;
+	}
+
+	n=0;
+	for (i=0; i<j->nblocks; i++) {
+		if (pread(j->fd, block, JN_BLOCKSIZE, (off_t) i*JN_BLOCKSIZE) != JN_BLOCKSIZE) break;
+		if (get32(block) != JN_MAGIC || get32(block+8) > JN_PAYLOAD) continue;
+		crc=get32(block+12);
+		put32(block+12, 0);
+		if (crc32(block+4, JN_BLOCKSIZE-4) != crc) continue;
+		seqs[i]=get32(block+4);
+		valid[i]=1;
+		n++;
+		if (seqs[i]+1 > j->seq) j->seq=seqs[i]+1;
+	}
+
+	/* Replay in sequence order */
+	ntails=0;
+	for (k=0; k<n; k++) {
+		pick=-1;
+		best=0;
+		for (i=0; i<j->nblocks; i++) {
+			if (valid[i] && (pick < 0 || seqs[i] < best)) {
+				pick=i;
+				best=seqs[i];
+			}
+		}
+		valid[pick]=0;
+		pread(j->fd, block, JN_BLOCKSIZE, (off_t) pick*JN_BLOCKSIZE);
+		len=get32(block+8);
+		p=(char *) block+JN_HEADER;
+		end=p+len;
+		while (p < end) {
+			if ((tab=memchr(p, '\t', end-p)) == NULL || (eol=memchr(tab, '\n', end-tab)) == NULL || tab-p >= JN_MAXPATH ||
+				eol-tab <= JN_OFFSETLEN+1 || tab[JN_OFFSETLEN+1] != '\t' || sscanf(tab+1, "%16llx", &offset) != 1) break;
+			eol++;
+			*tab='\0';
+			row=tab+1+JN_OFFSETLEN+1;
+
+			/* The paths point into the block, which is read over, so the tails keep their own copies */
+			for (i=0; i<ntails && strcmp(tails[i].path, p) != 0; i++);
+			if (i == ntails) {
+				if (ntails == JN_MAXTAILS) {
+					free((char *) tails[0].path);
+					memmove(&tails[0], &tails[1], (JN_MAXTAILS-1)*sizeof(struct jn_tail));
+					i=--ntails;
+				}
+				if ((tails[i].path = strdup(p)) == NULL) break;
+				tails[i].size=logsize(p, 1);
+				ntails++;
+			}
+			rlen=eol-row;
+			if (tails[i].size >= (off_t) offset+rlen) {
+				if (!logholds(p, offset, row, rlen)) j->misplaced++;	/* Already there, or never was */
+			} else if (tails[i].size > (off_t) offset) {
+				/* Torn part way through this row, if what is there is the start of it */
+				if (!logholds(p, offset, row, tails[i].size-offset)) {
+					j->misplaced++;
+				} else if (truncate(p, offset) == 0) {
+					tails[i].size=offset;
+					if (writelog(p, row, rlen, 1) == 0) {
+						j->replayed++;
+						tails[i].size+=rlen;
+					}
+				}
+			} else if (writelog(p, row, rlen, 1) == 0) {
+				j->replayed++;
+				tails[i].size+=rlen;
+			}
+			p=eol;
+		}
+	}
+
+	for (i=0; i<ntails; i++) free((char *) tails[i].path);
+	free(seqs);
+	free(valid);
+	free(tails);
+	return 0;
+}
+
+/* Append rows to a log file.  Replayed rows are synced, since the journal block that holds them may be overwritten next. */
+static int writelog(const char *path, const char *rows, int len, int sync)
+{
+	FILE *outfile;
+	int ok;
+
+	if ((outfile = fopen(path, "a")) == NULL) {
+		fprintf(stderr, "Can't create log file: %s\n", path);
+		return -1;
+	}
+	ok=fwrite(rows, 1, len, outfile) == len;
+	if (sync) {
+		fflush(outfile);
+		fsync(fileno(outfile));
+	}
+	fclose(outfile);
+	return ok ? 0 : -1;
+}
+
+/* True if the log file holds the first len bytes of row at offset */
+static int logholds(const char *path, off_t offset, const char *row, int len)
+{
+	char buf[JN_PAYLOAD];
+	int fd, n;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		return 0;
+	}
+	n=pread(fd, buf, len, offset);
+	close(fd);
+	return n == len && memcmp(buf, row, len) == 0;
+}
+
+/*	Size of a log file, 0 if there isn't one yet.  With fixtail, a last row without its newline, torn by a power loss, is cut off
+	first, so the rows appended after it start on a line of their own (the journal has the row again if it committed it). */
+static off_t logsize(const char *path, int fixtail)
+{
+	char buf[512];
+	off_t size, pos;
+	int fd, n;
+
+	if ((fd = open(path, fixtail ? O_RDWR : O_RDONLY)) == -1) {
+		return 0;
+	}
+	size=lseek(fd, 0, SEEK_END);
+	if (fixtail && size > 0) {
+		pos=size;
+		while (pos > 0) {
+			n=(pos < (off_t) sizeof(buf)) ? pos : (off_t) sizeof(buf);
+			if (pread(fd, buf, n, pos-n) != n) {
+				pos=size;
+				break;
+			}
+			if (pos == size && buf[n-1] == '\n') break;		/* Ends in a whole row */
+			while (n > 0 && buf[n-1] != '\n') {
+				n--;
+				pos--;
+			}
+			if (n > 0) break;									/* Just after the last newline */
+		}
+		if (pos < size && ftruncate(fd, pos) == 0) size=pos;
+	}
+	close(fd);
+	return size;
+}
+
+static uint32_t crc32(const unsigned char *p, int n)
+{
+	static uint32_t table[256];
+	uint32_t c;
+	int i, k;
+
+	if (table[1] == 0) {
+		for (i=0; i<256; i++) {
+			c=i;
+			for (k=0; k<8; k++) c=(c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i]=c;
+		}
+	}
+	c=0xFFFFFFFF;
+	while (n-- > 0) c=table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+	return c ^ 0xFFFFFFFF;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0]=v;
+	p[1]=v >> 8;
+	p[2]=v >> 16;
+	p[3]=v >> 24;
+}
@@ -0,0 +1,57 @@
+/*
+ *  journal.h - Group commit journal for log file rows, so the SD card sees a few large aligned writes instead of many small ones.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define JN_BLOCKSIZE	4096									/* Journal block size - one flash page */
+#define JN_BUFSIZE		65536									/* Largest amount of rows that can wait in memory */
+#define JN_MAXPATH		128
+
+struct jn_journal {
+	int fd;
+	int nblocks;												/* Number of blocks in the journal ring */
+	uint32_t seq;												/* Sequence number of the next block to be written */
+	int flushsize;												/* Commit when this many bytes are waiting */
+	char *buf;													/* Rows waiting to be committed, each "path\tline\n" */
+	int buflen;
+	int nrows;
+	time_t oldest;												/* When the oldest waiting row was added */
+	unsigned long rows;											/* Rows added */
+	unsigned long flushes;										/* Group commits */
+	unsigned long blocks;										/* Journal blocks written */
+	unsigned long appends;										/* Log file appends (one per file per commit) */
+	unsigned long payload;										/* Bytes of rows committed */
+	unsigned long logbytes;										/* Bytes appended to the log files */
+	unsigned long replayed;										/* Rows put back into the log files after a power loss */
+	unsigned long misplaced;									/* Journaled rows whose place in the log file holds other rows */
+	unsigned long dropped;										/* Rows given up on when their log file couldn't be appended to */
+};
+
+int jn_open(struct jn_journal *j, const char *path, int nblocks, int flushsize);
+int jn_add(struct jn_journal *j, const char *path, const char *line, time_t t);
+int jn_flush(struct jn_journal *j);
+void jn_close(struct jn_journal *j);
+
+#endif
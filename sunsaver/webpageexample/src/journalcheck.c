@@ -0,0 +1,266 @@
+/*
+ *  journalcheck.c - This program checks that the journal puts back the log rows a power loss cut off.
+ *
+ *	Usage: journalcheck [directory]
+ *
+ *	It commits rows to two log files in a scratch directory (by default under /tmp), the way powersystemd does: several rows
+ *	with the same time stamp, as events and energy rows of several devices have, and a time stamp that goes back, as after the
+ *	autumn clock change.  Then it cuts the log files back as a power loss would: one to before the commit with half a row left
+ *	at the end, the other to before the commit.  It opens the journal again and checks that the files are whole again, with
+ *	every row once, and that opening it once more adds nothing.  Then it commits rows to a log file whose directory isn't there
+ *	yet, makes the directory, commits more and opens the journal again, as when the daemon starts logging a new year: the rows
+ *	that couldn't be appended at first must come before the later ones and nothing may be cut off or written twice.  Prints OK
+ *	or what went wrong, and returns 0 if it passed.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Compile with: cc journalcheck.c journal.c -o journalcheck */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+#define CHECKBLOCKS		64
+
+static const char *before[] = {
+	"10/30/2016\t01:58:00\t12.51\t0.00\n",
+	"10/30/2016\t01:59:00\t12.50\t0.00\n"
+};
+static const char *rows[] = {
+	"10/30/2016\t01:59:30\t1\tRISE\talarm\tRTS open\n",				/* Three events in one read */
+	"10/30/2016\t01:59:30\t1\tRISE\talarm\tHeatsink temp sensor open\n",
+	"10/30/2016\t01:59:30\t1\tSTATE\tcharge_state\tNIGHT\n",
+	"10/30/2016\t01:00:10\t1\tSTATE\tled_state\tLED_OFF\n"				/* The clocks went back */
+};
+static const char *newyear[] = {
+	"01/01/2017\t00:00:00\t12.40\t0.00\n",							/* Committed before the directory is there */
+	"01/01/2017\t00:00:00\t12.40\t0.00\n",
+	"01/01/2017\t00:01:00\t12.39\t0.00\n",							/* After it is made */
+	"01/01/2017\t00:02:00\t12.39\t0.00\n"
+};
+static const char *energy[] = {
+	"10/30/2016\t01:55\t1\t0.4\t5.1\t0.2\t2.4\n",						/* One energy row a device */
+	"10/30/2016\t01:55\t2\t0.6\t7.3\t0.0\t0.0\n",
+	"10/30/2016\t01:55\t3\t1.1\t13.9\t0.0\t0.0\n"
+};
+
+static int commit(struct jn_journal *j, const char *path, const char **lines, int n);
+static long filesize(const char *path);
+static int check(const char *path, const char **a, int na, const char **b, int nb);
+static int checknewyear(const char *dir);
+
+int main(int argc, char *argv[])
+{
+	struct jn_journal j;
+	char dir[64], jpath[96], logpath[96], energypath[96];
+	long logstart, energystart;
+	int failed;
+
+	if (argc > 1) {
+		snprintf(dir, sizeof(dir), "%s", argv[1]);
+	} else {
+		strcpy(dir, "/tmp/journalcheckXXXXXX");
+		if (mkdtemp(dir) == NULL) {
+			fprintf(stderr, "Can't make a scratch directory\n");
+			return -1;
+		}
+	}
+	snprintf(jpath, sizeof(jpath), "%s/check.journal", dir);
+	snprintf(logpath, sizeof(logpath), "%s/log.txt", dir);
+	snprintf(energypath, sizeof(energypath), "%s/energy.txt", dir);
+	remove(jpath);
+	remove(logpath);
+	remove(energypath);
+
+	/* Rows already safely in the log file, then the commit that the power loss cuts off */
+	if (jn_open(&j, jpath, CHECKBLOCKS, JN_BUFSIZE) == -1) {
+		fprintf(stderr, "Can't open the journal %s\n", jpath);
+		return -1;
+	}
+	commit(&j, logpath, before, 2);
+	logstart=filesize(logpath);
+	energystart=0;
+	commit(&j, logpath, rows, 4);
+	commit(&j, energypath, energy, 3);
+	jn_close(&j);
+
+	/* The appends only partly reached the card */
+	if (truncate(logpath, logstart+strlen(rows[0])/2) == -1 || truncate(energypath, energystart) == -1) {
+		fprintf(stderr, "Can't cut back the log files\n");
+		return -1;
+	}
+
+	failed=0;
+	if (jn_open(&j, jpath, CHECKBLOCKS, JN_BUFSIZE) == -1) {
+		fprintf(stderr, "Can't open the journal %s again\n", jpath);
+		return -1;
+	}
+	if (j.replayed != 7) {
+		printf("Replayed %lu rows instead of 7\n", j.replayed);
+		failed=1;
+	}
+	jn_close(&j);
+	failed|=check(logpath, before, 2, rows, 4);
+	failed|=check(energypath, NULL, 0, energy, 3);
+
+	/* Nothing more the second time */
+	jn_open(&j, jpath, CHECKBLOCKS, JN_BUFSIZE);
+	if (j.replayed != 0) {
+		printf("Replayed %lu rows again\n", j.replayed);
+		failed=1;
+	}
+	jn_close(&j);
+	failed|=check(logpath, before, 2, rows, 4);
+	failed|=check(energypath, NULL, 0, energy, 3);
+
+	failed|=checknewyear(dir);
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	if (!failed && argc < 2) {
+		remove(jpath);
+		remove(logpath);
+		remove(energypath);
+		rmdir(dir);
+	}
+	return failed ? 1 : 0;
+}
+
+static int commit(struct jn_journal *j, const char *path, const char **lines, int n)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		if (jn_add(j, path, lines[i], time(NULL)) == -1) return -1;
+	}
+	return jn_flush(j);
+}
+
+static long filesize(const char *path)
+{
+	FILE *infile;
+	long size;
+
+	if ((infile = fopen(path, "r")) == NULL) {
+		return 0;
+	}
+	fseek(infile, 0, SEEK_END);
+	size=ftell(infile);
+	fclose(infile);
+	return size;
+}
+
+/* Is the file exactly the rows of a then the rows of b? */
+static int check(const char *path, const char **a, int na, const char **b, int nb)
+{
+	FILE *infile;
+	char line[256];
+	int i, n, bad;
+
+	if ((infile = fopen(path, "r")) == NULL) {
+		printf("%s is missing\n", path);
+		return 1;
+	}
+	bad=0;
+	n=0;
+	while (fgets(line, sizeof(line), infile) != NULL) {
+		if (n >= na+nb || strcmp(line, n < na ? a[n] : b[n-na]) != 0) {
+			printf("%s row %d is wrong: %s", path, n+1, line);
+			bad=1;
+		}
+		n++;
+	}
+	fclose(infile);
+	if (n != na+nb) {
+		printf("%s has %d rows instead of %d\n", path, n, na+nb);
+		bad=1;
+	}
+	for (i=0; bad && i<na+nb; i++) printf("\texpected: %s", i < na ? a[i] : b[i-na]);
+	return bad;
+}
+
+/* An append that fails, then ones that work, then a restart, then a power loss in the middle of the first rows */
+static int checknewyear(const char *dir)
+{
+	struct jn_journal j;
+	char jpath[96], yeardir[96], logpath[112];
+	int failed;
+
+	snprintf(jpath, sizeof(jpath), "%s/newyear.journal", dir);
+	snprintf(yeardir, sizeof(yeardir), "%s/2017", dir);
+	snprintf(logpath, sizeof(logpath), "%s/log.txt", yeardir);
+	remove(jpath);
+	remove(logpath);
+	rmdir(yeardir);
+
+	failed=0;
+	if (jn_open(&j, jpath, CHECKBLOCKS, JN_BUFSIZE) == -1) {
+		fprintf(stderr, "Can't open the journal %s\n", jpath);
+		return 1;
+	}
+	printf("A \"Can't create log file\" next is expected:\n");
+	fflush(stdout);
+	commit(&j, logpath, newyear, 2);
+	if (j.nrows != 2) {
+		printf("%d rows wait for %s instead of 2\n", j.nrows, logpath);
+		failed=1;
+	}
+	if (mkdir(yeardir, 0755) == -1) {
+		fprintf(stderr, "Can't make %s\n", yeardir);
+		jn_close(&j);
+		return 1;
+	}
+	commit(&j, logpath, newyear+2, 1);
+	commit(&j, logpath, newyear+3, 1);
+	jn_close(&j);
+	failed|=check(logpath, NULL, 0, newyear, 4);
+
+	/* Nothing to put back, and nothing to cut off */
+	jn_open(&j, jpath, CHECKBLOCKS, JN_BUFSIZE);
+	if (j.replayed != 0 || j.misplaced != 0) {
+		printf("Replayed %lu rows of %s and found %lu out of place after the directory was made\n", j.replayed, logpath, j.misplaced);
+		failed=1;
+	}
+	jn_close(&j);
+	failed|=check(logpath, NULL, 0, newyear, 4);
+
+	/* The power goes in the middle of the second row */
+	if (truncate(logpath, strlen(newyear[0])+3) == -1) {
+		fprintf(stderr, "Can't cut back %s\n", logpath);
+		return 1;
+	}
+	jn_open(&j, jpath, CHECKBLOCKS, JN_BUFSIZE);
+	if (j.replayed != 3) {
+		printf("Replayed %lu rows of %s instead of 3\n", j.replayed, logpath);
+		failed=1;
+	}
+	jn_close(&j);
+	failed|=check(logpath, NULL, 0, newyear, 4);
+
+	if (!failed) {
+		remove(jpath);
+		remove(logpath);
+		rmdir(yeardir);
+	}
+	return failed;
+}
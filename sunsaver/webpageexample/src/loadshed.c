@@ -0,0 +1,243 @@
+/*
+ *  loadshed.c - Low voltage load shedding for the acquisition daemon.
+ *
+ *	Each SunSaver MPPT drops its own load at its V_lvd, which is all or nothing.  This sheds loads switched by a Relay Driver or
+ *	a charge controller's load coil one at a time, least important first, so the important ones stay up longer.  After every fast
+ *	sample the battery voltage is taken as the lowest of the controllers, raised by SHEDIRCOMP ohms times their total load
+ *	current so a heavy load doesn't look like a flat battery.  Each controller read is handed over with sh_sample(), so TriStar
+ *	MPPTs count as well as SunSaver MPPTs; a TriStar MPPT has no load output and only adds its voltage and charge state.  When it has been below a load's shedvb for SHEDHOLD milliseconds
+ *	the least important load still on is shed.  Loads come back in the opposite order, each once the voltage has been above its
+ *	restorevb for SHEDRESTOREHOLD seconds (and, if SHEDCHARGING is set, while a controller is charging, since a rested battery
+ *	looks better than it is).  Only one load is switched every SHEDSETTLE milliseconds, to see what the last one did first.
+ *
+ *	The write is made straight after the sample and read back.  The time from the start of the sample that called for a shed to
+ *	the read back is the reaction time; it is kept for the metrics and sheds slower than SHEDMAXREACTION are counted.  While the
+ *	voltage is within SHEDMARGIN of a shed point or a load is shed, the daemon samples every SHEDPOLL milliseconds and doesn't
+ *	drop to the night rate (sh_armed).
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <modbus.h>
+
+#include "powersystem.h"
+#include "loadshed.h"
+#include "ssmppt.h"
+#include "cmdqueue.h"
+#include "pollsched.h"
+
+static int readstate(const struct sh_rule *r, modbus_t *ctx);
+static int setload(struct sh_ctl *sh, int i, int state, modbus_t *ctx, long sampled);
+
+void sh_init(struct sh_ctl *sh, const struct sh_rule *rules, int nrules)
+{
+	int i;
+
+	memset(sh, 0, sizeof(struct sh_ctl));
+	if (nrules > SH_MAXRULES) nrules=SH_MAXRULES;
+	sh->nrules=nrules;
+	sh->rule=rules;
+	for (i=0; i<nrules; i++) {
+		sh->load[i].state=SH_UNKNOWN;
+		sh->load[i].below=-1;
+		sh->load[i].above=-1;
+	}
+	sh->lastchange=-SHEDSETTLE;
+	sh->lastread=-SHEDSETTLE;
+}
+
+/*	Call for every charge controller read in a fast sample, with its battery voltage, load current (0 if it has no load output)
+	and charge state, before sh_step().  The TriStar MPPT's charge states are the SunSaver MPPT's up to EQUALIZE. */
+void sh_sample(struct sh_ctl *sh, float vb, float il, int charge_state)
+{
+	if (sh->nrules == 0) return;
+
+	if (sh->nsampled == 0 || vb < sh->minvb) sh->minvb=vb;
+	if (sh->nsampled == 0) {
+		sh->sumil=0;
+		sh->anycharging=0;
+	}
+	sh->sumil+=il;
+	if (charge_state >= SS_CS_BULK_CHARGE && charge_state <= SS_CS_EQUALIZE) sh->anycharging=1;
+	sh->nsampled++;
+}
+
+/*	Call after every fast sample, once sh_sample() has been given the devices that were read, with the time the sample started.
+	Sheds or restores at most one load.  Returns the number of loads switched. */
+int sh_step(struct sh_ctl *sh, modbus_t *ctx, long sampled)
+{
+	const struct sh_rule *r;
+	struct sh_load *l;
+	int i, first, last;
+
+	if (sh->nrules == 0 || sh->nsampled == 0) return 0;		/* Nothing new - hold everything as it is */
+	sh->nsampled=0;
+	sh->il=sh->sumil;
+	sh->charging=sh->anycharging;
+	sh->vb=sh->minvb+SHEDIRCOMP*sh->il;
+	sh->valid=1;
+	sh->samples++;
+
+	/* Find out what the loads are doing the first time, in case they were left shed.  A device that doesn't answer is asked
+	   again every SHEDSETTLE, not on every sample. */
+	if (sampled-sh->lastread >= SHEDSETTLE) {
+		for (i=0; i<sh->nrules; i++) {
+			if (sh->load[i].state == SH_UNKNOWN) {
+				sh->load[i].state=readstate(&sh->rule[i], ctx);
+				sh->lastread=sampled;
+			}
+		}
+	}
+
+	first=-1;
+	last=-1;
+	for (i=0; i<sh->nrules; i++) {
+		r=&sh->rule[i];
+		l=&sh->load[i];
+		if (sh->vb < r->shedvb) {
+			if (l->below < 0) l->below=sampled;
+		} else {
+			l->below=-1;
+		}
+		if (sh->vb > r->restorevb) {
+			if (l->above < 0) l->above=sampled;
+		} else {
+			l->above=-1;
+		}
+		if (l->state == SH_ON && first < 0) first=i;
+		if (l->state == SH_SHED) last=i;
+	}
+
+	if (sampled-sh->lastchange < SHEDSETTLE) return 0;
+
+	/* Any load that has been under its shed point long enough sheds the least important load still on */
+	if (first >= 0) {
+		for (i=0; i<sh->nrules; i++) {
+			l=&sh->load[i];
+			if (l->state != SH_SHED && l->below >= 0 && sampled-l->below >= SHEDHOLD) {
+				return setload(sh, first, SH_SHED, ctx, sampled) == 0 ? 1 : 0;
+			}
+		}
+	}
+
+	/* The most important load that is shed comes back first */
+	if (last >= 0) {
+		l=&sh->load[last];
+		if (l->above >= 0 && sampled-l->above >= SHEDRESTOREHOLD*1000L && (sh->charging || !SHEDCHARGING)) {
+			return setload(sh, last, SH_ON, ctx, sampled) == 0 ? 1 : 0;
+		}
+	}
+
+	return 0;
+}
+
+/* True while the voltage is near a shed point or a load is shed, so the daemon should keep sampling fast */
+int sh_armed(const struct sh_ctl *sh)
+{
+	int i;
+
+	if (sh->nrules == 0) return 0;
+	if (!sh->valid) return 1;
+	for (i=0; i<sh->nrules; i++) {
+		if (sh->load[i].state == SH_SHED || sh->vb < sh->rule[i].shedvb+SHEDMARGIN) return 1;
+	}
+	return 0;
+}
+
+/* Number of loads shed */
+int sh_nshed(const struct sh_ctl *sh)
+{
+	int i, n;
+
+	n=0;
+	for (i=0; i<sh->nrules; i++) {
+		if (sh->load[i].state == SH_SHED) n++;
+	}
+	return n;
+}
+
+/* Read whether a load is on or shed.  Returns SH_UNKNOWN if it can't be read. */
+static int readstate(const struct sh_rule *r, modbus_t *ctx)
+{
+	uint16_t reg;
+	uint8_t bit;
+	int rc;
+
+	modbus_set_slave(ctx, r->slave);
+	if (r->type == CQ_COIL) {
+		rc=modbus_read_bits(ctx, r->addr, 1, &bit);
+		reg=bit;
+	} else {
+		rc=modbus_read_registers(ctx, r->addr, 1, &reg);
+	}
+	if (rc != 1) {
+		fprintf(stderr, "Can't read the %s load from MODBUS id %d: %s\n", r->name, r->slave, modbus_strerror(errno));
+		modbus_flush(ctx);
+		return SH_UNKNOWN;
+	}
+	return (reg == (r->type == CQ_COIL ? (r->shed != 0) : r->shed)) ? SH_SHED : SH_ON;
+}
+
+/* Switch one load and read it back.  Returns 0, or -1 if it didn't switch (it is tried again after the next sample). */
+static int setload(struct sh_ctl *sh, int i, int state, modbus_t *ctx, long sampled)
+{
+	const struct sh_rule *r;
+	struct sh_load *l;
+	struct cq_cmd cmd;
+	long now;
+	int result;
+
+	r=&sh->rule[i];
+	l=&sh->load[i];
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.priority=CQ_URGENT;
+	cmd.slave=r->slave;
+	cmd.type=r->type;
+	cmd.addr=r->addr;
+	cmd.value=(state == SH_SHED) ? r->shed : r->restore;
+	if (cmd.type == CQ_COIL) cmd.value=(cmd.value != 0);
+
+	result=cq_write(ctx, &cmd);
+	now=ps_now();
+	if (result != CQ_OK) {
+		fprintf(stderr, "Can't %s the %s load on MODBUS id %d\n", state == SH_SHED ? "shed" : "restore", r->name, r->slave);
+		l->failures++;
+		return -1;
+	}
+
+	l->state=state;
+	l->below=-1;
+	l->above=-1;
+	sh->lastchange=now;
+	if (state == SH_SHED) {
+		l->sheds++;
+		sh->lastreaction=now-sampled;
+		if (sh->lastreaction > sh->maxreaction) sh->maxreaction=sh->lastreaction;
+		if (sh->lastreaction > SHEDMAXREACTION) {
+			fprintf(stderr, "Shedding the %s load took %ld ms\n", r->name, sh->lastreaction);
+			sh->overruns++;
+		}
+	} else {
+		l->restores++;
+	}
+	fprintf(stderr, "%s the %s load at %.2f V\n", state == SH_SHED ? "Shed" : "Restored", r->name, sh->vb);
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ *  loadshed.h - Low voltage load shedding for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef LOADSHED_H
+#define LOADSHED_H
+
+#include <modbus.h>
+
+#define SH_MAXRULES		8
+
+/* Load states */
+
+#define SH_UNKNOWN		0										/* Not read back yet - the daemon may have been restarted with the load shed */
+#define SH_ON			1
+#define SH_SHED			2
+
+/* One load, in the order they are shed (least important first).  The rules are given by SHEDRULES in powersystem.h. */
+
+struct sh_rule {
+	const char *name;
+	int slave;													/* MODBUS id of the Relay Driver or charge controller that switches it */
+	int type;													/* CQ_COIL or CQ_REG */
+	int addr;
+	int shed;													/* Value written to shed the load */
+	int restore;												/* Value written to restore it */
+	float shedvb;												/* Shed when the battery voltage is below this for SHEDHOLD ms */
+	float restorevb;											/* Restore when it is above this for SHEDRESTOREHOLD seconds */
+};
+
+struct sh_load {
+	int state;
+	long below;													/* When the voltage went below shedvb, or -1 */
+	long above;													/* When the voltage went above restorevb, or -1 */
+	unsigned long sheds;
+	unsigned long restores;
+	unsigned long failures;										/* Writes that failed or didn't read back */
+};
+
+struct sh_ctl {
+	int nrules;
+	const struct sh_rule *rule;
+	struct sh_load load[SH_MAXRULES];
+	float vb;													/* Lowest battery voltage, compensated for the load current */
+	float il;													/* Total load current */
+	int charging;												/* A charge controller is charging */
+	int valid;													/* vb, il and charging are from a sample */
+	int nsampled;												/* Devices given to sh_sample() since the last sh_step() */
+	float minvb;												/* Their lowest battery voltage */
+	float sumil;												/* Their total load current */
+	int anycharging;											/* One of them is charging */
+	long lastchange;											/* When a load was last shed or restored */
+	long lastread;												/* When the loads in SH_UNKNOWN were last read */
+	unsigned long samples;
+	long lastreaction;											/* Milliseconds from the sample that called for a shed to its read back */
+	long maxreaction;
+	unsigned long overruns;										/* Sheds that took longer than SHEDMAXREACTION */
+};
+
+void sh_init(struct sh_ctl *sh, const struct sh_rule *rules, int nrules);
+void sh_sample(struct sh_ctl *sh, float vb, float il, int charge_state);
+int sh_step(struct sh_ctl *sh, modbus_t *ctx, long sampled);
+int sh_armed(const struct sh_ctl *sh);
+int sh_nshed(const struct sh_ctl *sh);
+
+#endif
@@ -0,0 +1,361 @@
+/*
+ *  logsync.c - Incremental copy of the SunSaver MPPT or TriStar MPPT daily log ring into the daily log file, keyed by hourmeter.
+ *
+ *	The SunSaver MPPT keeps its last 32 daily records in a ring at 0x8000, one record every 0x10 registers, and writes a new one
+ *	when the charge state switches to night.  The hourmeter in each record only goes up, so the ring is a sorted list that has been
+ *	rotated, and the newest record can be found with a binary search that reads just the hourmeter words of five or six records.
+ *	The hourmeter of the last row in the daily log file says which records are new.  Once the slot of that record is known, a sync
+ *	is one read of the next slot to see if it holds a newer record, plus one more read for each new record.
+ *
+ *	ls_step() makes at most one small read each time it is called, so the daemon can spread a sync out between its polls.  The
+ *	date of each record comes from the hourmeter: the record was written as many hours ago as the hourmeter has moved since.
+ *
+ *	The TriStar MPPT keeps the same kind of ring at the same address, only longer (LS_TSSLOTS records of 16 registers), with the
+ *	daily values in the order of its RAM daily registers and its voltages scaled by V_PU.  Its records go in the same daily log
+ *	file columns, with no load values.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <modbus.h>
+
+#include "powersystem.h"
+#include "readplan.h"
+#include "logsync.h"
+
+static int probe(struct ls_sync *ls, modbus_t *ctx, int slot, unsigned int *hm);
+static unsigned int hourmeter(const uint16_t *data);
+static unsigned int tailhourmeter(const char *logfile);
+static void loadhint(struct ls_sync *ls);
+
+void ls_init(struct ls_sync *ls, int slave, unsigned int lasthm)
+{
+	memset(ls, 0, sizeof(struct ls_sync));
+	ls->slave=slave;
+	ls->lasthm=lasthm;
+	ls->lastslot=-1;
+	ls->slots=LS_SLOTS;
+	ls->recregs=LS_RECREGS;
+	loadhint(ls);
+}
+
+/* The same for a TriStar MPPT.  vpu is its V_PU (see ts_scale). */
+void ls_inittristar(struct ls_sync *ls, int slave, unsigned int lasthm, float vpu)
+{
+	memset(ls, 0, sizeof(struct ls_sync));
+	ls->slave=slave;
+	ls->lasthm=lasthm;
+	ls->lastslot=-1;
+	ls->tristar=1;
+	ls->vpu=vpu;
+	ls->slots=LS_TSSLOTS;
+	ls->recregs=LS_TSRECREGS;
+	loadhint(ls);
+}
+
+/* Begin a sync.  hmnow is the hourmeter from RAM, so a reset or replaced charge controller is noticed. */
+void ls_start(struct ls_sync *ls, unsigned int hmnow)
+{
+	if (hmnow != 0 && hmnow < ls->lasthm) {
+		ls->lasthm=0;											/* The log file is from another controller - start over */
+		ls->lastslot=-1;
+	}
+	memset(ls->hm, 0, sizeof(ls->hm));
+	ls->fetched=0;
+	ls->syncs++;
+	if (ls->lastslot >= 0) {
+		ls->slot=(ls->lastslot+1)%ls->slots;
+		ls->state=LS_FETCH;
+	} else {
+		ls->lo=0;
+		ls->hi=ls->slots-1;
+		ls->state=LS_HEAD;
+	}
+}
+
+/* Take one step of the sync.  Returns 1 with a new record in rec, 0 if there is nothing new yet (the sync is over once
+   ls->state is LS_IDLE), or -1 on a read error, which ends the sync. */
+int ls_step(struct ls_sync *ls, modbus_t *ctx, struct ls_record *rec)
+{
+	uint16_t data[LS_MAXRECREGS];
+	unsigned int hm, hm0;
+	int mid;
+
+	switch (ls->state) {
+	case LS_HEAD:
+		/* The newest record is the last slot, in ring order from slot 0, whose hourmeter is at least the one in slot 0.  Slots
+		   after it are older or have never been written. */
+		if (ls->hm[0] == 0) {
+			return probe(ls, ctx, 0, &hm0);						/* One read per step */
+		}
+		probe(ls, ctx, 0, &hm0);
+		if (hm0 == 0) {
+			ls->state=LS_IDLE;									/* Empty ring */
+			return 0;
+		}
+		if (ls->lo < ls->hi) {
+			mid=(ls->lo+ls->hi+1)/2;
+			if (probe(ls, ctx, mid, &hm) == -1) return -1;
+			if (hm != 0 && hm >= hm0) ls->lo=mid;
+			else ls->hi=mid-1;
+			return 0;
+		}
+		/* ls->lo is the newest record (already read).  The ring is full if the slot after it has ever been written. */
+		probe(ls, ctx, ls->lo, &hm);
+		if (hm <= ls->lasthm) {
+			ls->lastslot=ls->lo;								/* Nothing new, but the next sync knows where to look */
+			ls->state=LS_IDLE;
+			return 0;
+		}
+		if (ls->lo == ls->slots-1) {
+			ls->oldest=0;
+			ls->count=ls->slots;
+		} else {
+			if (probe(ls, ctx, ls->lo+1, &hm) == -1) return -1;
+			ls->oldest=(hm != 0) ? ls->lo+1 : 0;
+			ls->count=(hm != 0) ? ls->slots : ls->lo+1;
+		}
+		if (ls->lasthm == 0) {
+			ls->slot=ls->oldest;								/* Nothing logged yet - copy the whole ring */
+			ls->state=LS_FETCH;
+			return 0;
+		}
+		ls->lo=0;												/* Next, search the records in ring order */
+		ls->hi=ls->count-1;
+		ls->state=LS_FIRSTNEW;
+		return 0;
+
+	case LS_FIRSTNEW:
+		/* The first record, oldest first, with an hourmeter past the last one logged.  The newest record is known to be new. */
+		if (ls->lo < ls->hi) {
+			mid=(ls->lo+ls->hi)/2;
+			if (probe(ls, ctx, (ls->oldest+mid)%ls->slots, &hm) == -1) return -1;
+			if (hm > ls->lasthm) ls->hi=mid;
+			else ls->lo=mid+1;
+			return 0;
+		}
+		ls->slot=(ls->oldest+ls->lo)%ls->slots;
+		ls->state=LS_FETCH;
+		/* Fall through and fetch it */
+
+	case LS_FETCH:
+		if (ls->fetched >= ls->slots) {
+			ls->state=LS_IDLE;
+			return 0;
+		}
+		usleep(RP_READDELAY);									/* Give the charge controller time since the last read */
+		modbus_set_slave(ctx, ls->slave);
+		ls->reads++;
+		if (modbus_read_registers(ctx, LS_BASE+ls->slot*LS_STRIDE, ls->recregs, data) == -1) {
+			ls->state=LS_IDLE;
+			return -1;
+		}
+		if (!(ls->tristar ? ls_decodetristar(data, ls->vpu, rec) : ls_decode(data, rec)) || rec->hourmeter <= ls->lasthm) {
+			ls->state=LS_IDLE;									/* Caught up */
+			return 0;
+		}
+		ls->lasthm=rec->hourmeter;
+		ls->lastslot=ls->slot;
+		ls->slot=(ls->slot+1)%ls->slots;
+		ls->fetched++;
+		ls->records++;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Convert the registers of one log record.  Returns 0 if the slot has never been written. */
+int ls_decode(const uint16_t *data, struct ls_record *rec)
+{
+	rec->hourmeter=hourmeter(data);
+	rec->alarm_daily=(data[2] << 8) + (data[1] >> 8);
+	rec->Vb_min_daily=data[3]*100.0/32768.0;
+	rec->Vb_max_daily=data[4]*100.0/32768.0;
+	rec->Ahc_daily=data[5]*0.1;
+	rec->Ahl_daily=data[6]*0.1;
+	rec->array_fault_daily=data[7];
+	rec->load_fault_daily=data[8];
+	rec->Va_max_daily=data[9]*100.0/32768.0;
+	rec->time_ab_daily=data[10];
+	rec->time_eq_daily=data[11];
+	rec->time_fl_daily=data[12];
+
+	return rec->hourmeter != 0;
+}
+
+/*	Convert the registers of one TriStar MPPT log record: hourmeter and alarm_daily packed as in the SunSaver MPPT's, then
+	vb_min_daily to time_fl_daily in the order of the RAM daily registers.  Returns 0 if the slot has never been written. */
+int ls_decodetristar(const uint16_t *data, float vpu, struct ls_record *rec)
+{
+	rec->hourmeter=hourmeter(data);
+	rec->alarm_daily=(data[2] << 8) + (data[1] >> 8);
+	rec->Vb_min_daily=data[3]*vpu/32768.0;
+	rec->Vb_max_daily=data[4]*vpu/32768.0;
+	rec->Va_max_daily=data[5]*vpu/32768.0;
+	rec->Ahc_daily=data[6]*0.1;
+	rec->Ahl_daily=0;											/* No load output */
+	rec->array_fault_daily=data[12];							/* fault_daily */
+	rec->load_fault_daily=0;
+	rec->time_ab_daily=data[13];
+	rec->time_eq_daily=data[14];
+	rec->time_fl_daily=data[15];
+
+	return rec->hourmeter != 0;
+}
+
+/* When a record was written, from how far the hourmeter has moved since */
+time_t ls_when(const struct ls_record *rec, unsigned int hmnow, time_t now)
+{
+	if (hmnow < rec->hourmeter) {
+		return now;
+	}
+	return now-(time_t) (hmnow-rec->hourmeter)*3600;
+}
+
+/* Hourmeter of the last row in this year's daily log file, or last year's if this year's has no rows yet */
+unsigned int ls_lastlogged(time_t now)
+{
+	struct tm *then;
+	char filepath[64], logfile[64];
+	unsigned int hm;
+	time_t t;
+
+	sprintf(filepath,"%s/%%Y/%%Ydailylog.txt",LOGFILEPATH);
+	then=localtime(&now);
+	strftime(logfile, 64, filepath, then);
+	if ((hm=tailhourmeter(logfile)) != 0) {
+		return hm;
+	}
+	t=now-(then->tm_yday+1)*24*60*60L;
+	strftime(logfile, 64, filepath, localtime(&t));
+	return tailhourmeter(logfile);
+}
+
+/* Append a record to the daily log file for the year it was written in */
+int ls_writerow(const struct ls_record *rec, time_t when)
+{
+	FILE *outfile;
+	struct tm *then;
+	char tsdate[32], filepath[64], logfile[64];
+
+	then=localtime(&when);
+	strftime(tsdate, 32, "%m/%d/%Y", then);
+	sprintf(filepath,"%s/%%Y/%%Ydailylog.txt",LOGFILEPATH);
+	strftime(logfile, 64, filepath, then);
+
+	if ((outfile = fopen(logfile, "a")) == NULL) {
+		fprintf(stderr, "Can't create log file: %s\n", logfile);
+		return -1;
+	}
+	fprintf(outfile,"%s\t%u\t%u\t%.2f\t%.2f", tsdate, rec->hourmeter, rec->alarm_daily, rec->Vb_min_daily, rec->Vb_max_daily);
+	fprintf(outfile,"\t%.2f\t%.2f\t%d\t%d", rec->Ahc_daily, rec->Ahl_daily, rec->array_fault_daily, rec->load_fault_daily);
+	fprintf(outfile,"\t%.2f\t%d\t%d\t%d\n", rec->Va_max_daily, rec->time_ab_daily, rec->time_eq_daily, rec->time_fl_daily);
+	fclose(outfile);
+
+	return 0;
+}
+
+/* Remember which slot holds the last record logged, in RUNFILEPATH so it costs no flash writes.  After a reboot the first sync
+   finds the slot again with a binary search. */
+void ls_savehint(const struct ls_sync *ls)
+{
+	FILE *outfile;
+	char filepath[64], tmppath[72];
+
+	if (ls->lastslot < 0) {
+		return;
+	}
+	sprintf(filepath,"%s/logsync%d.txt",RUNFILEPATH,ls->slave);
+	sprintf(tmppath,"%s.tmp",filepath);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return;
+	}
+	fprintf(outfile,"%u %d\n", ls->lasthm, ls->lastslot);
+	fclose(outfile);
+	rename(tmppath, filepath);
+}
+
+/* The slot hint is only used if it is for the record the daily log file ends with */
+static void loadhint(struct ls_sync *ls)
+{
+	FILE *infile;
+	char filepath[64];
+	unsigned int hm;
+	int slot;
+
+	sprintf(filepath,"%s/logsync%d.txt",RUNFILEPATH,ls->slave);
+	if ((infile = fopen(filepath, "r")) == NULL) {
+		return;
+	}
+	if (fscanf(infile, "%u %d", &hm, &slot) == 2 && hm == ls->lasthm && hm != 0 && slot >= 0 && slot < ls->slots) {
+		ls->lastslot=slot;
+	}
+	fclose(infile);
+}
+
+/* Read the hourmeter words of one record, or use the value already read in this sync.  Never written slots give 0. */
+static int probe(struct ls_sync *ls, modbus_t *ctx, int slot, unsigned int *hm)
+{
+	uint16_t data[2];
+
+	if (ls->hm[slot] == 0) {
+		usleep(RP_READDELAY);
+		modbus_set_slave(ctx, ls->slave);
+		ls->reads++;
+		if (modbus_read_registers(ctx, LS_BASE+slot*LS_STRIDE, 2, data) == -1) {
+			ls->state=LS_IDLE;
+			return -1;
+		}
+		ls->hm[slot]=hourmeter(data);
+		if (ls->hm[slot] == 0) ls->hm[slot]=0xFFFFFFFF;			/* Read, and empty */
+	}
+	*hm=(ls->hm[slot] == 0xFFFFFFFF) ? 0 : ls->hm[slot];
+	return 0;
+}
+
+/* The 24-bit hourmeter of a record.  Slots that have never been written read 0 or 0xFFFFFF. */
+static unsigned int hourmeter(const uint16_t *data)
+{
+	unsigned int hm;
+
+	hm=data[0] + ((data[1] & 0x00FF) << 16);
+	return (hm == 0xFFFFFF) ? 0 : hm;
+}
+
+/* Hourmeter in the last row of a daily log file, or 0 */
+static unsigned int tailhourmeter(const char *logfile)
+{
+	FILE *infile;
+	char inputline[1000];
+	unsigned int hm, last;
+
+	if ((infile = fopen(logfile, "r")) == NULL) {
+		return 0;
+	}
+	last=0;
+	while (fgets(inputline, sizeof(inputline), infile) != NULL) {
+		if (sscanf(inputline, "%*s%u", &hm) == 1) last=hm;
+	}
+	fclose(infile);
+	return last;
+}
@@ -0,0 +1,91 @@
+/*
+ *  logsync.h - Incremental copy of the SunSaver MPPT or TriStar MPPT daily log ring into the daily log file, keyed by hourmeter.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef LOGSYNC_H
+#define LOGSYNC_H
+
+#include <stdio.h>
+#include <time.h>
+#include <modbus.h>
+
+#define LS_BASE			0x8000									/* First log record */
+#define LS_STRIDE		0x0010									/* Registers from one record to the next */
+#define LS_SLOTS		32										/* Records in the SunSaver MPPT ring */
+#define LS_RECREGS		13										/* Registers in one SunSaver MPPT record */
+#define LS_TSSLOTS		256										/* Records in the TriStar MPPT ring */
+#define LS_TSRECREGS	16										/* Registers in one TriStar MPPT record */
+#define LS_MAXSLOTS		LS_TSSLOTS
+#define LS_MAXRECREGS	LS_TSRECREGS
+
+/* Sync states */
+
+#define LS_IDLE			0
+#define LS_HEAD			1										/* Binary search for the newest record */
+#define LS_FIRSTNEW		2										/* Binary search for the oldest record not yet logged */
+#define LS_FETCH		3										/* Reading new records in order */
+
+struct ls_record {
+	unsigned int hourmeter;
+	unsigned int alarm_daily;
+	float Vb_min_daily;
+	float Vb_max_daily;
+	float Ahc_daily;
+	float Ahl_daily;
+	unsigned short array_fault_daily;
+	unsigned short load_fault_daily;
+	float Va_max_daily;
+	unsigned short time_ab_daily;
+	unsigned short time_eq_daily;
+	unsigned short time_fl_daily;
+};
+
+struct ls_sync {
+	int slave;
+	int tristar;												/* 1 for a TriStar MPPT's log */
+	float vpu;													/* The TriStar MPPT's V_PU, for its voltages */
+	int slots;
+	int recregs;
+	unsigned int lasthm;										/* Hourmeter of the newest record in the daily log file (0 = none) */
+	int lastslot;												/* Ring slot that record is in, or -1 if not known */
+	int state;
+	int lo, hi;													/* Binary search bounds */
+	int oldest, count;											/* Oldest slot and number of records in the ring */
+	int slot;													/* Next slot to fetch */
+	int fetched;
+	unsigned int hm[LS_MAXSLOTS];								/* Hourmeters read so far in this sync (0 = not read) */
+	unsigned long syncs;
+	unsigned long triggers;										/* Syncs started by the caller on a NIGHT transition */
+	unsigned long reads;
+	unsigned long records;
+};
+
+void ls_init(struct ls_sync *ls, int slave, unsigned int lasthm);
+void ls_inittristar(struct ls_sync *ls, int slave, unsigned int lasthm, float vpu);
+void ls_start(struct ls_sync *ls, unsigned int hmnow);
+int ls_step(struct ls_sync *ls, modbus_t *ctx, struct ls_record *rec);
+int ls_decode(const uint16_t *data, struct ls_record *rec);
+int ls_decodetristar(const uint16_t *data, float vpu, struct ls_record *rec);
+time_t ls_when(const struct ls_record *rec, unsigned int hmnow, time_t now);
+unsigned int ls_lastlogged(time_t now);
+int ls_writerow(const struct ls_record *rec, time_t when);
+void ls_savehint(const struct ls_sync *ls);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ *  mbtcp.c - Pipelined MODBUS TCP reads of a read plan, for the acquisition daemon.
+ *
+ *	libmodbus sends a request and waits for its response before sending the next, so over a network every read costs a whole
+ *	round trip.  MODBUS TCP doesn't need that: each request carries a transaction identifier in its MBAP header and the response
+ *	comes back with the same one.  mt_execute() sends the reads of a plan back to back, up to window of them in flight to each
+ *	device (a gateway passes them on to its serial bus one at a time, and a small window keeps it from timing them out), and
+ *	matches the responses to the reads by transaction identifier as they arrive.  A read whose response doesn't come within
+ *	timeout milliseconds fails, and a response that comes after that is counted and dropped.
+ *
+ *	The socket is the one of a libmodbus TCP context, which the daemon goes on using for its other reads and writes.  Both never
+ *	run at once, and the socket is flushed after a timeout so a late response isn't taken for an answer to libmodbus.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <modbus.h>
+
+#include "mbtcp.h"
+#include "pollsched.h"
+
+#define MBAPSIZE		7										/* Transaction id, protocol id, length and unit id */
+
+static int receive(struct mt_conn *c, struct rp_plan *plan, int fd);
+static int inflightto(const struct mt_conn *c, const struct rp_plan *plan, int slave);
+static void drop(struct mt_conn *c, int k);
+
+void mt_init(struct mt_conn *c, modbus_t *ctx, int window, long timeout)
+{
+	memset(c, 0, sizeof(struct mt_conn));
+	c->ctx=ctx;
+	c->window=(window < 1) ? 1 : (window > MT_MAXWINDOW) ? MT_MAXWINDOW : window;
+	c->timeout=timeout;
+	c->tid=1;
+}
+
+/*	Run the reads of a plan whose status is RP_PENDING and set their status.  No request is sent after deadline (monotonic
+	milliseconds); the reads left are marked deferred.  Returns the number of failed reads. */
+int mt_execute(struct mt_conn *c, struct rp_plan *plan, long deadline)
+{
+	unsigned char out[RP_MAXREADS*12], *p;
+	unsigned char run[RP_MAXREADS], queued[RP_MAXREADS];
+	struct pollfd pfd;
+	int i, k, fd, n, rc, failed, late;
+	long now, expire;
+
+	if (c->broken) {
+		modbus_close(c->ctx);
+		c->reconnects++;
+		if (modbus_connect(c->ctx) == -1) {
+			for (i=0; i<plan->nreads; i++) {
+				if (plan->status[i] == RP_PENDING) plan->status[i]=RP_FAILED;
+			}
+			return plan->nreads;
+		}
+		c->broken=0;
+	}
+	fd=modbus_get_socket(c->ctx);
+
+	for (i=0; i<plan->nreads; i++) run[i]=(plan->status[i] == RP_PENDING);
+	memset(queued, 0, sizeof(queued));
+	c->nslots=0;
+	c->nbuf=0;
+	late=0;
+	for (;;) {
+		/* Send every read the windows allow, in one write */
+		now=ps_now();
+		p=out;
+		for (i=0; i<plan->nreads; i++) {
+			if (plan->status[i] != RP_PENDING || queued[i]) continue;
+			if (now >= deadline) {
+				plan->status[i]=RP_DEFERRED;
+				continue;
+			}
+			if (inflightto(c, plan, plan->read[i].slave) >= c->window) continue;
+			p[0]=c->tid >> 8;
+			p[1]=c->tid & 0xFF;
+			p[2]=0;												/* Protocol id */
+			p[3]=0;
+			p[4]=0;												/* Length of what follows */
+			p[5]=6;
+			p[6]=plan->read[i].slave;
+			p[7]=0x03;											/* Read holding registers */
+			p[8]=plan->read[i].addr >> 8;
+			p[9]=plan->read[i].addr & 0xFF;
+			p[10]=plan->read[i].count >> 8;
+			p[11]=plan->read[i].count & 0xFF;
+			p+=12;
+			c->slot[c->nslots].tid=c->tid++;
+			c->slot[c->nslots].read=i;
+			c->slot[c->nslots].sent=now;
+			c->nslots++;
+			queued[i]=1;
+		}
+		if (p > out) {
+			n=p-out;
+			if (send(fd, out, n, MSG_NOSIGNAL) != n) {
+				fprintf(stderr, "MODBUS TCP send failed: %s\n", strerror(errno));
+				c->broken=1;
+			} else {
+				c->sent+=n/12;
+			}
+		}
+		if (c->nslots > c->maxinflight) c->maxinflight=c->nslots;
+		if (c->broken || c->nslots == 0) break;
+
+		/* Wait for a response, up to when the oldest request times out */
+		expire=c->slot[0].sent+c->timeout;
+		for (k=1; k<c->nslots; k++) {
+			if (c->slot[k].sent+c->timeout < expire) expire=c->slot[k].sent+c->timeout;
+		}
+		now=ps_now();
+		pfd.fd=fd;
+		pfd.events=POLLIN;
+		rc=(expire > now) ? poll(&pfd, 1, expire-now) : 0;
+		if (rc > 0) {
+			if (receive(c, plan, fd) == -1) {
+				c->broken=1;
+				break;
+			}
+		} else if (rc == -1 && errno != EINTR) {
+			c->broken=1;
+			break;
+		}
+
+		/* Requests not answered in time fail */
+		now=ps_now();
+		for (k=0; k<c->nslots; ) {
+			if (now >= c->slot[k].sent+c->timeout) {
+				plan->status[c->slot[k].read]=RP_FAILED;
+				c->timeouts++;
+				late=1;
+				drop(c, k);
+			} else {
+				k++;
+			}
+		}
+	}
+
+	/* After a failed connection nothing more will be answered */
+	failed=0;
+	for (i=0; i<plan->nreads; i++) {
+		if (!run[i]) continue;
+		if (plan->status[i] == RP_PENDING) plan->status[i]=RP_FAILED;
+		if (plan->status[i] == RP_FAILED) failed++;
+	}
+	c->nslots=0;
+	if (late || c->broken) modbus_flush(c->ctx);
+
+	return failed;
+}
+
+/*	Read what has arrived and match every whole response to its request.  Returns -1 if the connection failed or the stream can't
+	be followed any more. */
+static int receive(struct mt_conn *c, struct rp_plan *plan, int fd)
+{
+	struct rp_read *r;
+	unsigned char *f;
+	uint16_t tid;
+	int n, k, j, len, size;
+	long now;
+
+	n=recv(fd, c->buf+c->nbuf, MT_BUFSIZE-c->nbuf, 0);
+	if (n <= 0) {
+		if (n == -1 && (errno == EINTR || errno == EAGAIN)) return 0;
+		fprintf(stderr, "MODBUS TCP connection lost: %s\n", n == 0 ? "closed by the other end" : strerror(errno));
+		return -1;
+	}
+	c->nbuf+=n;
+	now=ps_now();
+
+	while (c->nbuf >= MBAPSIZE+1) {
+		f=c->buf;
+		len=(f[4] << 8)+f[5];									/* Unit id and PDU */
+		if (f[2] != 0 || f[3] != 0 || len < 2 || len > 254) {
+			fprintf(stderr, "MODBUS TCP stream out of step\n");
+			return -1;
+		}
+		size=6+len;
+		if (c->nbuf < size) break;
+
+		tid=(f[0] << 8)+f[1];
+		for (k=0; k<c->nslots && c->slot[k].tid != tid; k++);
+		if (k == c->nslots) {
+			c->stray++;
+		} else {
+			j=c->slot[k].read;
+			r=&plan->read[j];
+			c->received++;
+			c->lastrtt=now-c->slot[k].sent;
+			c->totalrtt+=c->lastrtt;
+			if (f[6] == r->slave && f[7] == 0x03 && f[8] == 2*r->count && size == 9+2*r->count) {
+				for (n=0; n<r->count; n++) {
+					plan->data[r->offset+n]=(f[9+2*n] << 8)+f[10+2*n];
+				}
+				plan->status[j]=RP_OK;
+			} else {
+				if (f[7] & 0x80) c->exceptions++;
+				plan->status[j]=RP_FAILED;
+			}
+			drop(c, k);
+		}
+		memmove(c->buf, c->buf+size, c->nbuf-size);
+		c->nbuf-=size;
+	}
+
+	return 0;
+}
+
+/* Requests in flight to one device */
+static int inflightto(const struct mt_conn *c, const struct rp_plan *plan, int slave)
+{
+	int k, n;
+
+	n=0;
+	for (k=0; k<c->nslots; k++) {
+		if (plan->read[c->slot[k].read].slave == slave) n++;
+	}
+	return n;
+}
+
+static void drop(struct mt_conn *c, int k)
+{
+	memmove(&c->slot[k], &c->slot[k+1], (c->nslots-k-1)*sizeof(struct mt_slot));
+	c->nslots--;
+}
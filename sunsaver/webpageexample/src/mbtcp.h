@@ -0,0 +1,65 @@
+/*
+ *  mbtcp.h - Pipelined MODBUS TCP reads of a read plan, for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef MBTCP_H
+#define MBTCP_H
+
+#include <stdint.h>
+#include <modbus.h>
+
+#include "readplan.h"
+
+#define MT_MAXWINDOW	16										/* Most requests in flight to one device */
+#define MT_BUFSIZE		1024									/* Receive buffer - a response is at most 9+2*RP_MAXREGS bytes */
+
+/* A request that has been sent and not answered */
+
+struct mt_slot {
+	uint16_t tid;												/* MBAP transaction identifier */
+	int read;													/* Index of the read in the plan */
+	long sent;													/* Monotonic milliseconds */
+};
+
+struct mt_conn {
+	modbus_t *ctx;												/* libmodbus TCP context whose socket is shared */
+	int window;													/* Requests in flight to one device at most */
+	long timeout;												/* Milliseconds to wait for each response */
+	uint16_t tid;												/* Next transaction identifier */
+	int nslots;
+	struct mt_slot slot[RP_MAXREADS];
+	unsigned char buf[MT_BUFSIZE];
+	int nbuf;
+	int broken;													/* The connection failed - reconnect before the next plan */
+	unsigned long sent;
+	unsigned long received;
+	unsigned long timeouts;
+	unsigned long exceptions;									/* MODBUS exception responses */
+	unsigned long stray;										/* Responses that matched no request in flight, e.g. late ones */
+	unsigned long reconnects;
+	int maxinflight;											/* Most requests in flight at once on the connection */
+	long lastrtt;												/* Milliseconds from sending the last request to its response */
+	double totalrtt;
+};
+
+void mt_init(struct mt_conn *c, modbus_t *ctx, int window, long timeout);
+int mt_execute(struct mt_conn *c, struct rp_plan *plan, long deadline);
+
+#endif
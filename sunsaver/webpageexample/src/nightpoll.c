@@ -0,0 +1,136 @@
+/*
+ *  nightpoll.c - Charge state aware polling rate for the acquisition daemon.
+ *
+ *	The host runs off the batteries it monitors, so there is no point in reading the bus every second all night.  Once every
+ *	SunSaver MPPT has been in NIGHT or DISCONNECT with no charging current for NIGHTHOLD seconds, the RAM polling classes are slowed
+ *	to POLLNIGHT.  Full rate comes back as soon as a sample shows a charge state change, a load state change, charging current, or
+ *	a battery voltage that has moved more than NIGHTVB from where it was when the night rate started.  A device whose read failed
+ *	is left out, so its last registers can neither hold the rate up nor bring it back.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "powersystem.h"
+#include "nightpoll.h"
+
+static int isquiet(const struct ss_image *im);
+static void setbase(struct np_state *np, const struct ss_image *im, int i);
+
+void np_init(struct np_state *np, const struct ps_sched *s, int ndevices)
+{
+	int c;
+
+	memset(np, 0, sizeof(struct np_state));
+	np->quietsince=-1;
+	np->lastfast=-1;
+	np->ndevices=ndevices;
+	for (c=0; c<s->nclasses; c++) np->normal[c]=s->cls[c].interval;
+}
+
+/*	Call after every fast sample with the classes read from each device (got).  Adjusts the polling intervals and returns 1 while
+	the daemon is at the night rate. */
+int np_update(struct np_state *np, struct ps_sched *s, const struct ss_image *image, const unsigned int *got, long now)
+{
+	struct rp_plan *plan;
+	float dv;
+	long skipped;
+	unsigned int fresh;
+	int i, c, quiet, changed;
+
+	fresh=0;
+	for (i=0; i<np->ndevices; i++) {
+		if (got[i] & (1 << SS_FAST)) fresh|=1 << i;
+	}
+	if (fresh == 0 && np->ndevices > 0) {
+		np->lastfast=now;										/* Nothing new to go on */
+		return np->quietrate;
+	}
+
+	quiet=!np->keepfast;
+	for (i=0; i<np->ndevices; i++) {
+		if ((fresh & (1 << i)) && !isquiet(&image[i])) quiet=0;
+	}
+
+	if (np->quietrate) {
+		/* Count the fast reads the full rate would have made since the last one */
+		skipped=(now-np->lastfast)/np->normal[SS_FAST]-1;
+		if (np->lastfast >= 0 && skipped > 0) {
+			np->wakeups_saved+=skipped;
+			if ((plan=ps_plan(s, 1 << SS_FAST)) != NULL) np->transactions_saved+=skipped*plan->nreads;
+		}
+
+		changed=0;
+		for (i=0; i<np->ndevices; i++) {
+			if (!(fresh & (1 << i))) continue;
+			if (!(np->based & (1 << i))) {
+				setbase(np, &image[i], i);						/* Wasn't read when the night rate started */
+				continue;
+			}
+			dv=ss_value(&image[i], SS_VB_F)-np->vb[i];
+			if (ss_raw(&image[i], SS_CHARGE_STATE) != np->charge_state[i] || ss_raw(&image[i], SS_LOAD_STATE) != np->load_state[i]
+				|| dv > NIGHTVB || dv < -NIGHTVB) {
+				changed=1;
+			}
+		}
+
+		if (!quiet || changed) {
+			for (c=0; c<s->nclasses; c++) ps_setinterval(s, c, np->normal[c], now);
+			np->quietrate=0;
+			np->snapbacks++;
+			np->quietsince=quiet ? now : -1;					/* Still quiet after a change - wait out NIGHTHOLD again */
+		}
+	} else if (!quiet) {
+		np->quietsince=-1;
+	} else if (np->quietsince < 0) {
+		np->quietsince=now;
+	} else if (now-np->quietsince >= NIGHTHOLD*1000L) {
+		np->based=0;
+		for (i=0; i<np->ndevices; i++) {
+			if (fresh & (1 << i)) setbase(np, &image[i], i);
+		}
+		for (c=0; c<s->nclasses; c++) {
+			if (np->normal[c] < POLLNIGHT) ps_setinterval(s, c, POLLNIGHT, now);
+		}
+		np->quietrate=1;
+		np->slowdowns++;
+	}
+
+	np->lastfast=now;
+	return np->quietrate;
+}
+
+/* A device is quiet when it isn't charging and the charging current is below NIGHTIC */
+static int isquiet(const struct ss_image *im)
+{
+	unsigned int charge_state;
+
+	charge_state=ss_raw(im, SS_CHARGE_STATE);
+	return (charge_state == SS_CS_NIGHT || charge_state == SS_CS_DISCONNECT) && ss_value(im, SS_ADC_IC_F) < NIGHTIC;
+}
+
+/* Remember where a device was when the night rate started */
+static void setbase(struct np_state *np, const struct ss_image *im, int i)
+{
+	np->charge_state[i]=ss_raw(im, SS_CHARGE_STATE);
+	np->load_state[i]=ss_raw(im, SS_LOAD_STATE);
+	np->vb[i]=ss_value(im, SS_VB_F);
+	np->based|=1 << i;
+}
@@ -0,0 +1,50 @@
+/*
+ *  nightpoll.h - Charge state aware polling rate for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef NIGHTPOLL_H
+#define NIGHTPOLL_H
+
+#include "pollsched.h"
+#include "ssmppt.h"
+
+#define NP_MAXDEVICES	8
+
+struct np_state {
+	int quietrate;												/* 1 while the daemon is polling at the night rate */
+	int keepfast;												/* Set by the caller to stay at full rate, e.g. while shedding loads */
+	long quietsince;											/* When every device last became quiet, or -1 while any device is busy */
+	long lastfast;												/* When the fast class was last read */
+	long normal[PS_MAXCLASSES];									/* Intervals to go back to at full rate */
+	int ndevices;
+	unsigned int charge_state[NP_MAXDEVICES];					/* States and battery voltage when the night rate started */
+	unsigned int load_state[NP_MAXDEVICES];
+	float vb[NP_MAXDEVICES];
+	unsigned int based;											/* A bit for each device the three above were read from */
+	unsigned long slowdowns;
+	unsigned long snapbacks;
+	unsigned long wakeups_saved;								/* Fast reads (and daemon wakeups) skipped at the night rate */
+	unsigned long transactions_saved;							/* MODBUS transactions those reads would have used */
+};
+
+void np_init(struct np_state *np, const struct ps_sched *s, int ndevices);
+int np_update(struct np_state *np, struct ps_sched *s, const struct ss_image *image, const unsigned int *got, long now);
+
+#endif
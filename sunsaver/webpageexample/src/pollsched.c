@@ -0,0 +1,254 @@
+/*
+ *  pollsched.c - Multi-rate polling scheduler for the acquisition daemon.
+ *
+ *	Every polling class has its own interval and deadline.  Each cycle reads all the classes whose deadlines have passed, so no
+ *	deadline is ever skipped.  If the reads for the cycle leave time on the bus before the fastest class is due again, classes that
+ *	are close to their deadline are pulled forward into the same plan (prefetched), so a slow class never lands on its own and
+ *	delays a fast sample.  A class whose registers all come back as part of another class's reads is refreshed for free.  A class
+ *	with a read that was deferred to keep the cycle deadline (see breaker.c) stays due.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pollsched.h"
+
+static int covered(const struct rp_plan *plan, const struct ps_class *c);
+static int deferred(const struct rp_plan *plan, const struct ps_class *c);
+
+/* Monotonic clock in milliseconds */
+long ps_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000L+ts.tv_nsec/1000000L;
+}
+
+int ps_init(struct ps_sched *s, const struct rp_cost *cost, float chartime)
+{
+	memset(s, 0, sizeof(struct ps_sched));
+	s->cost=*cost;
+	s->chartime=chartime;
+	s->plans=calloc(1 << PS_MAXCLASSES, sizeof(struct rp_plan));
+	s->built=calloc(1 << PS_MAXCLASSES, 1);
+	if (s->plans == NULL || s->built == NULL) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Add a polling class.  All classes are due straight away.  Returns the class number or -1. */
+int ps_addclass(struct ps_sched *s, const char *name, long interval)
+{
+	struct ps_class *c;
+
+	if (s->nclasses >= PS_MAXCLASSES) {
+		return -1;
+	}
+	c=&s->cls[s->nclasses];
+	memset(c, 0, sizeof(struct ps_class));
+	c->name=name;
+	c->interval=interval;
+	c->next=ps_now();
+
+	return s->nclasses++;
+}
+
+int ps_addfields(struct ps_sched *s, int c, const struct rp_field *fields, int nfields)
+{
+	struct ps_class *pc;
+
+	pc=&s->cls[c];
+	if (pc->nfields+nfields > RP_MAXFIELDS) {
+		return -1;
+	}
+	memcpy(&pc->field[pc->nfields], fields, nfields*sizeof(struct rp_field));
+	pc->nfields+=nfields;
+	memset(s->built, 0, 1 << PS_MAXCLASSES);					/* Any cached plan that includes this class is out of date */
+
+	return 0;
+}
+
+/* The plan that reads every class in mask, or NULL if the fields can't be planned */
+struct rp_plan *ps_plan(struct ps_sched *s, unsigned int mask)
+{
+	struct rp_field fields[RP_MAXFIELDS];
+	int i, n;
+
+	if (!s->built[mask]) {
+		n=0;
+		for (i=0; i<s->nclasses; i++) {
+			if (mask & (1 << i)) {
+				if (n+s->cls[i].nfields > RP_MAXFIELDS) {
+					return NULL;
+				}
+				memcpy(&fields[n], s->cls[i].field, s->cls[i].nfields*sizeof(struct rp_field));
+				n+=s->cls[i].nfields;
+			}
+		}
+		if (rp_build(&s->plans[mask], fields, n, &s->cost) == -1) {
+			return NULL;
+		}
+		s->built[mask]=1;
+	}
+
+	return &s->plans[mask];
+}
+
+/* Pick the classes to read this cycle - every class that is due, plus any that can be prefetched within the bus budget */
+unsigned int ps_select(struct ps_sched *s, long now)
+{
+	struct rp_plan *plan;
+	unsigned int mask, trial;
+	long budget, best;
+	int i, pick;
+
+	mask=0;
+	budget=-1;
+	for (i=0; i<s->nclasses; i++) {
+		if (s->cls[i].next <= now) {
+			mask|=1 << i;
+			if (budget < 0 || s->cls[i].interval < budget) budget=s->cls[i].interval;
+		}
+	}
+	if (mask == 0) {
+		return 0;
+	}
+	budget*=PS_BUSBUDGET;
+
+	/* Pull classes forward in deadline order while the cycle still fits in the budget */
+	for (;;) {
+		pick=-1;
+		best=0;
+		for (i=0; i<s->nclasses; i++) {
+			if ((mask & (1 << i)) || s->cls[i].next-now > s->cls[i].interval/PS_PREFETCH) continue;
+			if (pick < 0 || s->cls[i].next < best) {
+				pick=i;
+				best=s->cls[i].next;
+			}
+		}
+		if (pick < 0) break;
+		trial=mask | (1 << pick);
+		if ((plan=ps_plan(s, trial)) == NULL || plan->cost*s->chartime > budget) break;
+		mask=trial;
+	}
+
+	return mask;
+}
+
+/* Update the deadlines after the plan for mask has been read.  Returns the classes that now hold fresh data. */
+unsigned int ps_done(struct ps_sched *s, unsigned int mask, long now)
+{
+	struct rp_plan *plan;
+	struct ps_class *c;
+	unsigned int fresh;
+	int i;
+
+	plan=ps_plan(s, mask);
+	s->cycles++;
+	for (i=0; i<plan->nreads; i++) {
+		if (plan->status[i] == RP_OK || plan->status[i] == RP_FAILED) s->transactions++;
+	}
+
+	fresh=mask;
+	for (i=0; i<s->nclasses; i++) {
+		c=&s->cls[i];
+		if ((mask & (1 << i)) && deferred(plan, c)) {
+			fresh&=~(1 << i);									/* Read it again in the next cycle */
+		} else if (mask & (1 << i)) {
+			c->polls++;
+			if (c->next > now) {
+				c->prefetches++;
+				c->next=now+c->interval;
+			} else {
+				if (now-c->next >= c->interval) c->late++;
+				c->next+=c->interval;							/* Keep to the schedule rather than drifting */
+				if (c->next <= now) c->next=now+c->interval;
+			}
+		} else if (covered(plan, c)) {
+			c->piggybacks++;
+			c->next=now+c->interval;
+			fresh|=1 << i;
+		}
+	}
+
+	return fresh;
+}
+
+/* Change the interval of a class.  A shorter interval takes effect straight away, a longer one after the next read. */
+void ps_setinterval(struct ps_sched *s, int c, long interval, long now)
+{
+	s->cls[c].interval=interval;
+	if (s->cls[c].next > now+interval) s->cls[c].next=now+interval;
+}
+
+/* Make a class due straight away, e.g. when a fault says its registers have changed */
+void ps_due(struct ps_sched *s, int c, long now)
+{
+	if (s->cls[c].next > now) s->cls[c].next=now;
+}
+
+/* Earliest deadline of any class */
+long ps_nextdue(const struct ps_sched *s)
+{
+	long next;
+	int i;
+
+	next=s->cls[0].next;
+	for (i=1; i<s->nclasses; i++) {
+		if (s->cls[i].next < next) next=s->cls[i].next;
+	}
+	return next;
+}
+
+void ps_free(struct ps_sched *s)
+{
+	free(s->plans);
+	free(s->built);
+}
+
+/* True if every field of the class was read by the plan */
+static int covered(const struct rp_plan *plan, const struct ps_class *c)
+{
+	int i;
+
+	for (i=0; i<c->nfields; i++) {
+		if (rp_find(plan, c->field[i].slave, c->field[i].addr, c->field[i].count) == NULL) {
+			return 0;
+		}
+	}
+	return c->nfields > 0;
+}
+
+/* True if any field of the class was left for the next cycle */
+static int deferred(const struct rp_plan *plan, const struct ps_class *c)
+{
+	int i;
+
+	for (i=0; i<c->nfields; i++) {
+		if (rp_status(plan, c->field[i].slave, c->field[i].addr, c->field[i].count) == RP_DEFERRED) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ *  pollsched.h - Multi-rate polling scheduler for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef POLLSCHED_H
+#define POLLSCHED_H
+
+#include "readplan.h"
+
+#define PS_MAXCLASSES	8										/* Maximum number of polling classes */
+#define PS_PREFETCH		4										/* A class may be read early in the last 1/PS_PREFETCH of its interval */
+#define PS_BUSBUDGET	0.75									/* Fraction of the fastest interval that a cycle may use on the bus */
+
+/* A polling class is a set of fields (from any number of devices) that is read on one interval */
+
+struct ps_class {
+	const char *name;
+	long interval;												/* Milliseconds between reads */
+	long next;													/* Deadline for the next read (monotonic milliseconds) */
+	int nfields;
+	struct rp_field field[RP_MAXFIELDS];
+	unsigned long polls;										/* Reads of this class */
+	unsigned long prefetches;									/* Reads made early because the bus had time to spare */
+	unsigned long piggybacks;									/* Refreshes for free because another class's reads covered this class */
+	unsigned long late;											/* Reads that started after the deadline had passed a whole interval */
+};
+
+struct ps_sched {
+	int nclasses;
+	struct ps_class cls[PS_MAXCLASSES];
+	struct rp_cost cost;
+	float chartime;												/* Milliseconds per character on the bus */
+	struct rp_plan *plans;										/* One plan per combination of classes, built the first time it is needed */
+	unsigned char *built;
+	unsigned long cycles;
+	unsigned long transactions;
+};
+
+long ps_now(void);
+int ps_init(struct ps_sched *s, const struct rp_cost *cost, float chartime);
+int ps_addclass(struct ps_sched *s, const char *name, long interval);
+int ps_addfields(struct ps_sched *s, int c, const struct rp_field *fields, int nfields);
+struct rp_plan *ps_plan(struct ps_sched *s, unsigned int mask);
+unsigned int ps_select(struct ps_sched *s, long now);
+unsigned int ps_done(struct ps_sched *s, unsigned int mask, long now);
+void ps_setinterval(struct ps_sched *s, int c, long interval, long now);
+void ps_due(struct ps_sched *s, int c, long now);
+long ps_nextdue(const struct ps_sched *s);
+void ps_free(struct ps_sched *s);
+
+#endif
@@ -27,7 +27,9 @@
 #define SUNSAVERMPPT	0x01									/* MODBUS Address of the SunSaver MPPT */
 #define SUNSAVERDUO		0x01									/* MODBUS Address of the SunSaver Duo */
 #define TRISTARPWM		0x01									/* MODBUS Address of the TriStar PWM */
+#define TRISTARMPPT		0x01									/* MODBUS Address of the TriStar MPPT */
 #define SURESINE		0x01									/* MODBUS Address of the SureSine-300 */
+#define RELAYDRIVER		0x09									/* MODBUS Address of the Relay Driver */
 
 
 /*	Battery voltage settings for the daily graph - This changes the scale for graphing the voltage. */
@@ -55,6 +57,12 @@
 /*	Device and file path settings */
 
 #define SERIALPORTPATH	"/dev/ttyUSB0"							/* Path to appropriate serial port - typically /dev/ttyS0 for physical port or /dev/ttyUSB0 for USB-serial cable */
+#define SURESINEPORT	"/dev/ttyUSB1"							/* Serial port of the SureSine-300 for suresinecapture - it needs a port to itself */
+#define MODBUSTCPHOST	""										/* Host name or address of a MODBUS TCP gateway or TriStar MPPT for powersystemd
+																	to poll instead of SERIALPORTPATH, or "" for the serial port */
+#define MODBUSTCPPORT	502
+#define TCPWINDOW		4										/* Requests powersystemd keeps in flight to each device over MODBUS TCP */
+#define TCPTIMEOUT		1000									/* Milliseconds to wait for each MODBUS TCP response */
 
 #define LOGFILEPATH		"/home/tom/test/powersystem/log"		/* Path to directory to store log files - you need to create this directory
 																	You also need to create subdirectories with the year number (e.g, 2014, 2015, 2016, ...),
@@ -66,3 +74,161 @@
 																	since the daily graphs and daily log files are stored here. */
 
 #define MAINWEBPAGENAME	"index.html"							/* File name of the main power system status web page */
+
+
+/*	Acquisition daemon (powersystemd) settings - powersystemd keeps the serial port open and reads each class of SunSaver MPPT
+	registers on its own interval.  While it is running, powersystemstatus takes the latest registers from the daemon instead of
+	reading the serial port, and the daemon writes the daily log file. */
+
+#define DAEMONDEVICES	{ SUNSAVERMPPT }						/* MODBUS addresses of the SunSaver MPPTs polled by the daemon (0 = none) */
+#define DAEMONTRISTARS	{ 0 }									/* MODBUS addresses of the TriStar MPPTs polled by the daemon (0 = none),
+																	e.g. { TRISTARMPPT }.  They are read with the SunSaver MPPTs, on the
+																	same intervals */
+#define LOGTRISTAR		0										/* 1 to log the first TriStar MPPT instead of the first SunSaver MPPT to the
+																	log file and daily log.  The first TriStar MPPT is logged anyway when
+																	there are no SunSaver MPPTs */
+
+#define POLLFAST		1000									/* Milliseconds between reads of voltages, currents, power, states and faults */
+#define POLLTEMP		30000									/* Milliseconds between reads of temperatures */
+#define POLLSLOW		60000									/* Milliseconds between reads of counters, daily values and sweep results */
+#define POLLEEPROM		86400000								/* Milliseconds between reads of the EEPROM settings */
+
+#define POLLNIGHT		60000									/* Milliseconds between reads of the RAM registers at night.  The daemon slows
+																	to this rate when every SunSaver MPPT has been in NIGHT or DISCONNECT
+																	for NIGHTHOLD seconds, and goes back to full rate on a change of
+																	charge or load state, charging current, or a battery voltage change */
+#define NIGHTHOLD		300										/* Seconds of night before slowing down */
+#define NIGHTIC			0.05									/* Charging current (A) below which the array counts as dark */
+#define NIGHTVB			0.10									/* Battery voltage change (V) that brings back full rate */
+
+#define LOGEXCEPTION	1										/* 1 - log by exception: write a row only when a column moves more than its
+																	deadband or LOGHEARTBEAT seconds pass.  0 - write a row every LOGINTERVAL */
+#define LOGINTERVAL		300										/* Seconds between rows in the daily log file */
+#define LOGHEARTBEAT	900										/* Longest time between rows when logging by exception */
+#define LOGDEADBANDS	{ 0.02, 0.20, 0.02, 0.05, 0.05, 1.0, 0.1, 0.1, 0.0, 0.0 }
+																/* Deadbands for Vb (V), Va (V), Vl (V), Ic (A), Il (A), Power_out (W),
+																	Ahc_daily (Ah), Ahl_daily (Ah), charge_state and load_state */
+#define LOGSYNCINTERVAL	86400									/* Seconds between checks for new records in the SunSaver MPPT daily log.  The
+																	daemon also checks when it starts, and as soon as the charge state goes
+																	to NIGHT with the charging current below NIGHTIC, which is when the
+																	SunSaver MPPT writes a record.  Each check is one read, plus one per new
+																	record, made between polls */
+#define LOGSYNCRETRY	300										/* Seconds before trying again after a failed check */
+#define LOGSYNCWAIT		60										/* Seconds between checks after NIGHT until the new record shows up */
+#define LOGSYNCTRIES	10										/* Checks after NIGHT before waiting for LOGSYNCINTERVAL */
+#define ENERGYINTERVAL	300										/* Seconds between rows of the energy file, from the amp-hour and kWh
+																	counters.  Make it a multiple of POLLSLOW/1000 */
+#define ENERGYMAXAMPS	60										/* Highest current (A) a charge controller can count - a bigger rise of a
+																	counter between two reads is taken as a bad read */
+#define STATSWINDOWS	{ 60, 900, 3600 }						/* Seconds of each rolling window the daemon keeps the minimum, maximum, mean
+																	and standard deviation of Vb, Va, Vl, Ic, Il, Power_out and the load power
+																	over, for the metrics and the status page (at most 4) */
+#define STATSSTEP		1000									/* Shortest time (ms) between samples in the rolling windows */
+#define RESIDENCYVB		{ 10.0, 0.1, 60 }						/* Battery voltage residency histogram kept for each day: lowest voltage, bin
+																	width (V) and number of bins - double them for a 24 V battery.  See
+																	sketch.c */
+#define RESIDENCYPOWER	{ 0.0, 10.0, 100 }						/* The same for the charging and load power (W) */
+#define SKETCHSAVE		3600									/* Seconds between saves of the day's sketches, which are also saved at
+																	midnight and when the daemon stops */
+#define CYCLEDEADLINE	800										/* Longest time (ms) one polling cycle may use the bus.  A read only starts
+																	if it would end in time even after a whole response timeout; reads that
+																	don't fit are made in the next cycle */
+#define BREAKERFAILS	2										/* Failed cycles in a row before a device is taken out of service */
+#define BREAKERBACKOFF	5000									/* Milliseconds before the first probe of a device out of service */
+#define BREAKERMAXBACKOFF	300000								/* Longest time (ms) between probes - the time doubles after each failed probe */
+#define FLIGHTPRE		60										/* Seconds of full rate samples kept in memory for the flight recorder.  A
+																	new fault or alarm bit, a charge state change or a sweep result that moves
+																	more than FLIGHTSWEEP percent adds them to LOGFILEPATH/YYYY/YYYYMMDDevents.txt,
+																	with the FLIGHTPOST seconds after it at FLIGHTBURST */
+#define FLIGHTPOST		30										/* Seconds recorded after a trigger */
+#define FLIGHTBURST		200										/* Milliseconds between fast reads while recording */
+#define FLIGHTSWEEP		10										/* Percent change of Sweep_Pmax or Sweep_Vmp that triggers a record */
+#define FLIGHTHOLDOFF	300										/* Seconds after a record before another can be triggered */
+#define METRICSINTERVAL	10										/* Seconds between updates of the daemon metrics file */
+#define SNAPSHOTAGE		180										/* Seconds after which the tools take the daemon's registers, state of charge
+																	and rolling windows as stale.  Whether the daemon is running comes from
+																	DAEMONPIDFILE, not from this. */
+#if SNAPSHOTAGE*1000 < 2*POLLNIGHT
+#error "SNAPSHOTAGE must be at least twice POLLNIGHT, or every reading goes stale at night"
+#endif
+
+#define JOURNALFILE		LOGFILEPATH "/powersystemd.journal"	/* Journal the daemon commits log rows to before appending them to the log files */
+#define JOURNALBLOCKS	256										/* Size of the journal in 4 kB blocks - it is reused from the start when full */
+#define JOURNALFLUSH	300										/* Longest time (seconds) a row waits in memory before it is committed.  This
+																	is how many seconds of rows a power loss can take.  Rows are also committed
+																	straight away when the load goes into LVD_WARNING or LVD */
+#define JOURNALSIZE		16384									/* Commit when this many bytes of rows are waiting */
+#define EVENTINDEX		LOGFILEPATH "/eventindex.txt"			/* When each alarm, fault and state was first and last seen, for eventlookup */
+
+#define PROVISIONSETTLE	500										/* Milliseconds sunsaverprovision gives the EEPROMs to finish writing before
+																	reading them back */
+#define SCANTIMEOUT		40										/* Starting response timeout (ms) for each address busscan tries.  A
+																	SunSaver MPPT answers in about 30 ms at 9600 baud */
+
+#define SURGEIAC		3.0										/* AC current (A) over which suresinecapture counts a surge - a SureSine-300
+																	gives about 2.6 A at 115 V continuous */
+#define SURGEHYST		0.3										/* The surge ends when the current drops this far (A) below SURGEIAC */
+#define SURGEVAC		115										/* AC voltage for the surge energy if the SureSine's setting can't be read */
+#define SURGETIMEOUT	100										/* Response timeout (ms) for suresinecapture's reads */
+
+#define RUNFILEPATH		"/run/powersystem"						/* Directory for the daemon's latest registers and metrics - use a tmpfs
+																	directory so the once a second updates don't wear out an SD card */
+#define DAEMONPIDFILE	RUNFILEPATH "/powersystemd.pid"			/* powersystemd keeps this locked while it runs, which is how the tools know */
+#define CMDFIFO			RUNFILEPATH "/command"					/* FIFO powersystemcmd sends register and coil writes to the daemon through */
+#define CMDRESULTS		RUNFILEPATH "/commands.txt"				/* The daemon adds the result of each command here */
+#define CMDRESULTSSIZE	8192									/* Bytes CMDRESULTS can grow to before the older half of it is dropped */
+#define CMDTIMEOUT		5										/* Seconds powersystemcmd waits for the daemon to write a command */
+
+
+/*	Load shedding (powersystemd) - the daemon can switch loads off one at a time as the battery runs down, least important first,
+	so the important ones stay up longer than the SunSaver MPPT's own low voltage disconnect would let them.  Each rule is a load:
+	{ name, MODBUS id, CQ_COIL or CQ_REG, coil or register address, value that sheds it, value that restores it, shed voltage,
+	restore voltage }.  List them least important first - that is the order they are shed in, and they come back in reverse.  The
+	Relay Driver's relays are coils 0-3 (1 closes the relay), and the SunSaver MPPT's load disconnect is coil 1 (1 is off). */
+
+#define LOADSHED		0										/* 1 - shed loads by SHEDRULES.  0 - leave it to the charge controllers */
+#define SHEDRULES		{ { "lights", RELAYDRIVER, CQ_COIL, 0x0000, 0, 1, 12.20, 12.80 }, \
+						  { "pump", RELAYDRIVER, CQ_COIL, 0x0001, 0, 1, 12.00, 12.80 }, \
+						  { "load", SUNSAVERMPPT, CQ_COIL, 0x0001, 1, 0, 11.80, 12.60 } }
+#define SHEDHOLD		2000									/* Milliseconds the voltage must stay under a shed voltage before a load goes */
+#define SHEDRESTOREHOLD	300										/* Seconds the voltage must stay over a restore voltage before the load comes back */
+#define SHEDCHARGING	1										/* 1 - only restore loads while a charge controller is charging */
+#define SHEDSETTLE		10000									/* Milliseconds after switching a load before the next one is switched */
+#define SHEDIRCOMP		0.010									/* Ohms of battery and wiring resistance - the voltage is raised by this times
+																	the total load current, so a heavy load doesn't look like a flat battery */
+#define SHEDMARGIN		0.30									/* Volts above the highest shed voltage at which sampling speeds up */
+#define SHEDPOLL		250										/* Milliseconds between fast reads while near a shed voltage or with loads shed */
+#define SHEDMAXREACTION	1000									/* Sheds that take longer than this (ms) from the sample to the read back are
+																	counted and reported */
+
+/*	Alerts (powersystemd) - rules on the SunSaver MPPT channels, each "[id:]channel op value [for time]" (see alerts.c), such as
+	"Vb < 11.8 for 10m" or "load_state == LVD_WARNING".  A rule that fires or clears is sent to each of ALERTSINKS: file:path appends
+	a line to a file, unix:path sends it to a datagram socket and exec:command runs a command with it in ALERT_LINE. */
+
+#define ALERTRULES		{ "Vb < 11.8 for 10m", "Ths > 70", "load_state == LVD_WARNING", "alarm has RTS miswire" }
+#define ALERTSINKS		{ "file:" LOGFILEPATH "/alerts.txt" }
+
+/*	Derived channels (powersystemd, powersystemstatus) - each "Name = expression" over the log columns Vb, Va, Vl, Ic, Il, Power_out,
+	Ahc_daily, Ahl_daily, charge_state and load_state, and Ia and Power_in, which only a TriStar MPPT measures and are 0 for a
+	SunSaver MPPT (see derived.c).  sum(x) adds x up over the controllers read together.  Load_power is the load power used by
+	the rolling windows, the sketches and the status page. */
+
+#define DERIVEDCHANNELS	{ "Load_power = Vl*Il", "Array_power = Va*Ia", "Efficiency = 100*Power_out/Array_power", \
+						  "Net_battery_current = Ic-Il", "Charge_power_total = sum(Power_out)" }
+
+/*	State of charge (powersystemd, powersystemstatus) - counted from the amp-hour counters and set again from the voltage at rest
+	and in FLOAT (see soc.c).  Each of SOCBANKS is the MODBUS ids of the controllers charging a battery bank and its capacity in
+	amp-hours at 25 C, such as "1,2:200". */
+
+#define SOCBANKS		{ "1:100" }
+#define SOCCHARGEEFF	0.95									/* Fraction of the amp-hours charged that the battery keeps */
+#define SOCTEMPCAP		0.006									/* Change of capacity a degree C from 25 C */
+#define SOCRESTAMPS		0.20									/* Charging and load current (A) under which the battery is at rest */
+#define SOCRESTHOLD		3600									/* Seconds at rest before the voltage is taken as the open circuit voltage */
+#define SOCFLOATHOLD	600										/* Seconds in FLOAT before the battery is taken as full */
+#define SOCOCV			{ 11.40, 11.55, 11.70, 11.84, 11.98, 12.10, 12.23, 12.36, 12.49, 12.61, 12.73 }
+																/* Open circuit voltage of a 12 V battery at 25 C at 0, 10, ... 100 % */
+#define SOCOCVTEMPCO	0.0015									/* Change of the open circuit voltage (V) a degree C from 25 C */
+#define SOCSTATE		LOGFILEPATH "/socstate.txt"				/* Where the state of charge is kept across restarts */
+#define SOCSAVE			900										/* Seconds between saves of SOCSTATE, which is also saved on a resync and
+																	at shutdown */
@@ -0,0 +1,188 @@
+/*
+ *  powersystemcmd.c - This program writes a coil or register on a Morningstar device, e.g. to turn the SunSaver MPPT load off.
+ *
+ *	Usage: powersystemcmd [-u | -n] load on|off
+ *	       powersystemcmd [-u | -n] relay 1-4 on|off
+ *	       powersystemcmd [-u | -n] id coil|reg addr value
+ *
+ *	If powersystemd holds its pid file lock the command goes through its command queue (see cmdqueue.c), even at night or while
+ *	the device's breaker is open; otherwise it goes straight to the serial port.
+ *	"load off" is urgent (-u), so the daemon writes it between two reads instead of after the polling cycle; everything else waits
+ *	for the end of the cycle unless -u is given.  -n makes "load off" wait too.  Every write is read back to confirm it.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` powersystemcmd.c cmdqueue.c pollsched.c readplan.c daemonlock.c -o powersystemcmd */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <modbus.h>
+
+#include "powersystem.h"
+#include "cmdqueue.h"
+#include "pollsched.h"
+#include "daemonlock.h"
+
+#define LOADCOIL		0x0001									/* SunSaver MPPT load disconnect coil - 1 turns the load off */
+
+int sendtodaemon(const struct cq_cmd *cmd);
+int writedirect(const struct cq_cmd *cmd);
+
+int main(int argc, char *argv[])
+{
+	struct cq_cmd cmd;
+	int a, priority, on;
+
+	a=1;
+	priority=-1;
+	if (a < argc && strcmp(argv[a], "-u") == 0) {
+		priority=CQ_URGENT;
+		a++;
+	} else if (a < argc && strcmp(argv[a], "-n") == 0) {
+		priority=CQ_NORMAL;
+		a++;
+	}
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.type=CQ_COIL;
+	if (argc-a == 2 && strcmp(argv[a], "load") == 0) {
+		on=(strcmp(argv[a+1], "on") == 0);
+		cmd.slave=SUNSAVERMPPT;
+		cmd.addr=LOADCOIL;
+		cmd.value=!on;
+		cmd.priority=on ? CQ_NORMAL : CQ_URGENT;				/* Shedding the load is the one that can't wait */
+	} else if (argc-a == 3 && strcmp(argv[a], "relay") == 0 && atoi(argv[a+1]) >= 1 && atoi(argv[a+1]) <= 4) {
+		cmd.slave=RELAYDRIVER;
+		cmd.addr=atoi(argv[a+1])-1;
+		cmd.value=(strcmp(argv[a+2], "on") == 0);
+		cmd.priority=CQ_NORMAL;
+	} else if (argc-a == 4) {
+		cmd.slave=strtol(argv[a], NULL, 0);
+		cmd.type=(strcmp(argv[a+1], "reg") == 0) ? CQ_REG : CQ_COIL;
+		if (cmd.slave < 1 || cmd.slave > 247 || (cmd.type == CQ_COIL && strcmp(argv[a+1], "coil") != 0)) {
+			fprintf(stderr, "Give a MODBUS id, coil or reg, an address and a value\n");
+			return -1;
+		}
+		cmd.addr=strtol(argv[a+2], NULL, 0);
+		cmd.value=strtol(argv[a+3], NULL, 0);
+		if (cmd.type == CQ_COIL) cmd.value=(cmd.value != 0);
+		cmd.priority=CQ_NORMAL;
+	} else {
+		fprintf(stderr, "Usage: %s [-u | -n] load on|off\n", argv[0]);
+		fprintf(stderr, "       %s [-u | -n] relay 1-4 on|off\n", argv[0]);
+		fprintf(stderr, "       %s [-u | -n] id coil|reg addr value\n", argv[0]);
+		return -1;
+	}
+	if (priority != -1) cmd.priority=priority;
+	cmd.submitted=ps_now();
+	sprintf(cmd.tag, "%d.%ld", (int) getpid(), cmd.submitted);
+
+	if (dl_running()) return sendtodaemon(&cmd);
+	return writedirect(&cmd);
+}
+
+/* Hand the command to powersystemd and wait for its result */
+int sendtodaemon(const struct cq_cmd *cmd)
+{
+	FILE *infile;
+	char line[CQ_LINESIZE], tag[CQ_TAGSIZE], result[16];
+	struct stat st;
+	long offset, latency, wait;
+	ino_t ino;
+	int fd, len, i;
+
+	/* Results already in the file are someone else's */
+	offset=0;
+	ino=0;
+	if (stat(CMDRESULTS, &st) == 0) {
+		offset=st.st_size;
+		ino=st.st_ino;
+	}
+
+	if ((fd = open(CMDFIFO, O_WRONLY | O_NONBLOCK)) == -1) {
+		fprintf(stderr, "Unable to open %s: %s\n", CMDFIFO, strerror(errno));
+		return -1;
+	}
+	len=snprintf(line, sizeof(line), "%d %d %s %d %d %ld %s\n", cmd->priority, cmd->slave, cmd->type == CQ_COIL ? "coil" : "reg",
+				 cmd->addr, cmd->value, cmd->submitted, cmd->tag);
+	if (write(fd, line, len) != len) {									/* Less than PIPE_BUF, so it goes in whole or not at all */
+		fprintf(stderr, "Unable to send the command: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	/* Look for the result every 10 ms */
+	for (i=0; i<CMDTIMEOUT*100; i++) {
+		usleep(10000);
+		if ((infile = fopen(CMDRESULTS, "r")) == NULL) continue;
+		if (fstat(fileno(infile), &st) == 0 && st.st_ino != ino) {
+			offset=0;											/* The daemon cut the file back - the tags are unique, so read it all */
+			ino=st.st_ino;
+		}
+		fseek(infile, offset, SEEK_SET);
+		while (fgets(line, sizeof(line), infile) != NULL) {
+			if (sscanf(line, "%31s %15s %ld %ld", tag, result, &latency, &wait) == 4 && strcmp(tag, cmd->tag) == 0) {
+				fclose(infile);
+				printf("%s in %ld ms (%ld ms in the queue)\n", result, latency, wait);
+				return (strcmp(result, "ok") == 0) ? 0 : -1;
+			}
+		}
+		fclose(infile);
+	}
+
+	fprintf(stderr, "powersystemd didn't write the command within %d seconds\n", CMDTIMEOUT);
+	return -1;
+}
+
+/* Write the command on the serial port */
+int writedirect(const struct cq_cmd *cmd)
+{
+	modbus_t *ctx;
+	int result;
+
+	/* Set up a new MODBUS context */
+	ctx = modbus_new_rtu(SERIALPORTPATH, 9600, 'N', 8, 2);
+	if (ctx == NULL) {
+		fprintf(stderr, "Unable to create the libmodbus context\n");
+		return -1;
+	}
+
+	/* Open the MODBUS connection */
+	if (modbus_connect(ctx) == -1) {
+		fprintf(stderr, "Connection failed: %s\n", modbus_strerror(errno));
+		modbus_free(ctx);
+		return -1;
+	}
+
+	result=cq_write(ctx, cmd);
+	printf("%s in %ld ms\n", result == CQ_OK ? "ok" : result == CQ_MISMATCH ? "mismatch" : "failed", ps_now()-cmd->submitted);
+
+	/* Close the MODBUS connection */
+	modbus_close(ctx);
+	modbus_free(ctx);
+
+	return (result == CQ_OK) ? 0 : -1;
+}
@@ -0,0 +1,1024 @@
+/*
+ *  powersystemd.c - Acquisition daemon that keeps the serial port open and polls the SunSaver MPPT registers at several rates.
+ *
+ *	Voltages, currents, power, states and faults are read every POLLFAST milliseconds.  Temperatures, counters and daily values
+ *	change slowly and are read on their own, longer intervals, and the EEPROM once a day.  The latest registers are written to
+ *	RUNFILEPATH for powersystemstatus.  Rows are added to the daily log file by exception (see rbelog.c), or every LOGINTERVAL
+ *	seconds if LOGEXCEPTION is 0, and reach the log file in group commits through a journal (see journal.c).  At night the RAM
+ *	registers are read every POLLNIGHT milliseconds instead (see nightpoll.c).  New records in the SunSaver MPPT's own daily log
+ *	are copied to the daily log file one small read at a time, in the gaps between polls (see logsync.c).  The SunSaver MPPT
+ *	writes a record when it goes to NIGHT, so that transition starts a copy straight away and dailylog isn't needed in cron.
+ *	Each EEPROM read is kept as a versioned snapshot for the tools (see eecache.c).  A device that stops answering is taken out
+ *	of service and probed now and then, and no cycle runs past CYCLEDEADLINE, so the other devices keep their rate (see breaker.c).
+ *	Other programs send register and coil writes through CMDFIFO, and urgent ones go between the reads of a cycle (see cmdqueue.c).
+ *	With LOADSHED set, loads are shed one at a time as the battery runs down and restored as it recovers (see loadshed.c).
+ *	Faults, charge state changes and new sweep results save the full rate samples around them to an events file (see flightrec.c).
+ *	TriStar MPPTs on the same bus are read with the SunSaver MPPTs, scaled by the V_PU and I_PU read once per connection (see
+ *	tsmppt.c), and one of them can be the device logged.  With MODBUSTCPHOST set the devices are polled over MODBUS TCP instead,
+ *	with several reads in flight at once (see mbtcp.c).  Energy charged and used is worked out from the amp-hour and kWh
+ *	counters, so it is exact however slowly they are read, and written to an energy file every ENERGYINTERVAL (see energy.c).
+ *	Rolling minimum, maximum, mean and standard deviation of the main channels over each of STATSWINDOWS are kept up to date on
+ *	every fast read (see rollstats.c) and written with the metrics and to RUNFILEPATH/stats<id>.txt for powersystemstatus.
+ *	The time spent at each battery voltage and power goes into quantile sketches and residency histograms for the day, saved
+ *	to LOGFILEPATH/YYYY/YYYYMMDDsketch.txt for sketchquery (see sketch.c).  Each alarm or fault bit that sets or clears and each
+ *	charge, load and LED state change is a row in LOGFILEPATH/YYYY/YYYYeventlog.txt, and EVENTINDEX keeps when each was first
+ *	and last seen for eventlookup (see events.c).  ALERTRULES are evaluated as the channels they use change and notify ALERTSINKS
+ *	when they fire or clear (see alerts.c).  DERIVEDCHANNELS, such as load power and the charging power of all the controllers,
+ *	are worked out for the devices of each fast read together and put in the metrics (see derived.c).  The state of charge of
+ *	each of SOCBANKS is counted from the amp-hour counters and set again from the voltage at rest and in FLOAT, kept in
+ *	SOCSTATE across restarts and written to RUNFILEPATH/soc.txt for powersystemstatus (see soc.c).
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` powersystemd.c ssmppt.c pollsched.c nightpoll.c rbelog.c journal.c daemonlock.c logsync.c dailylogpage.c eecache.c breaker.c cmdqueue.c loadshed.c flightrec.c tsmppt.c mbtcp.c energy.c rollstats.c sketch.c events.c alerts.c derived.c soc.c readplan.c -o powersystemd -lm
+
+ Start it at boot, e.g. from /etc/rc.local:
+
+ /home/tom/powersystem/bin/powersystemd &
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <modbus.h>
+
+#include "powersystem.h"
+#include "readplan.h"
+#include "pollsched.h"
+#include "ssmppt.h"
+#include "nightpoll.h"
+#include "rbelog.h"
+#include "journal.h"
+#include "daemonlock.h"
+#include "logsync.h"
+#include "dailylogpage.h"
+#include "eecache.h"
+#include "breaker.h"
+#include "cmdqueue.h"
+#include "loadshed.h"
+#include "flightrec.h"
+#include "tsmppt.h"
+#include "mbtcp.h"
+#include "energy.h"
+#include "rollstats.h"
+#include "sketch.h"
+#include "events.h"
+#include "alerts.h"
+#include "derived.h"
+#include "soc.h"
+
+#define MAXDEVICES	8
+#define LOGCOLS		10											/* Vb, Va, Vl, Ic, Il, Power_out, Ahc_daily, Ahl_daily, charge_state, load_state */
+
+static const int ssids[] = DAEMONDEVICES;
+static const int tsids[] = DAEMONTRISTARS;
+static const long intervals[SS_NCLASSES] = { POLLFAST, POLLTEMP, POLLSLOW, POLLEEPROM };
+static const char *classnames[SS_NCLASSES] = { "fast", "temp", "slow", "eeprom" };
+static const float deadbands[LOGCOLS] = LOGDEADBANDS;
+static const struct sh_rule shedrules[] = SHEDRULES;
+static const char *alertrules[] = ALERTRULES;
+static const char *alertsinks[] = ALERTSINKS;
+static const char *derivedchannels[] = DERIVEDCHANNELS;
+static const char *socbanks[] = SOCBANKS;
+
+static volatile sig_atomic_t running = 1;
+static struct jn_journal journal;
+static struct cq_queue cq;
+static struct sh_ctl shed;
+static struct fr_recorder fr;
+static struct mt_conn tcp;
+static struct en_meter meters[MAXDEVICES];						/* SunSaver MPPTs, then TriStar MPPTs, as in devices */
+static struct rs_stats stats[MAXDEVICES];						/* The same */
+static const long statswindows[] = STATSWINDOWS;
+static struct sk_day sketches[MAXDEVICES];						/* The same */
+static struct ev_engine events;									/* SunSaver MPPTs only */
+static struct al_engine alerts;									/* The same */
+static struct dv_set derived;
+static float dvvalues[MAXDEVICES][DV_MAXCHANNELS];				/* Derived channels of each device as last read, as in devices */
+static int dvvalid[MAXDEVICES];
+static int dvload;												/* The Load_power channel, or -1 */
+static struct soc_estimator soc;
+
+static void stop(int sig);
+static void writesnapshot(const struct ss_image *im, time_t t);
+static void writetristar(const struct ts_image *im, time_t t);
+static void logvalues(const struct ss_image *im, float *values);
+static void tslogvalues(const struct ts_image *im, float *values);
+static int writelogrow(const float *values, time_t t, int seconds);
+static void writeenergyrow(const struct en_meter *m, time_t t);
+static void addstats(struct rs_stats *st, const float *values, const float *dv, long now);
+static void writestats(struct rs_stats *st, time_t t, long now);
+static void addsketch(struct sk_day *d, const float *values, const float *dv, long now);
+static void savesketches(int n);
+static void loadsketches(int n);
+static void savesoc(time_t t);
+static long dateof(time_t t);
+static void writedailylogpage(time_t t);
+static void writemetrics(const struct ps_sched *s, const struct np_state *np, const struct rbe_log *rbe,
+						 const struct ls_sync *ls, const struct ee_cache *ee, const struct br_set *br, int ndevices,
+						 const struct ts_image *tsimage, int ntristars, long uptime, unsigned long errors, time_t t);
+
+int main(void)
+{
+	modbus_t *ctx;
+	struct rp_cost cost;
+	struct rp_field fields[RP_MAXFIELDS];
+	struct ps_sched sched;
+	struct rp_plan *plan;
+	struct ss_image image[MAXDEVICES];
+	struct ts_image tsimage[MAXDEVICES];
+	struct ee_cache ee[MAXDEVICES];
+	struct br_set br;
+	struct np_state np;
+	struct rbe_log rbe;
+	struct ls_sync ls;
+	struct ls_record rec;
+	float values[LOGCOLS], batch[MAXDEVICES][DV_NINPUTS], dvout[MAXDEVICES][DV_MAXCHANNELS];
+	struct pollfd pfd;
+	unsigned int mask, fresh, got[MAXDEVICES], tsgot[MAXDEVICES];
+	uint32_t tosec, tousec;
+	unsigned long errors;
+	int devices[MAXDEVICES], batchdev[MAXDEVICES];
+	int i, j, b, c, n, nbatch, synced, lockfd, ndevices, ntristars, logts, logdev, logged, haveslow, nightarmed, nighttries, recording;
+	long now, start, next, steptime, fast;
+	time_t t, lastmetrics, lastenergy, lastsketch, lastsoc, nextsync, recwhen;
+#if (LOGEXCEPTION)
+	time_t lastsample;
+#else
+	time_t lastlog;
+#endif
+
+	/* The SunSaver MPPTs, then the TriStar MPPTs */
+	ndevices=0;
+	ntristars=0;
+	for (i=0; i<sizeof(ssids)/sizeof(ssids[0]); i++) {
+		if (ssids[i] != 0) ndevices++;
+	}
+	for (i=0; i<sizeof(tsids)/sizeof(tsids[0]); i++) {
+		if (tsids[i] != 0) ntristars++;
+	}
+	if (ndevices+ntristars > MAXDEVICES) {
+		fprintf(stderr, "Too many devices in DAEMONDEVICES and DAEMONTRISTARS\n");
+		return -1;
+	}
+	if (ndevices+ntristars == 0) {
+		fprintf(stderr, "No devices in DAEMONDEVICES or DAEMONTRISTARS\n");
+		return -1;
+	}
+	n=0;
+	for (i=0; i<sizeof(ssids)/sizeof(ssids[0]); i++) {
+		if (ssids[i] != 0) devices[n++]=ssids[i];
+	}
+	for (i=0; i<sizeof(tsids)/sizeof(tsids[0]); i++) {
+		if (tsids[i] != 0) devices[n++]=tsids[i];
+	}
+	logts=(ntristars > 0 && (LOGTRISTAR || ndevices == 0));
+	logdev=logts ? ndevices : 0;								/* Index of the logged device in devices */
+
+	signal(SIGTERM, stop);
+	signal(SIGINT, stop);
+	mkdir(RUNFILEPATH, 0755);
+	if ((lockfd = dl_acquire()) == -1) {
+		fprintf(stderr, "powersystemd is already running, or %s can't be opened\n", DAEMONPIDFILE);
+		return -1;
+	}
+	if (cq_open(&cq, CMDFIFO) == -1) {
+		fprintf(stderr, "Unable to open %s - commands won't be taken: %s\n", CMDFIFO, strerror(errno));
+	}
+
+	/* Set up a new MODBUS context */
+	if (MODBUSTCPHOST[0] != '\0') {
+		ctx = modbus_new_tcp(MODBUSTCPHOST, MODBUSTCPPORT);
+	} else {
+		ctx = modbus_new_rtu(SERIALPORTPATH, 9600, 'N', 8, 2);
+	}
+	if (ctx == NULL) {
+		fprintf(stderr, "Unable to create the libmodbus context\n");
+		return -1;
+	}
+
+	/* Open the MODBUS connection to the SunSaver MPPTs and TriStar MPPTs */
+	if (modbus_connect(ctx) == -1) {
+		fprintf(stderr, "Connection failed: %s\n", modbus_strerror(errno));
+		modbus_free(ctx);
+		return -1;
+	}
+
+	/* One polling class per rate, each holding its fields from every device */
+	rp_rtucost(&cost, 9600, 11, RP_RESPONSETIME);
+	if (ps_init(&sched, &cost, 11*1000.0/9600) == -1) {
+		fprintf(stderr, "Unable to allocate the polling scheduler\n");
+		return -1;
+	}
+	for (c=0; c<SS_NCLASSES; c++) {
+		ps_addclass(&sched, classnames[c], intervals[c]);
+		for (i=0; i<ndevices; i++) {
+			n=ss_fields(c, devices[i], fields);
+			ps_addfields(&sched, c, fields, n);
+		}
+		for (j=0; j<ntristars; j++) {
+			n=ts_fields(c, devices[ndevices+j], fields);
+			ps_addfields(&sched, c, fields, n);
+		}
+	}
+	memset(image, 0, sizeof(image));
+	for (i=0; i<ndevices+ntristars; i++) {
+		if (rs_init(&stats[i], devices[i], (i < ndevices) ? ~0 : ~RS_LOADCHANNELS, statswindows,
+					sizeof(statswindows)/sizeof(statswindows[0])) == -1) {
+			fprintf(stderr, "Unable to allocate the rolling windows of MODBUS id %d\n", devices[i]);
+		}
+		sk_init(&sketches[i], devices[i], (i < ndevices) ? ~0 : ~SK_LOADCHANNELS, dateof(time(NULL)));
+	}
+	loadsketches(ndevices+ntristars);							/* Go on with today's if the daemon was restarted */
+	for (i=0; i<ndevices; i++) {
+		image[i].slave=devices[i];
+		ee_init(&ee[i], devices[i]);
+		en_init(&meters[i], devices[i], 0.1, 1, 0.1, 65536.0);	/* Ahc_t, Ahl_t and kWhc */
+	}
+	memset(tsimage, 0, sizeof(tsimage));
+	for (j=0; j<ntristars; j++) {
+		tsimage[j].slave=devices[ndevices+j];
+		en_init(&meters[ndevices+j], devices[ndevices+j], 0.1, 0, 1.0, 65536.0);	/* Ahc_t and kWhc_t */
+		if (ts_scale(&tsimage[j], ctx) == -1) {
+			fprintf(stderr, "Unable to read V_PU and I_PU of TriStar MPPT id %d - trying again when it answers\n", tsimage[j].slave);
+			modbus_flush(ctx);
+		}
+	}
+	np_init(&np, &sched, ndevices);
+	rbe_init(&rbe, deadbands, LOGCOLS);
+	if (jn_open(&journal, JOURNALFILE, JOURNALBLOCKS, JOURNALSIZE) == -1) {
+		fprintf(stderr, "Unable to open the journal %s: %s\n", JOURNALFILE, strerror(errno));
+		return -1;
+	}
+	if (journal.replayed > 0) {
+		fprintf(stderr, "Recovered %lu log rows from the journal\n", journal.replayed);
+	}
+	ev_init(&events, devices, ndevices, &journal);
+	ev_loadindex(&events, EVENTINDEX);							/* So a change while the daemon was stopped is an event */
+	if (al_init(&alerts, devices, ndevices, alertrules, sizeof(alertrules)/sizeof(alertrules[0]), ps_now()) == -1) {
+		fprintf(stderr, "Unable to allocate the alert rules\n");
+		return -1;
+	}
+	for (i=0; i<sizeof(alertsinks)/sizeof(alertsinks[0]); i++) {
+		if (al_addsink(&alerts, alertsinks[i]) == -1) fprintf(stderr, "Can't use alert sink: %s\n", alertsinks[i]);
+	}
+	dv_init(&derived, derivedchannels, sizeof(derivedchannels)/sizeof(derivedchannels[0]));
+	if ((dvload = dv_find(&derived, "Load_power")) == -1) fprintf(stderr, "No Load_power in DERIVEDCHANNELS, load power will be 0\n");
+	soc_init(&soc, devices, ndevices+ntristars, socbanks, sizeof(socbanks)/sizeof(socbanks[0]));
+	soc_load(&soc, SOCSTATE);									/* Carry on from where it was, with what was charged since */
+
+	/* Daily log records of the logged device, the first SunSaver MPPT the same as dailylog.  A step of the sync is only taken when
+	   the read fits before the next poll is due. */
+	if (logts) {
+		ls_inittristar(&ls, devices[logdev], ls_lastlogged(time(NULL)), tsimage[0].vpu);
+	} else {
+		ls_init(&ls, devices[logdev], ls_lastlogged(time(NULL)));
+	}
+
+	/* A breaker for each device, so one that stops answering doesn't hold up the others */
+	modbus_get_response_timeout(ctx, &tosec, &tousec);
+	br_init(&br, devices, ndevices+ntristars, &cost, 11*1000.0/9600, tosec*1000L+tousec/1000);
+	br.urgent=&cq;
+	if (MODBUSTCPHOST[0] != '\0') {
+		/* The polling reads are pipelined on the context's socket */
+		mt_init(&tcp, ctx, TCPWINDOW, TCPTIMEOUT);
+		br.tcp=&tcp;
+	}
+	sh_init(&shed, shedrules, LOADSHED ? sizeof(shedrules)/sizeof(shedrules[0]) : 0);
+	if (fr_init(&fr, devices, ndevices, &journal) == -1) {
+		fprintf(stderr, "Unable to allocate the flight recorder - faults won't be recorded\n");
+	}
+	recording=0;
+	steptime=(cost.overhead+ls.recregs*cost.perreg)*11*1000.0/9600+1;
+	haveslow=0;
+	nightarmed=0;
+	nighttries=0;
+	recwhen=0;
+
+	errors=0;
+	start=ps_now();
+	t=time(NULL);
+#if (LOGEXCEPTION)
+	lastsample=0;
+#else
+	lastlog=t-t%LOGINTERVAL;
+#endif
+	lastmetrics=t;
+	lastenergy=t-t%ENERGYINTERVAL;
+	lastsketch=t;
+	lastsoc=t;
+	nextsync=t;
+
+	while (running) {
+		/* Commands go before the next cycle */
+		cq_receive(&cq);
+		if (cq.n > 0) cq_run(&cq, ctx, CQ_NORMAL);
+
+		now=ps_now();
+		mask=ps_select(&sched, now);
+		if (mask != 0) {
+			if ((plan=ps_plan(&sched, mask)) == NULL) {
+				fprintf(stderr, "Unable to plan the register reads\n");
+				break;
+			}
+			errors+=br_execute(&br, plan, ctx, now+CYCLEDEADLINE);	/* A failed read is tried again on the next interval */
+			fresh=ps_done(&sched, mask, now);
+
+			/* Only the devices whose reads all worked have new registers */
+			for (i=0; i<ndevices; i++) {
+				got[i]=0;
+				for (c=0; c<SS_NCLASSES; c++) {
+					if ((fresh & (1 << c)) && ss_store(&image[i], plan, c)) got[i]|=1 << c;
+				}
+			}
+			for (j=0; j<ntristars; j++) {
+				tsgot[j]=0;
+				for (c=0; c<SS_NCLASSES; c++) {
+					if ((fresh & (1 << c)) && ts_store(&tsimage[j], plan, c)) tsgot[j]|=1 << c;
+				}
+				/* Scale again when it answers after being out of service, as it may have been changed for another model */
+				if (br.dev[ndevices+j].state != BR_CLOSED) {
+					tsimage[j].scaled=0;
+				} else if (!tsimage[j].scaled && (tsgot[j] & (1 << SS_FAST))) {
+					if (ts_scale(&tsimage[j], ctx) == -1) {
+						errors++;
+						modbus_flush(ctx);
+						br_result(&br, tsimage[j].slave, 0, ps_now());
+					} else if (logts && j == 0) {
+						ls.vpu=tsimage[0].vpu;
+					}
+				}
+			}
+			if (logts ? (tsgot[0] & (1 << SS_SLOW)) && tsimage[0].scaled : (got[0] & (1 << SS_SLOW))) haveslow=1;
+
+			t=time(NULL);
+			recording=fr_sample(&fr, image, got, now, t);
+			ev_update(&events, image, got, t);
+			for (i=0; i<ndevices; i++) {
+				if (got[i] != 0) al_sample(&alerts, i, &image[i], got[i], now, t);
+			}
+			/* Energy from the counters, with the mean voltage since the last time they were read, and the state of charge */
+			synced=0;
+			for (i=0; i<ndevices; i++) {
+				if (got[i] & (1 << SS_FAST)) {
+					en_voltage(&meters[i], ss_value(&image[i], SS_VB_F), ss_value(&image[i], SS_ADC_VL_F));
+					synced|=soc_sample(&soc, i, ss_value(&image[i], SS_VB_F), ss_value(&image[i], SS_ADC_IC_F),
+									   ss_value(&image[i], SS_ADC_IL_F), ss_raw(&image[i], SS_CHARGE_STATE), now, t);
+				}
+				if (got[i] & (1 << SS_TEMP)) soc_temperature(&soc, i, ss_value(&image[i], SS_T_BATT));
+				if (got[i] & (1 << SS_SLOW)) {
+					en_counters(&meters[i], ss_raw(&image[i], SS_AHC_T), ss_raw(&image[i], SS_AHL_T), ss_raw(&image[i], SS_KWHC), now);
+					soc_counters(&soc, i, &meters[i], t);
+				}
+			}
+			for (j=0; j<ntristars; j++) {
+				if (!tsimage[j].scaled) continue;
+				if (tsgot[j] & (1 << SS_FAST)) {
+					en_voltage(&meters[ndevices+j], ts_value(&tsimage[j], TS_ADC_VB_F_MED), 0);
+					synced|=soc_sample(&soc, ndevices+j, ts_value(&tsimage[j], TS_ADC_VB_F_MED), ts_value(&tsimage[j], TS_ADC_IB_F_SHADOW),
+									   0, ts_raw(&tsimage[j], TS_CHARGE_STATE), now, t);
+				}
+				if (tsgot[j] & (1 << SS_TEMP)) soc_temperature(&soc, ndevices+j, ts_value(&tsimage[j], TS_T_BATT));
+				if (tsgot[j] & (1 << SS_SLOW)) {
+					en_counters(&meters[ndevices+j], ts_raw(&tsimage[j], TS_AHC_T), 0, ts_raw(&tsimage[j], TS_KWHC_T), now);
+					soc_counters(&soc, ndevices+j, &meters[ndevices+j], t);
+				}
+			}
+			if (synced || (soc.dirty && t-lastsoc >= SOCSAVE)) {
+				savesoc(t);
+				lastsoc=t;
+			}
+			for (i=0; i<ndevices; i++) {
+				if ((got[i] & (1 << SS_EEPROM)) && ee_update(&ee[i], image[i].eeprom, t) && ee[i].version > 1) {
+					fprintf(stderr, "EEPROM settings of MODBUS id %d changed (version %u)\n", devices[i], ee[i].version);
+				}
+			}
+			if (fresh & (1 << SS_FAST)) {
+				/* Shed or restore a load before anything else, so the reaction time is just the sample and the write */
+				for (i=0; i<ndevices; i++) {
+					if (got[i] & (1 << SS_FAST)) sh_sample(&shed, ss_value(&image[i], SS_ADC_VB_F), ss_value(&image[i], SS_ADC_IL_F),
+														   ss_raw(&image[i], SS_CHARGE_STATE));
+				}
+				for (j=0; j<ntristars; j++) {
+					if ((tsgot[j] & (1 << SS_FAST)) && tsimage[j].scaled) sh_sample(&shed, ts_value(&tsimage[j], TS_ADC_VB_F_MED), 0,
+																					 ts_raw(&tsimage[j], TS_CHARGE_STATE));
+				}
+				sh_step(&shed, ctx, now);
+				/* The devices read, with their derived channels worked out together */
+				nbatch=0;
+				for (i=0; i<ndevices; i++) {
+					if (!(got[i] & (1 << SS_FAST))) continue;			/* Let its snapshot go stale rather than repeat old values */
+					logvalues(&image[i], batch[nbatch]);
+					batch[nbatch][DV_IA]=0;								/* The SunSaver MPPT doesn't measure the array current */
+					batch[nbatch][DV_POWER_IN]=0;
+					batchdev[nbatch++]=i;
+				}
+				for (j=0; j<ntristars; j++) {
+					if (!(tsgot[j] & (1 << SS_FAST)) || !tsimage[j].scaled) continue;
+					tslogvalues(&tsimage[j], batch[nbatch]);
+					batch[nbatch][DV_IA]=ts_value(&tsimage[j], TS_ADC_IA_F_SHADOW);
+					batch[nbatch][DV_POWER_IN]=ts_value(&tsimage[j], TS_POWER_IN);
+					batchdev[nbatch++]=ndevices+j;
+				}
+				dv_eval(&derived, &batch[0][0], nbatch, &dvout[0][0]);
+				for (b=0; b<nbatch; b++) {
+					i=batchdev[b];
+					memcpy(dvvalues[i], dvout[b], sizeof(dvvalues[i]));
+					dvvalid[i]=1;
+					addstats(&stats[i], batch[b], dvout[b], now);
+					addsketch(&sketches[i], batch[b], dvout[b], now);
+					if (i < ndevices) {
+						writesnapshot(&image[i], t);
+						if (ee_checkfault(&ee[i], ss_raw(&image[i], SS_ARRAY_FAULT))) ps_due(&sched, SS_EEPROM, now);
+					} else {
+						writetristar(&tsimage[i-ndevices], t);
+					}
+				}
+				/* Sample faster while near a shed voltage or making a flight record, and not at the night rate.  Only the SunSaver
+				   MPPTs tell when it is night, so with none the rate stays up. */
+				fast=POLLFAST;
+				if (sh_armed(&shed) && SHEDPOLL < fast) fast=SHEDPOLL;
+				if (recording && FLIGHTBURST < fast) fast=FLIGHTBURST;
+				np.keepfast=(fast != POLLFAST || ndevices == 0);
+				np_update(&np, &sched, image, got, now);
+				if (!np.quietrate && sched.cls[SS_FAST].interval != fast) ps_setinterval(&sched, SS_FAST, fast, ps_now());
+			}
+			if (logts ? (tsgot[0] & (1 << SS_FAST)) && tsimage[0].scaled : (got[0] & (1 << SS_FAST))) {
+				/* Log the first SunSaver MPPT, the same as powersystemstatus, or the first TriStar MPPT */
+				if (logts) {
+					tslogvalues(&tsimage[0], values);
+				} else {
+					logvalues(&image[0], values);
+				}
+				logged=0;
+#if (LOGEXCEPTION)
+				lastsample=t;
+				if (rbe_check(&rbe, values, t)) logged=writelogrow(values, t, 1);
+#else
+				if (t-lastlog >= LOGINTERVAL) {
+					lastlog=t-t%LOGINTERVAL;
+					logged=writelogrow(values, t, 0);
+				}
+#endif
+				/* The host may be about to lose power - commit the row that records the low voltage disconnect straight away */
+				if (logged && (values[9] == SS_LS_LVD_WARNING || values[9] == SS_LS_LVD)) jn_flush(&journal);
+
+				/* The controller writes its daily log record when it goes to NIGHT and the charging current drops to zero */
+				if (values[8] != SS_CS_NIGHT) {
+					nightarmed=1;
+				} else if (nightarmed && values[3] < NIGHTIC) {
+					nightarmed=0;
+					nighttries=LOGSYNCTRIES;
+					nextsync=t;
+					ls.triggers++;
+				}
+			}
+		}
+
+		/* Copy new daily log records, at most one read per pass */
+		t=time(NULL);
+		if (ls.state == LS_IDLE && haveslow && t >= nextsync) {
+			ls_start(&ls, logts ? ts_raw(&tsimage[0], TS_HOURMETER) : ss_raw(&image[0], SS_HOURMETER));
+			nextsync=t+LOGSYNCINTERVAL;
+		}
+		if (ls.state != LS_IDLE && br.dev[logdev].state == BR_CLOSED && ps_nextdue(&sched)-ps_now() > steptime) {
+			n=ls_step(&ls, ctx, &rec);
+			if (n == 1) {
+				recwhen=ls_when(&rec, logts ? ts_raw(&tsimage[0], TS_HOURMETER) : ss_raw(&image[0], SS_HOURMETER), t);
+				ls_writerow(&rec, recwhen);
+			} else if (n == -1) {
+				fprintf(stderr, "%s\n", modbus_strerror(errno));
+				errors++;
+				modbus_flush(ctx);
+				br_result(&br, devices[logdev], 0, ps_now());
+				nextsync=t+LOGSYNCRETRY;
+			}
+			if (ls.state == LS_IDLE) {
+				ls_savehint(&ls);
+				if (ls.fetched > 0) {
+					writedailylogpage(recwhen);
+					nighttries=0;
+				} else if (n == 0 && nighttries > 0) {
+					nighttries--;								/* The record may not be written yet - look again shortly */
+					nextsync=t+LOGSYNCWAIT;
+				}
+			}
+		}
+
+		if (t-lastenergy >= ENERGYINTERVAL) {
+			lastenergy=t-t%ENERGYINTERVAL;
+			for (i=0; i<ndevices+ntristars; i++) {
+				if (meters[i].cahc.valid) writeenergyrow(&meters[i], lastenergy);
+				en_endinterval(&meters[i]);
+			}
+		}
+		al_tick(&alerts, ps_now(), t);							/* Rules that have now held for their time */
+		/* The day's sketches are finished at midnight */
+		if (dateof(t) != sketches[0].date) {
+			savesketches(ndevices+ntristars);
+			for (i=0; i<ndevices+ntristars; i++) sk_newday(&sketches[i], dateof(t));
+			lastsketch=t;
+		} else if (t-lastsketch >= SKETCHSAVE) {
+			savesketches(ndevices+ntristars);
+			lastsketch=t;
+		}
+		if (journal.nrows > 0 && t-journal.oldest >= JOURNALFLUSH) {
+			jn_flush(&journal);
+		}
+		if (t-lastmetrics >= METRICSINTERVAL) {
+			lastmetrics=t;
+			writemetrics(&sched, &np, &rbe, &ls, ee, &br, ndevices, tsimage, ntristars, ps_now()-start, errors, t);
+			for (i=0; i<ndevices+ntristars; i++) writestats(&stats[i], t, ps_now());
+			if (soc.nbanks > 0 && soc_save(&soc, RUNFILEPATH "/soc.txt", t) == -1) {
+				fprintf(stderr, "Can't write %s/soc.txt\n", RUNFILEPATH);
+			}
+			if (events.dirty && ev_saveindex(&events, EVENTINDEX) == -1) {
+				fprintf(stderr, "Can't write the event index: %s\n", EVENTINDEX);
+			}
+		}
+
+		/* Sleep until the next class is due or a command comes in */
+		next=ps_nextdue(&sched);
+		if (next > ps_now()) {
+			pfd.fd=cq.fd;
+			pfd.events=POLLIN;
+			poll(&pfd, cq.fd != -1, next-ps_now());
+		}
+	}
+
+#if (LOGEXCEPTION)
+	/* Close the last step so readers know the values held until now */
+	if (rbe.haverow && lastsample > rbe.lastrow) writelogrow(values, lastsample, 1);
+#endif
+
+	fr_finish(&fr);
+	savesketches(ndevices+ntristars);
+	if (soc.dirty) savesoc(time(NULL));
+	if (events.dirty && ev_saveindex(&events, EVENTINDEX) == -1) {
+		fprintf(stderr, "Can't write the event index: %s\n", EVENTINDEX);
+	}
+	fr_free(&fr);
+	jn_close(&journal);
+	cq_close(&cq);
+	writemetrics(&sched, &np, &rbe, &ls, ee, &br, ndevices, tsimage, ntristars, ps_now()-start, errors, time(NULL));
+	ps_free(&sched);
+	for (i=0; i<ndevices+ntristars; i++) rs_free(&stats[i]);
+	al_free(&alerts);
+
+	/* Close the MODBUS connection */
+	modbus_close(ctx);
+	modbus_free(ctx);
+	dl_release(lockfd);
+
+	return(0);
+}
+
+static void stop(int sig)
+{
+	running=0;
+}
+
+/* Write the latest RAM registers of one device for powersystemstatus.  The file is renamed into place so it is never half written. */
+static void writesnapshot(const struct ss_image *im, time_t t)
+{
+	FILE *outfile;
+	char filepath[64], tmppath[72];
+	int i;
+
+	sprintf(filepath,"%s/sunsaver%d.txt",RUNFILEPATH,im->slave);
+	sprintf(tmppath,"%s.tmp",filepath);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return;
+	}
+	fprintf(outfile,"%ld\n", (long) t);
+	for (i=0; i<SS_RAMREGS; i++) {
+		fprintf(outfile,"%u%c", im->ram[i], (i < SS_RAMREGS-1) ? ' ' : '\n');
+	}
+	fclose(outfile);
+	rename(tmppath, filepath);
+}
+
+/* Write the latest RAM registers of one TriStar MPPT, after its V_PU and I_PU */
+static void writetristar(const struct ts_image *im, time_t t)
+{
+	FILE *outfile;
+	char filepath[64], tmppath[72];
+	int i;
+
+	sprintf(filepath,"%s/tristar%d.txt",RUNFILEPATH,im->slave);
+	sprintf(tmppath,"%s.tmp",filepath);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return;
+	}
+	fprintf(outfile,"%ld\n", (long) t);
+	fprintf(outfile,"%.4f %.4f\n", im->vpu, im->ipu);
+	for (i=0; i<TS_RAMREGS; i++) {
+		fprintf(outfile,"%u%c", im->ram[i], (i < TS_RAMREGS-1) ? ' ' : '\n');
+	}
+	fclose(outfile);
+	rename(tmppath, filepath);
+}
+
+/* Log file columns of one device */
+static void logvalues(const struct ss_image *im, float *values)
+{
+	values[0]=ss_value(im, SS_VB_F);
+	values[1]=ss_value(im, SS_ADC_VA_F);
+	values[2]=ss_value(im, SS_ADC_VL_F);
+	values[3]=ss_value(im, SS_ADC_IC_F);
+	values[4]=ss_value(im, SS_ADC_IL_F);
+	values[5]=ss_value(im, SS_POWER_OUT);
+	values[6]=ss_value(im, SS_AHC_DAILY);
+	values[7]=ss_value(im, SS_AHL_DAILY);
+	values[8]=ss_raw(im, SS_CHARGE_STATE);
+	values[9]=ss_raw(im, SS_LOAD_STATE);
+}
+
+/*	The same for a TriStar MPPT, which has no load output.  Its charge states are the SunSaver MPPT's, with MPPT logged as
+	BULK_CHARGE. */
+static void tslogvalues(const struct ts_image *im, float *values)
+{
+	values[0]=ts_value(im, TS_ADC_VB_F_MED);
+	values[1]=ts_value(im, TS_ADC_VA_F);
+	values[2]=0;
+	values[3]=ts_value(im, TS_ADC_IB_F_SHADOW);
+	values[4]=0;
+	values[5]=ts_value(im, TS_POWER_OUT);
+	values[6]=ts_value(im, TS_AHC_DAILY);
+	values[7]=0;
+	values[8]=ts_raw(im, TS_CHARGE_STATE);
+	values[9]=SS_LS_START;
+}
+
+/* Add a row to the daily log file in the same format as powersystemstatus.  Rows logged by exception carry seconds in the time
+   stamp (HH:MM:SS), which tells readers that each row holds until the next one.  Returns 1 if the row was added to the journal. */
+static int writelogrow(const float *values, time_t t, int seconds)
+{
+	struct tm *now;
+	char ts[32], filepath[64], logfile[64], row[160];
+	unsigned int charge_state, load_state;
+
+	now = localtime(&t);
+	strftime(ts, 32, seconds ? "%m/%d/%Y\t%H:%M:%S" : "%m/%d/%Y\t%H:%M", now);
+	sprintf(filepath,"%s/%%Y/%%Y%%m%%d.txt",LOGFILEPATH);
+	strftime(logfile, 64, filepath, now);
+
+	charge_state=values[8];
+	load_state=values[9];
+	snprintf(row, sizeof(row), "%s\t%5.2f\t%5.2f\t%5.2f\t%5.2f\t%5.2f\t%6.2f\t%5.2f\t%5.2f\t%s\t%s\n", ts, values[0], values[1],
+			 values[2], values[3], values[4], values[5], values[6], values[7],
+			 charge_state <= SS_CS_EQUALIZE ? ss_charge_states[charge_state] : "UNKNOWN",
+			 load_state <= SS_LS_DISCONNECT ? ss_load_states[load_state] : "UNKNOWN");
+
+	if (jn_add(&journal, logfile, row, t) == -1) {
+		fprintf(stderr, "Can't add a row for log file: %s\n", logfile);
+		return 0;
+	}
+	return 1;
+}
+
+/*	Add a row for one device to the day's energy file (LOGFILEPATH/YYYY/YYYYMMDDenergy.txt): the time the interval ended, the
+	MODBUS id, and the amp-hours and watt-hours charged and used in the interval */
+static void writeenergyrow(const struct en_meter *m, time_t t)
+{
+	struct tm *now;
+	char ts[32], filepath[64], energyfile[64], row[128];
+
+	now = localtime(&t);
+	strftime(ts, 32, "%m/%d/%Y\t%H:%M", now);
+	sprintf(filepath,"%s/%%Y/%%Y%%m%%denergy.txt",LOGFILEPATH);
+	strftime(energyfile, 64, filepath, now);
+	snprintf(row, sizeof(row), "%s\t%d\t%6.1f\t%6.1f\t%7.1f\t%7.1f\n", ts, m->slave, m->iahc, m->iahl, m->iwhc, m->iwhl);
+	if (jn_add(&journal, energyfile, row, t) == -1) {
+		fprintf(stderr, "Can't add a row for energy file: %s\n", energyfile);
+	}
+}
+
+/* Add a fast sample of one device's log columns, and the load power, to its rolling windows */
+static void addstats(struct rs_stats *st, const float *values, const float *dv, long now)
+{
+	float v[RS_NCHANNELS];
+
+	v[RS_VB]=values[0];
+	v[RS_VA]=values[1];
+	v[RS_VL]=values[2];
+	v[RS_IC]=values[3];
+	v[RS_IL]=values[4];
+	v[RS_POWER_OUT]=values[5];
+	v[RS_LOAD_POWER]=(dvload != -1) ? dv[dvload] : 0;
+	rs_add(st, v, now);
+}
+
+/* Add a fast sample of one device's battery voltage, charging power and load power to the day's sketches */
+static void addsketch(struct sk_day *d, const float *values, const float *dv, long now)
+{
+	float v[SK_NCHANNELS];
+
+	v[SK_VB]=values[0];
+	v[SK_POWER_OUT]=values[5];
+	v[SK_LOAD_POWER]=(dvload != -1) ? dv[dvload] : 0;
+	sk_add(d, v, now);
+}
+
+/* Save the sketches of every device to the file of their day (LOGFILEPATH/YYYY/YYYYMMDDsketch.txt) */
+static void savesketches(int n)
+{
+	char filepath[64];
+
+	sprintf(filepath,"%s/%ld/%ldsketch.txt",LOGFILEPATH,sketches[0].date/10000,sketches[0].date);
+	if (sk_write(sketches, n, filepath) == -1) {
+		fprintf(stderr, "Can't write the sketch file: %s\n", filepath);
+	}
+}
+
+/* Start from the sketches already saved today, for the devices still polled */
+static void loadsketches(int n)
+{
+	static struct sk_day saved[MAXDEVICES];
+	char filepath[64];
+	int i, k, m, ch;
+
+	sprintf(filepath,"%s/%ld/%ldsketch.txt",LOGFILEPATH,sketches[0].date/10000,sketches[0].date);
+	m=sk_read(saved, MAXDEVICES, filepath);
+	for (k=0; k<m; k++) {
+		for (i=0; i<n && sketches[i].slave != saved[k].slave; i++);
+		if (i == n) continue;
+		for (ch=0; ch<SK_NCHANNELS; ch++) {
+			if (sketches[i].channels & saved[k].channels & (1 << ch)) sk_merge(&sketches[i].ch[ch], &saved[k].ch[ch]);
+		}
+	}
+}
+
+/* Save the state of charge to carry on from after a restart */
+static void savesoc(time_t t)
+{
+	if (soc.nbanks == 0) return;
+	if (soc_save(&soc, SOCSTATE, t) == -1) {
+		fprintf(stderr, "Can't write the state of charge: %s\n", SOCSTATE);
+		return;
+	}
+	soc.dirty=0;
+}
+
+/* Local date as YYYYMMDD */
+static long dateof(time_t t)
+{
+	struct tm *now;
+
+	now=localtime(&t);
+	return (now->tm_year+1900)*10000L+(now->tm_mon+1)*100+now->tm_mday;
+}
+
+/*	Write the rolling window statistics of one device for powersystemstatus: the time, then a line for each channel and window
+	with the samples, minimum, maximum, mean and standard deviation */
+static void writestats(struct rs_stats *st, time_t t, long now)
+{
+	FILE *outfile;
+	struct rs_result res;
+	char filepath[64], tmppath[72], label[16];
+	int ch, w;
+
+	if (st->size == 0) return;
+	sprintf(filepath,"%s/stats%d.txt",RUNFILEPATH,st->slave);
+	sprintf(tmppath,"%s.tmp",filepath);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return;
+	}
+	fprintf(outfile,"%ld\n", (long) t);
+	for (ch=0; ch<RS_NCHANNELS; ch++) {
+		for (w=0; w<st->nwindows; w++) {
+			if (rs_get(st, ch, w, now, &res) == -1) continue;
+			rs_label(st->span[w], label, sizeof(label));
+			fprintf(outfile,"%s\t%s\t%d\t%.2f\t%.2f\t%.3f\t%.3f\n", rs_name(ch), label, res.n, res.min, res.max, res.mean, res.stddev);
+		}
+	}
+	fclose(outfile);
+	rename(tmppath, filepath);
+}
+
+/* Rewrite the daily log web page for the year of the newest record */
+static void writedailylogpage(time_t t)
+{
+	struct tm *then;
+	char filepath[64], logfilename[64], htmlfilename[64];
+
+	then = localtime(&t);
+	sprintf(filepath,"%s/%%Y/%%Ydailylog.txt",LOGFILEPATH);
+	strftime(logfilename, 64, filepath, then);
+	sprintf(filepath,"%s/%%Y/%%Ydailylog.html",WEBPAGEFILEPATH);
+	strftime(htmlfilename, 64, filepath, then);
+	writehtmlfile(logfilename, htmlfilename);
+}
+
+/* Write the scheduler counters in the text format read by the Prometheus node exporter textfile collector */
+static void writemetrics(const struct ps_sched *s, const struct np_state *np, const struct rbe_log *rbe,
+						 const struct ls_sync *ls, const struct ee_cache *ee, const struct br_set *br, int ndevices,
+						 const struct ts_image *tsimage, int ntristars, long uptime, unsigned long errors, time_t t)
+{
+	FILE *outfile;
+	struct rs_result res;
+	char filepath[64], tmppath[72], label[16], labels[64];
+	int i, ch, w;
+
+	sprintf(filepath,"%s/metrics.prom",RUNFILEPATH);
+	sprintf(tmppath,"%s.tmp",filepath);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return;
+	}
+	fprintf(outfile,"powersystemd_uptime_seconds %.1f\n", uptime/1000.0);
+	fprintf(outfile,"powersystemd_cycles_total %lu\n", s->cycles);
+	fprintf(outfile,"powersystemd_transactions_total %lu\n", s->transactions);
+	fprintf(outfile,"powersystemd_read_errors_total %lu\n", errors);
+	fprintf(outfile,"powersystemd_night_rate %d\n", np->quietrate);
+	fprintf(outfile,"powersystemd_night_slowdowns_total %lu\n", np->slowdowns);
+	fprintf(outfile,"powersystemd_night_snapbacks_total %lu\n", np->snapbacks);
+	fprintf(outfile,"powersystemd_night_wakeups_saved_total %lu\n", np->wakeups_saved);
+	fprintf(outfile,"powersystemd_night_transactions_saved_total %lu\n", np->transactions_saved);
+	fprintf(outfile,"powersystemd_log_samples_total %lu\n", rbe->samples);
+	fprintf(outfile,"powersystemd_log_rows_total %lu\n", rbe->rows);
+	fprintf(outfile,"powersystemd_journal_pending_rows %d\n", journal.nrows);
+	fprintf(outfile,"powersystemd_journal_pending_age_seconds %ld\n", journal.nrows > 0 ? (long) (t-journal.oldest) : 0L);
+	fprintf(outfile,"powersystemd_journal_commits_total %lu\n", journal.flushes);
+	fprintf(outfile,"powersystemd_journal_blocks_written_total %lu\n", journal.blocks);
+	fprintf(outfile,"powersystemd_journal_log_appends_total %lu\n", journal.appends);
+	fprintf(outfile,"powersystemd_journal_log_bytes_total %lu\n", journal.logbytes);
+	fprintf(outfile,"powersystemd_journal_replayed_rows_total %lu\n", journal.replayed);
+	fprintf(outfile,"powersystemd_journal_dropped_rows_total %lu\n", journal.dropped);
+	if (journal.logbytes > 0) {
+		/* Flash pages written per byte of log rows - each journal block and each log file append costs at least one page */
+		fprintf(outfile,"powersystemd_journal_write_amplification %.2f\n",
+				(double) (journal.blocks+journal.appends)*JN_BLOCKSIZE/journal.logbytes);
+		/* The same for one append per row, as before the journal */
+		fprintf(outfile,"powersystemd_journal_unbuffered_write_amplification %.2f\n",
+				(double) (journal.rows-journal.nrows)*JN_BLOCKSIZE/journal.logbytes);
+	}
+	fprintf(outfile,"powersystemd_logsync_syncs_total %lu\n", ls->syncs);
+	fprintf(outfile,"powersystemd_logsync_reads_total %lu\n", ls->reads);
+	fprintf(outfile,"powersystemd_logsync_records_total %lu\n", ls->records);
+	fprintf(outfile,"powersystemd_logsync_night_triggers_total %lu\n", ls->triggers);
+	fprintf(outfile,"powersystemd_logsync_last_hourmeter %u\n", ls->lasthm);
+	for (i=0; i<ndevices; i++) {
+		fprintf(outfile,"powersystemd_eeprom_version{id=\"%d\"} %u\n", ee[i].slave, ee[i].version);
+		fprintf(outfile,"powersystemd_eeprom_reads_total{id=\"%d\"} %lu\n", ee[i].slave, ee[i].reads);
+		fprintf(outfile,"powersystemd_eeprom_changes_total{id=\"%d\"} %lu\n", ee[i].slave, ee[i].changes);
+		fprintf(outfile,"powersystemd_eeprom_edit_faults_total{id=\"%d\"} %lu\n", ee[i].slave, ee[i].edits);
+		fprintf(outfile,"powersystemd_eeprom_edit_pending{id=\"%d\"} %d\n", ee[i].slave, ee[i].editfault);
+		if (ee[i].valid) fprintf(outfile,"powersystemd_eeprom_age_seconds{id=\"%d\"} %ld\n", ee[i].slave, (long) (t-ee[i].read));
+	}
+	for (i=0; i<ntristars; i++) {
+		fprintf(outfile,"powersystemd_tristar_scaled{id=\"%d\"} %d\n", tsimage[i].slave, tsimage[i].scaled);
+		if (!tsimage[i].scaled) continue;
+		fprintf(outfile,"powersystemd_tristar_battery_volts{id=\"%d\"} %.2f\n", tsimage[i].slave, ts_value(&tsimage[i], TS_ADC_VB_F_MED));
+		fprintf(outfile,"powersystemd_tristar_battery_amps{id=\"%d\"} %.2f\n", tsimage[i].slave, ts_value(&tsimage[i], TS_ADC_IB_F_SHADOW));
+		fprintf(outfile,"powersystemd_tristar_array_volts{id=\"%d\"} %.2f\n", tsimage[i].slave, ts_value(&tsimage[i], TS_ADC_VA_F));
+		fprintf(outfile,"powersystemd_tristar_array_amps{id=\"%d\"} %.2f\n", tsimage[i].slave, ts_value(&tsimage[i], TS_ADC_IA_F_SHADOW));
+		fprintf(outfile,"powersystemd_tristar_output_watts{id=\"%d\"} %.1f\n", tsimage[i].slave, ts_value(&tsimage[i], TS_POWER_OUT));
+		fprintf(outfile,"powersystemd_tristar_charge_state{id=\"%d\"} %u\n", tsimage[i].slave, ts_raw(&tsimage[i], TS_CHARGE_STATE));
+		fprintf(outfile,"powersystemd_tristar_heatsink_celsius{id=\"%d\"} %.0f\n", tsimage[i].slave, ts_value(&tsimage[i], TS_T_HS));
+		fprintf(outfile,"powersystemd_tristar_kwh_total{id=\"%d\"} %.0f\n", tsimage[i].slave, ts_value(&tsimage[i], TS_KWHC_T));
+		fprintf(outfile,"powersystemd_tristar_v_pu{id=\"%d\"} %.4f\n", tsimage[i].slave, tsimage[i].vpu);
+		fprintf(outfile,"powersystemd_tristar_i_pu{id=\"%d\"} %.4f\n", tsimage[i].slave, tsimage[i].ipu);
+	}
+	for (i=0; i<ndevices+ntristars; i++) {
+		if (!meters[i].cahc.valid) continue;
+		fprintf(outfile,"powersystemd_energy_charge_ah_total{id=\"%d\"} %.1f\n", meters[i].slave, meters[i].ahc);
+		fprintf(outfile,"powersystemd_energy_charge_wh_total{id=\"%d\"} %.1f\n", meters[i].slave, meters[i].whc);
+		fprintf(outfile,"powersystemd_energy_charge_kwh_counted_total{id=\"%d\"} %.1f\n", meters[i].slave, meters[i].kwh);
+		if (meters[i].cahl.present) {
+			fprintf(outfile,"powersystemd_energy_load_ah_total{id=\"%d\"} %.1f\n", meters[i].slave, meters[i].ahl);
+			fprintf(outfile,"powersystemd_energy_load_wh_total{id=\"%d\"} %.1f\n", meters[i].slave, meters[i].whl);
+		}
+		fprintf(outfile,"powersystemd_energy_counter_resets_total{id=\"%d\"} %lu\n", meters[i].slave,
+				meters[i].cahc.resets+meters[i].cahl.resets+meters[i].ckwh.resets);
+		fprintf(outfile,"powersystemd_energy_counter_wraps_total{id=\"%d\"} %lu\n", meters[i].slave,
+				meters[i].cahc.wraps+meters[i].cahl.wraps+meters[i].ckwh.wraps);
+		fprintf(outfile,"powersystemd_energy_counter_glitches_total{id=\"%d\"} %lu\n", meters[i].slave,
+				meters[i].cahc.glitches+meters[i].cahl.glitches+meters[i].ckwh.glitches);
+	}
+	for (i=0; i<ndevices+ntristars; i++) {
+		for (ch=0; ch<RS_NCHANNELS; ch++) {
+			for (w=0; w<stats[i].nwindows; w++) {
+				if (rs_get(&stats[i], ch, w, ps_now(), &res) == -1) continue;
+				rs_label(stats[i].span[w], label, sizeof(label));
+				sprintf(labels, "id=\"%d\",channel=\"%s\",window=\"%s\"", stats[i].slave, rs_name(ch), label);
+				fprintf(outfile,"powersystemd_window_min{%s} %.3f\n", labels, res.min);
+				fprintf(outfile,"powersystemd_window_max{%s} %.3f\n", labels, res.max);
+				fprintf(outfile,"powersystemd_window_mean{%s} %.3f\n", labels, res.mean);
+				fprintf(outfile,"powersystemd_window_stddev{%s} %.3f\n", labels, res.stddev);
+			}
+		}
+	}
+	for (i=0; i<ndevices+ntristars; i++) {
+		if (!dvvalid[i]) continue;
+		for (ch=0; ch<derived.nchannels; ch++) {
+			if (i < ndevices && !dv_has(&derived, ch, DV_SUNSAVERINPUTS)) continue;
+			fprintf(outfile,"powersystemd_derived{id=\"%d\",channel=\"%s\"} %.3f\n", stats[i].slave, derived.ch[ch].name, dvvalues[i][ch]);
+		}
+	}
+	for (i=0; i<soc.nbanks; i++) {
+		if (soc.bank[i].source == SOC_NONE) continue;
+		fprintf(outfile,"powersystemd_soc_percent{bank=\"%s\"} %.1f\n", soc.bank[i].text, soc.bank[i].soc*100.0);
+		fprintf(outfile,"powersystemd_soc_source{bank=\"%s\"} %d\n", soc.bank[i].text, soc.bank[i].source);
+		fprintf(outfile,"powersystemd_soc_counted_ah{bank=\"%s\"} %.2f\n", soc.bank[i].text, soc.bank[i].ahsince);
+		fprintf(outfile,"powersystemd_soc_battery_celsius{bank=\"%s\"} %.0f\n", soc.bank[i].text, soc.bank[i].temp);
+		fprintf(outfile,"powersystemd_soc_resyncs_total{bank=\"%s\"} %lu\n", soc.bank[i].text, soc.bank[i].resyncs);
+		if (soc.bank[i].lastsync != 0) {
+			fprintf(outfile,"powersystemd_soc_resync_age_seconds{bank=\"%s\"} %ld\n", soc.bank[i].text, (long) (t-soc.bank[i].lastsync));
+		}
+	}
+	fprintf(outfile,"powersystemd_events_total %lu\n", events.events);
+	fprintf(outfile,"powersystemd_alert_rules %d\n", alerts.nrules);
+	fprintf(outfile,"powersystemd_alerts_firing %d\n", alerts.firing);
+	fprintf(outfile,"powersystemd_alert_evaluations_total %lu\n", alerts.evaluations);
+	fprintf(outfile,"powersystemd_alert_notifications_total %lu\n", alerts.notifications);
+	fprintf(outfile,"powersystemd_alert_sink_errors_total %lu\n", alerts.sinkerrors);
+	if (alerts.samples > 0) fprintf(outfile,"powersystemd_alert_sample_us_avg %.2f\n", alerts.evalus/alerts.samples);
+	fprintf(outfile,"powersystemd_deferred_reads_total %lu\n", br->deferred);
+	if (br->tcp != NULL) {
+		fprintf(outfile,"powersystemd_tcp_requests_total %lu\n", br->tcp->sent);
+		fprintf(outfile,"powersystemd_tcp_responses_total %lu\n", br->tcp->received);
+		fprintf(outfile,"powersystemd_tcp_timeouts_total %lu\n", br->tcp->timeouts);
+		fprintf(outfile,"powersystemd_tcp_exceptions_total %lu\n", br->tcp->exceptions);
+		fprintf(outfile,"powersystemd_tcp_stray_responses_total %lu\n", br->tcp->stray);
+		fprintf(outfile,"powersystemd_tcp_reconnects_total %lu\n", br->tcp->reconnects);
+		fprintf(outfile,"powersystemd_tcp_inflight_max %d\n", br->tcp->maxinflight);
+		if (br->tcp->received > 0) {
+			fprintf(outfile,"powersystemd_tcp_rtt_ms %ld\n", br->tcp->lastrtt);
+			fprintf(outfile,"powersystemd_tcp_rtt_avg_ms %.1f\n", br->tcp->totalrtt/br->tcp->received);
+		}
+	}
+	fprintf(outfile,"powersystemd_flight_recording %d\n", fr.state == FR_RECORDING);
+	fprintf(outfile,"powersystemd_flight_triggers_total %lu\n", fr.triggers);
+	fprintf(outfile,"powersystemd_flight_suppressed_total %lu\n", fr.suppressed);
+	fprintf(outfile,"powersystemd_flight_records_total %lu\n", fr.records);
+	fprintf(outfile,"powersystemd_flight_samples_total %lu\n", fr.samples);
+	fprintf(outfile,"powersystemd_flight_bytes_total %lu\n", fr.bytes);
+	if (shed.nrules > 0) {
+		if (shed.valid) fprintf(outfile,"powersystemd_shed_battery_volts %.2f\n", shed.vb);
+		fprintf(outfile,"powersystemd_shed_loads_shed %d\n", sh_nshed(&shed));
+		fprintf(outfile,"powersystemd_shed_armed %d\n", sh_armed(&shed));
+		fprintf(outfile,"powersystemd_shed_reaction_ms %ld\n", shed.lastreaction);
+		fprintf(outfile,"powersystemd_shed_reaction_max_ms %ld\n", shed.maxreaction);
+		fprintf(outfile,"powersystemd_shed_overruns_total %lu\n", shed.overruns);
+		for (i=0; i<shed.nrules; i++) {
+			fprintf(outfile,"powersystemd_shed_load_state{load=\"%s\"} %d\n", shed.rule[i].name, shed.load[i].state);
+			fprintf(outfile,"powersystemd_shed_sheds_total{load=\"%s\"} %lu\n", shed.rule[i].name, shed.load[i].sheds);
+			fprintf(outfile,"powersystemd_shed_restores_total{load=\"%s\"} %lu\n", shed.rule[i].name, shed.load[i].restores);
+			fprintf(outfile,"powersystemd_shed_failures_total{load=\"%s\"} %lu\n", shed.rule[i].name, shed.load[i].failures);
+		}
+	}
+	fprintf(outfile,"powersystemd_commands_received_total %lu\n", cq.received);
+	fprintf(outfile,"powersystemd_commands_done_total %lu\n", cq.done);
+	fprintf(outfile,"powersystemd_commands_failed_total %lu\n", cq.failed);
+	fprintf(outfile,"powersystemd_commands_mismatched_total %lu\n", cq.mismatches);
+	fprintf(outfile,"powersystemd_commands_dropped_total %lu\n", cq.dropped);
+	fprintf(outfile,"powersystemd_commands_pending %d\n", cq.n);
+	if (cq.done > 0) {
+		fprintf(outfile,"powersystemd_command_latency_ms %ld\n", cq.lastlatency);
+		fprintf(outfile,"powersystemd_command_wait_ms %ld\n", cq.lastwait);
+		fprintf(outfile,"powersystemd_command_latency_max_ms %ld\n", cq.maxlatency);
+		fprintf(outfile,"powersystemd_command_latency_avg_ms %.1f\n", cq.totallatency/cq.done);
+	}
+	for (i=0; i<br->ndevices; i++) {
+		fprintf(outfile,"powersystemd_device_up{id=\"%d\"} %d\n", br->dev[i].slave, br->dev[i].state == BR_CLOSED);
+		fprintf(outfile,"powersystemd_device_trips_total{id=\"%d\"} %lu\n", br->dev[i].slave, br->dev[i].trips);
+		fprintf(outfile,"powersystemd_device_probes_total{id=\"%d\"} %lu\n", br->dev[i].slave, br->dev[i].probes);
+		fprintf(outfile,"powersystemd_device_failed_reads_total{id=\"%d\"} %lu\n", br->dev[i].slave, br->dev[i].failures);
+		fprintf(outfile,"powersystemd_device_skipped_reads_total{id=\"%d\"} %lu\n", br->dev[i].slave, br->dev[i].skipped);
+	}
+	for (i=0; i<s->nclasses; i++) {
+		fprintf(outfile,"powersystemd_class_polls_total{class=\"%s\"} %lu\n", s->cls[i].name, s->cls[i].polls);
+		fprintf(outfile,"powersystemd_class_prefetches_total{class=\"%s\"} %lu\n", s->cls[i].name, s->cls[i].prefetches);
+		fprintf(outfile,"powersystemd_class_piggybacks_total{class=\"%s\"} %lu\n", s->cls[i].name, s->cls[i].piggybacks);
+		fprintf(outfile,"powersystemd_class_late_total{class=\"%s\"} %lu\n", s->cls[i].name, s->cls[i].late);
+		if (uptime > 0) {
+			fprintf(outfile,"powersystemd_class_rate_hz{class=\"%s\"} %.3f\n", s->cls[i].name,
+					(s->cls[i].polls+s->cls[i].piggybacks)*1000.0/uptime);
+		}
+	}
+	fclose(outfile);
+	rename(tmppath, filepath);
+}
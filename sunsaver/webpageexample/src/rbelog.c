@@ -0,0 +1,66 @@
+/*
+ *  rbelog.c - Report by exception filter for the daily log file.
+ *
+ *	A sample is logged only when one of its columns has moved more than the column's deadband away from the value in the last
+ *	row written, when LOGHEARTBEAT seconds have passed since the last row, or when it is the first sample of a new day.  Each
+ *	row holds until the next one, so a reader gets the same series back by drawing steps between rows.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "powersystem.h"
+#include "rbelog.h"
+
+void rbe_init(struct rbe_log *r, const float *deadband, int ncols)
+{
+	memset(r, 0, sizeof(struct rbe_log));
+	r->ncols=ncols;
+	memcpy(r->deadband, deadband, ncols*sizeof(float));
+}
+
+/* Returns 1 if the sample should be written to the log, and remembers it as the last row */
+int rbe_check(struct rbe_log *r, const float *values, time_t t)
+{
+	struct tm *now;
+	float d;
+	int i, log;
+
+	r->samples++;
+	now=localtime(&t);
+
+	log=!r->haverow || t-r->lastrow >= LOGHEARTBEAT || now->tm_yday != r->lastday;
+	for (i=0; i<r->ncols && !log; i++) {
+		d=values[i]-r->logged[i];
+		if (d > r->deadband[i] || d < -r->deadband[i] || (r->deadband[i] == 0.0 && d != 0.0)) log=1;
+	}
+	if (!log) {
+		return 0;
+	}
+
+	memcpy(r->logged, values, r->ncols*sizeof(float));
+	r->haverow=1;
+	r->lastrow=t;
+	r->lastday=now->tm_yday;
+	r->rows++;
+
+	return 1;
+}
@@ -0,0 +1,43 @@
+/*
+ *  rbelog.h - Report by exception filter for the daily log file.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef RBELOG_H
+#define RBELOG_H
+
+#include <time.h>
+
+#define RBE_MAXCOLS		16
+
+struct rbe_log {
+	int ncols;
+	float deadband[RBE_MAXCOLS];								/* A column must move more than this to be logged (0 = any change) */
+	float logged[RBE_MAXCOLS];									/* Values in the last row written */
+	int haverow;
+	time_t lastrow;
+	int lastday;												/* Day of the year of the last row, so every daily file starts with a row */
+	unsigned long samples;
+	unsigned long rows;
+};
+
+void rbe_init(struct rbe_log *r, const float *deadband, int ncols);
+int rbe_check(struct rbe_log *r, const float *values, time_t t);
+
+#endif
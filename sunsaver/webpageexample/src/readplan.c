@@ -0,0 +1,212 @@
+/*
+ *  readplan.c - Read planner that merges the register fields a program needs into the fewest MODBUS read transactions.
+ *
+ *	Fields from all the devices on the bus are sorted by device and register address.  Overlapping fields are joined so no field is
+ *	ever split.  The cheapest way to cover the fields with reads is then found by dynamic programming over the sorted fields: each
+ *	read either bridges the gap to the next field (paying perreg for every unwanted register) or a new read is started (paying the
+ *	overhead again), subject to the MODBUS limit on registers per read.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <modbus.h>
+
+#include "readplan.h"
+
+struct rp_unit {
+	int slave;
+	int addr;
+	int end;													/* One past the last register */
+};
+
+static int unit_cmp(const void *a, const void *b);
+
+/*	Fill in the cost model for a MODBUS RTU serial line.  bits is the number of bits per character (11 for 8N2 or 8E1), and
+	response_us is how long the device takes to start answering once the request has ended. */
+void rp_rtucost(struct rp_cost *cost, int baud, int bits, int response_us)
+{
+	float chartime_us;
+
+	chartime_us=bits*1000000.0/baud;
+
+	/*	8 byte read request, then the turnaround - the 3.5 character silence that ends the request and the device's response
+		latency - then the 5 byte response header and CRC and the 3.5 character silence that ends the response */
+	cost->overhead=8.0+3.5+response_us/chartime_us+5.0+3.5;
+	cost->perreg=2.0;
+	cost->maxregs=RP_MAXREGS;
+}
+
+/* Build the cheapest plan that reads every field.  Returns the number of reads or -1 if the fields can't be planned. */
+int rp_build(struct rp_plan *plan, const struct rp_field *fields, int nfields, const struct rp_cost *cost)
+{
+	struct rp_unit unit[RP_MAXFIELDS];
+	float best[RP_MAXFIELDS+1];
+	int from[RP_MAXFIELDS+1];
+	int i, j, n, nreads, offset;
+	float c;
+
+	if (nfields > RP_MAXFIELDS || cost->maxregs > RP_MAXREGS) {
+		return -1;
+	}
+
+	for (i=0; i<nfields; i++) {
+		unit[i].slave=fields[i].slave;
+		unit[i].addr=fields[i].addr;
+		unit[i].end=fields[i].addr+fields[i].count;
+	}
+	qsort(unit, nfields, sizeof(struct rp_unit), unit_cmp);
+
+	/* Join fields that overlap so that no field is split between reads */
+	n=0;
+	for (i=0; i<nfields; i++) {
+		if (n > 0 && unit[i].slave == unit[n-1].slave && unit[i].addr < unit[n-1].end) {
+			if (unit[i].end > unit[n-1].end) unit[n-1].end=unit[i].end;
+		} else {
+			unit[n++]=unit[i];
+		}
+	}
+
+	/* best[i] is the cheapest cost of reading the first i units, and from[i] is the first unit of the last read in that plan */
+	best[0]=0.0;
+	for (i=0; i<n; i++) {
+		if (unit[i].end-unit[i].addr > cost->maxregs) {
+			return -1;											/* A single field is larger than one read */
+		}
+		best[i+1]=-1.0;
+		for (j=i; j>=0; j--) {
+			if (unit[j].slave != unit[i].slave || unit[i].end-unit[j].addr > cost->maxregs) break;
+			c=best[j]+cost->overhead+cost->perreg*(unit[i].end-unit[j].addr);
+			if (best[i+1] < 0.0 || c < best[i+1]) {
+				best[i+1]=c;
+				from[i+1]=j;
+			}
+		}
+	}
+
+	/* Count the reads, then fill them in from the last one back */
+	nreads=0;
+	for (i=n; i>0; i=from[i]) nreads++;
+	if (nreads > RP_MAXREADS) {
+		return -1;
+	}
+
+	plan->nreads=nreads;
+	plan->cost=best[n];
+	for (i=n, j=nreads-1; i>0; i=from[i], j--) {
+		plan->read[j].slave=unit[from[i]].slave;
+		plan->read[j].addr=unit[from[i]].addr;
+		plan->read[j].count=unit[i-1].end-unit[from[i]].addr;
+	}
+
+	offset=0;
+	for (j=0; j<nreads; j++) {
+		plan->read[j].offset=offset;
+		offset+=plan->read[j].count;
+	}
+	if (offset > RP_MAXDATA) {
+		return -1;
+	}
+
+	return nreads;
+}
+
+/* Run every read in the plan.  Returns 0, or -1 with errno set by libmodbus if a read fails. */
+int rp_execute(struct rp_plan *plan, modbus_t *ctx)
+{
+	int i, rc, slave;
+
+	slave=-1;
+	for (i=0; i<plan->nreads; i++) plan->status[i]=RP_PENDING;
+	for (i=0; i<plan->nreads; i++) {
+		if (i > 0) {
+			usleep(RP_READDELAY);								// Give the charge controller time before requesting next set of registers
+		}
+		if (plan->read[i].slave != slave) {
+			slave=plan->read[i].slave;
+			modbus_set_slave(ctx, slave);
+		}
+		rc = modbus_read_registers(ctx, plan->read[i].addr, plan->read[i].count, plan->data+plan->read[i].offset);
+		if (rc == -1) {
+			plan->status[i]=RP_FAILED;
+			return -1;
+		}
+		plan->status[i]=RP_OK;
+	}
+
+	return 0;
+}
+
+/* Pointer to count registers starting at addr on a device in an executed plan, or NULL if the plan didn't read them */
+const uint16_t *rp_find(const struct rp_plan *plan, int slave, uint16_t addr, int count)
+{
+	int i;
+
+	for (i=0; i<plan->nreads; i++) {
+		if (plan->read[i].slave == slave && addr >= plan->read[i].addr
+			&& addr+count <= plan->read[i].addr+plan->read[i].count) {
+			return (plan->status[i] == RP_OK) ? plan->data+plan->read[i].offset+addr-plan->read[i].addr : NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/* Status of the read that holds count registers starting at addr on a device, or -1 if the plan doesn't hold them */
+int rp_status(const struct rp_plan *plan, int slave, uint16_t addr, int count)
+{
+	int i;
+
+	for (i=0; i<plan->nreads; i++) {
+		if (plan->read[i].slave == slave && addr >= plan->read[i].addr
+			&& addr+count <= plan->read[i].addr+plan->read[i].count) {
+			return plan->status[i];
+		}
+	}
+
+	return -1;
+}
+
+/* Copy count registers starting at addr on a device out of an executed plan.  Returns 0, or -1 if the plan didn't read them. */
+int rp_copy(const struct rp_plan *plan, int slave, uint16_t addr, int count, uint16_t *dest)
+{
+	const uint16_t *src;
+	int j;
+
+	if ((src=rp_find(plan, slave, addr, count)) == NULL) {
+		return -1;
+	}
+	for (j=0; j<count; j++) {
+		dest[j]=src[j];
+	}
+
+	return 0;
+}
+
+/* qsort comparison function - order by device, then by register address */
+static int unit_cmp(const void *a, const void *b)
+{
+	const struct rp_unit *ua = (const struct rp_unit *)a;
+	const struct rp_unit *ub = (const struct rp_unit *)b;
+
+	if (ua->slave != ub->slave) return ua->slave - ub->slave;
+	return ua->addr - ub->addr;
+}
@@ -0,0 +1,84 @@
+/*
+ *  readplan.h - Read planner that merges the register fields a program needs into the fewest MODBUS read transactions.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef READPLAN_H
+#define READPLAN_H
+
+#include <stdint.h>
+#include <modbus.h>
+
+#define RP_MAXREGS		125										/* MODBUS limit on the number of registers returned by one read */
+#define RP_MAXFIELDS	128										/* Maximum number of fields in one plan */
+#define RP_MAXREADS		32										/* Maximum number of read transactions in one plan */
+#define RP_MAXDATA		1024									/* Register storage shared by all the reads in one plan */
+#define RP_READDELAY	2500									/* Microseconds to give the charge controller between reads */
+#define RP_RESPONSETIME	5000									/* Microseconds a charge controller takes to start answering a read */
+
+/* What happened to each read the last time the plan was run */
+
+#define RP_PENDING		0										/* Not run */
+#define RP_OK			1
+#define RP_FAILED		2
+#define RP_SKIPPED		3										/* The device is out of service (see breaker.c) */
+#define RP_DEFERRED		4										/* Didn't fit before the end of the cycle */
+
+/*	A field is a register, a hi/lo register pair (e.g. Ahc_r), or a block of registers that a program needs from one device.
+	The planner never splits a field between two read transactions, so a 32-bit value is always read in one piece. */
+
+struct rp_field {
+	int slave;													/* MODBUS address of the device */
+	uint16_t addr;												/* First register of the field */
+	uint16_t count;												/* Number of registers in the field */
+};
+
+/*	Bus cost model in character times.  overhead is what every read costs no matter how many registers it returns (request frame,
+	response header and CRC, the silent intervals between frames, and the time the device needs to turn around).  perreg is the
+	cost of each register returned.  A gap between two fields is read and thrown away when that is cheaper than a new transaction. */
+
+struct rp_cost {
+	float overhead;
+	float perreg;
+	int maxregs;
+};
+
+struct rp_read {
+	int slave;
+	uint16_t addr;
+	uint16_t count;
+	uint16_t offset;											/* Index of the first register of this read in data[] */
+};
+
+struct rp_plan {
+	int nreads;
+	float cost;													/* Estimated bus time for the whole plan in character times */
+	struct rp_read read[RP_MAXREADS];
+	unsigned char status[RP_MAXREADS];							/* RP_OK etc. for each read */
+	uint16_t data[RP_MAXDATA];
+};
+
+void rp_rtucost(struct rp_cost *cost, int baud, int bits, int response_us);
+int rp_build(struct rp_plan *plan, const struct rp_field *fields, int nfields, const struct rp_cost *cost);
+int rp_execute(struct rp_plan *plan, modbus_t *ctx);
+const uint16_t *rp_find(const struct rp_plan *plan, int slave, uint16_t addr, int count);
+int rp_copy(const struct rp_plan *plan, int slave, uint16_t addr, int count, uint16_t *dest);
+int rp_status(const struct rp_plan *plan, int slave, uint16_t addr, int count);
+
+#endif
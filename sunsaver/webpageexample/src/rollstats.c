@@ -0,0 +1,269 @@
+/*
+ *  rollstats.c - Rolling window minimum, maximum, mean and standard deviation of the logged channels, for the acquisition daemon.
+ *
+ *	"Average charge power over the last 15 minutes" or "highest battery voltage this hour" would otherwise mean reading back the
+ *	log file.  Here every fast sample goes into a ring that holds the longest window (STATSWINDOWS), and each window keeps, for
+ *	every channel, the sum and the sum of squares of the samples in it and two monotonic deques: sample numbers whose values
+ *	increase (for the minimum) or decrease (for the maximum) from the front.  A new sample is added to the sums and pushed onto
+ *	the deques after popping the samples it makes useless from their backs; a sample that leaves the window is taken off the
+ *	sums and popped from the fronts.  Each sample goes on and comes off once, so an update costs the same however long the
+ *	window is, and the answers are always ready.
+ *
+ *	The sums are of the values less the first value of the channel, so the variance isn't lost to rounding when it is small
+ *	next to the mean, and they are added up again from the ring once every time round it so rounding can't build up.  Samples
+ *	less than about STATSSTEP apart are left out, so a burst of fast reads doesn't outweigh the rest of the window.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "powersystem.h"
+#include "rollstats.h"
+
+#define MINGAP			(STATSSTEP*3/4)							/* A little under STATSSTEP, so jitter in the polling doesn't skip samples */
+
+static const char *names[RS_NCHANNELS] = { "Vb", "Va", "Vl", "Ic", "Il", "Power_out", "Load_power" };
+
+static void push(struct rs_stats *st, struct rs_track *tr, int ch, unsigned int seq);
+static void drop(struct rs_stats *st, int w, unsigned int upto);
+static void age(struct rs_stats *st, int w, long now);
+static void resum(struct rs_stats *st, int w);
+
+/*	Set up the windows, spans[] seconds long, for a device with the channels in the channels mask and allocate the ring.  Returns
+	0, or -1. */
+int rs_init(struct rs_stats *st, int slave, unsigned int channels, const long *spans, int nwindows)
+{
+	struct rs_track *tr;
+	long longest;
+	int w, ch;
+
+	memset(st, 0, sizeof(struct rs_stats));
+	st->slave=slave;
+	st->channels=channels;
+	if (nwindows > RS_MAXWINDOWS) nwindows=RS_MAXWINDOWS;
+	st->nwindows=nwindows;
+	longest=0;
+	for (w=0; w<nwindows; w++) {
+		st->span[w]=spans[w]*1000L;
+		if (st->span[w] > longest) longest=st->span[w];
+	}
+	st->size=longest/MINGAP+2;
+	st->when=malloc(st->size*sizeof(long));
+	st->value=malloc(st->size*RS_NCHANNELS*sizeof(float));
+	if (st->when == NULL || st->value == NULL) {
+		rs_free(st);
+		return -1;
+	}
+	for (w=0; w<nwindows; w++) {
+		for (ch=0; ch<RS_NCHANNELS; ch++) {
+			if (!(channels & (1 << ch))) continue;
+			tr=&st->win[w].track[ch];
+			tr->minq=malloc(st->size*sizeof(unsigned int));
+			tr->maxq=malloc(st->size*sizeof(unsigned int));
+			if (tr->minq == NULL || tr->maxq == NULL) {
+				rs_free(st);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+void rs_free(struct rs_stats *st)
+{
+	int w, ch;
+
+	for (w=0; w<RS_MAXWINDOWS; w++) {
+		for (ch=0; ch<RS_NCHANNELS; ch++) {
+			free(st->win[w].track[ch].minq);
+			free(st->win[w].track[ch].maxq);
+		}
+	}
+	free(st->when);
+	free(st->value);
+	memset(st, 0, sizeof(struct rs_stats));
+}
+
+/* Add a sample of every channel (values[] in RS_ channel order) taken at now (monotonic milliseconds) */
+void rs_add(struct rs_stats *st, const float *values, long now)
+{
+	struct rs_track *tr;
+	unsigned int seq;
+	double d;
+	int w, ch, k;
+
+	if (st->size == 0) return;
+	if (st->next > 0 && now-st->when[(st->next-1)%st->size] < MINGAP) {
+		st->skipped++;
+		return;
+	}
+	if (st->next == 0) {
+		for (ch=0; ch<RS_NCHANNELS; ch++) st->ref[ch]=values[ch];
+	}
+
+	/* The slot is about to be written over, so no window may still hold the sample in it */
+	seq=st->next;
+	for (w=0; w<st->nwindows; w++) {
+		if (seq-st->win[w].first >= st->size) drop(st, w, seq-st->size+1);
+	}
+	k=seq%st->size;
+	st->when[k]=now;
+	memcpy(&st->value[k*RS_NCHANNELS], values, RS_NCHANNELS*sizeof(float));
+	st->next++;
+
+	for (w=0; w<st->nwindows; w++) {
+		for (ch=0; ch<RS_NCHANNELS; ch++) {
+			if (!(st->channels & (1 << ch))) continue;
+			tr=&st->win[w].track[ch];
+			d=values[ch]-st->ref[ch];
+			tr->sum+=d;
+			tr->sumsq+=d*d;
+			push(st, tr, ch, seq);
+		}
+		age(st, w, now);
+		if (st->next%st->size == 0) resum(st, w);
+	}
+}
+
+/*	Minimum, maximum, mean and standard deviation of a channel over window w as of now.  Returns 0, or -1 if the window has no
+	samples or the device doesn't have the channel. */
+int rs_get(struct rs_stats *st, int ch, int w, long now, struct rs_result *res)
+{
+	const struct rs_track *tr;
+	double mean, var;
+
+	memset(res, 0, sizeof(struct rs_result));
+	if (st->size == 0 || w < 0 || w >= st->nwindows || ch < 0 || ch >= RS_NCHANNELS || !(st->channels & (1 << ch))) return -1;
+	age(st, w, now);
+	res->n=st->next-st->win[w].first;
+	if (res->n == 0) return -1;
+
+	tr=&st->win[w].track[ch];
+	res->min=st->value[(tr->minq[tr->minhead%st->size]%st->size)*RS_NCHANNELS+ch];
+	res->max=st->value[(tr->maxq[tr->maxhead%st->size]%st->size)*RS_NCHANNELS+ch];
+	mean=tr->sum/res->n;
+	var=tr->sumsq/res->n-mean*mean;
+	res->mean=st->ref[ch]+mean;
+	res->stddev=(var > 0) ? sqrt(var) : 0;
+	return 0;
+}
+
+/* Channel by name (Vb, Power_out, ...), or -1 */
+int rs_channel(const char *name)
+{
+	int ch;
+
+	for (ch=0; ch<RS_NCHANNELS; ch++) {
+		if (strcasecmp(name, names[ch]) == 0) return ch;
+	}
+	return -1;
+}
+
+const char *rs_name(int ch)
+{
+	return names[ch];
+}
+
+/* Short name of a window span in milliseconds: 90s, 15m, 1h */
+void rs_label(long span, char *label, int size)
+{
+	span/=1000;
+	if (span%3600 == 0) {
+		snprintf(label, size, "%ldh", span/3600);
+	} else if (span%60 == 0) {
+		snprintf(label, size, "%ldm", span/60);
+	} else {
+		snprintf(label, size, "%lds", span);
+	}
+}
+
+/* Pop the samples a new one makes useless from the backs of the deques and push it */
+static void push(struct rs_stats *st, struct rs_track *tr, int ch, unsigned int seq)
+{
+	float v;
+
+	v=st->value[(seq%st->size)*RS_NCHANNELS+ch];
+	while (tr->mintail != tr->minhead && st->value[(tr->minq[(tr->mintail-1)%st->size]%st->size)*RS_NCHANNELS+ch] >= v) {
+		tr->mintail--;
+	}
+	tr->minq[tr->mintail++%st->size]=seq;
+	while (tr->maxtail != tr->maxhead && st->value[(tr->maxq[(tr->maxtail-1)%st->size]%st->size)*RS_NCHANNELS+ch] <= v) {
+		tr->maxtail--;
+	}
+	tr->maxq[tr->maxtail++%st->size]=seq;
+}
+
+/* Take the samples before upto out of window w */
+static void drop(struct rs_stats *st, int w, unsigned int upto)
+{
+	struct rs_window *win;
+	struct rs_track *tr;
+	double d;
+	int ch, k;
+
+	win=&st->win[w];
+	while (win->first != upto) {
+		k=win->first%st->size;
+		for (ch=0; ch<RS_NCHANNELS; ch++) {
+			if (!(st->channels & (1 << ch))) continue;
+			tr=&win->track[ch];
+			d=st->value[k*RS_NCHANNELS+ch]-st->ref[ch];
+			tr->sum-=d;
+			tr->sumsq-=d*d;
+			if (tr->minhead != tr->mintail && tr->minq[tr->minhead%st->size] == win->first) tr->minhead++;
+			if (tr->maxhead != tr->maxtail && tr->maxq[tr->maxhead%st->size] == win->first) tr->maxhead++;
+		}
+		win->first++;
+	}
+}
+
+/* Take the samples older than the span out of window w */
+static void age(struct rs_stats *st, int w, long now)
+{
+	unsigned int seq;
+
+	seq=st->win[w].first;
+	while (seq != st->next && now-st->when[seq%st->size] >= st->span[w]) seq++;
+	drop(st, w, seq);
+}
+
+/* Add up the sums of window w again from the ring */
+static void resum(struct rs_stats *st, int w)
+{
+	struct rs_track *tr;
+	unsigned int seq;
+	double d;
+	int ch;
+
+	for (ch=0; ch<RS_NCHANNELS; ch++) {
+		if (!(st->channels & (1 << ch))) continue;
+		tr=&st->win[w].track[ch];
+		tr->sum=0;
+		tr->sumsq=0;
+		for (seq=st->win[w].first; seq != st->next; seq++) {
+			d=st->value[(seq%st->size)*RS_NCHANNELS+ch]-st->ref[ch];
+			tr->sum+=d;
+			tr->sumsq+=d*d;
+		}
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ *  rollstats.h - Rolling window minimum, maximum, mean and standard deviation of the logged channels, for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef ROLLSTATS_H
+#define ROLLSTATS_H
+
+#define RS_MAXWINDOWS	4
+
+/* Channels, the first six log columns and the load power */
+
+enum {
+	RS_VB, RS_VA, RS_VL, RS_IC, RS_IL, RS_POWER_OUT, RS_LOAD_POWER, RS_NCHANNELS
+};
+
+#define RS_LOADCHANNELS	((1 << RS_VL) | (1 << RS_IL) | (1 << RS_LOAD_POWER))
+
+/* One channel over one window: the sums of its samples and the deques of candidates for its minimum and maximum */
+
+struct rs_track {
+	double sum;													/* Of the samples less the channel's reference */
+	double sumsq;
+	unsigned int *minq;											/* Sequence numbers, values increasing from the front */
+	unsigned int *maxq;											/* Sequence numbers, values decreasing from the front */
+	unsigned int minhead, mintail;
+	unsigned int maxhead, maxtail;
+};
+
+struct rs_window {
+	unsigned int first;											/* Sequence number of the oldest sample in the window */
+	struct rs_track track[RS_NCHANNELS];
+};
+
+struct rs_stats {
+	int slave;
+	unsigned int channels;										/* One bit for each channel the device has */
+	int nwindows;
+	long span[RS_MAXWINDOWS];									/* Milliseconds */
+	int size;													/* Samples the ring holds - enough for the longest window */
+	unsigned int next;											/* Sequence number of the next sample */
+	long *when;													/* Monotonic milliseconds of each sample */
+	float *value;												/* RS_NCHANNELS values for each sample */
+	float ref[RS_NCHANNELS];									/* First value, taken off to keep the sums small */
+	struct rs_window win[RS_MAXWINDOWS];
+	unsigned long skipped;										/* Samples too soon after the last one */
+};
+
+struct rs_result {
+	int n;
+	float min;
+	float max;
+	float mean;
+	float stddev;
+};
+
+int rs_init(struct rs_stats *st, int slave, unsigned int channels, const long *spans, int nwindows);
+void rs_free(struct rs_stats *st);
+void rs_add(struct rs_stats *st, const float *values, long now);
+int rs_get(struct rs_stats *st, int ch, int w, long now, struct rs_result *res);
+int rs_channel(const char *name);
+const char *rs_name(int ch);
+void rs_label(long span, char *label, int size);
+
+#endif
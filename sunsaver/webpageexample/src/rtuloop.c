@@ -0,0 +1,343 @@
+/*
+ *  rtuloop.c - Non-blocking MODBUS RTU engine that runs requests on many serial ports from one event loop.
+ *
+ *	libmodbus blocks on each request, so a program that talks to several ports at once needs a thread or a process for each.
+ *	Here every port is a small state machine driven from one epoll loop: the port's file descriptor says when bytes have come in,
+ *	and a timerfd for each port times the quiet gap before a request, the response timeout, and the 3.5 character silence that
+ *	ends a frame.  A response is finished as soon as its length is known from its header, without waiting out the silence, and
+ *	once the length is known the rest of it may be up to RL_BYTETIMEOUT late before the frame is given up as garbled.  The
+ *	CRC is checked with a 256 entry table, one lookup per byte.  Each port costs one fixed structure and two file descriptors, and
+ *	the loop only wakes for the ports with something to do, so adding ports adds no work to the others.
+ *
+ *	A request is started with rl_request() and its result handed to a callback, which can start the port's next request.
+ *	rl_run() returns when no port has a request in progress.  Ports are opened 8N2, like the rest of these programs.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "rtuloop.h"
+#include "pollsched.h"
+
+#define MAXEVENTS		32
+
+static uint16_t crctable[256];
+
+static speed_t baudcode(int baud);
+static void arm(struct rl_port *p, long us);
+static void transmit(struct rl_loop *l, int i);
+static void receive(struct rl_loop *l, int i);
+static void expire(struct rl_loop *l, int i);
+static int framesize(const struct rl_port *p);
+static void finish(struct rl_loop *l, int i, int status);
+
+int rl_init(struct rl_loop *l)
+{
+	uint16_t crc;
+	int i, b;
+
+	memset(l, 0, sizeof(struct rl_loop));
+	for (i=0; i<256; i++) {
+		crc=i;
+		for (b=0; b<8; b++) crc=(crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+		crctable[i]=crc;
+	}
+	l->epfd=epoll_create1(0);
+	return (l->epfd == -1) ? -1 : 0;
+}
+
+/* Open a serial port at baud, 8N2, raw and non-blocking.  Returns the port number, or -1. */
+int rl_open(struct rl_loop *l, const char *path, int baud)
+{
+	struct rl_port *p;
+	struct termios tio;
+	struct epoll_event ev;
+	int i;
+
+	if (l->nports >= RL_MAXPORTS || baudcode(baud) == 0) {
+		errno=EINVAL;
+		return -1;
+	}
+	i=l->nports;
+	p=&l->port[i];
+	memset(p, 0, sizeof(struct rl_port));
+	p->path=path;
+	if ((p->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) return -1;
+	memset(&tio, 0, sizeof(tio));
+	tio.c_cflag=CS8 | CSTOPB | CLOCAL | CREAD;
+	tio.c_cc[VMIN]=0;
+	tio.c_cc[VTIME]=0;
+	cfsetispeed(&tio, baudcode(baud));
+	cfsetospeed(&tio, baudcode(baud));
+	if (tcsetattr(p->fd, TCSANOW, &tio) == -1 || (p->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) == -1) {
+		close(p->fd);
+		return -1;
+	}
+	p->chartime=11*1000000L/baud;
+
+	/* The event data says which port, and whether it is the timer */
+	ev.events=EPOLLIN;
+	ev.data.u32=i*2;
+	epoll_ctl(l->epfd, EPOLL_CTL_ADD, p->fd, &ev);
+	ev.data.u32=i*2+1;
+	epoll_ctl(l->epfd, EPOLL_CTL_ADD, p->tfd, &ev);
+	l->nports++;
+	return i;
+}
+
+/*	Start a read on a port that is idle: function RL_READREGS or RL_READBITS, count registers or coils from addr.  The bus is
+	kept quiet for gap microseconds (and at least 3.5 characters) first, and the response must start within timeout
+	milliseconds.  done is called with the result.  Returns 0, or -1 if the port is busy. */
+int rl_request(struct rl_loop *l, int port, int slave, int function, uint16_t addr, uint16_t count, long timeout, long gap,
+			   rl_done done, void *arg)
+{
+	struct rl_port *p;
+	uint16_t crc;
+
+	p=&l->port[port];
+	if (p->state != RL_IDLE || count == 0 || count > RL_MAXREGS) return -1;
+	p->slave=slave;
+	p->function=function;
+	p->count=count;
+	p->timeout=timeout;
+	p->done=done;
+	p->arg=arg;
+	p->tx[0]=slave;
+	p->tx[1]=function;
+	p->tx[2]=addr >> 8;
+	p->tx[3]=addr & 0xFF;
+	p->tx[4]=count >> 8;
+	p->tx[5]=count & 0xFF;
+	crc=rl_crc16(p->tx, 6);
+	p->tx[6]=crc & 0xFF;										/* The CRC goes low byte first */
+	p->tx[7]=crc >> 8;
+	p->state=RL_GAP;
+	arm(p, (gap > p->chartime*7/2) ? gap : p->chartime*7/2);
+	return 0;
+}
+
+/* Run the loop until no port has a request in progress.  Returns 0, or -1 if epoll failed. */
+int rl_run(struct rl_loop *l)
+{
+	struct epoll_event ev[MAXEVENTS];
+	int i, n, busy;
+
+	for (;;) {
+		busy=0;
+		for (i=0; i<l->nports; i++) {
+			if (l->port[i].state != RL_IDLE) busy=1;
+		}
+		if (!busy) return 0;
+
+		n=epoll_wait(l->epfd, ev, MAXEVENTS, -1);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		for (i=0; i<n; i++) {
+			if (ev[i].data.u32 & 1) {
+				expire(l, ev[i].data.u32/2);
+			} else {
+				receive(l, ev[i].data.u32/2);
+			}
+		}
+	}
+}
+
+void rl_close(struct rl_loop *l)
+{
+	int i;
+
+	for (i=0; i<l->nports; i++) {
+		close(l->port[i].fd);
+		close(l->port[i].tfd);
+	}
+	close(l->epfd);
+	l->nports=0;
+}
+
+/* MODBUS CRC-16 (polynomial 0xA001 reflected, starting at 0xFFFF) */
+uint16_t rl_crc16(const uint8_t *buf, int len)
+{
+	uint16_t crc;
+	int i;
+
+	crc=0xFFFF;
+	for (i=0; i<len; i++) crc=(crc >> 8) ^ crctable[(crc ^ buf[i]) & 0xFF];
+	return crc;
+}
+
+static speed_t baudcode(int baud)
+{
+	switch (baud) {
+	case 1200:
+		return B1200;
+	case 2400:
+		return B2400;
+	case 4800:
+		return B4800;
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	}
+	return 0;
+}
+
+/* Start (or with 0, stop) the port's timer */
+static void arm(struct rl_port *p, long us)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec=us/1000000;
+	its.it_value.tv_nsec=(us%1000000)*1000;
+	timerfd_settime(p->tfd, 0, &its, NULL);
+}
+
+/* The gap is over - throw away anything left on the line and send the request */
+static void transmit(struct rl_loop *l, int i)
+{
+	struct rl_port *p;
+
+	p=&l->port[i];
+	tcflush(p->fd, TCIFLUSH);
+	p->nrx=0;
+	p->sent=ps_now()+8*p->chartime/1000;						/* The frame is still going out */
+	if (write(p->fd, p->tx, 8) != 8) {
+		finish(l, i, RL_TIMEOUT);
+		return;
+	}
+	p->requests++;
+	p->state=RL_WAIT;
+	arm(p, 8*p->chartime+p->timeout*1000);
+}
+
+static void receive(struct rl_loop *l, int i)
+{
+	struct rl_port *p;
+	uint8_t junk[64];
+	int n, size;
+
+	p=&l->port[i];
+	if (p->state != RL_WAIT && p->state != RL_RECV) {
+		while (read(p->fd, junk, sizeof(junk)) > 0);			/* Noise or a late answer between requests */
+		return;
+	}
+	n=read(p->fd, p->rx+p->nrx, RL_MAXFRAME-p->nrx);
+	if (n <= 0) return;
+	p->nrx+=n;
+	p->state=RL_RECV;
+
+	size=framesize(p);
+	if (size > 0 && p->nrx >= size) {
+		finish(l, i, (p->nrx == size) ? RL_OK : RL_GARBLED);
+	} else if (p->nrx >= RL_MAXFRAME) {
+		finish(l, i, RL_GARBLED);
+	} else if (size > 0) {
+		/* The rest is coming - a USB-serial adapter hands bytes over in bursts that can be far more than 3.5 characters apart */
+		arm(p, (RL_BYTETIMEOUT*1000L > p->chartime*7/2) ? RL_BYTETIMEOUT*1000L : p->chartime*7/2);
+	} else {
+		arm(p, p->chartime*7/2);								/* The frame ends after 3.5 quiet characters */
+	}
+}
+
+static void expire(struct rl_loop *l, int i)
+{
+	struct rl_port *p;
+	uint64_t ticks;
+
+	p=&l->port[i];
+	if (read(p->tfd, &ticks, sizeof(ticks)) != sizeof(ticks)) return;
+	switch (p->state) {
+	case RL_GAP:
+		transmit(l, i);
+		break;
+	case RL_WAIT:
+		finish(l, i, RL_TIMEOUT);
+		break;
+	case RL_RECV:
+		finish(l, i, RL_GARBLED);								/* Went quiet before the whole frame came */
+		break;
+	}
+}
+
+/* Length of the whole response once its header is in, or 0 if it isn't yet */
+static int framesize(const struct rl_port *p)
+{
+	if (p->nrx < 3) return 0;
+	if (p->rx[1] & 0x80) return 5;								/* Address, function, exception code and CRC */
+	return 5+p->rx[2];											/* Address, function, byte count, data and CRC */
+}
+
+/* Check the response, decode it and hand it to the callback */
+static void finish(struct rl_loop *l, int i, int status)
+{
+	struct rl_port *p;
+	struct rl_result res;
+	int k, n;
+
+	p=&l->port[i];
+	arm(p, 0);
+	p->state=RL_IDLE;
+	memset(&res, 0, sizeof(res));
+	res.rtt=ps_now()-p->sent;
+
+	if (status == RL_OK) {
+		n=p->nrx;
+		if (rl_crc16(p->rx, n-2) != (p->rx[n-2] | (p->rx[n-1] << 8)) || p->rx[0] != p->slave || (p->rx[1] & 0x7F) != p->function) {
+			status=RL_GARBLED;
+		} else if (p->rx[1] & 0x80) {
+			status=RL_EXCEPTION;
+			res.exception=p->rx[2];
+		} else if (p->function == RL_READREGS) {
+			if (p->rx[2] != 2*p->count) {
+				status=RL_GARBLED;
+			} else {
+				for (k=0; k<p->count; k++) res.data[k]=(p->rx[3+2*k] << 8) | p->rx[4+2*k];
+				res.count=p->count;
+			}
+		} else {
+			if (p->rx[2] != (p->count+7)/8) {
+				status=RL_GARBLED;
+			} else {
+				for (k=0; k<p->count; k++) res.data[k]=(p->rx[3+k/8] >> (k%8)) & 1;
+				res.count=p->count;
+			}
+		}
+	}
+	if (status == RL_TIMEOUT) p->timeouts++;
+	if (status == RL_GARBLED) p->garbled++;
+	res.status=status;
+	p->done(l, i, &res, p->arg);
+}
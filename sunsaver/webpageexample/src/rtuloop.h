@@ -0,0 +1,101 @@
+/*
+ *  rtuloop.h - Non-blocking MODBUS RTU engine that runs requests on many serial ports from one event loop.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef RTULOOP_H
+#define RTULOOP_H
+
+#include <stdint.h>
+
+#define RL_MAXPORTS		16
+#define RL_MAXREGS		125										/* MODBUS limit on the registers returned by one read */
+#define RL_MAXFRAME		256										/* Longest RTU frame */
+#define RL_BYTETIMEOUT	30										/* Milliseconds the rest of a frame of known length may lag - a
+																	USB-serial adapter can hold bytes back for its 16 ms latency */
+
+/* Function codes the engine can send */
+
+#define RL_READBITS		0x01									/* Read coils */
+#define RL_READREGS		0x03									/* Read holding registers */
+
+/* Request results */
+
+#define RL_OK			0
+#define RL_EXCEPTION	1										/* The device answered with an exception - it is there */
+#define RL_TIMEOUT		2										/* Nothing came back */
+#define RL_GARBLED		3										/* Bad CRC, the wrong address or function, or the wrong length */
+
+/* Port states */
+
+#define RL_IDLE			0
+#define RL_GAP			1										/* Keeping the bus quiet before sending */
+#define RL_WAIT			2										/* Request sent, waiting for the first byte */
+#define RL_RECV			3										/* Receiving - the frame ends at its length, or after 3.5 quiet
+																	characters if its header isn't in yet */
+
+struct rl_loop;
+
+struct rl_result {
+	int status;
+	int exception;												/* Exception code for RL_EXCEPTION */
+	int count;													/* Registers or coils in data[] */
+	uint16_t data[RL_MAXREGS*2];								/* Registers, or one coil (0 or 1) in each */
+	long rtt;													/* Milliseconds from the end of the request to the end of the response */
+};
+
+typedef void (*rl_done)(struct rl_loop *l, int port, const struct rl_result *res, void *arg);
+
+struct rl_port {
+	const char *path;
+	int fd;
+	int tfd;													/* timerfd for the gap, the response timeout and the end of frame */
+	int state;
+	long chartime;												/* Microseconds per character (11 bits) */
+	int slave;
+	int function;
+	int count;
+	long timeout;												/* Milliseconds */
+	long gap;													/* Microseconds of quiet bus before the request */
+	uint8_t tx[8];
+	long sent;													/* Monotonic milliseconds when the request was out */
+	uint8_t rx[RL_MAXFRAME];
+	int nrx;
+	rl_done done;
+	void *arg;
+	unsigned long requests;
+	unsigned long timeouts;
+	unsigned long garbled;
+};
+
+struct rl_loop {
+	int epfd;
+	int nports;
+	struct rl_port port[RL_MAXPORTS];
+};
+
+int rl_init(struct rl_loop *l);
+int rl_open(struct rl_loop *l, const char *path, int baud);
+int rl_request(struct rl_loop *l, int port, int slave, int function, uint16_t addr, uint16_t count, long timeout, long gap,
+			   rl_done done, void *arg);
+int rl_run(struct rl_loop *l);
+void rl_close(struct rl_loop *l);
+uint16_t rl_crc16(const uint8_t *buf, int len);
+
+#endif
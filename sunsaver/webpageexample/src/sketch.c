@@ -0,0 +1,290 @@
+/*
+ *  sketch.c - Mergeable quantile sketches and residency histograms of battery voltage and power, one set a day.
+ *
+ *	"Hours below 12.0 V this month" or the 5th and 95th percentile of the charging power each day for years would otherwise mean
+ *	reading every row of every log file.  The daemon keeps, for each device and day, the time spent at each value of the
+ *	battery voltage, the charging power and the load power in two kinds of bins:
+ *
+ *	- A quantile sketch, with bins whose width grows with the value, so any quantile read back from it is within SK_ACCURACY
+ *	  (1%) of the true one, and it needs about 700 bins from 1 mW to 250 kW.
+ *	- A residency histogram of fixed width bins (RESIDENCYVB and RESIDENCYPOWER), for the time spent below or above a level.
+ *
+ *	Both count seconds rather than samples: each sample is held until the next one, up to MAXHOLD, so the faster reads near a
+ *	shed voltage or during a flight record don't count extra and a gap in the polling isn't counted at all.  Both merge by adding
+ *	bin to bin, so a month, a year or several sites are just the sum of their days, and a query reads one small file a day.
+ *	Each day is saved to LOGFILEPATH/YYYY/YYYYMMDDsketch.txt, one line for each sketch or histogram:
+ *
+ *		id	channel	sketch	total	zero	bin:seconds ...			(only the bins with time in them)
+ *		id	channel	residency	low	width	nbins	seconds ...			(below low, the nbins bins, above the top)
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "powersystem.h"
+#include "sketch.h"
+
+#define MAXHOLD			(2L*POLLNIGHT)								/* Longest time (ms) a sample is held - longer is a gap */
+#define LINESIZE		32768
+
+static const char *names[SK_NCHANNELS] = { "Vb", "Power_out", "Load_power" };
+static const float resvb[3] = RESIDENCYVB;
+static const float respower[3] = RESIDENCYPOWER;
+
+static void addtime(struct sk_channel *c, float v, double sec);
+static struct sk_day *finddevice(struct sk_day *days, int *n, int max, int slave);
+
+void sk_init(struct sk_day *d, int slave, unsigned int channels, long date)
+{
+	int ch;
+
+	memset(d, 0, sizeof(struct sk_day));
+	d->slave=slave;
+	d->channels=channels;
+	d->date=date;
+	for (ch=0; ch<SK_NCHANNELS; ch++) sk_clear(&d->ch[ch], ch);
+}
+
+/* Add a sample of every channel (values[] in SK_ channel order) taken at now (monotonic milliseconds) */
+void sk_add(struct sk_day *d, const float *values, long now)
+{
+	int ch;
+
+	/* The last sample held until this one */
+	if (d->havelast && now-d->lastwhen <= MAXHOLD) {
+		for (ch=0; ch<SK_NCHANNELS; ch++) {
+			if (d->channels & (1 << ch)) addtime(&d->ch[ch], d->last[ch], (now-d->lastwhen)/1000.0);
+		}
+	}
+	memcpy(d->last, values, sizeof(d->last));
+	d->lastwhen=now;
+	d->havelast=1;
+}
+
+/* Start a new day, going on holding the last sample */
+void sk_newday(struct sk_day *d, long date)
+{
+	int ch;
+
+	d->date=date;
+	for (ch=0; ch<SK_NCHANNELS; ch++) sk_clear(&d->ch[ch], ch);
+}
+
+/* Empty a channel's sketch and histogram, with the histogram bins set up from powersystem.h */
+void sk_clear(struct sk_channel *c, int ch)
+{
+	const float *layout;
+
+	memset(c, 0, sizeof(struct sk_channel));
+	layout=(ch == SK_VB) ? resvb : respower;
+	c->res.low=layout[0];
+	c->res.width=layout[1];
+	c->res.nbins=(layout[2] > SK_MAXRESBINS) ? SK_MAXRESBINS : layout[2];
+}
+
+/* Add one channel's time into another.  Returns 0, or -1 if the histograms' bins differ (the sketch is added anyway). */
+int sk_merge(struct sk_channel *to, const struct sk_channel *from)
+{
+	int i;
+
+	to->sketch.total+=from->sketch.total;
+	to->sketch.zero+=from->sketch.zero;
+	for (i=0; i<SK_NBINS; i++) to->sketch.bin[i]+=from->sketch.bin[i];
+
+	if (to->res.low != from->res.low || to->res.width != from->res.width || to->res.nbins != from->res.nbins) return -1;
+	for (i=0; i<from->res.nbins+2; i++) to->res.sec[i]+=from->res.sec[i];
+	return 0;
+}
+
+/* Value below which fraction q (0 to 1) of the time was spent, to within SK_ACCURACY.  0 for an empty sketch. */
+float sk_quantile(const struct sk_sketch *s, double q)
+{
+	double gamma, rank, sum;
+	int i;
+
+	if (s->total <= 0) return 0;
+	rank=q*s->total;
+	sum=s->zero;
+	if (sum > rank) return 0;
+	gamma=(1+SK_ACCURACY)/(1-SK_ACCURACY);
+	for (i=0; i<SK_NBINS; i++) {
+		sum+=s->bin[i];
+		if (sum > rank) break;
+	}
+	if (i == SK_NBINS) {
+		for (i=SK_NBINS-1; i>0 && s->bin[i] == 0; i--);
+	}
+	return 2*pow(gamma, i-SK_OFFSET)/(gamma+1);					/* The middle of the bin, within SK_ACCURACY of its ends */
+}
+
+/* Seconds spent below x, counting the bin x falls in as spread evenly across it */
+double sk_below(const struct sk_residency *r, float x)
+{
+	double sec, f;
+	int i;
+
+	if (r->nbins == 0) return 0;
+	sec=r->sec[0];
+	for (i=0; i<r->nbins; i++) {
+		f=(x-(r->low+i*r->width))/r->width;
+		if (f <= 0) return sec;
+		sec+=(f < 1) ? f*r->sec[i+1] : r->sec[i+1];
+	}
+	return sec;
+}
+
+/* Write the sketches of n devices to path, renamed into place so a reader never sees half of it.  Returns 0, or -1. */
+int sk_write(const struct sk_day *days, int n, const char *path)
+{
+	FILE *outfile;
+	const struct sk_channel *c;
+	char tmppath[80];
+	int i, ch, k;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return -1;
+	}
+	for (i=0; i<n; i++) {
+		for (ch=0; ch<SK_NCHANNELS; ch++) {
+			if (!(days[i].channels & (1 << ch))) continue;
+			c=&days[i].ch[ch];
+			fprintf(outfile,"%d\t%s\tsketch\t%.3f\t%.3f", days[i].slave, names[ch], c->sketch.total, c->sketch.zero);
+			for (k=0; k<SK_NBINS; k++) {
+				if (c->sketch.bin[k] > 0) fprintf(outfile," %d:%.3f", k, c->sketch.bin[k]);
+			}
+			fprintf(outfile,"\n");
+			fprintf(outfile,"%d\t%s\tresidency\t%g\t%g\t%d", days[i].slave, names[ch], c->res.low, c->res.width, c->res.nbins);
+			for (k=0; k<c->res.nbins+2; k++) fprintf(outfile," %.3f", c->res.sec[k]);
+			fprintf(outfile,"\n");
+		}
+	}
+	if (fclose(outfile) != 0) {
+		remove(tmppath);
+		return -1;
+	}
+	return rename(tmppath, path);
+}
+
+/*	Read a file written by sk_write into days[], one entry for each device in it, with channels set to the channels found.
+	Returns the number of devices, or -1 if the file can't be opened. */
+int sk_read(struct sk_day *days, int max, const char *path)
+{
+	FILE *infile;
+	struct sk_day *d;
+	struct sk_channel *c;
+	char *line, *p, *end, name[16], kind[16];
+	float low, width;
+	double sec;
+	int n, slave, ch, nbins, k, used;
+
+	if ((infile = fopen(path, "r")) == NULL) {
+		return -1;
+	}
+	if ((line = malloc(LINESIZE)) == NULL) {
+		fclose(infile);
+		return -1;
+	}
+	n=0;
+	while (fgets(line, LINESIZE, infile) != NULL) {
+		if (sscanf(line, "%d %15s %15s%n", &slave, name, kind, &used) != 3 || (ch = sk_channel(name)) == -1) continue;
+		if ((d = finddevice(days, &n, max, slave)) == NULL) continue;
+		c=&d->ch[ch];
+		p=line+used;
+		if (strcmp(kind, "sketch") == 0) {
+			c->sketch.total=strtod(p, &p);
+			c->sketch.zero=strtod(p, &p);
+			while ((k = strtol(p, &end, 10)) >= 0 && end != p && *end == ':') {
+				sec=strtod(end+1, &p);
+				if (k < SK_NBINS) c->sketch.bin[k]=sec;
+			}
+			d->channels|=1 << ch;
+		} else if (strcmp(kind, "residency") == 0) {
+			low=strtod(p, &p);
+			width=strtod(p, &p);
+			nbins=strtol(p, &p, 10);
+			if (nbins < 1 || nbins > SK_MAXRESBINS || width <= 0) continue;
+			c->res.low=low;
+			c->res.width=width;
+			c->res.nbins=nbins;
+			for (k=0; k<nbins+2; k++) c->res.sec[k]=strtod(p, &p);
+		}
+	}
+	free(line);
+	fclose(infile);
+
+	return n;
+}
+
+/* Channel by name (Vb, Power_out or Load_power), or -1 */
+int sk_channel(const char *name)
+{
+	int ch;
+
+	for (ch=0; ch<SK_NCHANNELS; ch++) {
+		if (strcasecmp(name, names[ch]) == 0) return ch;
+	}
+	return -1;
+}
+
+const char *sk_name(int ch)
+{
+	return names[ch];
+}
+
+static void addtime(struct sk_channel *c, float v, double sec)
+{
+	int i;
+
+	c->sketch.total+=sec;
+	if (v <= SK_MINVALUE) {
+		c->sketch.zero+=sec;
+	} else {
+		i=ceil(log(v)/log((1+SK_ACCURACY)/(1-SK_ACCURACY)))+SK_OFFSET;
+		if (i < 0) i=0;
+		if (i >= SK_NBINS) i=SK_NBINS-1;
+		c->sketch.bin[i]+=sec;
+	}
+
+	if (c->res.nbins == 0) return;
+	if (v < c->res.low) {
+		i=0;
+	} else {
+		i=(v-c->res.low)/c->res.width+1;
+		if (i > c->res.nbins+1) i=c->res.nbins+1;
+	}
+	c->res.sec[i]+=sec;
+}
+
+/* The entry for a device in days[], added if it isn't there yet */
+static struct sk_day *finddevice(struct sk_day *days, int *n, int max, int slave)
+{
+	int i;
+
+	for (i=0; i<*n; i++) {
+		if (days[i].slave == slave) return &days[i];
+	}
+	if (*n >= max) return NULL;
+	sk_init(&days[*n], slave, 0, 0);
+	return &days[(*n)++];
+}
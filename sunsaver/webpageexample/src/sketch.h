@@ -0,0 +1,89 @@
+/*
+ *  sketch.h - Mergeable quantile sketches and residency histograms of battery voltage and power, one set a day.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SKETCH_H
+#define SKETCH_H
+
+/*	The quantile sketch bins are part of the file format: changing these makes old files unmergeable with new ones.  Bin i holds
+	values from SK_GAMMA^(i-SK_OFFSET-1) to SK_GAMMA^(i-SK_OFFSET), SK_GAMMA being (1+SK_ACCURACY)/(1-SK_ACCURACY), so values from
+	SK_MINVALUE to about 250000 are kept to within SK_ACCURACY. */
+
+#define SK_ACCURACY		0.01
+#define SK_NBINS		1024
+#define SK_OFFSET		400
+#define SK_MINVALUE		0.001										/* Smaller values count as 0 */
+#define SK_MAXRESBINS	256
+
+/* Channels */
+
+enum {
+	SK_VB, SK_POWER_OUT, SK_LOAD_POWER, SK_NCHANNELS
+};
+
+#define SK_LOADCHANNELS	(1 << SK_LOAD_POWER)
+
+/* Seconds spent at each value, in bins of relative width */
+
+struct sk_sketch {
+	double total;
+	double zero;												/* At or below SK_MINVALUE */
+	double bin[SK_NBINS];
+};
+
+/* Seconds spent at each value, in nbins bins of width from low, with the time below and above in the first and last */
+
+struct sk_residency {
+	float low;
+	float width;
+	int nbins;
+	double sec[SK_MAXRESBINS+2];
+};
+
+struct sk_channel {
+	struct sk_sketch sketch;
+	struct sk_residency res;
+};
+
+/* One device over one day */
+
+struct sk_day {
+	int slave;
+	unsigned int channels;										/* One bit for each channel the device has */
+	long date;													/* YYYYMMDD */
+	int havelast;
+	float last[SK_NCHANNELS];									/* Held until the next sample */
+	long lastwhen;												/* Monotonic milliseconds */
+	struct sk_channel ch[SK_NCHANNELS];
+};
+
+void sk_init(struct sk_day *d, int slave, unsigned int channels, long date);
+void sk_add(struct sk_day *d, const float *values, long now);
+void sk_newday(struct sk_day *d, long date);
+void sk_clear(struct sk_channel *c, int ch);
+int sk_merge(struct sk_channel *to, const struct sk_channel *from);
+float sk_quantile(const struct sk_sketch *s, double q);
+double sk_below(const struct sk_residency *r, float x);
+int sk_write(const struct sk_day *days, int n, const char *path);
+int sk_read(struct sk_day *days, int max, const char *path);
+int sk_channel(const char *name);
+const char *sk_name(int ch);
+
+#endif
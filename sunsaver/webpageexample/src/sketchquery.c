@@ -0,0 +1,163 @@
+/*
+ *  sketchquery.c - This program answers percentile and residency questions from the daily sketch files written by powersystemd.
+ *
+ *	Usage: sketchquery [-l logdir]... [-i id] [-d] channel from to query...
+ *
+ *	channel is Vb, Power_out or Load_power, and from and to are dates (YYYYMMDD).  Each query is pN for the Nth percentile
+ *	(p5, p50, p99.9), "below V" or "above V" for the hours spent below or above a value.  The days from from to to are merged
+ *	and answered once, or with -d answered one line a day.  Each -l adds the log directory of another site to the merge (the
+ *	default is LOGFILEPATH), and -i only takes the device with that MODBUS id.  For example the hours the battery spent below
+ *	12.0 V in January 2015, and the 5th and 95th percentile of the charging power each day of 2014:
+ *
+ *		sketchquery Vb 20150101 20150131 below 12.0
+ *		sketchquery -d Power_out 20140101 20141231 p5 p95
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Compile with: cc sketchquery.c sketch.c -o sketchquery -lm */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "powersystem.h"
+#include "sketch.h"
+
+#define MAXSITES		16
+#define MAXDAYDEVICES	16
+
+static int parsedate(const char *s, struct tm *tm);
+static int addday(struct sk_channel *total, const char **sites, int nsites, int id, int ch, const struct tm *day);
+static void answer(const struct sk_channel *c, char **query, int nquery);
+
+int main(int argc, char *argv[])
+{
+	struct sk_channel total;
+	struct tm day, last;
+	const char *sites[MAXSITES];
+	char date[16];
+	int a, nsites, id, daily, ch, mismatched;
+
+	nsites=0;
+	id=0;
+	daily=0;
+	for (a=1; a<argc && argv[a][0] == '-'; a++) {
+		if (strcmp(argv[a], "-l") == 0 && a+1 < argc && nsites < MAXSITES) {
+			sites[nsites++]=argv[++a];
+		} else if (strcmp(argv[a], "-i") == 0 && a+1 < argc) {
+			id=strtol(argv[++a], NULL, 0);
+		} else if (strcmp(argv[a], "-d") == 0) {
+			daily=1;
+		} else {
+			break;
+		}
+	}
+	if (argc-a < 4 || (ch = sk_channel(argv[a])) == -1 || parsedate(argv[a+1], &day) == -1 || parsedate(argv[a+2], &last) == -1) {
+		fprintf(stderr, "Usage: %s [-l logdir]... [-i id] [-d] Vb|Power_out|Load_power from to query...\n", argv[0]);
+		fprintf(stderr, "       from and to are YYYYMMDD, and each query is pN (percentile), below V or above V (hours)\n");
+		return -1;
+	}
+	if (nsites == 0) sites[nsites++]=LOGFILEPATH;
+
+	/* Merge the days, answering at the end or after each one */
+	sk_clear(&total, ch);
+	mismatched=0;
+	while (mktime(&day) <= mktime(&last)) {
+		if (daily) sk_clear(&total, ch);
+		if (addday(&total, sites, nsites, id, ch, &day) == -1) mismatched++;
+		if (daily && total.sketch.total > 0) {
+			strftime(date, sizeof(date), "%Y%m%d", &day);
+			printf("%s", date);
+			answer(&total, argv+a+3, argc-a-3);
+		}
+		day.tm_mday++;
+		mktime(&day);
+	}
+	if (!daily) {
+		if (total.sketch.total == 0) {
+			fprintf(stderr, "No %s sketches between %s and %s\n", sk_name(ch), argv[a+1], argv[a+2]);
+			return -1;
+		}
+		printf("%s\t%.1f hours", sk_name(ch), total.sketch.total/3600);
+		answer(&total, argv+a+3, argc-a-3);
+	}
+	if (mismatched > 0) {
+		fprintf(stderr, "%d days have residency bins that don't match RESIDENCYVB or RESIDENCYPOWER - only their percentiles are counted\n",
+				mismatched);
+	}
+
+	return 0;
+}
+
+static int parsedate(const char *s, struct tm *tm)
+{
+	long d;
+	char *end;
+
+	d=strtol(s, &end, 10);
+	if (*end != '\0' || d < 19700101 || d > 99991231) return -1;
+	memset(tm, 0, sizeof(struct tm));
+	tm->tm_year=d/10000-1900;
+	tm->tm_mon=d/100%100-1;
+	tm->tm_mday=d%100;
+	tm->tm_hour=12;												/* Clear of daylight saving changes */
+	tm->tm_isdst=-1;
+	return 0;
+}
+
+/* Merge one day of one channel from every site.  Returns the number of devices merged, or -1 if a histogram didn't fit. */
+static int addday(struct sk_channel *total, const char **sites, int nsites, int id, int ch, const struct tm *day)
+{
+	static struct sk_day days[MAXDAYDEVICES];
+	char name[32], filepath[256];
+	int s, i, n, merged, bad;
+
+	strftime(name, sizeof(name), "%Y/%Y%m%dsketch.txt", day);
+	merged=0;
+	bad=0;
+	for (s=0; s<nsites; s++) {
+		snprintf(filepath, sizeof(filepath), "%s/%s", sites[s], name);
+		n=sk_read(days, MAXDAYDEVICES, filepath);
+		for (i=0; i<n; i++) {
+			if ((id != 0 && days[i].slave != id) || !(days[i].channels & (1 << ch))) continue;
+			if (sk_merge(total, &days[i].ch[ch]) == -1) bad=1;
+			merged++;
+		}
+	}
+	return bad ? -1 : merged;
+}
+
+static void answer(const struct sk_channel *c, char **query, int nquery)
+{
+	int q;
+
+	for (q=0; q<nquery; q++) {
+		if (query[q][0] == 'p') {
+			printf("\t%s %.2f", query[q], sk_quantile(&c->sketch, atof(query[q]+1)/100));
+		} else if (strcmp(query[q], "below") == 0 && q+1 < nquery) {
+			printf("\tbelow %s %.2f h", query[q+1], sk_below(&c->res, atof(query[q+1]))/3600);
+			q++;
+		} else if (strcmp(query[q], "above") == 0 && q+1 < nquery) {
+			printf("\tabove %s %.2f h", query[q+1], (c->sketch.total-sk_below(&c->res, atof(query[q+1])))/3600);
+			q++;
+		}
+	}
+	printf("\n");
+}
@@ -0,0 +1,312 @@
+/*
+ *  soc.c - Battery state of charge for the acquisition daemon.
+ *
+ *	The battery voltage is a poor guide to the state of charge while current is flowing: a load pulls it down and charging
+ *	pushes it up.  So the state of charge is counted instead, from the same amp-hour counters as the energy file (see energy.c):
+ *	the amp-hours charged, times SOCCHARGEEFF for what is lost to gassing, less the amp-hours used by the load, over the bank's
+ *	capacity.  The capacity is corrected for the battery temperature (T_batt) by SOCTEMPCAP a degree from 25 C, as a cold
+ *	battery gives less.  Only the charge controllers' load outputs are counted, so a load wired straight to the battery isn't.
+ *
+ *	Counting drifts, so it is set again whenever the voltage can be trusted.  After SOCFLOATHOLD seconds in FLOAT the battery
+ *	is full.  After SOCRESTHOLD seconds with the charging and load currents of every controller on the bank under SOCRESTAMPS,
+ *	the voltage has settled to the open circuit voltage, which SOCOCV turns into a state of charge once corrected for the
+ *	temperature by SOCOCVTEMPCO.  Each sample costs a few comparisons, whatever the history.
+ *
+ *	The state is saved to SOCSTATE with the last counter readings, so after a restart the estimate carries on and the amp-hours
+ *	counted while the daemon was stopped are added.  A bank with no saved state starts from its voltage as a rough guess.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "powersystem.h"
+#include "ssmppt.h"
+#include "soc.h"
+
+static const float ocv[] = SOCOCV;
+
+static struct soc_device *finddevice(struct soc_estimator *e, int slave);
+static void resync(struct soc_bank *b, double soc, int source, time_t t);
+static void count(struct soc_bank *b, double ahc, double ahl);
+
+/*	Set up the banks from SOCBANKS, reporting and skipping any that don't parse, for the devices of the daemon (slaves, as in its
+	devices).  Returns the number of banks. */
+int soc_init(struct soc_estimator *e, const int *slaves, int ndevices, const char **banks, int nbanks)
+{
+	struct soc_bank *b;
+	struct soc_device *d;
+	const char *p;
+	char *end;
+	float capacity;
+	int i, slave, n;
+
+	memset(e, 0, sizeof(struct soc_estimator));
+	for (i=0; i<ndevices && i<SOC_MAXDEVICES; i++) {
+		e->dev[i].slave=slaves[i];
+		e->dev[i].bank=-1;
+		e->dev[i].quietsince=-1;
+		e->dev[i].floatsince=-1;
+	}
+	e->ndevices=i;
+
+	for (i=0; i<nbanks && e->nbanks < SOC_MAXBANKS; i++) {
+		b=&e->bank[e->nbanks];
+		p=strchr(banks[i], ':');
+		capacity=(p != NULL) ? strtod(p+1, &end) : 0;
+		if (p == NULL || capacity <= 0 || *end != '\0' || strlen(banks[i]) >= SOC_TEXTSIZE || strchr(banks[i], ' ') != NULL) {
+			fprintf(stderr, "Can't understand battery bank: %s\n", banks[i]);
+			continue;
+		}
+		n=0;
+		for (p=banks[i]; *p != ':'; p=end) {
+			if (*p == ',') p++;
+			slave=strtol(p, &end, 10);
+			if (end == p) break;
+			if ((d = finddevice(e, slave)) == NULL || d->bank != -1) {
+				fprintf(stderr, "Battery bank %s: MODBUS id %d isn't polled or is in another bank\n", banks[i], slave);
+				continue;
+			}
+			d->bank=e->nbanks;
+			n++;
+		}
+		if (n == 0) continue;
+		strcpy(b->text, banks[i]);
+		b->capacity=capacity;
+		b->temp=25.0;
+		e->nbanks++;
+	}
+	return e->nbanks;
+}
+
+/* Read the state saved by soc_save.  Returns 0, or -1 if there is none. */
+int soc_load(struct soc_estimator *e, const char *filepath)
+{
+	FILE *infile;
+	struct soc_device *d;
+	char line[128], text[SOC_TEXTSIZE];
+	double soc, ahsince;
+	long lastsync, rawtime;
+	unsigned long resyncs;
+	unsigned int ahc, ahl;
+	int i, slave;
+
+	if ((infile = fopen(filepath, "r")) == NULL) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), infile) != NULL) {
+		if (sscanf(line, "bank %31s %lf %lf %ld %lu", text, &soc, &ahsince, &lastsync, &resyncs) == 5) {
+			for (i=0; i<e->nbanks && strcmp(text, e->bank[i].text) != 0; i++);
+			if (i == e->nbanks || soc < 0 || soc > 1) continue;
+			e->bank[i].soc=soc;
+			e->bank[i].source=SOC_SAVED;
+			e->bank[i].ahsince=ahsince;
+			e->bank[i].lastsync=lastsync;
+			e->bank[i].resyncs=resyncs;
+		} else if (sscanf(line, "device %d %u %u %ld", &slave, &ahc, &ahl, &rawtime) == 4) {
+			if ((d = finddevice(e, slave)) == NULL) continue;
+			d->haveraw=1;
+			d->rawahc=ahc;
+			d->rawahl=ahl;
+			d->rawtime=rawtime;
+		}
+	}
+	fclose(infile);
+
+	return 0;
+}
+
+/*	Write the state of each bank and the last counter readings of each device, renamed into place.  The daemon saves it to
+	SOCSTATE to carry on after a restart and to RUNFILEPATH/soc.txt for powersystemstatus.  Returns 0, or -1. */
+int soc_save(const struct soc_estimator *e, const char *filepath, time_t t)
+{
+	FILE *outfile;
+	const struct soc_bank *b;
+	const struct soc_device *d;
+	char tmppath[136];
+	int i;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", filepath);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return -1;
+	}
+	fprintf(outfile,"%ld\n", (long) t);
+	for (i=0; i<e->nbanks; i++) {
+		b=&e->bank[i];
+		if (b->source == SOC_NONE) continue;
+		fprintf(outfile,"bank %s %.5f %.2f %ld %lu\n", b->text, b->soc, b->ahsince, (long) b->lastsync, b->resyncs);
+	}
+	for (i=0; i<e->ndevices; i++) {
+		d=&e->dev[i];
+		if (d->bank == -1 || !d->haveraw) continue;
+		fprintf(outfile,"device %d %u %u %ld\n", d->slave, d->rawahc, d->rawahl, (long) d->rawtime);
+	}
+	if (fclose(outfile) != 0) {
+		remove(tmppath);
+		return -1;
+	}
+	return rename(tmppath, filepath);
+}
+
+/*	Call on every fast read of a device (now in monotonic milliseconds), with its charging and load currents.  A TriStar MPPT's
+	FLOAT is the same state number as a SunSaver MPPT's.  Returns 1 if the bank's state of charge was set again. */
+int soc_sample(struct soc_estimator *e, int dev, float vb, float ic, float il, int charge_state, long now, time_t t)
+{
+	struct soc_device *d;
+	struct soc_bank *b;
+	unsigned long synced;
+	long quiet, full;
+	int i;
+
+	d=&e->dev[dev];
+	if (d->bank == -1) return 0;
+	b=&e->bank[d->bank];
+	b->vb=vb;
+
+	if (ic < SOCRESTAMPS && ic > -SOCRESTAMPS && il < SOCRESTAMPS && il > -SOCRESTAMPS) {
+		if (d->quietsince == -1) d->quietsince=now;
+	} else {
+		d->quietsince=-1;
+	}
+	if (charge_state == SS_CS_FLOAT) {
+		if (d->floatsince == -1) d->floatsince=now;
+	} else {
+		d->floatsince=-1;
+	}
+
+	/* The bank is at rest once every controller on it is, and full once any of them has held FLOAT */
+	quiet=0;
+	full=-1;
+	for (i=0; i<e->ndevices; i++) {
+		if (e->dev[i].bank != d->bank) continue;
+		if (e->dev[i].quietsince == -1 || quiet == -1) {
+			quiet=-1;
+		} else if (e->dev[i].quietsince > quiet) {
+			quiet=e->dev[i].quietsince;
+		}
+		if (e->dev[i].floatsince != -1 && (full == -1 || e->dev[i].floatsince < full)) full=e->dev[i].floatsince;
+	}
+
+	synced=b->resyncs;
+	if (full != -1 && now-full >= SOCFLOATHOLD*1000L) {
+		if (!b->resynced) resync(b, 1.0, SOC_FLOAT, t);
+		b->soc=1.0;												/* Held full while it floats */
+	} else if (quiet != -1 && now-quiet >= SOCRESTHOLD*1000L) {
+		if (!b->resynced) resync(b, soc_ocv(vb, b->temp), SOC_REST, t);
+		b->soc=soc_ocv(vb, b->temp);							/* Follows the voltage as it settles */
+	} else {
+		b->resynced=0;
+		if (b->source == SOC_NONE) resync(b, soc_ocv(vb, b->temp), SOC_VOLTAGE, 0);
+	}
+	e->dirty=1;
+	return b->resyncs != synced;
+}
+
+/* Call on every read of a device's battery temperature */
+void soc_temperature(struct soc_estimator *e, int dev, float temp)
+{
+	if (e->dev[dev].bank == -1 || temp < -40 || temp > 80) return;
+	e->bank[e->dev[dev].bank].temp=temp;
+}
+
+/* Call after en_counters with the device's meter, to count the amp-hours since the last reading */
+void soc_counters(struct soc_estimator *e, int dev, const struct en_meter *m, time_t t)
+{
+	struct soc_device *d;
+	double ahc, ahl, hours;
+
+	d=&e->dev[dev];
+	if (d->bank == -1 || !m->cahc.valid) return;
+	if (!d->counted) {
+		/* The first reading since the daemon started: what was counted while it was stopped, if the counters look sane */
+		ahc=0;
+		ahl=0;
+		hours=(t-d->rawtime)/3600.0;
+		if (d->haveraw && m->cahc.last >= d->rawahc && (!m->cahl.valid || m->cahl.last >= d->rawahl) && hours > 0) {
+			ahc=(m->cahc.last-d->rawahc)*m->cahc.scale;
+			if (m->cahl.valid) ahl=(m->cahl.last-d->rawahl)*m->cahl.scale;
+			if (ahc > ENERGYMAXAMPS*hours || ahl > ENERGYMAXAMPS*hours) ahc=ahl=0;
+		}
+		d->counted=1;
+	} else {
+		ahc=m->ahc-d->ahc;
+		ahl=m->ahl-d->ahl;
+	}
+	d->ahc=m->ahc;
+	d->ahl=m->ahl;
+	d->haveraw=1;
+	d->rawahc=m->cahc.last;
+	d->rawahl=m->cahl.valid ? m->cahl.last : 0;
+	d->rawtime=t;
+	count(&e->bank[d->bank], ahc, ahl);
+	e->dirty=1;
+}
+
+/* State of charge (0 - 1) of a battery at rest, from SOCOCV for a 12 V battery at 25 C */
+float soc_ocv(float vb, float temp)
+{
+	int n, i;
+	float v;
+
+	n=sizeof(ocv)/sizeof(ocv[0]);
+	v=vb/VOLTAGESCALE-SOCOCVTEMPCO*(temp-25.0);
+	if (v <= ocv[0]) return 0;
+	if (v >= ocv[n-1]) return 1;
+	for (i=1; i<n-1 && v > ocv[i]; i++);
+	return (i-1+(v-ocv[i-1])/(ocv[i]-ocv[i-1]))/(n-1);
+}
+
+static struct soc_device *finddevice(struct soc_estimator *e, int slave)
+{
+	int i;
+
+	for (i=0; i<e->ndevices; i++) {
+		if (e->dev[i].slave == slave) return &e->dev[i];
+	}
+	return NULL;
+}
+
+/* Set the state of charge from the voltage (t is 0 for the first guess, which isn't counted as a resync) */
+static void resync(struct soc_bank *b, double soc, int source, time_t t)
+{
+	b->soc=soc;
+	b->source=source;
+	b->ahsince=0;
+	if (t != 0) {
+		b->resynced=1;
+		b->lastsync=t;
+		b->resyncs++;
+	}
+}
+
+/* Add amp-hours charged and used, with the capacity corrected for the temperature */
+static void count(struct soc_bank *b, double ahc, double ahl)
+{
+	double capacity, net;
+
+	if (b->source == SOC_NONE) return;
+	capacity=b->capacity*(1.0+SOCTEMPCAP*(b->temp-25.0));
+	if (capacity < b->capacity/2) capacity=b->capacity/2;
+	net=ahc*SOCCHARGEEFF-ahl;
+	b->ahsince+=net;
+	b->soc+=net/capacity;
+	if (b->soc < 0) b->soc=0;
+	if (b->soc > 1) b->soc=1;
+}
@@ -0,0 +1,86 @@
+/*
+ *  soc.h - Battery state of charge from the charge controllers' amp-hour counters, set again from the voltage at rest and in float.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SOC_H
+#define SOC_H
+
+#include <time.h>
+
+#include "energy.h"
+
+#define SOC_MAXBANKS	4
+#define SOC_MAXDEVICES	8
+#define SOC_TEXTSIZE	32
+
+/* How the state of charge was last set */
+
+#define SOC_NONE		0										/* Not yet */
+#define SOC_VOLTAGE		1										/* From the first voltage read, not at rest - a rough guess */
+#define SOC_REST		2										/* From the voltage after SOCRESTHOLD seconds at rest */
+#define SOC_FLOAT		3										/* Full, after SOCFLOATHOLD seconds in FLOAT */
+#define SOC_SAVED		4										/* From the state file */
+
+/* One charge controller */
+
+struct soc_device {
+	int slave;
+	int bank;													/* -1 if it isn't in a bank */
+	long quietsince;											/* Monotonic milliseconds since its currents have been small, or -1 */
+	long floatsince;											/* The same in FLOAT */
+	int counted;												/* ahc and ahl hold its meter's totals */
+	double ahc, ahl;
+	int haveraw;												/* raw holds the counters as last saved or read */
+	unsigned int rawahc, rawahl;
+	time_t rawtime;
+};
+
+/* One battery bank, "ids:capacity" such as "1,2:200" for two controllers charging a 200 Ah bank */
+
+struct soc_bank {
+	char text[SOC_TEXTSIZE];
+	float capacity;												/* Amp-hours at 25 C */
+	double soc;													/* 0 - 1 */
+	int source;													/* What last set soc */
+	int resynced;												/* Already set in this rest or float */
+	float vb;
+	float temp;													/* Battery temperature, 25 until read */
+	double ahsince;												/* Amp-hours counted since soc was last set */
+	time_t lastsync;											/* When it was last set at rest or in float, or 0 */
+	unsigned long resyncs;
+};
+
+struct soc_estimator {
+	int nbanks;
+	struct soc_bank bank[SOC_MAXBANKS];
+	int ndevices;
+	struct soc_device dev[SOC_MAXDEVICES];
+	int dirty;													/* Changed since the state file was saved */
+};
+
+int soc_init(struct soc_estimator *e, const int *slaves, int ndevices, const char **banks, int nbanks);
+int soc_load(struct soc_estimator *e, const char *filepath);
+int soc_save(const struct soc_estimator *e, const char *filepath, time_t t);
+int soc_sample(struct soc_estimator *e, int dev, float vb, float ic, float il, int charge_state, long now, time_t t);
+void soc_temperature(struct soc_estimator *e, int dev, float temp);
+void soc_counters(struct soc_estimator *e, int dev, const struct en_meter *m, time_t t);
+float soc_ocv(float vb, float temp);
+
+#endif
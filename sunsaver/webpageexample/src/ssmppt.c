@@ -0,0 +1,249 @@
+/*
+ *  ssmppt.c - SunSaver MPPT register map, polling classes, and channel decoding for the acquisition daemon.
+ *
+ *	The scaling factors are the same ones used in sunsaverRAM.c.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ssmppt.h"
+
+#define V_SCALE		(100.0/32768.0)
+#define I_SCALE		(79.16/32768.0)
+#define P_SCALE		(989.5/65536.0)
+
+const struct ss_channel ss_channels[SS_NCHANNELS] = {
+	{ "adc_vb_f",				0x0008, SS_U16, V_SCALE,		"V",	SS_FAST },
+	{ "adc_va_f",				0x0009, SS_U16, V_SCALE,		"V",	SS_FAST },
+	{ "adc_vl_f",				0x000A, SS_U16, V_SCALE,		"V",	SS_FAST },
+	{ "adc_ic_f",				0x000B, SS_U16, I_SCALE,		"A",	SS_FAST },
+	{ "adc_il_f",				0x000C, SS_U16, I_SCALE,		"A",	SS_FAST },
+	{ "T_hs",					0x000D, SS_S16, 1.0,			"C",	SS_TEMP },
+	{ "T_batt",					0x000E, SS_S16, 1.0,			"C",	SS_TEMP },
+	{ "T_amb",					0x000F, SS_S16, 1.0,			"C",	SS_TEMP },
+	{ "T_rts",					0x0010, SS_S16, 1.0,			"C",	SS_TEMP },
+	{ "charge_state",			0x0011, SS_U16, 1.0,			"",		SS_FAST },
+	{ "array_fault",			0x0012, SS_U16, 1.0,			"",		SS_FAST },
+	{ "Vb_f",					0x0013, SS_U16, V_SCALE,		"V",	SS_FAST },
+	{ "Vb_ref",					0x0014, SS_U16, 96.667/32768.0,	"V",	SS_SLOW },
+	{ "Ahc_r",					0x0015, SS_U32, 0.1,			"Ah",	SS_SLOW },
+	{ "Ahc_t",					0x0017, SS_U32, 0.1,			"Ah",	SS_SLOW },
+	{ "kWhc",					0x0019, SS_U16, 0.1,			"kWh",	SS_SLOW },
+	{ "load_state",				0x001A, SS_U16, 1.0,			"",		SS_FAST },
+	{ "load_fault",				0x001B, SS_U16, 1.0,			"",		SS_FAST },
+	{ "V_lvd",					0x001C, SS_U16, V_SCALE,		"V",	SS_SLOW },
+	{ "Ahl_r",					0x001D, SS_U32, 0.1,			"Ah",	SS_SLOW },
+	{ "Ahl_t",					0x001F, SS_U32, 0.1,			"Ah",	SS_SLOW },
+	{ "hourmeter",				0x0021, SS_U32, 1.0,			"h",	SS_SLOW },
+	{ "alarm",					0x0023, SS_U32, 1.0,			"",		SS_FAST },
+	{ "dip_switch",				0x0025, SS_U16, 1.0,			"",		SS_SLOW },
+	{ "led_state",				0x0026, SS_U16, 1.0,			"",		SS_SLOW },
+	{ "Power_out",				0x0027, SS_U16, P_SCALE,		"W",	SS_FAST },
+	{ "Sweep_Vmp",				0x0028, SS_U16, V_SCALE,		"V",	SS_SLOW },
+	{ "Sweep_Pmax",				0x0029, SS_U16, P_SCALE,		"W",	SS_SLOW },
+	{ "Sweep_Voc",				0x002A, SS_U16, V_SCALE,		"V",	SS_SLOW },
+	{ "Vb_min_daily",			0x002B, SS_U16, V_SCALE,		"V",	SS_SLOW },
+	{ "Vb_max_daily",			0x002C, SS_U16, V_SCALE,		"V",	SS_SLOW },
+	{ "Ahc_daily",				0x002D, SS_U16, 0.1,			"Ah",	SS_SLOW },
+	{ "Ahl_daily",				0x002E, SS_U16, 0.1,			"Ah",	SS_SLOW },
+	{ "array_fault_daily",		0x002F, SS_U16, 1.0,			"",		SS_SLOW },
+	{ "load_fault_daily",		0x0030, SS_U16, 1.0,			"",		SS_SLOW },
+	{ "alarm_daily",			0x0031, SS_U32, 1.0,			"",		SS_SLOW },
+	{ "vb_min",					0x0033, SS_U16, V_SCALE,		"V",	SS_SLOW },
+	{ "vb_max",					0x0034, SS_U16, V_SCALE,		"V",	SS_SLOW },
+	{ "lighting_should_be_on",	0x0038, SS_U16, 1.0,			"",		SS_SLOW },
+	{ "va_ref_fixed",			0x0039, SS_U16, V_SCALE,		"V",	SS_SLOW },
+	{ "va_ref_fixed_pct",		0x003A, SS_U16, 100.0/256.0,	"%",	SS_SLOW }
+};
+
+/* EEPROM settings, named and scaled as in sunsaverEEPROM.c.  The read only section from 0xE040 isn't here. */
+const struct ss_channel ss_settings[SS_NSETTINGS] = {
+	{ "EV_reg",					0xE000, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_float",				0xE001, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "Et_float",				0xE002, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "Et_floatlb",				0xE003, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "EV_floatlb_trip",		0xE004, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_float_cancel",		0xE005, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "Et_float_exit_cum",		0xE006, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "EV_eq",					0xE007, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "Et_eqcalendar",			0xE008, SS_U16, 1.0,			"days",	SS_EEPROM },
+	{ "Et_eq_above",			0xE009, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "Et_eq_reg",				0xE00A, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "EV_reg2",				0xE00D, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_float2",				0xE00E, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "Et_float2",				0xE00F, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "Et_floatlb2",			0xE010, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "EV_floatlb_trip2",		0xE011, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_float_cancel2",		0xE012, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "Et_float_exit_cum2",		0xE013, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "EV_eq2",					0xE014, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "Et_eqcalendar2",			0xE015, SS_U16, 1.0,			"days",	SS_EEPROM },
+	{ "Et_eq_above2",			0xE016, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "Et_eq_reg2",				0xE017, SS_U16, 1.0,			"s",	SS_EEPROM },
+	{ "EV_tempcomp",			0xE01A, SS_U16, 100.0/65536.0,	"V",	SS_EEPROM },
+	{ "EV_hvd",					0xE01B, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_hvr",					0xE01C, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "Evb_ref_lim",			0xE01D, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "ETb_max",				0xE01E, SS_S16, 1.0,			"C",	SS_EEPROM },
+	{ "ETb_min",				0xE01F, SS_S16, 1.0,			"C",	SS_EEPROM },
+	{ "EV_lvd",					0xE022, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_lvr",					0xE023, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_lhvd",				0xE024, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_lhvr",				0xE025, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "ER_icomp",				0xE026, SS_U16, 1.263/65536.0,	"ohms",	SS_EEPROM },
+	{ "Et_lvd_warn",			0xE027, SS_U16, 0.1,			"s",	SS_EEPROM },
+	{ "EV_soc_y2g",				0xE030, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_soc_g2y",				0xE031, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_soc_y2r0",			0xE032, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EV_soc_r2y",				0xE033, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "Emodbus_id",				0xE034, SS_U16, 1.0,			"",		SS_EEPROM },
+	{ "Emeter_id",				0xE035, SS_U16, 1.0,			"",		SS_EEPROM },
+	{ "EVa_ref_fixed",			0xE036, SS_U16, V_SCALE,		"V",	SS_EEPROM },
+	{ "EVa_ref_fixed_pct",		0xE037, SS_U16, 100.0/256.0,	"%",	SS_EEPROM },
+	{ "Eic_lim",				0xE038, SS_U16, I_SCALE,		"A",	SS_EEPROM }
+};
+
+const char *ss_charge_states[] = {
+	"START", "NIGHT_CHECK", "DISCONNECT", "NIGHT", "FAULT", "BULK_CHARGE", "ABSORPTION", "FLOAT", "EQUALIZE"
+};
+
+const char *ss_load_states[] = {
+	"START", "LOAD_ON", "LVD_WARNING", "LVD", "FAULT", "DISCONNECT"
+};
+
+const char *ss_led_states[] = {
+	"LED_START", "LED_START2", "LED_BRANCH", "EQUALIZE", "FLOAT", "ABSORPTION", "GREEN_LED", "UNDEFINED", "YELLOW_LED", "UNDEFINED",
+	"BLINK_RED_LED", "RED_LED", "R-Y-G ERROR", "R/Y-G ERROR", "R/G-Y ERROR", "R-Y ERROR (HTD)", "R-G ERROR (HVD)", "R/Y-G/Y ERROR",
+	"G/Y/R ERROR"
+};
+
+/* Bits of alarm, array_fault and load_fault, lowest first */
+
+const char *ss_alarm_bits[] = {
+	"RTS open", "RTS shorted", "RTS disconnected", "Ths open", "Ths shorted", "SSMPPT hot", "Current limit", "Current offset",
+	"Undefined", "Undefined", "Uncalibrated", "RTS miswire", "Undefined", "Undefined", "Miswire", "FET open", "P12",
+	"High Va current limit", "Alarm 19", "Alarm 20", "Alarm 21", "Alarm 22", "Alarm 23", "Alarm 24"
+};
+
+const char *ss_array_fault_bits[] = {
+	"Overcurrent", "FETs shorted", "Software bug", "Battery HVD", "Array HVD", "EEPROM setting edit (reset required)",
+	"RTS shorted", "RTS was valid, now disconnected", "Local temperature sensor failed", "Fault 10", "Fault 11", "Fault 12",
+	"Fault 13", "Fault 14", "Fault 15", "Fault 16"
+};
+
+const char *ss_load_fault_bits[] = {
+	"External short circuit", "Overcurrent", "FETs shorted", "Software bug", "HVD", "Heatsink over-temperature",
+	"EEPROM setting edit (reset required)", "Fault 8"
+};
+
+/* EEPROM register blocks, the same ones sunsaverEEPROM.c decodes */
+static const struct rp_field ss_eeprom_blocks[] = {
+	{ 0, 0xE000, 11 },
+	{ 0, 0xE00D, 11 },
+	{ 0, 0xE01A, 6 },
+	{ 0, 0xE022, 6 },
+	{ 0, 0xE030, 6 },
+	{ 0, 0xE036, 3 },
+	{ 0, 0xE040, 15 }
+};
+
+/* Fill in the read planner fields for one polling class on one device.  Returns the number of fields. */
+int ss_fields(int pollclass, int slave, struct rp_field *fields)
+{
+	int i, n;
+
+	n=0;
+	if (pollclass == SS_EEPROM) {
+		for (i=0; i<sizeof(ss_eeprom_blocks)/sizeof(ss_eeprom_blocks[0]); i++) {
+			fields[n]=ss_eeprom_blocks[i];
+			fields[n++].slave=slave;
+		}
+		return n;
+	}
+
+	for (i=0; i<SS_NCHANNELS; i++) {
+		if (ss_channels[i].pollclass == pollclass) {
+			fields[n].slave=slave;
+			fields[n].addr=ss_channels[i].addr;
+			fields[n++].count=(ss_channels[i].type == SS_U32) ? 2 : 1;
+		}
+	}
+
+	return n;
+}
+
+/* Pointer to the image copy of a register, or NULL if the register isn't in the image */
+uint16_t *ss_reg(struct ss_image *im, uint16_t addr)
+{
+	if (addr >= SS_RAMBASE && addr < SS_RAMBASE+SS_RAMREGS) return &im->ram[addr-SS_RAMBASE];
+	if (addr >= SS_EEBASE && addr < SS_EEBASE+SS_EEREGS) return &im->eeprom[addr-SS_EEBASE];
+	return NULL;
+}
+
+/*	Copy the registers of one polling class out of an executed plan into the image.  Returns 1, or 0 without changing the image if
+	any of the class's reads of this device didn't work. */
+int ss_store(struct ss_image *im, const struct rp_plan *plan, int pollclass)
+{
+	struct rp_field fields[RP_MAXFIELDS];
+	int i, n;
+
+	n=ss_fields(pollclass, im->slave, fields);
+	for (i=0; i<n; i++) {
+		if (rp_find(plan, im->slave, fields[i].addr, fields[i].count) == NULL) return 0;
+	}
+	for (i=0; i<n; i++) {
+		rp_copy(plan, im->slave, fields[i].addr, fields[i].count, ss_reg(im, fields[i].addr));
+	}
+	return 1;
+}
+
+/* Raw register value of a channel */
+unsigned int ss_raw(const struct ss_image *im, int ch)
+{
+	int k;
+
+	k=ss_channels[ch].addr-SS_RAMBASE;
+	if (ss_channels[ch].type == SS_U32) {
+		return ((unsigned int) im->ram[k] << 16) + im->ram[k+1];
+	}
+	return im->ram[k];
+}
+
+/* Index of an EEPROM setting in ss_settings by name, or -1 */
+int ss_setting(const char *name)
+{
+	int i;
+
+	for (i=0; i<SS_NSETTINGS; i++) {
+		if (strcmp(ss_settings[i].name, name) == 0) return i;
+	}
+	return -1;
+}
+
+/* Channel value in engineering units */
+float ss_value(const struct ss_image *im, int ch)
+{
+	if (ss_channels[ch].type == SS_S16) {
+		return (short) ss_raw(im, ch)*ss_channels[ch].scale;
+	}
+	return ss_raw(im, ch)*ss_channels[ch].scale;
+}
@@ -0,0 +1,120 @@
+/*
+ *  ssmppt.h - SunSaver MPPT register map, polling classes, and channel decoding for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SSMPPT_H
+#define SSMPPT_H
+
+#include <stdint.h>
+
+#include "readplan.h"
+
+#define SS_RAMBASE		0x0008									/* First RAM register (adc_vb_f) */
+#define SS_RAMREGS		51										/* RAM registers 0x0008 - 0x003A */
+#define SS_EEBASE		0xE000									/* First EEPROM register (EV_reg) */
+#define SS_EEREGS		79										/* EEPROM registers 0xE000 - 0xE04E */
+
+/* Polling classes - each class is read on its own interval (see POLL* in powersystem.h) */
+
+#define SS_FAST			0										/* Voltages, currents, power, states, faults and alarms */
+#define SS_TEMP			1										/* Temperatures */
+#define SS_SLOW			2										/* Counters, daily values, sweep results and settings in RAM */
+#define SS_EEPROM		3										/* EEPROM settings */
+#define SS_NCLASSES		4
+
+/* Channel types */
+
+#define SS_U16			0
+#define SS_S16			1
+#define SS_U32			2										/* hi/lo register pair, high word first */
+
+/* RAM channels, in register order */
+
+enum ss_chan {
+	SS_ADC_VB_F, SS_ADC_VA_F, SS_ADC_VL_F, SS_ADC_IC_F, SS_ADC_IL_F, SS_T_HS, SS_T_BATT, SS_T_AMB, SS_T_RTS,
+	SS_CHARGE_STATE, SS_ARRAY_FAULT, SS_VB_F, SS_VB_REF, SS_AHC_R, SS_AHC_T, SS_KWHC, SS_LOAD_STATE, SS_LOAD_FAULT,
+	SS_V_LVD, SS_AHL_R, SS_AHL_T, SS_HOURMETER, SS_ALARM, SS_DIP_SWITCH, SS_LED_STATE, SS_POWER_OUT, SS_SWEEP_VMP,
+	SS_SWEEP_PMAX, SS_SWEEP_VOC, SS_VB_MIN_DAILY, SS_VB_MAX_DAILY, SS_AHC_DAILY, SS_AHL_DAILY, SS_ARRAY_FAULT_DAILY,
+	SS_LOAD_FAULT_DAILY, SS_ALARM_DAILY, SS_VB_MIN, SS_VB_MAX, SS_LIGHTING_SHOULD_BE_ON, SS_VA_REF_FIXED,
+	SS_VA_REF_FIXED_PCT, SS_NCHANNELS
+};
+
+#define SS_NSETTINGS	43										/* EEPROM settings that can be written (see ss_settings) */
+
+/* charge_state and load_state values */
+
+#define SS_CS_START			0
+#define SS_CS_NIGHT_CHECK	1
+#define SS_CS_DISCONNECT	2
+#define SS_CS_NIGHT			3
+#define SS_CS_FAULT			4
+#define SS_CS_BULK_CHARGE	5
+#define SS_CS_ABSORPTION	6
+#define SS_CS_FLOAT			7
+#define SS_CS_EQUALIZE		8
+
+#define SS_LS_START			0
+#define SS_LS_LOAD_ON		1
+#define SS_LS_LVD_WARNING	2
+#define SS_LS_LVD			3
+#define SS_LS_FAULT			4
+#define SS_LS_DISCONNECT	5
+
+/* led_state values, and the bits of alarm, array_fault and load_fault with names in ssmppt.c */
+
+#define SS_LED_STATES		19
+#define SS_ALARM_BITS		24
+#define SS_ARRAY_FAULT_BITS	16
+#define SS_LOAD_FAULT_BITS	8
+
+struct ss_channel {
+	const char *name;
+	uint16_t addr;
+	int type;
+	float scale;												/* Raw value times scale gives the value in engineering units */
+	const char *units;
+	int pollclass;
+};
+
+/* Register image of one SunSaver MPPT, filled in as the polling classes are read */
+
+struct ss_image {
+	int slave;
+	uint16_t ram[SS_RAMREGS];
+	uint16_t eeprom[SS_EEREGS];
+};
+
+extern const struct ss_channel ss_channels[SS_NCHANNELS];
+extern const struct ss_channel ss_settings[SS_NSETTINGS];
+extern const char *ss_charge_states[];
+extern const char *ss_load_states[];
+extern const char *ss_led_states[];
+extern const char *ss_alarm_bits[];
+extern const char *ss_array_fault_bits[];
+extern const char *ss_load_fault_bits[];
+
+int ss_fields(int pollclass, int slave, struct rp_field *fields);
+uint16_t *ss_reg(struct ss_image *im, uint16_t addr);
+int ss_store(struct ss_image *im, const struct rp_plan *plan, int pollclass);
+unsigned int ss_raw(const struct ss_image *im, int ch);
+float ss_value(const struct ss_image *im, int ch);
+int ss_setting(const char *name);
+
+#endif
@@ -1,5 +1,7 @@
 /*
  *  sunsaverEEPROM.c - This program reads all the EEPROM registers on a Moringstar SunSaver MPPT and prints the results.
+ *
+ *	If powersystemd is running, the registers come from its EEPROM snapshot (see eecache.c) and the serial port isn't used.
  *  
 
 Copyright 2014 Tom Rinehart.
@@ -20,14 +22,30 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 
-/* Compile with: cc `pkg-config --cflags --libs libmodbus` sunsaverEEPROM.c -o sunsaverEEPROM */
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` sunsaverEEPROM.c eecache.c readplan.c daemonlock.c -o sunsaverEEPROM */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <modbus.h>
 
 #include "powersystem.h"
+#include "readplan.h"
+#include "eecache.h"
+#include "daemonlock.h"
+
+/* EEPROM register blocks decoded below.  The read planner merges them into as few reads as the bus cost model allows. */
+static const struct rp_field eeprom_fields[] = {
+	{ SUNSAVERMPPT, 0xE000, 11 },								/* Charge settings (bank 1) */
+	{ SUNSAVERMPPT, 0xE00D, 11 },								/* Charge settings (bank 2) */
+	{ SUNSAVERMPPT, 0xE01A, 6 },								/* Charge settings (shared) */
+	{ SUNSAVERMPPT, 0xE022, 6 },								/* Load settings */
+	{ SUNSAVERMPPT, 0xE030, 6 },								/* Misc settings */
+	{ SUNSAVERMPPT, 0xE036, 3 },								/* MPPT settings */
+	{ SUNSAVERMPPT, 0xE040, 15 }								/* Read only section */
+};
 
 int main(void)
 {
@@ -46,31 +64,58 @@ int main(void)
 	unsigned int Ehourmeter;
 	short Etmr_eqcalendar;
 	float EAhl_r, EAhl_t, EAhc_r, EAhc_t, EkWhc, EVb_min, EVb_max, EVa_max;
-	uint16_t data[50];
-	
-	/* Set up a new MODBUS context */
-	ctx = modbus_new_rtu(SERIALPORTPATH, 9600, 'N', 8, 2);
-	if (ctx == NULL) {
-		fprintf(stderr, "Unable to create the libmodbus context\n");
-		return -1;
+	uint16_t data[50], eeprom[SS_EEREGS];
+	struct rp_cost cost;
+	struct rp_plan plan;
+	unsigned int version;
+	time_t read;
+	int i, n;
+	
+	/* Use powersystemd's snapshot if it has one, otherwise read the EEPROM */
+	if (dl_running() && ee_load(SUNSAVERMPPT, eeprom, &version, &read) == 0) {
+		printf("\nEEPROM snapshot version %u from powersystemd, read %s", version, ctime(&read));
+	} else {
+		/* Set up a new MODBUS context */
+		ctx = modbus_new_rtu(SERIALPORTPATH, 9600, 'N', 8, 2);
+		if (ctx == NULL) {
+			fprintf(stderr, "Unable to create the libmodbus context\n");
+			return -1;
+		}
+		
+		/* Set the slave id to the SunSaver MPPT MODBUS id */
+		modbus_set_slave(ctx, SUNSAVERMPPT);
+		
+		/* Open the MODBUS connection to the SunSaver MPPT */
+	    if (modbus_connect(ctx) == -1) {
+	        fprintf(stderr, "Connection failed: %s\n", modbus_strerror(errno));
+	        modbus_free(ctx);
+	        return -1;
+	    }
+		
+		/* Plan and read the EEPROM Registers */
+		rp_rtucost(&cost, 9600, 11, RP_RESPONSETIME);
+		n=sizeof(eeprom_fields)/sizeof(eeprom_fields[0]);
+		if (rp_build(&plan, eeprom_fields, n, &cost) == -1) {
+			fprintf(stderr, "Unable to plan the EEPROM register reads\n");
+			return -1;
+		}
+		rc = rp_execute(&plan, ctx);
+		if (rc == -1) {
+			fprintf(stderr, "%s\n", modbus_strerror(errno));
+			return -1;
+		}
+		memset(eeprom, 0, sizeof(eeprom));
+		for (i=0; i<n; i++) {
+			rp_copy(&plan, SUNSAVERMPPT, eeprom_fields[i].addr, eeprom_fields[i].count, &eeprom[eeprom_fields[i].addr-SS_EEBASE]);
+		}
+		
+		/* Close the MODBUS connection */
+		modbus_close(ctx);
+		modbus_free(ctx);
 	}
 	
-	/* Set the slave id to the SunSaver MPPT MODBUS id */
-	modbus_set_slave(ctx, SUNSAVERMPPT);
-	
-	/* Open the MODBUS connection to the SunSaver MPPT */
-    if (modbus_connect(ctx) == -1) {
-        fprintf(stderr, "Connection failed: %s\n", modbus_strerror(errno));
-        modbus_free(ctx);
-        return -1;
-    }
-	
-	/* Read the EEPROM Registers and convert the results to their proper values */
-	rc = modbus_read_registers(ctx, 0xE000, 11, data);
-	if (rc == -1) {
-		fprintf(stderr, "%s\n", modbus_strerror(errno));
-		return -1;
-	}
+	/* Convert the results to their proper values */
+	memcpy(data, &eeprom[0xE000-SS_EEBASE], 11*sizeof(uint16_t));
 	
 	printf("\nEEPROM Registers\n\n");
 	
@@ -109,14 +154,8 @@ int main(void)
 	Et_eq_reg=data[10];
 	printf("Et_eq_reg = %d s\n",Et_eq_reg);
 	
-	usleep(2500);		// Give the charge controller time before requesting next set of registers
-	
-	/* Read the EEPROM Registers and convert the results to their proper values */
-	rc = modbus_read_registers(ctx, 0xE00D, 11, data);
-	if (rc == -1) {
-		fprintf(stderr, "%s\n", modbus_strerror(errno));
-		return -1;
-	}
+	/* Convert the results to their proper values */
+	memcpy(data, &eeprom[0xE00D-SS_EEBASE], 11*sizeof(uint16_t));
 	
 	printf("\nCharge Settings (bank 2)\n");
 	
@@ -153,14 +192,8 @@ int main(void)
 	Et_eq_reg2=data[10];
 	printf("Et_eq_reg2 = %d s\n",Et_eq_reg2);
 	
-	usleep(2500);		// Give the charge controller time before requesting next set of registers
-	
-	/* Read the EEPROM Registers and convert the results to their proper values */
-	rc = modbus_read_registers(ctx, 0xE01A, 6, data);
-	if (rc == -1) {
-		fprintf(stderr, "%s\n", modbus_strerror(errno));
-		return -1;
-	}
+	/* Convert the results to their proper values */
+	memcpy(data, &eeprom[0xE01A-SS_EEBASE], 6*sizeof(uint16_t));
 	
 	printf("\nCharge Settings (shared)\n");
 	
@@ -182,14 +215,8 @@ int main(void)
 	ETb_min=data[5];
 	printf("ETb_min = %d °C\n",ETb_min);
 	
-	usleep(2500);		// Give the charge controller time before requesting next set of registers
-	
-	/* Read the EEPROM Registers and convert the results to their proper values */
-	rc = modbus_read_registers(ctx, 0xE022, 6, data);
-	if (rc == -1) {
-		fprintf(stderr, "%s\n", modbus_strerror(errno));
-		return -1;
-	}
+	/* Convert the results to their proper values */
+	memcpy(data, &eeprom[0xE022-SS_EEBASE], 6*sizeof(uint16_t));
 	
 	printf("\nLoad Settings\n");
 	
@@ -211,14 +238,8 @@ int main(void)
 	Et_lvd_warn=data[5]*0.1;
 	printf("Et_lvd_warn = %.2f s\n",Et_lvd_warn);
 	
-	usleep(2500);		// Give the charge controller time before requesting next set of registers
-	
-	/* Read the EEPROM Registers and convert the results to their proper values */
-	rc = modbus_read_registers(ctx, 0xE030, 6, data);
-	if (rc == -1) {
-		fprintf(stderr, "%s\n", modbus_strerror(errno));
-		return -1;
-	}
+	/* Convert the results to their proper values */
+	memcpy(data, &eeprom[0xE030-SS_EEBASE], 6*sizeof(uint16_t));
 	
 	printf("\nMisc Settings\n");
 	
@@ -240,14 +261,8 @@ int main(void)
 	Emeter_id=data[5];
 	printf("Emeter_id = %d\n",Emeter_id);
 	
-	usleep(2500);		// Give the charge controller time before requesting next set of registers
-	
-	/* Read the EEPROM Registers and convert the results to their proper values */
-	rc = modbus_read_registers(ctx, 0xE036, 3, data);
-	if (rc == -1) {
-		fprintf(stderr, "%s\n", modbus_strerror(errno));
-		return -1;
-	}
+	/* Convert the results to their proper values */
+	memcpy(data, &eeprom[0xE036-SS_EEBASE], 3*sizeof(uint16_t));
 	
 	printf("\nMPPT Settings\n");
 	
@@ -260,14 +275,8 @@ int main(void)
 	Eic_lim=data[2]*79.16/32768.0;
 	printf("Eic_lim = %.2f A\n",Eic_lim);
 	
-	usleep(2500);		// Give the charge controller time before requesting next set of registers
-	
-	/* Read the EEPROM Registers and convert the results to their proper values */
-	rc = modbus_read_registers(ctx, 0xE040, 15, data);
-	if (rc == -1) {
-		fprintf(stderr, "%s\n", modbus_strerror(errno));
-		return -1;
-	}
+	/* Convert the results to their proper values */
+	memcpy(data, &eeprom[0xE040-SS_EEBASE], 15*sizeof(uint16_t));
 	
 	printf("\nRead only section of EEPROM\n");
 	
@@ -301,10 +310,5 @@ int main(void)
 	Etmr_eqcalendar=data[14];
 	printf("Etmr_eqcalendar = %d days\n\n",Etmr_eqcalendar);
 	
-	/* Close the MODBUS connection */
-    modbus_close(ctx);
-    modbus_free(ctx);
-	
 	return(0);
 }
-
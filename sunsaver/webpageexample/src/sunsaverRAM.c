@@ -20,7 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 
-/* Compile with: cc `pkg-config --cflags --libs libmodbus` sunsaverRAM.c -o sunsaverRAM */
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` sunsaverRAM.c ssmppt.c readplan.c -o sunsaverRAM */
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,6 +28,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <modbus.h>
 
 #include "powersystem.h"
+#include "readplan.h"
+#include "ssmppt.h"
+
+/* RAM register blocks decoded below.  The read planner merges them into as few reads as the bus cost model allows. */
+static const struct rp_field ram_fields[] = {
+	{ SUNSAVERMPPT, 0x0008, 45 },								/* adc_vb_f through vb_max */
+	{ SUNSAVERMPPT, 0x0038, 3 }									/* lighting_should_be_on through va_ref_fixed_pct */
+};
+
+static void printbits(unsigned int bits, const char **names, int n);
 
 int main(void)
 {
@@ -42,6 +52,8 @@ int main(void)
 	unsigned short array_fault, load_fault, dip_switch, array_fault_daily, load_fault_daily;
 	unsigned int alarm, alarm_daily;
 	uint16_t data[50];
+	struct rp_cost cost;
+	struct rp_plan plan;
 	
 	/* Set up a new MODBUS context */
 	ctx = modbus_new_rtu(SERIALPORTPATH, 9600, 'N', 8, 2);
@@ -60,13 +72,21 @@ int main(void)
         return -1;
     }
 	
-	/* Read the first 45 RAM Registers */
-	rc = modbus_read_registers(ctx, 0x0008, 45, data);
+	/* Plan and read the RAM Registers */
+	rp_rtucost(&cost, 9600, 11, RP_RESPONSETIME);
+	if (rp_build(&plan, ram_fields, sizeof(ram_fields)/sizeof(ram_fields[0]), &cost) == -1) {
+		fprintf(stderr, "Unable to plan the RAM register reads\n");
+		return -1;
+	}
+	rc = rp_execute(&plan, ctx);
 	if (rc == -1) {
 		fprintf(stderr, "%s\n", modbus_strerror(errno));
 		return -1;
 	}
 	
+	/* The first 45 RAM Registers */
+	rp_copy(&plan, SUNSAVERMPPT, 0x0008, 45, data);
+	
 	/* Convert the results to their proper values and print them out */
 	printf("\nRAM Registers\n\n");
 	
@@ -137,22 +157,7 @@ int main(void)
 	if (array_fault == 0) {
 		printf("\tNo faults\n");
 	} else {
-		if (array_fault & 1) printf("\tOvercurrent\n");
-		if ((array_fault & (1 << 1)) >> 1) printf("\tFETs shorted\n");
-		if ((array_fault & (1 << 2)) >> 2) printf("\tSoftware bug\n");
-		if ((array_fault & (1 << 3)) >> 3) printf("\tBattery HVD\n");
-		if ((array_fault & (1 << 4)) >> 4) printf("\tArray HVD\n");
-		if ((array_fault & (1 << 5)) >> 5) printf("\tEEPROM setting edit (reset required)\n");
-		if ((array_fault & (1 << 6)) >> 6) printf("\tRTS shorted\n");
-		if ((array_fault & (1 << 7)) >> 7) printf("\tRTS was valid, now disconnected\n");
-		if ((array_fault & (1 << 8)) >> 8) printf("\tLocal temperature sensor failed\n");
-		if ((array_fault & (1 << 9)) >> 9) printf("\tFault 10\n");
-		if ((array_fault & (1 << 10)) >> 10) printf("\tFault 11\n");
-		if ((array_fault & (1 << 11)) >> 11) printf("\tFault 12\n");
-		if ((array_fault & (1 << 12)) >> 12) printf("\tFault 13\n");
-		if ((array_fault & (1 << 13)) >> 13) printf("\tFault 14\n");
-		if ((array_fault & (1 << 14)) >> 14) printf("\tFault 15\n");
-		if ((array_fault & (1 << 15)) >> 15) printf("\tFault 16\n");
+		printbits(array_fault, ss_array_fault_bits, SS_ARRAY_FAULT_BITS);
 	}
 	
 	Vb_f=data[11]*100.0/32768.0;
@@ -197,14 +202,7 @@ int main(void)
 	if (load_fault == 0) {
 		printf("\tNo faults\n");
 	} else {
-		if (load_fault & 1) printf("\tExternal short circuit\n");
-		if ((load_fault & (1 << 1)) >> 1) printf("\tOvercurrent\n");
-		if ((load_fault & (1 << 2)) >> 2) printf("\tFETs shorted\n");
-		if ((load_fault & (1 << 3)) >> 3) printf("\tSoftware bug\n");
-		if ((load_fault & (1 << 4)) >> 4) printf("\tHVD\n");
-		if ((load_fault & (1 << 5)) >> 5) printf("\tHeatsink over-temperature\n");
-		if ((load_fault & (1 << 6)) >> 6) printf("\tEEPROM setting edit (reset required)\n");
-		if ((load_fault & (1 << 7)) >> 7) printf("\tFault 8\n");
+		printbits(load_fault, ss_load_fault_bits, SS_LOAD_FAULT_BITS);
 	}
 	
 	V_lvd=data[20]*100.0/32768.0;
@@ -224,30 +222,7 @@ int main(void)
 	if (alarm == 0) {
 		printf("\tNo alarms\n");
 	} else {
-		if (alarm & 1) printf("\tRTS open\n");
-		if ((alarm & (1 << 1)) >> 1) printf("\tRTS shorted\n");
-		if ((alarm & (1 << 2)) >> 2) printf("\tRTS disconnected\n");
-		if ((alarm & (1 << 3)) >> 3) printf("\tThs open\n");
-		if ((alarm & (1 << 4)) >> 4) printf("\tThs shorted\n");
-		if ((alarm & (1 << 5)) >> 5) printf("\tSSMPPT hot\n");
-		if ((alarm & (1 << 6)) >> 6) printf("\tCurrent limit\n");
-		if ((alarm & (1 << 7)) >> 7) printf("\tCurrent offset\n");
-		if ((alarm & (1 << 8)) >> 8) printf("\tUndefined\n");
-		if ((alarm & (1 << 9)) >> 9) printf("\tUndefined\n");
-		if ((alarm & (1 << 10)) >> 10) printf("\tUncalibrated\n");
-		if ((alarm & (1 << 11)) >> 11) printf("\tRTS miswire\n");
-		if ((alarm & (1 << 12)) >> 12) printf("\tUndefined\n");
-		if ((alarm & (1 << 13)) >> 13) printf("\tUndefined\n");
-		if ((alarm & (1 << 14)) >> 14) printf("\tMiswire\n");
-		if ((alarm & (1 << 15)) >> 15) printf("\tFET open\n");
-		if ((alarm & (1 << 16)) >> 16) printf("\tP12\n");
-		if ((alarm & (1 << 17)) >> 17) printf("\tHigh Va current limit\n");
-		if ((alarm & (1 << 18)) >> 18) printf("\tAlarm 19\n");
-		if ((alarm & (1 << 19)) >> 19) printf("\tAlarm 20\n");
-		if ((alarm & (1 << 20)) >> 20) printf("\tAlarm 21\n");
-		if ((alarm & (1 << 21)) >> 21) printf("\tAlarm 22\n");
-		if ((alarm & (1 << 22)) >> 22) printf("\tAlarm 23\n");
-		if ((alarm & (1 << 23)) >> 23) printf("\tAlarm 24\n");
+		printbits(alarm, ss_alarm_bits, SS_ALARM_BITS);
 	}
 	
 	dip_switch=data[29];
@@ -366,22 +341,7 @@ int main(void)
 	if (array_fault_daily == 0) {
 		printf("\tNo faults\n");
 	} else {
-		if (array_fault_daily & 1) printf("\tOvercurrent\n");
-		if ((array_fault_daily & (1 << 1)) >> 1) printf("\tFETs shorted\n");
-		if ((array_fault_daily & (1 << 2)) >> 2) printf("\tSoftware bug\n");
-		if ((array_fault_daily & (1 << 3)) >> 3) printf("\tBattery HVD\n");
-		if ((array_fault_daily & (1 << 4)) >> 4) printf("\tArray HVD\n");
-		if ((array_fault_daily & (1 << 5)) >> 5) printf("\tEEPROM setting edit (reset required)\n");
-		if ((array_fault_daily & (1 << 6)) >> 6) printf("\tRTS shorted\n");
-		if ((array_fault_daily & (1 << 7)) >> 7) printf("\tRTS was valid, now disconnected\n");
-		if ((array_fault_daily & (1 << 8)) >> 8) printf("\tLocal temperature sensor failed\n");
-		if ((array_fault_daily & (1 << 9)) >> 9) printf("\tFault 10\n");
-		if ((array_fault_daily & (1 << 10)) >> 10) printf("\tFault 11\n");
-		if ((array_fault_daily & (1 << 11)) >> 11) printf("\tFault 12\n");
-		if ((array_fault_daily & (1 << 12)) >> 12) printf("\tFault 13\n");
-		if ((array_fault_daily & (1 << 13)) >> 13) printf("\tFault 14\n");
-		if ((array_fault_daily & (1 << 14)) >> 14) printf("\tFault 15\n");
-		if ((array_fault_daily & (1 << 15)) >> 15) printf("\tFault 16\n");
+		printbits(array_fault_daily, ss_array_fault_bits, SS_ARRAY_FAULT_BITS);
 	}
 	
 	load_fault_daily=data[40];
@@ -389,14 +349,7 @@ int main(void)
 	if (load_fault_daily == 0) {
 		printf("\tNo faults\n");
 	} else {
-		if (load_fault_daily & 1) printf("\tExternal short circuit\n");
-		if ((load_fault_daily & (1 << 1)) >> 1) printf("\tOvercurrent\n");
-		if ((load_fault_daily & (1 << 2)) >> 2) printf("\tFETs shorted\n");
-		if ((load_fault_daily & (1 << 3)) >> 3) printf("\tSoftware bug\n");
-		if ((load_fault_daily & (1 << 4)) >> 4) printf("\tHVD\n");
-		if ((load_fault_daily & (1 << 5)) >> 5) printf("\tHeatsink over-temperature\n");
-		if ((load_fault_daily & (1 << 6)) >> 6) printf("\tEEPROM setting edit (reset required)\n");
-		if ((load_fault_daily & (1 << 7)) >> 7) printf("\tFault 8\n");
+		printbits(load_fault_daily, ss_load_fault_bits, SS_LOAD_FAULT_BITS);
 	}
 	
 	alarm_daily=(data[41] << 16) + data[42];
@@ -404,30 +357,7 @@ int main(void)
 	if (alarm_daily == 0) {
 		printf("\tNo alarms\n");
 	} else {
-		if (alarm_daily & 1) printf("\tRTS open\n");
-		if ((alarm_daily & (1 << 1)) >> 1) printf("\tRTS shorted\n");
-		if ((alarm_daily & (1 << 2)) >> 2) printf("\tRTS disconnected\n");
-		if ((alarm_daily & (1 << 3)) >> 3) printf("\tThs open\n");
-		if ((alarm_daily & (1 << 4)) >> 4) printf("\tThs shorted\n");
-		if ((alarm_daily & (1 << 5)) >> 5) printf("\tSSMPPT hot\n");
-		if ((alarm_daily & (1 << 6)) >> 6) printf("\tCurrent limit\n");
-		if ((alarm_daily & (1 << 7)) >> 7) printf("\tCurrent offset\n");
-		if ((alarm_daily & (1 << 8)) >> 8) printf("\tUndefined\n");
-		if ((alarm_daily & (1 << 9)) >> 9) printf("\tUndefined\n");
-		if ((alarm_daily & (1 << 10)) >> 10) printf("\tUncalibrated\n");
-		if ((alarm_daily & (1 << 11)) >> 11) printf("\tRTS miswire\n");
-		if ((alarm_daily & (1 << 12)) >> 12) printf("\tUndefined\n");
-		if ((alarm_daily & (1 << 13)) >> 13) printf("\tUndefined\n");
-		if ((alarm_daily & (1 << 14)) >> 14) printf("\tMiswire\n");
-		if ((alarm_daily & (1 << 15)) >> 15) printf("\tFET open\n");
-		if ((alarm_daily & (1 << 16)) >> 16) printf("\tP12\n");
-		if ((alarm_daily & (1 << 17)) >> 17) printf("\tHigh Va current limit\n");
-		if ((alarm_daily & (1 << 18)) >> 18) printf("\tAlarm 19\n");
-		if ((alarm_daily & (1 << 19)) >> 19) printf("\tAlarm 20\n");
-		if ((alarm_daily & (1 << 20)) >> 20) printf("\tAlarm 21\n");
-		if ((alarm_daily & (1 << 21)) >> 21) printf("\tAlarm 22\n");
-		if ((alarm_daily & (1 << 22)) >> 22) printf("\tAlarm 23\n");
-		if ((alarm_daily & (1 << 23)) >> 23) printf("\tAlarm 24\n");
+		printbits(alarm_daily, ss_alarm_bits, SS_ALARM_BITS);
 	}
 	
 	vb_min=data[43]*100.0/32768.0;
@@ -436,14 +366,8 @@ int main(void)
 	vb_max=data[44]*100.0/32768.0;
 	printf("vb_max = %.2f V\n",vb_max);
 	
-	usleep(2500);		// Give the charge controller time before requesting next set of registers
-	
-	/* Read the last three RAM Registers */
-	rc = modbus_read_registers(ctx, 0x0038, 3, data);
-	if (rc == -1) {
-		fprintf(stderr, "%s\n", modbus_strerror(errno));
-		return -1;
-	}
+	/* The last three RAM Registers */
+	rp_copy(&plan, SUNSAVERMPPT, 0x0038, 3, data);
 	
 	lighting_should_be_on=data[0];
 	printf("lighting_should_be_on = %d\n",lighting_should_be_on);
@@ -461,3 +385,14 @@ int main(void)
 	return(0);
 }
 
+/* Print the name of each bit set, lowest first, visiting only the set bits */
+static void printbits(unsigned int bits, const char **names, int n)
+{
+	int b;
+
+	while (bits != 0) {
+		b=__builtin_ctz(bits);
+		bits&=bits-1;
+		if (b < n) printf("\t%s\n", names[b]);
+	}
+}
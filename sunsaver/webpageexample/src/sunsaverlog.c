@@ -22,7 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 
-/* Compile with: cc `pkg-config --cflags --libs libmodbus` sunsaverlog.c -o sunsaverlog */
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` sunsaverlog.c logsync.c readplan.c -o sunsaverlog */
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,23 +32,30 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <modbus.h>
 
 #include "powersystem.h"
+#include "readplan.h"
+#include "logsync.h"
 
 int main(void)
 {
 	modbus_t *ctx;
-	int i, j, k, n, low, rc, hour, today, indx[32];
-	unsigned int hm, hourmeter[32], alarm_daily[32];
-	float sunsaver_Ic, Vb_min_daily[32], Vb_max_daily[32], Ahc_daily[32], Ahl_daily[32], Va_max_daily[32];
+	struct rp_field fields[LS_SLOTS];
+	struct rp_cost cost;
+	struct rp_plan plan;
+	struct ls_record rec;
+	int i, j, k, n, low, rc, indx[32];
+	unsigned int hmnow, hourmeter[32], alarm_daily[32];
+	float Vb_min_daily[32], Vb_max_daily[32], Ahc_daily[32], Ahl_daily[32], Va_max_daily[32];
 	unsigned short array_fault_daily[32], load_fault_daily[32], time_ab_daily[32], time_eq_daily[32], time_fl_daily[32];
-	unsigned short charge_state;
 	unsigned short data[50];
 	time_t lclTime, logTime;
-	struct tm *now,*logthen;
-	char tsdate[32], tshour[3];
+	struct tm *logthen;
+	char tsdate[32];
+	
+	/* Initialize index array with ascending values starting at 0 */
+	for (i=0;i<32;i++) indx[i]=i;
 	
 	/* Get current local time */
 	lclTime = time(NULL);
-	now = localtime(&lclTime);
 	
 	/* Set up a new MODBUS context */
 	ctx = modbus_new_rtu(SERIALPORTPATH, 9600, 'N', 8, 2);
@@ -74,60 +81,43 @@ int main(void)
 		return -1;
 	}
 	
-	/* Determine if the last daily log record is from today or yesterday */
-	strftime(tshour, 3, "%H", now);
-	hour=atoi(tshour);
-	sunsaver_Ic=data[3]*79.16/32768.0;
-	charge_state=data[9];
-	if ((charge_state == 3) && (hour > 12) && (sunsaver_Ic < 0.001)) {		/* If the charge state is night, the time is past noon, 
-																			 and the array current is < 0.001, then the newest log record is from today */
-		today=1;
+	/* The hourmeter dates the log records - each record was written as many hours ago as the hourmeter has moved since */
+	hmnow=((unsigned int) data[25] << 16) + data[26];
+	
+	/* Read all 32 log records.  The planner reads the unused registers between records rather than making 32 separate reads. */
+	for (i=0; i<LS_SLOTS; i++) {
+		fields[i].slave=SUNSAVERMPPT;
+		fields[i].addr=LS_BASE+i*LS_STRIDE;
+		fields[i].count=LS_RECREGS;
 	}
-	else {											/* Otherwise, the newest record is from yesterday */
-		today=0;
+	rp_rtucost(&cost, 9600, 11, RP_RESPONSETIME);
+	if (rp_build(&plan, fields, LS_SLOTS, &cost) == -1) {
+		fprintf(stderr, "Unable to plan the log register reads\n");
+		return -1;
+	}
+	usleep(RP_READDELAY);				// Give the charge controller time before requesting the log registers
+	if (rp_execute(&plan, ctx) == -1) {
+		fprintf(stderr, "modbus_read_registers: %s\n", modbus_strerror(errno));
+		return -1;
 	}
-	
-	usleep(2500);						// Give the charge controller time before requesting next set of log registers
 	
 	j=0;
-	for(i=0x8000; i<0x81FF; i+=0x0010) {
-		
-		/* Read the log registers and convert the results to their proper values */
-		rc = modbus_read_registers(ctx, i, 13, data);
-		if (rc == -1) {
-			fprintf(stderr, "modbus_read_registers: %s\n", modbus_strerror(errno));
-			return -1;
-		}
-		
-		hm=data[0] + ((data[1] & 0x00FF) << 16);
-		if (hm != 0x000000 && hm != 0xFFFFFF) {
-			hourmeter[j]=hm;
-			
-			alarm_daily[j]=(data[2] << 8) + (data[1] >> 8);
-			
-			Vb_min_daily[j]=data[3]*100.0/32768.0;
-			
-			Vb_max_daily[j]=data[4]*100.0/32768.0;
-			
-			Ahc_daily[j]=data[5]*0.1;
-			
-			Ahl_daily[j]=data[6]*0.1;
-			
-			array_fault_daily[j]=data[7];
-			
-			load_fault_daily[j]=data[8];
-			
-			Va_max_daily[j]=data[9]*100.0/32768.0;
-			
-			time_ab_daily[j]=data[10];
-			
-			time_eq_daily[j]=data[11];
-			
-			time_fl_daily[j]=data[12];
-			
+	for (i=0; i<LS_SLOTS; i++) {
+		if (ls_decode(rp_find(&plan, SUNSAVERMPPT, fields[i].addr, LS_RECREGS), &rec)) {
+			hourmeter[j]=rec.hourmeter;
+			alarm_daily[j]=rec.alarm_daily;
+			Vb_min_daily[j]=rec.Vb_min_daily;
+			Vb_max_daily[j]=rec.Vb_max_daily;
+			Ahc_daily[j]=rec.Ahc_daily;
+			Ahl_daily[j]=rec.Ahl_daily;
+			array_fault_daily[j]=rec.array_fault_daily;
+			load_fault_daily[j]=rec.load_fault_daily;
+			Va_max_daily[j]=rec.Va_max_daily;
+			time_ab_daily[j]=rec.time_ab_daily;
+			time_eq_daily[j]=rec.time_eq_daily;
+			time_fl_daily[j]=rec.time_fl_daily;
 			j++;
 		}
-		usleep(2500);					// Give the charge controller time before requesting next set of log registers
 	}
 	
     /* Close the MODBUS connection */
@@ -153,7 +143,7 @@ int main(void)
 		if (i != 0) {
 			printf("-------------------------------------------------------------\n\n");
 		}
-		logTime=lclTime-(n-i-today)*(24*60*60);
+		logTime=lclTime-(time_t) (hmnow-hourmeter[indx[i]])*3600;
 		logthen = localtime(&logTime);
 		strftime(tsdate, 32, "%m/%d/%Y", logthen);
 		printf("Date = %s\n",tsdate);
@@ -0,0 +1,434 @@
+/*
+ *  sunsaverprovision.c - This program writes a charge profile to the EEPROM of a set of Morningstar SunSaver MPPTs and checks it.
+ *
+ *	Usage: sunsaverprovision [-n] profile [port id[,id...]]...
+ *
+ *	The profile has one setting per line, named and in the units sunsaverEEPROM prints them in ("EV_reg 14.40").  Lines starting
+ *	with # are comments.  With no ports on the command line the DAEMONDEVICES on SERIALPORTPATH are provisioned.  -n only shows
+ *	what would be written.
+ *
+ *	Each controller's settings are compared with what is in it, and only the registers that differ are written, a run of
+ *	neighbouring registers in one write.  Then every setting in the profile is read back.  A register that doesn't match is
+ *	written again once.  Each port is done by its own process so ports work in parallel; on one port the controllers are all
+ *	written before any is read back, which gives each EEPROM time to finish.
+ *
+ *	The EEPROM snapshots (see eecache.c) are only for the controllers on SERIALPORTPATH, which are the ones powersystemd reads -
+ *	another port can have other controllers with the same MODBUS ids.  On SERIALPORTPATH the comparison starts from the snapshot
+ *	instead of a fresh read, and a dry run while powersystemd is running uses only the snapshots and leaves the port alone.  The
+ *	process for that port passes what it read back to the first process, which stores it in the snapshots once every port is done.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` sunsaverprovision.c ssmppt.c eecache.c readplan.c daemonlock.c -o sunsaverprovision */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <modbus.h>
+
+#include "powersystem.h"
+#include "ssmppt.h"
+#include "eecache.h"
+#include "daemonlock.h"
+
+#define MAXPORTS	8
+#define MAXDEVICES	32											/* Controllers on one port */
+
+struct pv_device {
+	struct ss_image image;										/* Settings as last known - snapshot or read, then read back */
+	unsigned int version;										/* Snapshot version the comparison started from (0 = read) */
+	int written;												/* Registers written */
+	int writes;													/* Write transactions */
+	int failed;
+};
+
+struct pv_result {
+	int slave;
+	uint16_t eeprom[SS_EEREGS];									/* As read back */
+};
+
+static int target[SS_NSETTINGS];								/* Raw register values from the profile */
+static int wanted[SS_NSETTINGS];								/* 1 if the profile sets the setting */
+
+int readprofile(const char *filename);
+int provisionport(const char *port, const int *slaves, int nslaves, int dryrun, int offline, int resultfd);
+int readsettings(modbus_t *ctx, struct pv_device *dev);
+int writesettings(modbus_t *ctx, struct pv_device *dev, const int *write);
+int passresult(int resultfd, const struct pv_device *dev);
+void savesnapshots(int resultfd);
+
+int main(int argc, char *argv[])
+{
+	const char *ports[MAXPORTS];
+	int slaves[MAXPORTS][MAXDEVICES], nslaves[MAXPORTS], defaults[] = DAEMONDEVICES;
+	int i, a, nports, dryrun, running, offline, status, failed;
+	int results[2];
+	char *p;
+	pid_t pid;
+
+	a=1;
+	dryrun=0;
+	if (a < argc && strcmp(argv[a], "-n") == 0) {
+		dryrun=1;
+		a++;
+	}
+	if (a >= argc || (argc-a-1)%2 != 0) {
+		fprintf(stderr, "Usage: %s [-n] profile [port id[,id...]]...\n", argv[0]);
+		return -1;
+	}
+	if (readprofile(argv[a++]) == -1) return -1;
+
+	/* Ports and their controllers */
+	nports=0;
+	if (a == argc) {
+		ports[0]=SERIALPORTPATH;
+		nslaves[0]=sizeof(defaults)/sizeof(defaults[0]);
+		memcpy(slaves[0], defaults, sizeof(defaults));
+		nports=1;
+	}
+	for (; a < argc; a+=2) {
+		if (nports == MAXPORTS) {
+			fprintf(stderr, "Too many ports\n");
+			return -1;
+		}
+		ports[nports]=argv[a];
+		nslaves[nports]=0;
+		for (p=strtok(argv[a+1], ","); p != NULL; p=strtok(NULL, ",")) {
+			if (nslaves[nports] == MAXDEVICES) {
+				fprintf(stderr, "Too many controllers on %s\n", argv[a]);
+				return -1;
+			}
+			slaves[nports][nslaves[nports]++]=atoi(p);
+		}
+		nports++;
+	}
+
+	/* powersystemd has the serial port open */
+	running=dl_running();
+	if (!dryrun && running) {
+		for (i=0; i<nports; i++) {
+			if (strcmp(ports[i], SERIALPORTPATH) == 0) {
+				fprintf(stderr, "powersystemd is using %s - stop it before provisioning\n", SERIALPORTPATH);
+				return -1;
+			}
+		}
+	}
+
+	/* What is read back on SERIALPORTPATH comes back through a pipe */
+	if (pipe(results) == -1) {
+		fprintf(stderr, "pipe: %s\n", strerror(errno));
+		return -1;
+	}
+
+	failed=0;
+	if (nports == 1) {
+		offline=(dryrun && running && strcmp(ports[0], SERIALPORTPATH) == 0);
+		if (provisionport(ports[0], slaves[0], nslaves[0], dryrun, offline, results[1]) == -1) failed++;
+	} else {
+		/* One process per port */
+		for (i=0; i<nports; i++) {
+			offline=(dryrun && running && strcmp(ports[i], SERIALPORTPATH) == 0);
+			pid=fork();
+			if (pid == -1) {
+				fprintf(stderr, "fork: %s\n", strerror(errno));
+				return -1;
+			}
+			if (pid == 0) {
+				close(results[0]);
+				exit(provisionport(ports[i], slaves[i], nslaves[i], dryrun, offline, results[1]) == 0 ? 0 : 1);
+			}
+		}
+		while (wait(&status) > 0) {
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+		}
+	}
+
+	/* Every port is done, so only this process writes the snapshots */
+	close(results[1]);
+	savesnapshots(results[0]);
+	close(results[0]);
+
+	return (failed ? -1 : 0);
+}
+
+/* Read the profile into target[] and wanted[].  Returns -1 on an unknown setting or a value out of range. */
+int readprofile(const char *filename)
+{
+	FILE *infile;
+	char line[128], name[64];
+	double value, raw;
+	int k, n, lineno;
+
+	if ((infile = fopen(filename, "r")) == NULL) {
+		fprintf(stderr, "Unable to open %s\n", filename);
+		return -1;
+	}
+
+	n=0;
+	lineno=0;
+	while (fgets(line, sizeof(line), infile) != NULL) {
+		lineno++;
+		if (line[0] == '#' || sscanf(line, "%63s", name) != 1) continue;
+		if (sscanf(line, "%63s %lf", name, &value) != 2) {
+			fprintf(stderr, "%s:%d: expected a setting and a value\n", filename, lineno);
+			fclose(infile);
+			return -1;
+		}
+		if ((k = ss_setting(name)) == -1) {
+			fprintf(stderr, "%s:%d: %s isn't a SunSaver MPPT EEPROM setting\n", filename, lineno, name);
+			fclose(infile);
+			return -1;
+		}
+		if (ss_settings[k].addr == 0xE034) {
+			fprintf(stderr, "%s:%d: Emodbus_id can't be provisioned - every controller would get the same id\n", filename, lineno);
+			fclose(infile);
+			return -1;
+		}
+		raw=value/ss_settings[k].scale;
+		raw=(raw < 0) ? (long) (raw-0.5) : (long) (raw+0.5);
+		if ((ss_settings[k].type == SS_S16 && (raw < -32768 || raw > 32767)) || (ss_settings[k].type != SS_S16 && (raw < 0 || raw > 65535))) {
+			fprintf(stderr, "%s:%d: %s is out of range\n", filename, lineno, name);
+			fclose(infile);
+			return -1;
+		}
+		target[k]=(int) raw & 0xFFFF;
+		wanted[k]=1;
+		n++;
+	}
+	fclose(infile);
+
+	if (n == 0) {
+		fprintf(stderr, "%s has no settings\n", filename);
+		return -1;
+	}
+	return 0;
+}
+
+/*	Provision the controllers on one port.  offline is set for a dry run on the port powersystemd is using, which then only
+	compares with the snapshots.  What is read back on SERIALPORTPATH is written to resultfd.  Returns 0 if every controller
+	was verified, -1 otherwise. */
+int provisionport(const char *port, const int *slaves, int nslaves, int dryrun, int offline, int resultfd)
+{
+	modbus_t *ctx;
+	struct pv_device *devs;
+	int write[SS_NSETTINGS];
+	int i, k, n, pass, pending, failed, cached;
+	uint16_t *reg;
+	time_t read;
+
+	devs=calloc(nslaves, sizeof(struct pv_device));
+	if (devs == NULL) {
+		fprintf(stderr, "%s: out of memory\n", port);
+		return -1;
+	}
+	cached=(strcmp(port, SERIALPORTPATH) == 0);
+
+	ctx=NULL;
+	if (!offline) {
+		/* Set up a new MODBUS context */
+		ctx = modbus_new_rtu(port, 9600, 'N', 8, 2);
+		if (ctx == NULL) {
+			fprintf(stderr, "%s: unable to create the libmodbus context\n", port);
+			free(devs);
+			return -1;
+		}
+
+		/* Open the MODBUS connection to the SunSaver MPPTs */
+		if (modbus_connect(ctx) == -1) {
+			fprintf(stderr, "%s: connection failed: %s\n", port, modbus_strerror(errno));
+			modbus_free(ctx);
+			free(devs);
+			return -1;
+		}
+	}
+
+	/* Compare with the snapshot, or what is in the controller if there isn't one, and write the differences */
+	for (i=0; i<nslaves; i++) {
+		devs[i].image.slave=slaves[i];
+		if (!cached || ee_load(slaves[i], devs[i].image.eeprom, &devs[i].version, &read) == -1) {
+			devs[i].version=0;
+			if (offline) {
+				printf("%s id %d: no EEPROM snapshot, and powersystemd is using the port\n", port, slaves[i]);
+				devs[i].failed=1;
+				continue;
+			}
+			if (readsettings(ctx, &devs[i]) == -1) {
+				printf("%s id %d: read failed: %s\n", port, slaves[i], modbus_strerror(errno));
+				devs[i].failed=1;
+				continue;
+			}
+		}
+		n=0;
+		for (k=0; k<SS_NSETTINGS; k++) {
+			reg=ss_reg(&devs[i].image, ss_settings[k].addr);
+			write[k]=(wanted[k] && *reg != target[k]);
+			if (write[k]) {
+				printf("%s id %d: %s %.2f -> %.2f %s\n", port, slaves[i], ss_settings[k].name,
+					   (ss_settings[k].type == SS_S16 ? (short) *reg : *reg)*ss_settings[k].scale,
+					   (ss_settings[k].type == SS_S16 ? (short) target[k] : target[k])*ss_settings[k].scale, ss_settings[k].units);
+				n++;
+			}
+		}
+		if (devs[i].version) {
+			printf("%s id %d: %d settings differ from snapshot version %u\n", port, slaves[i], n, devs[i].version);
+		} else {
+			printf("%s id %d: %d settings differ\n", port, slaves[i], n);
+		}
+		if (!dryrun && writesettings(ctx, &devs[i], write) == -1) {
+			printf("%s id %d: write failed: %s\n", port, slaves[i], modbus_strerror(errno));
+			devs[i].failed=1;
+		}
+	}
+	if (dryrun) {
+		if (ctx != NULL) {
+			modbus_close(ctx);
+			modbus_free(ctx);
+		}
+		free(devs);
+		return 0;
+	}
+
+	/* Read back every setting in the profile, and write any that don't match once more */
+	for (i=0, n=0; i<nslaves; i++) n+=devs[i].writes;
+	for (pass=0; pass<2; pass++) {
+		if (pass || n) usleep(PROVISIONSETTLE*1000);
+		pending=0;
+		for (i=0; i<nslaves; i++) {
+			if (devs[i].failed) continue;
+			if (readsettings(ctx, &devs[i]) == -1) {
+				printf("%s id %d: read back failed: %s\n", port, slaves[i], modbus_strerror(errno));
+				devs[i].failed=1;
+				continue;
+			}
+			n=0;
+			for (k=0; k<SS_NSETTINGS; k++) {
+				write[k]=(wanted[k] && *ss_reg(&devs[i].image, ss_settings[k].addr) != target[k]);
+				if (write[k]) {
+					if (pass) printf("%s id %d: %s didn't verify\n", port, slaves[i], ss_settings[k].name);
+					n++;
+				}
+			}
+			if (n == 0) continue;
+			if (pass || writesettings(ctx, &devs[i], write) == -1) {
+				devs[i].failed=1;
+			} else {
+				pending++;
+			}
+		}
+		if (pending == 0) break;
+	}
+
+	/* Report, and pass what was read back on to the snapshots */
+	failed=0;
+	for (i=0; i<nslaves; i++) {
+		if (devs[i].failed) {
+			printf("%s id %d: FAILED\n", port, slaves[i]);
+			failed++;
+			continue;
+		}
+		printf("%s id %d: verified, %d registers in %d writes\n", port, slaves[i], devs[i].written, devs[i].writes);
+		if (cached && passresult(resultfd, &devs[i]) == -1) {
+			printf("%s id %d: the EEPROM snapshot wasn't updated\n", port, slaves[i]);
+		}
+	}
+	if (failed == 0 && nslaves > 0) {
+		printf("%s: the new settings take effect when the SunSaver MPPTs are reset or power cycled\n", port);
+	}
+
+	/* Close the MODBUS connection */
+	modbus_close(ctx);
+	modbus_free(ctx);
+	free(devs);
+
+	return (failed ? -1 : 0);
+}
+
+/* Read the whole EEPROM of one controller into its image */
+int readsettings(modbus_t *ctx, struct pv_device *dev)
+{
+	struct rp_field fields[RP_MAXFIELDS];
+	struct rp_cost cost;
+	struct rp_plan plan;
+	int n;
+
+	rp_rtucost(&cost, 9600, 11, RP_RESPONSETIME);
+	n=ss_fields(SS_EEPROM, dev->image.slave, fields);
+	if (rp_build(&plan, fields, n, &cost) == -1) return -1;
+	if (rp_execute(&plan, ctx) == -1) return -1;
+	ss_store(&dev->image, &plan, SS_EEPROM);
+
+	return 0;
+}
+
+/*	Write the flagged settings, each run of neighbouring registers in one write multiple registers transaction.  Registers that
+	aren't flagged are never written, even between two that are, so a stale snapshot can't put an old value back. */
+int writesettings(modbus_t *ctx, struct pv_device *dev, const int *write)
+{
+	uint16_t data[SS_NSETTINGS];
+	int k, first, n;
+
+	modbus_set_slave(ctx, dev->image.slave);
+	for (k=0; k<SS_NSETTINGS; ) {
+		if (!write[k]) {
+			k++;
+			continue;
+		}
+		first=k;
+		n=0;
+		do {
+			data[n++]=target[k++];
+		} while (k < SS_NSETTINGS && write[k] && ss_settings[k].addr == ss_settings[k-1].addr+1);
+		usleep(RP_READDELAY);
+		if (modbus_write_registers(ctx, ss_settings[first].addr, n, data) != n) return -1;
+		dev->written+=n;
+		dev->writes++;
+	}
+
+	return 0;
+}
+
+/* Send what was read back from one controller to the first process */
+int passresult(int resultfd, const struct pv_device *dev)
+{
+	struct pv_result result;
+
+	result.slave=dev->image.slave;
+	memcpy(result.eeprom, dev->image.eeprom, sizeof(result.eeprom));
+	if (write(resultfd, &result, sizeof(result)) != sizeof(result)) return -1;
+
+	return 0;
+}
+
+/* Store the EEPROM images read back on SERIALPORTPATH in powersystemd's snapshots */
+void savesnapshots(int resultfd)
+{
+	struct pv_result result;
+	struct ee_cache ec;
+
+	while (read(resultfd, &result, sizeof(result)) == sizeof(result)) {
+		ee_init(&ec, result.slave);
+		ee_update(&ec, result.eeprom, time(NULL));
+		printf("%s id %d: EEPROM version %u\n", SERIALPORTPATH, result.slave, ec.version);
+	}
+}
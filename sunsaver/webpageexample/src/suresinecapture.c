@@ -0,0 +1,240 @@
+/*
+ *  suresinecapture.c - This program watches the AC current of a Morningstar SureSine-300 for surges, e.g. a motor starting.
+ *
+ *	Usage: suresinecapture [port]
+ *
+ *	A surge that trips the SureSine's over-current fault lasts a fraction of a second, so it never shows up in readings taken a
+ *	few times a minute.  This reads only adc_vb and adc_iac (two registers, one short transaction) back to back, as fast as the
+ *	bus allows, and finds the surges as the samples come in.  A surge starts when the current goes over SURGEIAC and ends when it
+ *	drops below SURGEIAC-SURGEHYST; the crossing times are interpolated between samples.  For each one a row is added to
+ *	LOGFILEPATH/YYYY/YYYYMMDDsurges.txt, next to the daily log file, with the time it started, the peak current, how long it
+ *	lasted, the AC energy (the SureSine's output voltage times the current), the lowest battery voltage, and whether the
+ *	SureSine faulted.  Counters are written to RUNFILEPATH/suresine.prom.
+ *
+ *	It needs the port to itself.  With no port SURESINEPORT is used.  Start it at boot like powersystemd.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Compile with: cc `pkg-config --cflags --libs libmodbus` suresinecapture.c pollsched.c readplan.c daemonlock.c -o suresinecapture */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <modbus.h>
+
+#include "powersystem.h"
+#include "pollsched.h"
+#include "daemonlock.h"
+
+#define SS3_SCALE		(16.92/65536.0)							/* adc_vb and Vb */
+#define SS3_ISCALE		(16.92/32768.0)							/* adc_iac and Iac */
+#define SS3_FAULT		0x0007
+#define SS3_VOLTS		0x000D
+#define SS3_OVERCURRENT	(1 << 1)
+#define MAXERRORS		10										/* Failed reads in a row before waiting a second - the SureSine may be off */
+
+struct surge {
+	long start;													/* Monotonic milliseconds, interpolated to the crossing */
+	time_t when;
+	float peak;
+	float vbmin;
+	double energy;												/* Joules */
+	int lost;													/* Failed reads during the surge */
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig);
+static int endsurge(modbus_t *ctx, const struct surge *sg, long end);
+static void writemetrics(unsigned long samples, unsigned long errors, unsigned long surges, unsigned long faults, float lastpeak,
+						 long uptime);
+
+int main(int argc, char *argv[])
+{
+	modbus_t *ctx;
+	struct surge sg;
+	const char *port;
+	uint16_t data[2];
+	float vb, iac, lastiac, vac, lastpeak;
+	unsigned long samples, errors, surges, faults;
+	int insurge, failed;
+	long now, last, start;
+	time_t t, lastmetrics;
+
+	port=(argc > 1) ? argv[1] : SURESINEPORT;
+	if (strcmp(port, SERIALPORTPATH) == 0 && dl_running()) {
+		fprintf(stderr, "powersystemd is using %s - give the SureSine its own port\n", port);
+		return -1;
+	}
+
+	signal(SIGTERM, stop);
+	signal(SIGINT, stop);
+
+	/* Set up a new MODBUS context */
+	ctx = modbus_new_rtu(port, 9600, 'N', 8, 2);
+	if (ctx == NULL) {
+		fprintf(stderr, "Unable to create the libmodbus context\n");
+		return -1;
+	}
+	modbus_set_slave(ctx, SURESINE);
+	modbus_set_response_timeout(ctx, 0, SURGETIMEOUT*1000);		/* A lost frame shouldn't leave a long hole in the samples */
+
+	/* Open the MODBUS connection to the SureSine-300 */
+	if (modbus_connect(ctx) == -1) {
+		fprintf(stderr, "Connection failed: %s\n", modbus_strerror(errno));
+		modbus_free(ctx);
+		return -1;
+	}
+
+	/* The output voltage setting, for the energy */
+	vac=SURGEVAC;
+	if (modbus_read_registers(ctx, SS3_VOLTS, 1, data) == 1 && data[0] > 0) vac=data[0];
+
+	samples=0;
+	errors=0;
+	surges=0;
+	faults=0;
+	failed=0;
+	insurge=0;
+	lastiac=0;
+	lastpeak=0;
+	memset(&sg, 0, sizeof(sg));
+	start=ps_now();
+	last=start;
+	lastmetrics=time(NULL);
+
+	while (running) {
+		/* adc_vb and adc_iac - the unfiltered readings, so the surge isn't smoothed away */
+		if (modbus_read_registers(ctx, 0x0000, 2, data) != 2) {
+			errors++;
+			modbus_flush(ctx);
+			if (insurge) sg.lost++;
+			if (++failed >= MAXERRORS) {
+				fprintf(stderr, "SureSine isn't answering: %s\n", modbus_strerror(errno));
+				sleep(1);
+				failed=0;
+			}
+			continue;
+		}
+		now=ps_now();
+		failed=0;
+		samples++;
+		vb=data[0]*SS3_SCALE;
+		iac=data[1]*SS3_ISCALE;
+
+		if (!insurge && iac >= SURGEIAC) {
+			memset(&sg, 0, sizeof(sg));
+			sg.start=(samples > 1 && iac > lastiac) ? last+(long) ((SURGEIAC-lastiac)/(iac-lastiac)*(now-last)) : now;
+			sg.when=time(NULL)-(now-sg.start)/1000;
+			sg.peak=iac;
+			sg.vbmin=vb;
+			sg.energy=vac*(SURGEIAC+iac)/2*(now-sg.start)/1000.0;
+			insurge=1;
+		} else if (insurge) {
+			if (iac > sg.peak) sg.peak=iac;
+			if (vb < sg.vbmin) sg.vbmin=vb;
+			if (iac < SURGEIAC-SURGEHYST) {
+				/* Ends where the current crossed the lower threshold */
+				now=last+(long) ((lastiac-(SURGEIAC-SURGEHYST))/(lastiac-iac)*(now-last));
+				sg.energy+=vac*(lastiac+SURGEIAC-SURGEHYST)/2*(now-last)/1000.0;
+				faults+=endsurge(ctx, &sg, now);
+				surges++;
+				lastpeak=sg.peak;
+				insurge=0;
+			} else {
+				sg.energy+=vac*(lastiac+iac)/2*(now-last)/1000.0;
+			}
+		}
+		lastiac=iac;
+		last=now;
+
+		t=time(NULL);
+		if (t-lastmetrics >= METRICSINTERVAL) {
+			lastmetrics=t;
+			writemetrics(samples, errors, surges, faults, lastpeak, ps_now()-start);
+		}
+	}
+
+	if (insurge) endsurge(ctx, &sg, last);
+	writemetrics(samples, errors, surges, faults, lastpeak, ps_now()-start);
+
+	/* Close the MODBUS connection */
+	modbus_close(ctx);
+	modbus_free(ctx);
+
+	return(0);
+}
+
+static void stop(int sig)
+{
+	running=0;
+}
+
+/* Add a row for one surge to the day's surge file.  Returns 1 if the SureSine faulted. */
+static int endsurge(modbus_t *ctx, const struct surge *sg, long end)
+{
+	FILE *outfile;
+	struct tm *then;
+	char filepath[64], surgefile[64], ts[32];
+	uint16_t fault;
+	int tripped;
+
+	/* The over-current fault is latched, so one read after the surge shows whether it tripped */
+	tripped=(modbus_read_registers(ctx, SS3_FAULT, 1, &fault) == 1 && (fault & SS3_OVERCURRENT));
+
+	then=localtime(&sg->when);
+	sprintf(filepath,"%s/%%Y/%%Y%%m%%dsurges.txt",LOGFILEPATH);
+	strftime(surgefile, 64, filepath, then);
+	strftime(ts, 32, "%m/%d/%Y\t%H:%M:%S", then);
+	if ((outfile = fopen(surgefile, "a")) == NULL) {
+		fprintf(stderr, "Can't open surge file: %s\n", surgefile);
+		return tripped;
+	}
+	fprintf(outfile, "%s\t%5.2f\t%ld\t%7.1f\t%5.2f\t%s\t%d\n", ts, sg->peak, end-sg->start, sg->energy, sg->vbmin,
+			tripped ? "OVERCURRENT" : "OK", sg->lost);
+	fclose(outfile);
+
+	return tripped;
+}
+
+/* Write the counters in the text format read by the Prometheus node exporter textfile collector */
+static void writemetrics(unsigned long samples, unsigned long errors, unsigned long surges, unsigned long faults, float lastpeak,
+						 long uptime)
+{
+	FILE *outfile;
+	char filepath[64], tmppath[72];
+
+	sprintf(filepath,"%s/suresine.prom",RUNFILEPATH);
+	sprintf(tmppath,"%s.tmp",filepath);
+	if ((outfile = fopen(tmppath, "w")) == NULL) {
+		return;
+	}
+	fprintf(outfile,"suresinecapture_samples_total %lu\n", samples);
+	fprintf(outfile,"suresinecapture_read_errors_total %lu\n", errors);
+	if (uptime > 0) fprintf(outfile,"suresinecapture_sample_rate_hz %.1f\n", samples*1000.0/uptime);
+	fprintf(outfile,"suresinecapture_surges_total %lu\n", surges);
+	fprintf(outfile,"suresinecapture_overcurrent_faults_total %lu\n", faults);
+	if (surges > 0) fprintf(outfile,"suresinecapture_last_peak_amps %.2f\n", lastpeak);
+	fclose(outfile);
+	rename(tmppath, filepath);
+}
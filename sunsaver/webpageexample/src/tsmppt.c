@@ -0,0 +1,177 @@
+/*
+ *  tsmppt.c - TriStar MPPT register map, polling classes, and channel decoding for the acquisition daemon.
+ *
+ *	Voltages, currents and power are given as fractions of the V_PU and I_PU the controller reports in its first four registers,
+ *	which depend on the model (a TriStar MPPT-60 doesn't have the same ones as a -45).  ts_scale() reads them once for each
+ *	connection and works out the multiplier of every channel, so decoding a value is one multiplication.  The register map is the
+ *	one in Morningstar's TriStar MPPT MODBUS document.
+ *
+
+Copyright 2014 Tom Rinehart.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <modbus.h>
+
+#include "tsmppt.h"
+
+const struct ts_channel ts_channels[TS_NCHANNELS] = {
+	{ "adc_vb_f_med",			0x0018, SS_U16, TS_VOLTS,	1.0,	"V",	SS_FAST },
+	{ "adc_vbterm_f",			0x0019, SS_U16, TS_VOLTS,	1.0,	"V",	SS_FAST },
+	{ "adc_va_f",				0x001B, SS_U16, TS_VOLTS,	1.0,	"V",	SS_FAST },
+	{ "adc_ib_f_shadow",		0x001C, SS_S16, TS_AMPS,	1.0,	"A",	SS_FAST },
+	{ "adc_ia_f_shadow",		0x001D, SS_S16, TS_AMPS,	1.0,	"A",	SS_FAST },
+	{ "T_hs",					0x0023, SS_S16, TS_FIXED,	1.0,	"C",	SS_TEMP },
+	{ "T_rts",					0x0024, SS_S16, TS_FIXED,	1.0,	"C",	SS_TEMP },
+	{ "T_batt",					0x0025, SS_S16, TS_FIXED,	1.0,	"C",	SS_TEMP },
+	{ "adc_vb_f_1m",			0x0026, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "adc_ib_f_1m",			0x0027, SS_S16, TS_AMPS,	1.0,	"A",	SS_SLOW },
+	{ "vb_min",					0x0028, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "vb_max",					0x0029, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "hourmeter",				0x002A, SS_U32, TS_FIXED,	1.0,	"h",	SS_SLOW },
+	{ "fault_all",				0x002C, SS_U16, TS_FIXED,	1.0,	"",		SS_FAST },
+	{ "alarm",					0x002E, SS_U32, TS_FIXED,	1.0,	"",		SS_FAST },
+	{ "dip_all",				0x0030, SS_U16, TS_FIXED,	1.0,	"",		SS_SLOW },
+	{ "led_state",				0x0031, SS_U16, TS_FIXED,	1.0,	"",		SS_SLOW },
+	{ "charge_state",			0x0032, SS_U16, TS_FIXED,	1.0,	"",		SS_FAST },
+	{ "vb_ref",					0x0033, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "Ahc_r",					0x0034, SS_U32, TS_FIXED,	0.1,	"Ah",	SS_SLOW },
+	{ "Ahc_t",					0x0036, SS_U32, TS_FIXED,	0.1,	"Ah",	SS_SLOW },
+	{ "kWhc_r",					0x0038, SS_U16, TS_FIXED,	1.0,	"kWh",	SS_SLOW },
+	{ "kWhc_t",					0x0039, SS_U16, TS_FIXED,	1.0,	"kWh",	SS_SLOW },
+	{ "power_out_shadow",		0x003A, SS_U16, TS_WATTS,	1.0,	"W",	SS_FAST },
+	{ "power_in_shadow",		0x003B, SS_U16, TS_WATTS,	1.0,	"W",	SS_FAST },
+	{ "sweep_Pin_max",			0x003C, SS_U16, TS_WATTS,	1.0,	"W",	SS_SLOW },
+	{ "sweep_vmp",				0x003D, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "sweep_voc",				0x003E, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "vb_min_daily",			0x0040, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "vb_max_daily",			0x0041, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "va_max_daily",			0x0042, SS_U16, TS_VOLTS,	1.0,	"V",	SS_SLOW },
+	{ "Ahc_daily",				0x0043, SS_U16, TS_FIXED,	0.1,	"Ah",	SS_SLOW },
+	{ "whc_daily",				0x0044, SS_U16, TS_FIXED,	1.0,	"Wh",	SS_SLOW },
+	{ "flags_daily",			0x0045, SS_U16, TS_FIXED,	1.0,	"",		SS_SLOW },
+	{ "Pout_max_daily",			0x0046, SS_U16, TS_WATTS,	1.0,	"W",	SS_SLOW },
+	{ "Tb_min_daily",			0x0047, SS_S16, TS_FIXED,	1.0,	"C",	SS_SLOW },
+	{ "Tb_max_daily",			0x0048, SS_S16, TS_FIXED,	1.0,	"C",	SS_SLOW },
+	{ "fault_daily",			0x0049, SS_U16, TS_FIXED,	1.0,	"",		SS_SLOW },
+	{ "alarm_daily",			0x004B, SS_U32, TS_FIXED,	1.0,	"",		SS_SLOW },
+	{ "time_ab_daily",			0x004D, SS_U16, TS_FIXED,	1.0,	"s",	SS_SLOW },
+	{ "time_eq_daily",			0x004E, SS_U16, TS_FIXED,	1.0,	"s",	SS_SLOW },
+	{ "time_fl_daily",			0x004F, SS_U16, TS_FIXED,	1.0,	"s",	SS_SLOW }
+};
+
+const char *ts_charge_states[] = {
+	"START", "NIGHT_CHECK", "DISCONNECT", "NIGHT", "FAULT", "MPPT", "ABSORPTION", "FLOAT", "EQUALIZE", "SLAVE"
+};
+
+/*	Read V_PU and I_PU (registers 0x0000 - 0x0003, each a whole part and a fraction of 65536) and work out the multiplier of every
+	channel.  Call once after connecting, and again whenever the controller may have been changed.  Returns 0, or -1. */
+int ts_scale(struct ts_image *im, modbus_t *ctx)
+{
+	uint16_t data[4];
+	float v, i, w;
+	int ch;
+
+	usleep(RP_READDELAY);
+	modbus_set_slave(ctx, im->slave);
+	if (modbus_read_registers(ctx, 0x0000, 4, data) != 4) {
+		im->scaled=0;
+		return -1;
+	}
+	im->vpu=data[0]+data[1]/65536.0;
+	im->ipu=data[2]+data[3]/65536.0;
+
+	v=im->vpu/32768.0;
+	i=im->ipu/32768.0;
+	w=im->vpu*im->ipu/131072.0;
+	for (ch=0; ch<TS_NCHANNELS; ch++) {
+		switch (ts_channels[ch].scaling) {
+		case TS_VOLTS:
+			im->mult[ch]=v;
+			break;
+		case TS_AMPS:
+			im->mult[ch]=i;
+			break;
+		case TS_WATTS:
+			im->mult[ch]=w;
+			break;
+		default:
+			im->mult[ch]=ts_channels[ch].scale;
+		}
+	}
+	im->scaled=1;
+	return 0;
+}
+
+/* Fill in the read planner fields for one polling class on one device.  Returns the number of fields. */
+int ts_fields(int pollclass, int slave, struct rp_field *fields)
+{
+	int i, n;
+
+	n=0;
+	for (i=0; i<TS_NCHANNELS; i++) {
+		if (ts_channels[i].pollclass == pollclass) {
+			fields[n].slave=slave;
+			fields[n].addr=ts_channels[i].addr;
+			fields[n++].count=(ts_channels[i].type == SS_U32) ? 2 : 1;
+		}
+	}
+
+	return n;
+}
+
+/*	Copy the registers of one polling class out of an executed plan into the image.  Returns 1, or 0 without changing the image if
+	any of the class's reads of this device didn't work. */
+int ts_store(struct ts_image *im, const struct rp_plan *plan, int pollclass)
+{
+	struct rp_field fields[RP_MAXFIELDS];
+	int i, n;
+
+	n=ts_fields(pollclass, im->slave, fields);
+	if (n == 0) return 0;
+	for (i=0; i<n; i++) {
+		if (rp_find(plan, im->slave, fields[i].addr, fields[i].count) == NULL) return 0;
+	}
+	for (i=0; i<n; i++) {
+		rp_copy(plan, im->slave, fields[i].addr, fields[i].count, &im->ram[fields[i].addr]);
+	}
+	return 1;
+}
+
+/* Raw register value of a channel */
+unsigned int ts_raw(const struct ts_image *im, int ch)
+{
+	int k;
+
+	k=ts_channels[ch].addr;
+	if (ts_channels[ch].type == SS_U32) {
+		return ((unsigned int) im->ram[k] << 16) + im->ram[k+1];
+	}
+	return im->ram[k];
+}
+
+/* Channel value in engineering units - 0 for the scaled channels until ts_scale() has worked */
+float ts_value(const struct ts_image *im, int ch)
+{
+	if (ts_channels[ch].type == SS_S16) {
+		return (short) ts_raw(im, ch)*im->mult[ch];
+	}
+	return ts_raw(im, ch)*im->mult[ch];
+}
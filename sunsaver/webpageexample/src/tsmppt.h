@@ -0,0 +1,86 @@
+/*
+ *  tsmppt.h - TriStar MPPT register map, polling classes, and channel decoding for the acquisition daemon.
+ *
+
+ Copyright 2014 Tom Rinehart.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef TSMPPT_H
+#define TSMPPT_H
+
+#include <stdint.h>
+#include <modbus.h>
+
+#include "readplan.h"
+#include "ssmppt.h"
+
+#define TS_RAMREGS		92										/* RAM registers 0x0000 - 0x005B */
+
+/* Channel scaling - most TriStar MPPT values are fractions of the V_PU and I_PU the controller reports for itself */
+
+#define TS_FIXED		0										/* Raw value times scale */
+#define TS_VOLTS		1										/* Raw value times V_PU / 2^15 */
+#define TS_AMPS			2										/* Raw value times I_PU / 2^15 */
+#define TS_WATTS		3										/* Raw value times V_PU * I_PU / 2^17 */
+
+/* RAM channels, in register order.  The polling classes are the SunSaver MPPT's (SS_FAST, SS_TEMP and SS_SLOW). */
+
+enum ts_chan {
+	TS_ADC_VB_F_MED, TS_ADC_VBTERM_F, TS_ADC_VA_F, TS_ADC_IB_F_SHADOW, TS_ADC_IA_F_SHADOW, TS_T_HS, TS_T_RTS, TS_T_BATT,
+	TS_ADC_VB_F_1M, TS_ADC_IB_F_1M, TS_VB_MIN, TS_VB_MAX, TS_HOURMETER, TS_FAULT_ALL, TS_ALARM, TS_DIP_ALL, TS_LED_STATE,
+	TS_CHARGE_STATE, TS_VB_REF, TS_AHC_R, TS_AHC_T, TS_KWHC_R, TS_KWHC_T, TS_POWER_OUT, TS_POWER_IN, TS_SWEEP_PIN_MAX,
+	TS_SWEEP_VMP, TS_SWEEP_VOC, TS_VB_MIN_DAILY, TS_VB_MAX_DAILY, TS_VA_MAX_DAILY, TS_AHC_DAILY, TS_WHC_DAILY,
+	TS_FLAGS_DAILY, TS_POUT_MAX_DAILY, TS_TB_MIN_DAILY, TS_TB_MAX_DAILY, TS_FAULT_DAILY, TS_ALARM_DAILY, TS_TIME_AB_DAILY,
+	TS_TIME_EQ_DAILY, TS_TIME_FL_DAILY, TS_NCHANNELS
+};
+
+/* charge_state values - the same as the SunSaver MPPT's up to EQUALIZE, with MPPT in place of BULK_CHARGE */
+
+#define TS_CS_MPPT		5
+#define TS_CS_SLAVE		9
+
+struct ts_channel {
+	const char *name;
+	uint16_t addr;
+	int type;													/* SS_U16, SS_S16 or SS_U32 */
+	int scaling;												/* TS_FIXED, TS_VOLTS, TS_AMPS or TS_WATTS */
+	float scale;												/* Multiplier for TS_FIXED */
+	const char *units;
+	int pollclass;
+};
+
+/* Register image of one TriStar MPPT, with the multipliers worked out from the scaling it reported when it was connected */
+
+struct ts_image {
+	int slave;
+	int scaled;													/* 1 once V_PU and I_PU have been read on this connection */
+	float vpu;
+	float ipu;
+	float mult[TS_NCHANNELS];									/* Engineering units per count of each channel */
+	uint16_t ram[TS_RAMREGS];
+};
+
+extern const struct ts_channel ts_channels[TS_NCHANNELS];
+extern const char *ts_charge_states[];
+
+int ts_scale(struct ts_image *im, modbus_t *ctx);
+int ts_fields(int pollclass, int slave, struct rp_field *fields);
+int ts_store(struct ts_image *im, const struct rp_plan *plan, int pollclass);
+unsigned int ts_raw(const struct ts_image *im, int ch);
+float ts_value(const struct ts_image *im, int ch);
+
+#endif